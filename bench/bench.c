@@ -0,0 +1,877 @@
+/* Benchmarks for pandora's hot paths: make bench.
+
+   usage: bench [-r reps] [-a arch] [-o file] [-k] [group...]
+     groups: sha256 acl_parse acl_get search pack unpack fetch (default: all)
+     -r  timed repetitions per case (default 5), after one untimed warm-up
+     -a  standalone packer, used to build archives (default build/arch)
+     -o  also write the results to file
+     -k  keep the scratch directory
+
+   Every input is generated from a fixed seed, so two runs on one machine
+   measure the same work. Each case prints one JSON object per line:
+
+     {"bench":"sha256","case":"sha-ni/1x64MiB","reps":5,"bytes":67108864,
+      "ops":1,"min_ns":...,"median_ns":...,"max_ns":...,"mb_per_s":...,
+      "ns_per_op":...}
+
+   bytes and ops are per repetition; the rates are taken from the median.
+   The first line ("bench":"meta") records the build and the default SHA-256
+   kernel so results from different machines are not compared blindly. */
+#define _DEFAULT_SOURCE   /* realpath() */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "util/err.h"
+#include "util/path.h"
+#include "core/acl.h"
+#include "core/acl_arena.h"
+#include "core/arch.h"
+#include "core/cindex.h"
+#include "core/sha256.h"
+#include "net/download.h"
+
+#define MAX_REPS 101
+#define BENCH_PATH_LEN 1024
+
+static int g_reps = 5;
+static char g_arch[BENCH_PATH_LEN];
+static char g_work[BENCH_PATH_LEN];
+static FILE *g_out;
+static int g_failed;
+
+/* ---- timing and reporting ---- */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void emit(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    fflush(stdout);
+    if (g_out) {
+        va_start(ap, fmt);
+        vfprintf(g_out, fmt, ap);
+        va_end(ap);
+    }
+}
+
+static void report(const char *bench, const char *name, uint64_t bytes, uint64_t ops, uint64_t *ns, int reps) {
+    qsort(ns, (size_t)reps, sizeof(*ns), cmp_u64);
+    uint64_t median = ns[reps / 2];
+    double secs = median ? (double)median / 1e9 : 1e-9;
+    emit("{\"bench\":\"%s\",\"case\":\"%s\",\"reps\":%d,\"bytes\":%llu,\"ops\":%llu,"
+           "\"min_ns\":%llu,\"median_ns\":%llu,\"max_ns\":%llu,\"mb_per_s\":%.1f,\"ns_per_op\":%.1f}\n",
+           bench, name, reps, (unsigned long long)bytes, (unsigned long long)ops,
+           (unsigned long long)ns[0], (unsigned long long)median, (unsigned long long)ns[reps - 1],
+           bytes ? (double)bytes / secs / 1e6 : 0.0, ops ? (double)median / (double)ops : 0.0);
+}
+
+/* Run fn(arg) once untimed, then g_reps times; setup (may be NULL) runs
+   before each call, outside the timed part. A nonzero return from fn fails
+   the case. */
+typedef int (*bench_fn)(void *arg);
+
+static void run_case(const char *bench, const char *name, uint64_t bytes, uint64_t ops,
+                     bench_fn setup, bench_fn fn, void *arg) {
+    uint64_t ns[MAX_REPS];
+    for (int r = -1; r < g_reps; ++r) {
+        if (setup && setup(arg) != 0) goto fail;
+        uint64_t t0 = now_ns();
+        if (fn(arg) != 0) goto fail;
+        if (r >= 0) ns[r] = now_ns() - t0;
+    }
+    report(bench, name, bytes, ops, ns, g_reps);
+    return;
+fail:
+    fprintf(stderr, "bench %s/%s failed\n", bench, name);
+    g_failed = 1;
+}
+
+/* ---- scratch data ---- */
+
+static uint64_t g_rng;
+
+static uint64_t rng_next(void) {
+    /* xorshift64*: plenty for test data, and the same everywhere */
+    g_rng ^= g_rng >> 12;
+    g_rng ^= g_rng << 25;
+    g_rng ^= g_rng >> 27;
+    return g_rng * 0x2545F4914F6CDD1Dull;
+}
+
+static void fill_random(uint8_t *buf, size_t len, uint64_t seed) {
+    g_rng = seed;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v = rng_next();
+        memcpy(buf + i, &v, 8);
+    }
+    for (uint64_t v = rng_next(); i < len; ++i, v >>= 8) buf[i] = (uint8_t)v;
+}
+
+static int scratch_path(char *out, const char *rel) {
+    if (snprintf(out, BENCH_PATH_LEN, "%s/%s", g_work, rel) >= BENCH_PATH_LEN) {
+        fprintf(stderr, "scratch path too long\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int write_file(const char *path, const void *data, size_t len) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    int rc = fwrite(data, 1, len, f) == len ? 0 : -1;
+    if (fclose(f) != 0) rc = -1;
+    if (rc != 0) perror(path);
+    return rc;
+}
+
+static int remove_tree_at(int dirfd, const char *name) {
+    if (unlinkat(dirfd, name, 0) == 0 || errno == ENOENT) return 0;
+    if (errno != EISDIR && errno != EPERM) return -1;
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!d) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    int rc = 0;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        if (remove_tree_at(fd, de->d_name) != 0) rc = -1;
+    }
+    closedir(d);
+    return rc == 0 && unlinkat(dirfd, name, AT_REMOVEDIR) == 0 ? 0 : -1;
+}
+
+static int remove_tree(const char *path) {
+    return remove_tree_at(AT_FDCWD, path);
+}
+
+/* ---- sha256 ---- */
+
+#define SHA_LEN ((size_t)64 << 20)
+
+struct sha_case {
+    const uint8_t *buf;
+    uint8_t digest[32];
+    uint8_t lanes[SHA256_MAX_LANES][32];
+};
+
+static int sha_one(void *arg) {
+    struct sha_case *c = arg;
+    sha256(c->buf, SHA_LEN, c->digest);
+    return 0;
+}
+
+static int sha_lanes(void *arg) {
+    struct sha_case *c = arg;
+    sha256_ctx ctx[SHA256_MAX_LANES];
+    sha256_ctx *ptrs[SHA256_MAX_LANES];
+    const void *data[SHA256_MAX_LANES];
+    size_t part = SHA_LEN / SHA256_MAX_LANES;
+    for (size_t i = 0; i < SHA256_MAX_LANES; ++i) {
+        sha256_init(&ctx[i]);
+        ptrs[i] = &ctx[i];
+        data[i] = c->buf + i * part;
+    }
+    sha256_update_lanes(ptrs, data, SHA256_MAX_LANES, part);
+    for (size_t i = 0; i < SHA256_MAX_LANES; ++i) sha256_final(&ctx[i], c->lanes[i]);
+    return 0;
+}
+
+static void bench_sha256(void) {
+    static const char *const kernels[] = { "scalar", "sha-ni", "avx2-x8", "armv8-ce" };
+    const char *dflt = sha256_impl_name();   /* a string literal in sha256.c */
+
+    struct sha_case c;
+    uint8_t *buf = malloc(SHA_LEN);
+    if (!buf) {
+        perror("malloc");
+        g_failed = 1;
+        return;
+    }
+    fill_random(buf, SHA_LEN, 1);
+    c.buf = buf;
+
+    /* every kernel must agree with the scalar one */
+    uint8_t ref[32], ref_lanes[SHA256_MAX_LANES][32];
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        if (sha256_select_impl(kernels[k]) != 0) continue;
+        char name[64];
+        snprintf(name, sizeof(name), "%s/1x64MiB", kernels[k]);
+        run_case("sha256", name, SHA_LEN, 1, NULL, sha_one, &c);
+        snprintf(name, sizeof(name), "%s/%dx8MiB", kernels[k], SHA256_MAX_LANES);
+        run_case("sha256", name, SHA_LEN, SHA256_MAX_LANES, NULL, sha_lanes, &c);
+        if (k == 0) {
+            memcpy(ref, c.digest, sizeof(ref));
+            memcpy(ref_lanes, c.lanes, sizeof(ref_lanes));
+        } else if (memcmp(ref, c.digest, sizeof(ref)) != 0 || memcmp(ref_lanes, c.lanes, sizeof(ref_lanes)) != 0) {
+            fprintf(stderr, "sha256: kernel %s disagrees with scalar\n", kernels[k]);
+            g_failed = 1;
+        }
+    }
+    sha256_select_impl(dflt);
+    free(buf);
+}
+
+/* ---- acl ---- */
+
+static const char *const words[] = {
+    "fast", "tiny", "portable", "image", "audio", "network", "parser", "compression",
+    "terminal", "graphics", "crypto", "database", "font", "shell", "editor", "library",
+};
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+/* A registry index in the layout gen_index.py writes, n packages of one
+   version each. base_url prefixes the manifest and package urls. With
+   search_fields, every package also gets a description and two tags
+   drawn from words. */
+static int write_index(const char *path, size_t n, const char *base_url, int search_fields) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "Registry {\n    string url = \"%s/index.acl\";\n    int priority = 100;\n"
+               "    bool require_signatures = false;\n    string cache_policy = \"ttl=3600\";\n\n", base_url);
+    g_rng = 2;
+    for (size_t i = 0; i < n; ++i) {
+        char hex[65];
+        for (int k = 0; k < 64; k += 16) snprintf(hex + k, 17, "%016llx", (unsigned long long)rng_next());
+        fprintf(f, "    Package \"p%zu\" {\n        string[] versions = { \"1.0\" };\n        string latest = \"1.0\";\n", i);
+        if (search_fields) {
+            uint64_t w = rng_next();
+            fprintf(f, "        string description = \"A %s %s %s\";\n        string tags = \"%s %s\";\n",
+                    words[w % NWORDS], words[w / 16 % NWORDS], words[w / 256 % NWORDS],
+                    words[w / 4096 % NWORDS], words[w / 65536 % NWORDS]);
+        }
+        fprintf(f, "        string pkg_base_url = \"\";\n\n        Version \"1.0\" {\n"
+                   "            string manifest_url = \"%s/p%zu-manifest.acl\";\n"
+                   "            string pkg_url = \"%s/p%zu-1.0.pkg\";\n"
+                   "            string sha256 = \"%s\";\n            bool deprecated = false;\n        }\n    }\n\n",
+                base_url, i, base_url, i, hex);
+    }
+    fputs("}\n", f);
+    if (fclose(f) != 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+struct parse_case {
+    const char *path;
+};
+
+static int parse_libacl(void *arg) {
+    AclBlock *root = acl_parse_file(((struct parse_case *)arg)->path);
+    if (!root) return -1;
+    acl_free(root);
+    return 0;
+}
+
+static int parse_arena(void *arg) {
+    acl_arena *a = acl_arena_parse_file(((struct parse_case *)arg)->path);
+    if (!a) return -1;
+    acl_arena_free(a);
+    return 0;
+}
+
+static void bench_acl_parse(void) {
+    static const size_t sizes[] = { 10000, 100000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        char path[BENCH_PATH_LEN], rel[64], name[64];
+        snprintf(rel, sizeof(rel), "index-%zu.acl", sizes[s]);
+        if (scratch_path(path, rel) != 0 || write_index(path, sizes[s], "http://127.0.0.1", 0) != 0) {
+            g_failed = 1;
+            return;
+        }
+        struct parse_case c = { path };
+        uint64_t bytes = file_size(path);
+        snprintf(name, sizeof(name), "libacl/%zuk", sizes[s] / 1000);
+        run_case("acl_parse", name, bytes, 1, NULL, parse_libacl, &c);
+        snprintf(name, sizeof(name), "arena/%zuk", sizes[s] / 1000);
+        run_case("acl_parse", name, bytes, 1, NULL, parse_arena, &c);
+        unlink(path);
+    }
+}
+
+#define GET_PACKAGES 10000
+#define GET_LOOKUPS 10000
+
+struct get_case {
+    AclBlock *tree;
+    acl_arena *arena;
+    acl_query *query;
+    char (*paths)[96];
+    char (*names)[16];
+};
+
+static int get_libacl(void *arg) {
+    struct get_case *c = arg;
+    for (size_t i = 0; i < GET_LOOKUPS; ++i) {
+        char *s = NULL;
+        if (!acl_get_string(c->tree, c->paths[i], &s) || !s) return -1;
+    }
+    return 0;
+}
+
+static int get_arena(void *arg) {
+    struct get_case *c = arg;
+    for (size_t i = 0; i < GET_LOOKUPS; ++i) {
+        const char *s = NULL;
+        if (!acl_arena_get_string(c->arena, c->paths[i], &s)) return -1;
+    }
+    return 0;
+}
+
+static int get_query(void *arg) {
+    struct get_case *c = arg;
+    for (size_t i = 0; i < GET_LOOKUPS; ++i) {
+        const char *s = NULL;
+        if (!acl_query_string(c->arena, c->query, (const char *const[]){ c->names[i], "1.0" }, &s)) return -1;
+    }
+    return 0;
+}
+
+static void bench_acl_get(void) {
+    char path[BENCH_PATH_LEN];
+    struct get_case c = {0};
+    if (scratch_path(path, "index-get.acl") != 0 || write_index(path, GET_PACKAGES, "http://127.0.0.1", 0) != 0) {
+        g_failed = 1;
+        return;
+    }
+    c.tree = acl_parse_file(path);
+    c.arena = acl_arena_parse_file(path);
+    c.query = acl_query_compile("Registry.Package[\"$\"].Version[\"$\"].sha256");
+    c.paths = calloc(GET_LOOKUPS, sizeof(*c.paths));
+    c.names = calloc(GET_LOOKUPS, sizeof(*c.names));
+    if (!c.tree || !c.arena || !c.query || !c.paths || !c.names) {
+        fprintf(stderr, "acl_get: setup failed\n");
+        g_failed = 1;
+        goto out;
+    }
+    g_rng = 3;
+    for (size_t i = 0; i < GET_LOOKUPS; ++i) {
+        snprintf(c.names[i], sizeof(c.names[i]), "p%llu", (unsigned long long)(rng_next() % GET_PACKAGES));
+        snprintf(c.paths[i], sizeof(c.paths[i]), "Registry.Package[\"%s\"].Version[\"1.0\"].sha256", c.names[i]);
+    }
+    run_case("acl_get", "libacl/10k", 0, GET_LOOKUPS, NULL, get_libacl, &c);
+    run_case("acl_get", "arena/10k", 0, GET_LOOKUPS, NULL, get_arena, &c);
+    run_case("acl_get", "arena-compiled/10k", 0, GET_LOOKUPS, NULL, get_query, &c);
+out:
+    free(c.paths);
+    free(c.names);
+    acl_query_free(c.query);
+    acl_arena_free(c.arena);
+    acl_free(c.tree);
+    unlink(path);
+}
+
+/* ---- search ---- */
+
+#define SEARCH_PACKAGES 100000
+
+struct search_case {
+    const cindex *ci;
+    const char *query;
+    size_t hits;
+};
+
+static void count_hit(void *arg, const cindex_package *pkg) {
+    (void)pkg;
+    ((struct search_case *)arg)->hits++;
+}
+
+static int run_search(void *arg) {
+    struct search_case *c = arg;
+    c->hits = 0;
+    cindex_search(c->ci, c->query, count_hit, c);
+    return c->hits ? 0 : -1;
+}
+
+/* pandora search over the compiled cache of a 100k-package index: a rare
+   name, a word in about a third of the packages, a query whose trigrams are
+   all common but which matches few, and one too short for the trigrams */
+static void bench_search(void) {
+    static const struct { const char *name, *query; } cases[] = {
+        { "name/100k", "p4242" },
+        { "word/100k", "Graphics" },
+        { "rare-pair/100k", "font fast" },
+        { "short/100k", "p7" },
+    };
+    char path[BENCH_PATH_LEN], bin[BENCH_PATH_LEN];
+    if (scratch_path(path, "index-search.acl") != 0 || scratch_path(bin, "index-search.bin") != 0
+     || write_index(path, SEARCH_PACKAGES, "http://127.0.0.1", 1) != 0) {
+        g_failed = 1;
+        return;
+    }
+    acl_arena *a = acl_arena_parse_file(path);
+    AclBlock *tree = a ? acl_arena_root(a) : NULL;
+    cindex_source src = { .mtime = 0, .size = file_size(path), .ttl = 3600 };
+    cindex *ci = a && cindex_build(&tree, 1, &src, bin) == 0 ? cindex_open(bin) : NULL;
+    acl_arena_free(a);
+    if (!ci) {
+        fprintf(stderr, "search: setup failed\n");
+        g_failed = 1;
+        goto out;
+    }
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        struct search_case c = { ci, cases[i].query, 0 };
+        run_case("search", cases[i].name, 0, 1, NULL, run_search, &c);
+    }
+    cindex_close(ci);
+out:
+    unlink(path);
+    unlink(bin);
+}
+
+/* ---- pack / unpack ---- */
+
+struct tree_spec {
+    const char *name;
+    size_t files;
+    size_t min_size, max_size;    /* file sizes are drawn from [min, max] */
+    size_t per_dir;
+};
+
+static const struct tree_spec trees[] = {
+    { "small-files", 5000, 256, 4096, 100 },
+    { "huge-files", 4, (size_t)32 << 20, (size_t)32 << 20, 4 },
+};
+
+/* Builds work/<name>/ once; returns its content size. */
+static uint64_t make_tree(const struct tree_spec *t, char *dir) {
+    if (scratch_path(dir, t->name) != 0) return 0;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror(dir);
+        return 0;
+    }
+    uint8_t *buf = malloc(t->max_size);
+    if (!buf) return 0;
+    g_rng = 4;
+    uint64_t total = 0;
+    for (size_t i = 0; i < t->files; ++i) {
+        char path[BENCH_PATH_LEN];
+        if (i % t->per_dir == 0
+         && (snprintf(path, sizeof(path), "%s/d%zu", dir, i / t->per_dir) >= (int)sizeof(path)
+          || (mkdir(path, 0755) != 0 && errno != EEXIST))) {
+            total = 0;
+            break;
+        }
+        size_t len = t->min_size + (size_t)(rng_next() % (t->max_size - t->min_size + 1));
+        fill_random(buf, len, i + 5);
+        if (snprintf(path, sizeof(path), "%s/d%zu/f%zu", dir, i / t->per_dir, i) >= (int)sizeof(path)
+         || write_file(path, buf, len) != 0) {
+            total = 0;
+            break;
+        }
+        total += len;
+    }
+    free(buf);
+    return total;
+}
+
+struct pack_case {
+    char tree[BENCH_PATH_LEN];
+    char archive[BENCH_PATH_LEN];
+    char dest[BENCH_PATH_LEN];
+    char jobs[24];                /* pack -j, or "" for the default */
+};
+
+static int run_arch_pack(void *arg) {
+    struct pack_case *c = arg;
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        /* pack relative to the scratch dir so entries are "<tree>/..." */
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        const char *tree = strrchr(c->tree, '/') + 1;
+        if (chdir(g_work) != 0) _exit(127);
+        if (c->jobs[0]) execl(g_arch, g_arch, "pack", "-j", c->jobs, c->archive, tree, (char *)NULL);
+        else execl(g_arch, g_arch, "pack", c->archive, tree, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    return 0;
+}
+
+static int clear_dest(void *arg) {
+    struct pack_case *c = arg;
+    return remove_tree(c->dest);
+}
+
+static int run_unpack(void *arg) {
+    struct pack_case *c = arg;
+    return arch_unpack(c->archive, c->dest, 1, NULL, ARCH_QUIET, NULL);
+}
+
+static void bench_pack(int do_pack, int do_unpack) {
+    for (size_t t = 0; t < sizeof(trees) / sizeof(trees[0]); ++t) {
+        struct pack_case c = { .jobs = "" };
+        uint64_t bytes = make_tree(&trees[t], c.tree);
+        char rel[64];
+        snprintf(rel, sizeof(rel), "%s.pnd", trees[t].name);
+        if (!bytes || scratch_path(c.archive, rel) != 0) {
+            g_failed = 1;
+            break;
+        }
+        snprintf(rel, sizeof(rel), "%s.out", trees[t].name);
+        if (scratch_path(c.dest, rel) != 0) break;
+
+        /* unpack needs an archive even when pack is not being measured */
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (do_pack && cpus > 1) {
+            /* the same on every core; the archive comes out identical */
+            char name[64];
+            snprintf(name, sizeof(name), "%s/j%ld", trees[t].name, cpus);
+            snprintf(c.jobs, sizeof(c.jobs), "%ld", cpus);
+            run_case("pack", name, bytes, trees[t].files, NULL, run_arch_pack, &c);
+            c.jobs[0] = '\0';
+        }
+        if (do_pack) run_case("pack", trees[t].name, bytes, trees[t].files, NULL, run_arch_pack, &c);
+        else if (run_arch_pack(&c) != 0) g_failed = 1;
+        if (do_unpack && file_size(c.archive)) {
+            run_case("unpack", trees[t].name, bytes, trees[t].files, clear_dest, run_unpack, &c);
+            /* the same without io_uring (util/uring.h), for comparison */
+            char name[64];
+            snprintf(name, sizeof(name), "%s/no-uring", trees[t].name);
+            setenv("PANDORA_NO_URING", "1", 1);
+            run_case("unpack", name, bytes, trees[t].files, clear_dest, run_unpack, &c);
+            unsetenv("PANDORA_NO_URING");
+        }
+        remove_tree(c.dest);
+        remove_tree(c.tree);
+        unlink(c.archive);
+    }
+}
+
+/* ---- end-to-end fetch against a loopback HTTP fixture ---- */
+
+/* Just enough HTTP/1.0 to serve files from one directory: GET only, one
+   request per connection, 404 for anything missing. */
+struct fixture {
+    int listen_fd;
+    int port;
+    char root[BENCH_PATH_LEN];
+    pthread_t thread;
+};
+
+static void fixture_serve(struct fixture *fx, int fd) {
+    char req[2048];
+    size_t len = 0;
+    ssize_t r;
+    while (len < sizeof(req) - 1 && (r = read(fd, req + len, sizeof(req) - 1 - len)) > 0) {
+        len += (size_t)r;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n")) break;
+    }
+    req[len] = '\0';
+
+    char path[BENCH_PATH_LEN];
+    char *sp = strncmp(req, "GET /", 5) == 0 ? strchr(req + 4, ' ') : NULL;
+    int file = -1;
+    if (sp) *sp = '\0';
+    if (sp && !strstr(req + 4, "..") && snprintf(path, sizeof(path), "%s%s", fx->root, req + 4) < (int)sizeof(path))
+        file = open(path, O_RDONLY);
+    struct stat st;
+    if (file < 0 || fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+        static const char nf[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        if (write(fd, nf, sizeof(nf) - 1) < 0) {}
+        if (file >= 0) close(file);
+        return;
+    }
+    char hdr[128];
+    int hl = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n",
+                      (long long)st.st_size);
+    if (write(fd, hdr, (size_t)hl) == hl) {
+        char buf[65536];
+        while ((r = read(file, buf, sizeof(buf))) > 0)
+            if (write(fd, buf, (size_t)r) != r) break;
+    }
+    close(file);
+}
+
+static void *fixture_main(void *arg) {
+    struct fixture *fx = arg;
+    for (;;) {
+        int fd = accept(fx->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;   /* shut down */
+        }
+        fixture_serve(fx, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static int fixture_start(struct fixture *fx) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t alen = sizeof(addr);
+    fx->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fx->listen_fd < 0 || bind(fx->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+     || listen(fx->listen_fd, 16) != 0 || getsockname(fx->listen_fd, (struct sockaddr *)&addr, &alen) != 0) {
+        perror("fixture socket");
+        if (fx->listen_fd >= 0) close(fx->listen_fd);
+        return -1;
+    }
+    fx->port = ntohs(addr.sin_port);
+    if (pthread_create(&fx->thread, NULL, fixture_main, fx) != 0) {
+        close(fx->listen_fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void fixture_stop(struct fixture *fx) {
+    shutdown(fx->listen_fd, SHUT_RDWR);
+    close(fx->listen_fd);
+    pthread_join(fx->thread, NULL);
+}
+
+#define FETCH_PACKAGES 1000
+#define FETCH_BLOB_LEN ((size_t)8 << 20)
+
+struct fetch_case {
+    char home_pandora[BENCH_PATH_LEN];
+    char blob[BENCH_PATH_LEN];
+};
+
+static int fetch_cold_setup(void *arg) {
+    struct fetch_case *c = arg;
+    return remove_tree(c->home_pandora);
+}
+
+static int fetch_warm_setup(void *arg) {
+    struct fetch_case *c = arg;
+    /* keep the compiled index and the blob; drop the manifest */
+    char path[BENCH_PATH_LEN];
+    if (snprintf(path, sizeof(path), "%s/manifests/bench-1.0-manifest.acl", c->home_pandora) >= (int)sizeof(path))
+        return -1;
+    return unlink(path) == 0 || errno == ENOENT ? 0 : -1;
+}
+
+/* the whole invocation: session, index, manifest and blob */
+static int fetch_run(void *arg) {
+    (void)arg;
+    fetch_env env;
+    if (fetch_env_open(&env, 0) != ERR_OK) return -1;
+    error_t rc = fetch_package(&env, "bench", "1.0");
+    fetch_env_close(&env);
+    return rc == ERR_OK ? 0 : -1;
+}
+
+/* Registry layout: index.acl with FETCH_PACKAGES filler packages and one
+   real one, "bench@1.0", whose blob is an archive of one random file. */
+static int fetch_fixture(const struct fixture *fx, struct fetch_case *c) {
+    char base[128], path[BENCH_PATH_LEN], payload[BENCH_PATH_LEN];
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", fx->port);
+
+    uint8_t *buf = malloc(FETCH_BLOB_LEN);
+    if (!buf) return -1;
+    fill_random(buf, FETCH_BLOB_LEN, 6);
+    int rc = scratch_path(payload, "payload") == 0 && write_file(payload, buf, FETCH_BLOB_LEN) == 0 ? 0 : -1;
+    free(buf);
+    if (rc != 0) return -1;
+    if (snprintf(c->blob, sizeof(c->blob), "%s/bench-1.0.pkg", fx->root) >= (int)sizeof(c->blob)) return -1;
+
+    struct pack_case pc;
+    snprintf(pc.tree, sizeof(pc.tree), "%s", payload);
+    snprintf(pc.archive, sizeof(pc.archive), "%s", c->blob);
+    if (run_arch_pack(&pc) != 0) {
+        fprintf(stderr, "fetch: cannot pack the fixture blob with %s\n", g_arch);
+        return -1;
+    }
+    char hex[65];
+    FILE *f = fopen(c->blob, "rb");
+    if (!f) return -1;
+    sha256_ctx ctx;
+    uint8_t chunk[65536], digest[32];
+    size_t n;
+    sha256_init(&ctx);
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) sha256_update(&ctx, chunk, n);
+    fclose(f);
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, hex);
+
+    if (snprintf(path, sizeof(path), "%s/index.acl", fx->root) >= (int)sizeof(path)
+     || write_index(path, FETCH_PACKAGES, base, 0) != 0) return -1;
+    /* the real package goes last, after the filler */
+    f = fopen(path, "r+");
+    if (!f || fseek(f, -2, SEEK_END) != 0) {
+        if (f) fclose(f);
+        return -1;
+    }
+    fprintf(f, "    Package \"bench\" {\n        string[] versions = { \"1.0\" };\n        string latest = \"1.0\";\n"
+               "        string pkg_base_url = \"\";\n\n        Version \"1.0\" {\n"
+               "            string manifest_url = \"%s/bench-manifest.acl\";\n"
+               "            string pkg_url = \"%s/bench-1.0.pkg\";\n"
+               "            string sha256 = \"%s\";\n            bool deprecated = false;\n        }\n    }\n}\n",
+            base, base, hex);
+    if (fclose(f) != 0) return -1;
+
+    char manifest[1024];
+    int ml = snprintf(manifest, sizeof(manifest),
+                      "Manifest {\n    string name = \"bench\";\n    string version = \"1.0\";\n"
+                      "    string sha256 = \"%s\";\n    string pkg_url = \"%s/bench-1.0.pkg\";\n"
+                      "    string[] dependencies = {};\n}\n", hex, base);
+    if (snprintf(path, sizeof(path), "%s/bench-manifest.acl", fx->root) >= (int)sizeof(path)
+     || write_file(path, manifest, (size_t)ml) != 0) return -1;
+
+    /* a private HOME whose only mirror is the fixture */
+    char home[BENCH_PATH_LEN], conf[BENCH_PATH_LEN + 32];
+    if (scratch_path(home, "home") != 0) return -1;
+    snprintf(conf, sizeof(conf), "%s/conf", home);
+    if (ensure_dir(conf, 0755) != ERR_OK) return -1;
+    snprintf(conf, sizeof(conf), "%s/conf/pandora.conf", home);
+    char text[512];
+    int tl = snprintf(text, sizeof(text), "Pandora {\n    Mirrors {\n        mirror {\n"
+                                          "            string index = \"%s/index.acl\";\n        }\n    }\n}\n", base);
+    if (write_file(conf, text, (size_t)tl) != 0) return -1;
+    if (setenv("HOME", home, 1) != 0) return -1;
+    if (snprintf(c->home_pandora, sizeof(c->home_pandora), "%s/pandora", home) >= (int)sizeof(c->home_pandora))
+        return -1;
+    unlink(payload);
+    return 0;
+}
+
+static void bench_fetch(void) {
+    struct fixture fx;
+    struct fetch_case c;
+    const char *home = getenv("HOME");
+    char *saved_home = home ? strdup(home) : NULL;
+    if (scratch_path(fx.root, "registry") != 0 || ensure_dir(fx.root, 0755) != ERR_OK || fixture_start(&fx) != 0) {
+        g_failed = 1;
+        goto out;
+    }
+    if (fetch_fixture(&fx, &c) != 0) {
+        fprintf(stderr, "fetch: cannot set up the registry fixture\n");
+        g_failed = 1;
+    } else {
+        uint64_t blob = file_size(c.blob);
+        run_case("fetch", "cold", blob, 1, fetch_cold_setup, fetch_run, &c);
+        run_case("fetch", "warm", blob, 1, fetch_warm_setup, fetch_run, &c);
+    }
+    fixture_stop(&fx);
+out:
+    if (saved_home) setenv("HOME", saved_home, 1);
+    free(saved_home);
+}
+
+/* ---- driver ---- */
+
+static int wanted(int argc, char **argv, int first, const char *group) {
+    if (first >= argc) return 1;
+    for (int i = first; i < argc; ++i)
+        if (strcmp(argv[i], group) == 0) return 1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int keep = 0, opt;
+    const char *arch = "build/arch", *out_path = NULL;
+    while ((opt = getopt(argc, argv, "r:a:o:k")) != -1) {
+        switch (opt) {
+        case 'r':
+            g_reps = atoi(optarg);
+            if (g_reps < 1 || g_reps > MAX_REPS) {
+                fprintf(stderr, "bench: -r takes 1..%d\n", MAX_REPS);
+                return 2;
+            }
+            break;
+        case 'a': arch = optarg; break;
+        case 'o': out_path = optarg; break;
+        case 'k': keep = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-r reps] [-a arch] [-o file] [-k] [sha256|acl_parse|acl_get|search|pack|unpack|fetch]...\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    static const char *const groups[] = { "sha256", "acl_parse", "acl_get", "search", "pack", "unpack", "fetch" };
+    for (int i = optind; i < argc; ++i) {
+        size_t g = 0;
+        while (g < sizeof(groups) / sizeof(groups[0]) && strcmp(argv[i], groups[g]) != 0) g++;
+        if (g == sizeof(groups) / sizeof(groups[0])) {
+            fprintf(stderr, "bench: unknown group '%s'\n", argv[i]);
+            return 2;
+        }
+    }
+
+    int do_pack = wanted(argc, argv, optind, "pack"), do_unpack = wanted(argc, argv, optind, "unpack");
+    int do_fetch = wanted(argc, argv, optind, "fetch");
+    /* archives are built by the packer, which runs from the scratch dir */
+    if ((do_pack || do_unpack || do_fetch) && !realpath(arch, g_arch)) {
+        fprintf(stderr, "bench: %s: %s (run 'make arch' first)\n", arch, strerror(errno));
+        return 1;
+    }
+    if (out_path && !(g_out = fopen(out_path, "w"))) {
+        perror(out_path);
+        return 1;
+    }
+
+    /* the fixture writes to sockets the client may close early */
+    signal(SIGPIPE, SIG_IGN);
+    const char *tmp = getenv("TMPDIR");
+    if (snprintf(g_work, sizeof(g_work), "%s/pandora-bench.XXXXXX", tmp && *tmp ? tmp : "/tmp") >= (int)sizeof(g_work)
+     || !mkdtemp(g_work)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    emit("{\"bench\":\"meta\",\"reps\":%d,\"sha256_default\":\"%s\",\"compiler\":\"%s\"}\n",
+           g_reps, sha256_impl_name(), __VERSION__);
+    if (wanted(argc, argv, optind, "sha256")) bench_sha256();
+    if (wanted(argc, argv, optind, "acl_parse")) bench_acl_parse();
+    if (wanted(argc, argv, optind, "acl_get")) bench_acl_get();
+    if (wanted(argc, argv, optind, "search")) bench_search();
+    if (do_pack || do_unpack) bench_pack(do_pack, do_unpack);
+    if (do_fetch) bench_fetch();
+
+    if (keep) fprintf(stderr, "bench: scratch kept in %s\n", g_work);
+    else remove_tree(g_work);
+    if (g_out && fclose(g_out) != 0) {
+        perror(out_path);
+        g_failed = 1;
+    }
+    return g_failed ? 1 : 0;
+}
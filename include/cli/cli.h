@@ -2,7 +2,14 @@
 #define CLI_CLI_H
 
 #include "util/err.h"
+#include "net/download.h"
 
 error_t cli_help(void);
 
+/* Show the index record for name@version, or the versions of name. */
+error_t cli_info(fetch_env *env, const char *spec);
+
+/* List packages whose name contains query (case-insensitive). */
+error_t cli_search(fetch_env *env, const char *query);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef CORE_ACL_ARENA_H
+#define CORE_ACL_ARENA_H
+
+#include <stddef.h>
+
+#include "core/acl.h"
+
+/* Arena-backed ACL parse mode for the large machine-written files (registry
+   index and shards, manifests). The tree is made of the same AclBlock/AclField
+   nodes libacl hands out, so code walking ->children/->fields/->next works
+   unchanged, but the nodes sit in contiguous arrays and every name, label and
+   value is interned in one string buffer: the whole tree is a single
+   allocation and acl_arena_free is O(1). It is reentrant, unlike libacl.
+   Blocks nest at most 64 deep; deeper input is a parse error.
+
+   Every scalar keeps its literal text in AclField.value ("42", "true"); the
+   typed getters below interpret it. An array's value is its first element;
+   index it with "field[N]". The user config keeps going through libacl. */
+typedef struct acl_arena acl_arena;
+
+acl_arena *acl_arena_parse_file(const char *path);
+acl_arena *acl_arena_parse_string(const char *text, size_t len);
+void acl_arena_free(acl_arena *a);
+
+/* First top-level block. */
+AclBlock *acl_arena_root(const acl_arena *a);
+
+/* Same path syntax and return convention as acl_get_* (1 found, 0 otherwise):
+     "Registry.Package[\"name\"].Version[\"1.0\"].sha256", "Manifest.authors[0]"
+   Strings point into the arena. */
+int acl_arena_get_string(const acl_arena *a, const char *path, const char **out);
+int acl_arena_get_int(const acl_arena *a, const char *path, long *out);
+int acl_arena_get_bool(const acl_arena *a, const char *path, int *out);
+
+/* A path compiled once and evaluated many times, with parameter slots:
+   ["$"] takes a label and [#] an index (decimal) from args, in order:
+     q = acl_query_compile("Registry.Package[\"$\"].Version[\"$\"].sha256");
+     acl_query_string(index, q, (const char *[]){ name, version }, &sha);
+   Labelled steps go through a per-arena child-by-label hash, so they cost
+   O(1) whether or not a query is compiled. A query is immutable and may be
+   shared between threads. */
+typedef struct acl_query acl_query;
+
+acl_query *acl_query_compile(const char *path);
+void acl_query_free(acl_query *q);
+size_t acl_query_slots(const acl_query *q);
+
+int acl_query_string(const acl_arena *a, const acl_query *q, const char *const args[], const char **out);
+int acl_query_int(const acl_arena *a, const acl_query *q, const char *const args[], long *out);
+int acl_query_bool(const acl_arena *a, const acl_query *q, const char *const args[], int *out);
+
+#endif
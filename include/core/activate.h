@@ -0,0 +1,25 @@
+#ifndef CORE_ACTIVATE_H
+#define CORE_ACTIVATE_H
+
+#include "util/err.h"
+#include "net/download.h"
+
+/* Make profile the active one: every file under bin/ and lib/ of each
+   package pinned in $HOME/pandora/manifests/<profile>.lock is linked into
+   $HOME/pandora/vir. The new forest is built beside the live one and swapped
+   in with a single rename, so readers see either the old profile or the new
+   one, never a mix. The previous forest is kept as the next spare and only
+   the entries that differ are rebuilt next time. Packages must already be
+   in the store. The lockfile is first completed with its dependencies
+   (resolve_profile, through env; free when it already holds them, and
+   without a registry the lockfile is linked as written). Which package
+   provides which path is kept in the profile's owners file (core/owners.h),
+   so only packages new to the profile are walked in the store. */
+error_t activate_profile(fetch_env *env, const char *profile);
+
+/* Print the packages of profile as of its last activation, with file counts
+   and how many of their paths another package shadows. Reads only the
+   profile's owners file. */
+error_t profile_list(const char *profile);
+
+#endif
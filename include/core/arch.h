@@ -0,0 +1,86 @@
+#ifndef CORE_ARCH_H
+#define CORE_ARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Extract every entry of the .pnd archive into destdir (created if missing)
+   and write destdir/.manifest listing the extracted paths in table order.
+   Directories are created first, then blobs are extracted by offset on up
+   to jobs threads (small archives stay single-threaded).
+   When objects is not NULL it names a content-addressed object store: files
+   whose content is already there are hardlinked from it instead of being
+   written again, and new content is verified and added to it.
+   Each extracted path is printed unless flags has ARCH_QUIET; stats, when
+   not NULL, gets the number of entries extracted and their total size.
+   Returns 0 on success, or -1 after printing why; the files extracted up
+   to then (and the directories made for them) are removed again, so on
+   a fresh destdir nothing but destdir itself is left. No error exits the
+   process, and several unpacks may run at once. */
+#define ARCH_QUIET 0x1
+
+typedef struct arch_stats {
+    uint64_t files;
+    uint64_t bytes;
+} arch_stats;
+
+int arch_unpack(const char *archive, const char *destdir, int jobs, const char *objects,
+                int flags, arch_stats *stats);
+
+/* Extraction while the archive arrives, e.g. straight from a download.
+   Write the archive's bytes, in order, to arch_stream_input; each entry is
+   extracted into destdir (as with arch_unpack, object store included) as
+   soon as its blob has gone by, so nothing but the table is held in memory.
+   This needs the blobs to follow one another without overlapping, as pack
+   writes them. A write fails once the data turned out bad; everything
+   written until then stays in destdir, so extract into a scratch directory.
+   arch_stream_close frees the stream and, if the whole archive arrived
+   intact, writes destdir/.manifest and returns 0; otherwise it returns -1
+   after printing why. */
+typedef struct arch_stream arch_stream;
+
+/* Returns NULL if the stream cannot be set up. */
+arch_stream *arch_stream_open(const char *destdir, const char *objects, int flags);
+FILE *arch_stream_input(arch_stream *s);
+int arch_stream_close(arch_stream *s, arch_stats *stats);
+
+/* Random access to single entries. arch_open maps the header and entry
+   table only; blobs are read when an entry is asked for. Version 3 archives
+   carry a path index, so arch_find is a binary search; older ones are scanned.
+   A reader is not safe to use from several threads at once. */
+typedef struct arch_reader arch_reader;
+
+typedef struct arch_entry {
+    const char *path;        /* stored path, path_len bytes, NOT NUL-terminated */
+    size_t path_len;
+    uint64_t size;           /* uncompressed size (link target length for symlinks) */
+    int symlink;
+    int compressed;          /* blob is a zstd frame rather than the raw content */
+    const uint8_t *sha256;   /* 32-byte content digest, or NULL if the archive has none */
+    /* location of the blob, for arch_read/arch_extract */
+    uint64_t offset;
+    uint64_t stored;
+    uint32_t flags;
+} arch_entry;
+
+/* Returns NULL (after printing why) if the file is missing or not a valid archive. */
+arch_reader *arch_open(const char *archive);
+void arch_close(arch_reader *r);
+
+/* Entries in table order, 0 <= i < arch_count(r). Returns 0, or -1 if out of range or corrupt. */
+size_t arch_count(const arch_reader *r);
+int arch_entry_at(const arch_reader *r, size_t i, arch_entry *out);
+
+/* Look up an entry by path ("./a//b" and "a/b" are the same). Returns 0 if found, -1 if not. */
+int arch_find(const arch_reader *r, const char *path, arch_entry *out);
+
+/* Read one entry into a malloc'd, NUL-terminated buffer; *len gets its size.
+   The content is checked against its digest. Returns NULL on error. */
+void *arch_read(arch_reader *r, const arch_entry *e, size_t *len);
+
+/* Write one entry to outpath, whose parent must exist. Returns 0 on
+   success, or -1 after printing why, with outpath removed. */
+int arch_extract(arch_reader *r, const arch_entry *e, const char *outpath);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef CORE_CINDEX_H
+#define CORE_CINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/acl.h"
+
+/* Compiled registry index: a flat, hash-indexed binary image of index.acl
+   stored under $HOME/pandora/cache and mapped read-only at startup.
+   Lookups touch the mapping directly: no parsing, no per-node allocation.
+   The image is in host byte order; it is a machine-local cache. */
+typedef struct cindex cindex;
+
+/* identity of the index.acl an image was compiled from */
+typedef struct cindex_source {
+    int64_t mtime;
+    uint64_t size;
+    int64_t ttl;        /* registry cache_policy ttl in seconds */
+} cindex_source;
+
+/* One Registry.Package["name"].Version["version"] record. Strings point into the mapping. */
+typedef struct cindex_entry {
+    const char *name;
+    const char *version;
+    const char *manifest_url;
+    const char *pkg_url;
+    const char *sha256;
+    int deprecated;
+    uint32_t first_delta;   /* for cindex_delta_at */
+    uint32_t ndeltas;
+} cindex_entry;
+
+/* One Delta["base"] child of a Version: a patch that rebuilds this version's
+   blob from base's store tree (see core/delta.h). */
+typedef struct cindex_delta {
+    const char *base_version;
+    const char *url;
+    const char *sha256;     /* of the delta file itself */
+    uint64_t size;
+} cindex_delta;
+
+/* One Registry.Package block; versions are in index order. */
+typedef struct cindex_package {
+    const char *name;
+    const char *latest;
+    const char *description;   /* "" if the index has none */
+    const char *tags;          /* space-separated, or "" */
+    uint32_t first;     /* first version record, for cindex_version */
+    uint32_t count;
+} cindex_package;
+
+/* Compile the Registry packages of one or more parsed index trees (a whole
+   index.acl, or every shard of a sharded index) into out_path, written to a
+   temp file and renamed. Returns 0 on success. */
+int cindex_build(AclBlock *const trees[], size_t ntrees, const cindex_source *src, const char *out_path);
+
+/* Map and validate an image. Returns NULL if missing, truncated or of another format version. */
+cindex *cindex_open(const char *path);
+void cindex_close(cindex *ci);
+
+const cindex_source *cindex_source_of(const cindex *ci);
+
+/* Record the new mtime/ttl of an index.acl revalidated as unchanged, in place. */
+int cindex_touch(const char *path, const cindex_source *src);
+
+/* O(1) lookup of name@version. Returns 0 and fills out on success, -1 if absent. */
+int cindex_find(const cindex *ci, const char *name, const char *version, cindex_entry *out);
+
+/* Packages sorted by name. */
+size_t cindex_package_count(const cindex *ci);
+int cindex_package_at(const cindex *ci, size_t i, cindex_package *out);
+int cindex_find_package(const cindex *ci, const char *name, cindex_package *out);
+int cindex_version(const cindex *ci, const cindex_package *pkg, uint32_t i, cindex_entry *out);
+
+/* Packages whose name, tags or description contain query, ignoring ASCII
+   case, in name order: fn is called for each. The image carries a trigram
+   index over those fields, so a query of three or more bytes only looks at
+   packages holding every trigram of it; shorter ones check them all.
+   Returns the number of matches. */
+size_t cindex_search(const cindex *ci, const char *query, void (*fn)(void *arg, const cindex_package *pkg), void *arg);
+
+/* The i-th delta advertised for e, 0 <= i < e->ndeltas. Returns 0, or -1 if out of range. */
+int cindex_delta_at(const cindex *ci, const cindex_entry *e, uint32_t i, cindex_delta *out);
+
+#endif
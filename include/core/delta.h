@@ -0,0 +1,33 @@
+#ifndef CORE_DELTA_H
+#define CORE_DELTA_H
+
+#include <stdint.h>
+
+/* Binary deltas between two versions of a package. A delta rebuilds the new
+   version's .pkg byte for byte from the unpacked store tree of an older one,
+   one archive entry at a time:
+
+     [8 bytes magic "PNDDLT\0\1"] [u64 output size] [32 bytes output sha256]
+     ops, each starting with a u8 code, until END:
+       0 END
+       1 LITERAL [u64 len] [len bytes]             bytes copied from the delta
+       2 FILE    [u32 path_len] [path] [u64 len]   a whole file of the base tree
+       3 PATCH   [u32 path_len] [path] [u64 len] [u64 ncmds] cmds
+                   1 COPY   [u64 offset] [u64 len]  bytes of that base file
+                   2 INSERT [u64 len] [len bytes]   bytes from the delta
+   All integers little-endian. Archive headers, tables, symlinks, compressed
+   blobs and new files travel as literals; an unchanged file (found by digest,
+   under any path) costs one FILE op and a changed one a copy/insert patch
+   against its predecessor, matched rsync-style on 32-byte blocks. */
+
+/* Write to out_path a delta that turns the tree base_pkg unpacks to into
+   new_pkg. Returns 0 on success. */
+int delta_create(const char *base_pkg, const char *new_pkg, const char *out_path);
+
+/* Rebuild the archive described by delta_path from base_dir, the unpacked
+   base version, into out_path; digest receives the SHA-256 of what was
+   written (the caller compares it against the manifest). Returns 0 on
+   success, -1 after printing why; out_path is the caller's to remove. */
+int delta_apply(const char *delta_path, const char *base_dir, const char *out_path, uint8_t digest[32]);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef CORE_GRAPH_H
+#define CORE_GRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Dependency edges of every manifest parsed so far, keyed by the manifest's
+   sha256 (the digest the index and the lockfile pin, so a lookup needs
+   neither a download nor a parse): $HOME/pandora/cache/graph.bin. A package
+   version's manifest never changes under the same digest, so entries never
+   go stale. The file is mapped and searched in place; edges added during a
+   run are kept in memory until graph_save merges them in. */
+typedef struct graph graph;
+
+typedef struct graph_dep {
+    const char *name;
+    const char *version;
+} graph_dep;
+
+typedef struct graph_node {
+    uint32_t first;       /* opaque, for graph_dep_at */
+    uint32_t ndeps;
+    int added;            /* opaque */
+} graph_node;
+
+/* Write the graph cache path for home into out. Returns 0, or -1 if it does not fit. */
+int graph_path(const char *home, char *out, size_t len);
+
+/* Map the cache at path; a missing or unreadable one gives an empty graph.
+   Returns NULL only when out of memory. */
+graph *graph_open(const char *path);
+void graph_close(graph *g);
+
+/* Edges of the manifest with this digest. Returns 0, or -1 if it was never recorded. */
+int graph_find(const graph *g, const uint8_t sha256[32], graph_node *out);
+int graph_dep_at(const graph *g, const graph_node *node, uint32_t i, graph_dep *out);
+
+/* Record a manifest's edges (strings are copied). Not thread-safe. Returns 0, or -1 when out of memory. */
+int graph_add(graph *g, const uint8_t sha256[32], const graph_dep *deps, size_t n);
+
+/* If anything was added, write the merged graph beside path and rename it
+   over path. Returns 0, or -1 on error. */
+int graph_save(graph *g, const char *path);
+
+#endif
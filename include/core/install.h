@@ -0,0 +1,21 @@
+#ifndef CORE_INSTALL_H
+#define CORE_INSTALL_H
+
+#include <stddef.h>
+
+#include "util/err.h"
+#include "net/download.h"
+
+/* Install every "name@version" in specs, and everything they depend on
+   (core/resolve.h), into $HOME/pandora/store/<name>/<version>.
+   Manifest fetches, blob downloads (hashed in flight) and unpacking run as
+   overlapping pipeline stages on bounded worker pools; the limit comes from
+   Pandora.Install.jobs in pandora.conf. Fails if any package fails. */
+error_t install_packages(fetch_env *env, const char *const specs[], size_t n);
+
+/* Install everything pinned in $HOME/pandora/manifests/<profile>.lock,
+   checking each manifest checksum against the lockfile. A lockfile that does
+   not yet hold its own closure is resolved and rewritten first. */
+error_t install_restore(fetch_env *env, const char *profile);
+
+#endif
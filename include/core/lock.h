@@ -0,0 +1,29 @@
+#ifndef CORE_LOCK_H
+#define CORE_LOCK_H
+
+#include <stddef.h>
+
+/* One resolved entry of a profile lockfile ($HOME/pandora/manifests/<profile>.lock).
+   File format: one "name@version [sha256]" per line; blank lines and '#' comments ignored. */
+typedef struct lock_entry {
+    char *name;
+    char *version;
+    char *sha256;   /* NULL when the line carries no checksum */
+} lock_entry;
+
+/* Split "name@version" at the last '@'. Rejects empty parts and anything that
+   could escape a store path. On success *name and *version are malloc'd. */
+int pkg_spec_parse(const char *spec, char **name, char **version);
+
+/* 1 if version passes as the version part of a spec (as pkg_spec_parse
+   checks it), so it is safe to put in a store or cache path; 0 otherwise. */
+int pkg_version_valid(const char *version);
+
+/* Read a lockfile. Returns 0 and fills entries and count on success, -1 on error. */
+int lock_read(const char *path, lock_entry **entries, size_t *count);
+
+/* Write entries to path.tmp and rename over path. Returns 0, or -1 on error. */
+int lock_write(const char *path, const lock_entry *entries, size_t count);
+void lock_free(lock_entry *entries, size_t count);
+
+#endif
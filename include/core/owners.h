@@ -0,0 +1,46 @@
+#ifndef CORE_OWNERS_H
+#define CORE_OWNERS_H
+
+#include <stddef.h>
+
+/* Persistent record of which package provides which path of a profile's
+   forest: $HOME/pandora/profiles/<profile>/owners. One block per package,
+   in lockfile order:
+
+       = name@version
+       bin/foo
+       lib/libfoo.so
+
+   Every provider of a path is listed, so when the package that wins a
+   conflict goes away the one it shadowed takes over without a rescan.
+   Activation keeps the file current; packages already in it are never
+   walked in the store again. */
+typedef struct owners_pkg {
+    char *spec;           /* name@version */
+    char **paths;         /* forest-relative, e.g. "bin/foo" */
+    size_t npaths, cap;
+} owners_pkg;
+
+typedef struct owners {
+    owners_pkg *pkgs;
+    size_t n, cap;
+} owners;
+
+/* Write the owners file path of profile into out. Returns 0, or -1 if it does not fit. */
+int owners_path(const char *home, const char *profile, char *out, size_t len);
+
+/* Read an owners file; a missing one gives an empty set. Returns 0, or -1 on error. */
+int owners_load(const char *path, owners *out);
+
+/* Write to path.tmp and rename over path. Returns 0, or -1 on error. */
+int owners_save(const owners *o, const char *path);
+void owners_free(owners *o);
+
+/* Package lookup by name@version, or NULL. */
+owners_pkg *owners_find(owners *o, const char *spec);
+
+/* Append a package (taking ownership of spec) or a path to one. Return NULL/-1 when out of memory. */
+owners_pkg *owners_add_pkg(owners *o, char *spec);
+int owners_add_path(owners_pkg *p, const char *path);
+
+#endif
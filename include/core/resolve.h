@@ -0,0 +1,33 @@
+#ifndef CORE_RESOLVE_H
+#define CORE_RESOLVE_H
+
+#include <stddef.h>
+
+#include "util/err.h"
+#include "core/lock.h"
+#include "net/download.h"
+
+/* Exact-pin dependency resolution. A manifest lists what its package needs as
+
+       string[] dependencies = { "libfoo@1.0.0", "libbar@2.1" };
+
+   and the closure of a set of roots is every version reachable from them.
+   A closure holds one version per name; requiring a second is a conflict.
+   The closure is walked breadth first. A version whose index sha256 is in
+   the graph cache (core/graph.h) costs a lookup; the manifests of the rest
+   of each level are fetched in parallel and their edges recorded. */
+
+/* Resolve the closure of roots; a root's sha256, when set, must match the
+   registry. *out lists the closure breadth first, roots first, each entry
+   with its sha256. Caller frees with lock_free. */
+error_t resolve_closure(fetch_env *env, const lock_entry *roots, size_t nroots,
+                        lock_entry **out, size_t *count);
+
+/* The packages of $HOME/pandora/manifests/<profile>.lock plus everything they
+   depend on. If every entry carries a checksum and the graph cache shows the
+   lockfile already holds its own closure, it is returned as read, without
+   the index or any manifest. Otherwise its entries are resolved as roots
+   through env and the lockfile is rewritten with the result. */
+error_t resolve_profile(fetch_env *env, const char *profile, lock_entry **out, size_t *count);
+
+#endif
@@ -3,6 +3,31 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* incremental hashing context; treat as opaque outside sha256.c */
+typedef struct {
+    uint32_t state[8];
+    uint64_t total;      /* bytes fed so far */
+    uint8_t buf[64];     /* pending partial block */
+    size_t buf_len;
+} sha256_ctx;
+
+/* incremental API: init, feed any number of chunks, then final (digest must be 32 bytes) */
+void sha256_init(sha256_ctx *ctx);
+void sha256_update(sha256_ctx *ctx, const void *data, size_t len);
+void sha256_final(sha256_ctx *ctx, uint8_t digest[32]);
+
+/* multi-buffer update: feed len bytes of data[i] into ctx[i] for each i < n.
+   n must not exceed SHA256_MAX_LANES. Lanes are hashed in lockstep with a SIMD
+   kernel when one is available and every ctx sits on a block boundary. */
+#define SHA256_MAX_LANES 8
+void sha256_update_lanes(sha256_ctx *const ctx[], const void *const data[], size_t n, size_t len);
+
+/* name of the compression kernel picked at startup ("scalar", "sha-ni", "avx2-x8", "armv8-ce") */
+const char *sha256_impl_name(void);
+
+/* force a kernel by name (for benchmarks/diagnostics); returns 0, or -1 if unsupported here */
+int sha256_select_impl(const char *name);
+
 /* compute SHA-256: digest must be 32 bytes */
 void sha256(const void *data, size_t len, uint8_t digest[32]);
 
@@ -0,0 +1,19 @@
+#ifndef CORE_STORE_H
+#define CORE_STORE_H
+
+#include <stddef.h>
+
+#include "util/err.h"
+
+/* Content-addressed file objects shared by every version in the store:
+   $HOME/pandora/objects/<2 hex>/<62 hex>, named by the SHA-256 of the
+   content. Store trees hardlink them, so an object whose link count is 1
+   is referenced by nothing but the object store itself. */
+
+/* Write the object store directory for home into out. Returns 0, or -1 if it does not fit. */
+int store_objects_path(const char *home, char *out, size_t len);
+
+/* Delete every object no store tree links to any more and report what was freed. */
+error_t store_prune(void);
+
+#endif
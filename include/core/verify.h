@@ -0,0 +1,22 @@
+#ifndef CORE_VERIFY_H
+#define CORE_VERIFY_H
+
+#include "util/err.h"
+
+/* verify flags */
+#define VERIFY_FULL 0x1   /* rehash everything, ignoring the verify cache */
+
+/* Re-hash the whole store on every core: each object in $HOME/pandora/objects
+   against its name, and each cached blob in pkgs/ against the sha256 in its
+   cached manifest. Store trees hardlink the objects, so this covers the
+   content of every installed file that shares one. Files whose size, mtime
+   and inode match a recent entry of $HOME/pandora/cache/verify.cache are
+   skipped unless VERIFY_FULL is set. Fails if anything is corrupt or
+   unreadable. */
+error_t verify_all(int flags);
+
+/* Verify one installed version: its cached blob (if any) and every file of
+   store/<name>/<version> that is linked from the object store. */
+error_t verify_package(const char *spec, int flags);
+
+#endif
@@ -1,8 +1,79 @@
 #ifndef NET_DOWNLOAD_H
 #define NET_DOWNLOAD_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 #include "util/err.h"
+#include "core/acl.h"
+#include "core/cindex.h"
+
+struct fetch_state;
+
+/* Runtime context for one pandora invocation, opened once by main and handed
+   to fetch, install and activate. The config, the mirrors (net/mirror.h)
+   and the pandora dirs are set up when it opens; the registry index (with the HTTP
+   transport) the first time something asks for it, so a command that never
+   needs the registry never syncs it. Manifests parsed through it are kept
+   until it closes. Safe to share between threads. */
+typedef struct fetch_env {
+    const char *home;
+    AclBlock *conf;            /* parsed $HOME/conf/pandora.conf */
+    char *mirror_index;        /* index URL of the first configured mirror, or NULL */
+    char *mirror_root;         /* its sharded index root URL, or NULL */
+    int flags;                 /* as passed to fetch_env_open */
+    struct fetch_state *state; /* index and manifests, loaded on demand */
+} fetch_env;
+
+/* fetch_env_open flags */
+#define FETCH_REFRESH_INDEX 0x1   /* revalidate the index even if its ttl has not expired */
+
+/* Parse config and make sure the pandora dirs exist. */
+error_t fetch_env_open(fetch_env *env, int flags);
+void fetch_env_close(fetch_env *env);
+
+/* The compiled registry index, synced and mapped on the first call (see
+   index_sync). Read-only and safe to share. NULL if it could not be had;
+   that is remembered, so later calls fail at once. */
+cindex *fetch_env_index(fetch_env *env);
+
+/* Worker count for a session's parallel stages: Pandora.Install.jobs from
+   pandora.conf, 4 if unset. */
+size_t fetch_env_jobs(const fetch_env *env);
+
+/* Whether install keeps downloaded blobs in pkgs/: Pandora.Install.keep_blobs
+   from pandora.conf, true if unset. */
+int fetch_env_keep_blobs(const fetch_env *env);
+
+/* Resolve name@version in the index and fetch its manifest (once per
+   session). On success *pkg_url and *sha256 are newly allocated; caller frees. */
+error_t fetch_manifest(fetch_env *env, const char *name, const char *version,
+                       char **pkg_url, char **sha256);
+
+/* Fetch name@version's manifest like fetch_manifest and return its sha256 and
+   its Manifest.dependencies, as written ("name@version"). All newly
+   allocated; caller frees. */
+error_t fetch_dependencies(fetch_env *env, const char *name, const char *version,
+                           char **sha256, char ***deps, size_t *ndeps);
+
+/* Download the .pkg blob (unless cached) and verify it against sha256.
+   The blob path is written to pkg_path. */
+error_t fetch_blob(fetch_env *env, const char *name, const char *version,
+                   const char *pkg_url, const char *sha256,
+                   char *pkg_path, size_t pkg_path_len);
+
+/* Download the .pkg blob into out as it arrives, hashing it on the way, and
+   check it against sha256; nothing is cached. A transfer that breaks off
+   moves to the next mirror without repeating bytes out already has; on
+   failure the caller discards whatever out made of them. */
+error_t fetch_blob_stream(fetch_env *env, const char *name, const char *version,
+                          const char *pkg_url, const char *sha256, FILE *out);
+
+/* Sync the index of a session opened with FETCH_REFRESH_INDEX, which
+   revalidates it regardless of its ttl. */
+error_t fetch_update_index(fetch_env *env);
 
-error_t fetch_package(const char* name, const char* version);
+/* Fetch and verify a single package's blob. */
+error_t fetch_package(fetch_env *env, const char* name, const char* version);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,20 @@
+#ifndef NET_HTTP_H
+#define NET_HTTP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* HTTP transport shared by the whole CLI invocation.
+   Easy handles are cached per origin (scheme://host[:port]) and handed back
+   out for the next request to the same mirror, so the backend can keep the
+   TCP/TLS connection alive instead of handshaking on every fetch. Thread-safe. */
+
+/* Reference-counted global setup; pair every http_init with http_cleanup.
+   The last cleanup closes all cached connections. Returns 0 on success. */
+int http_init(void);
+void http_cleanup(void);
+
+/* Stream url into out. Returns 0 on success, -1 on curl failure, -2 on other error. */
+int http_get_stream(const char *url, FILE *out);
+
+#endif
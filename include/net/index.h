@@ -0,0 +1,32 @@
+#ifndef NET_INDEX_H
+#define NET_INDEX_H
+
+#include "core/cindex.h"
+#include "net/mirror.h"
+
+/* default freshness when the index carries no Registry.cache_policy */
+#define INDEX_DEFAULT_TTL 3600
+
+/* Bring $HOME/pandora/tmp/index.acl up to date with index_url and map its
+   compiled form, $HOME/pandora/cache/index.bin (recompiled whenever index.acl
+   changes, so the text index is only parsed once per registry update).
+   A cached copy younger than the registry's cache_policy ttl is used as is.
+   An older one is revalidated against the registry's <index>.sha256 sidecar
+   and only transferred again when its digest changed. force skips the ttl check.
+   If the registry is unreachable a stale copy is used with a warning.
+
+   If root_url is given the registry's sharded index is used instead: a small
+   root file listing per-name-prefix shards with a sequence number and digest
+   each (see scripts/gen_index.py). Only shards that changed since the last
+   sync are transferred; they live in $HOME/pandora/tmp/index/ under their
+   digest, and a failed sync leaves the previous root and its shards whole.
+
+   Everything goes through mirrors (see net/mirror.h), which may be NULL:
+   the sidecar and the root are small fetches, index.acl and the shards bulk.
+   Returns the mapped index, or NULL on failure. */
+cindex *index_sync(const char *home, mirror_set *mirrors, const char *index_url, const char *root_url, int force);
+
+/* Parse the "ttl=<seconds>" entry of a cache_policy string; -1 if absent. */
+long index_policy_ttl(const char *policy);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef NET_MIRROR_H
+#define NET_MIRROR_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "core/acl.h"
+
+/* The registry mirrors of pandora.conf and how well each has been doing.
+
+       Pandora {
+           Mirrors {
+               int race = 3;
+               mirror "main" { string index = "https://a.example/index.acl"; }
+               mirror "eu"   { string index = "https://b.example/pandora/index.acl"; int priority = 50; }
+           }
+       }
+
+   Every mirror serves the same tree, so a url under one mirror's base (its
+   index url without the file name) maps onto every other. A single mirror
+   may be left unlabeled; with several, each needs a label. Lower priority
+   (default 100) is preferred when the stats don't decide.
+
+   Per mirror the set keeps a moving average of the latency of small
+   requests, of blob throughput, and the run of consecutive failures. A
+   failure only counts when another mirror then served the same url, so a
+   file missing everywhere marks nobody down. A mirror with failures is
+   passed over for a while (30 seconds, doubling per failure, up to an
+   hour) unless nothing else is left. The numbers are loaded from
+   and saved to $HOME/pandora/cache/mirrors.bin.
+
+   Requests come in two kinds. A small one (the index sidecar or root, a
+   manifest) is the latency bound first request of a session: the first is
+   raced across the `race` best mirrors and the fastest answer wins; later
+   ones go to the best mirror, then the next on failure. A bulk one (an
+   index or shard, a blob, a delta) streams from the mirror with the best
+   throughput; when it fails midway the transfer moves to the next mirror,
+   which resumes where the last left off, so the bytes written to out are
+   never repeated. The transport has no Range requests, so resuming means
+   discarding that many bytes of the new response.
+
+   A url under no mirror's base is fetched as is. Every call is safe from
+   any thread; NULL for set means the plain urls without mirror handling. */
+typedef struct mirror_set mirror_set;
+
+/* The mirrors of conf with their saved stats. Returns NULL if conf lists
+   none or on error, after printing why. */
+mirror_set *mirror_set_open(AclBlock *conf, const char *home);
+
+/* The first mirror's index url and sharded index root url, which name the
+   index for every mirror; either may be NULL, not both. */
+const char *mirror_index_url(const mirror_set *ms);
+const char *mirror_root_url(const mirror_set *ms);
+
+/* Save the stats (when anything changed) and free the set. */
+void mirror_set_close(mirror_set *ms);
+
+/* mirror_fetch flags */
+#define MIRROR_SMALL 0x0   /* buffered, raced or failed over whole */
+#define MIRROR_BULK  0x1   /* streamed, failed over mid-transfer */
+
+/* Fetch url into out. A small fetch writes out only once a whole response
+   is in. Returns 0 on success, -1 if every mirror failed, -2 on a local
+   error (out failing to take the bytes is one, and ends the fetch). */
+int mirror_fetch(mirror_set *ms, const char *url, FILE *out, int flags);
+
+/* mirror_fetch into out_path, which is truncated first. If digest is
+   non-NULL the SHA-256 of the bytes written is stored there. */
+int mirror_fetch_file(mirror_set *ms, const char *url, const char *out_path, uint8_t digest[32], int flags);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef UTIL_DIRCACHE_H
+#define UTIL_DIRCACHE_H
+
+#include <sys/types.h>
+
+/* mkdir -p: try path itself first and, only if its parent is missing, climb
+   to the deepest ancestor that exists. Missing parents get mode 0755.
+   Returns 0 if path is (now) a directory, -1 with errno set otherwise. */
+int mkdir_p(const char *path, mode_t mode);
+
+/* rm -r of name inside dir_fd (AT_FDCWD for a plain path), best effort:
+   whatever cannot be removed is left. Does not follow symlinks. */
+void remove_tree_at(int dir_fd, const char *name);
+
+/* Directory creation below one root, remembering which relative prefixes
+   already exist, so extracting or linking thousands of files into one tree
+   costs one mkdirat per new directory and none for the rest. Not thread-safe. */
+typedef struct dircache dircache;
+
+/* Open the existing directory path (relative to dir_fd, as with openat; use
+   AT_FDCWD for a plain path). Returns NULL with errno set on failure. */
+dircache *dircache_open(int dir_fd, const char *path);
+void dircache_close(dircache *dc);
+
+/* The root's descriptor, for *at() calls against paths under it. */
+int dircache_fd(const dircache *dc);
+
+/* Create rel (relative to the root) and any missing parents.
+   Returns 0 on success, -1 with errno set. */
+int dircache_mkdirs(dircache *dc, const char *rel, mode_t mode);
+
+/* Same for the directory that will hold the file rel. */
+int dircache_mkparent(dircache *dc, const char *rel, mode_t mode);
+
+#endif
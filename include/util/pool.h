@@ -0,0 +1,25 @@
+#ifndef UTIL_POOL_H
+#define UTIL_POOL_H
+
+#include <stddef.h>
+
+/* Fixed-size worker pool with an unbounded FIFO job queue. */
+typedef struct pool pool_t;
+typedef void (*pool_fn)(void *arg);
+
+/* Start nthreads workers (at least one). Returns NULL on failure. */
+pool_t *pool_create(size_t nthreads);
+
+/* Queue fn(arg). Safe to call from inside a job. Returns 0 on success, -1 on failure. */
+int pool_submit(pool_t *p, pool_fn fn, void *arg);
+
+/* Block until the queue is empty and every worker is idle. */
+void pool_wait(pool_t *p);
+
+/* Wait for outstanding jobs, then stop and free the pool. */
+void pool_destroy(pool_t *p);
+
+/* Number of online CPUs (at least 1). */
+size_t pool_cpu_count(void);
+
+#endif
@@ -1,6 +1,13 @@
 #ifndef UTIL_SHA256_H
 #define UTIL_SHA256_H
 
+#include <stdio.h>
+#include "core/sha256.h"
+
 int sha256_file_hex(const char *path, char out_hex[65]);
 
+/* Wrap out in a write-only stream that also feeds every byte into ctx.
+   Closing the returned stream flushes it but leaves out open. Returns NULL on error. */
+FILE *sha256_tee_open(FILE *out, sha256_ctx *ctx);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef UTIL_TRACE_H
+#define UTIL_TRACE_H
+
+#include <stdint.h>
+
+/* Phase timing for one pandora invocation. Each traced step records a span:
+   when it started, how long it took, and the bytes and files it handled.
+   --timings sums the spans per phase into a table on stderr at exit;
+   --trace FILE also writes every span as a Chrome trace event (load it in
+   chrome://tracing or ui.perfetto.dev). With neither, trace_now returns 0
+   and trace_span does nothing, so instrumented code pays one branch. */
+typedef enum trace_phase {
+    TRACE_CONFIG,
+    TRACE_INDEX_DOWNLOAD,
+    TRACE_INDEX_PARSE,
+    TRACE_RESOLVE,
+    TRACE_MANIFEST,
+    TRACE_BLOB,
+    TRACE_HASH,
+    TRACE_UNPACK,
+    TRACE_ACTIVATE,
+    TRACE_NPHASES
+} trace_phase;
+
+/* trace_open flags */
+#define TRACE_TIMINGS 0x1   /* print the per-phase summary at trace_close */
+#define TRACE_QUIET   0x2   /* drop per-file progress lines ("extracted: ...") */
+
+/* Start tracing; trace_path may be NULL. Returns 0, or -1 if the trace file
+   cannot be created (timings and quiet mode still apply). */
+int trace_open(int flags, const char *trace_path);
+
+/* Print the summary and finish the trace file. */
+void trace_close(void);
+
+/* Whether per-file output is off. */
+int trace_quiet(void);
+
+/* Monotonic clock in nanoseconds, or 0 when nothing is being recorded. */
+uint64_t trace_now(void);
+
+/* Record a span of phase that began at start (from trace_now). name labels the
+   event in the trace file ("zlib@1.3", "index.acl"). Safe from any thread. */
+void trace_span(trace_phase phase, const char *name, uint64_t start, uint64_t bytes, uint64_t files);
+
+#endif
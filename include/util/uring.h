@@ -0,0 +1,38 @@
+#ifndef UTIL_URING_H
+#define UTIL_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A small io_uring wrapper for batched file I/O, built on the raw system
+   calls (no liburing). A ring owns nbufs buffers of buf_size bytes that are
+   registered with the kernel once, so reads and writes into them skip the
+   per-call page pinning. Usage is batch-shaped: queue up to `entries`
+   operations, then uring_run submits them in one call and waits for every
+   completion. One ring per thread; nothing here is thread-safe.
+
+   uring_open returns NULL when io_uring is missing (not Linux, an old
+   kernel, a seccomp filter, a memlock limit too small for the buffers) or
+   when PANDORA_NO_URING is set in the environment. Callers keep their
+   blocking path for that case. */
+typedef struct uring uring;
+
+uring *uring_open(unsigned entries, unsigned nbufs, size_t buf_size);
+void uring_close(uring *r);
+
+/* Registered buffer i (0 <= i < nbufs), and the size of each. */
+void *uring_buf(uring *r, unsigned i);
+size_t uring_buf_size(const uring *r);
+
+/* Queue a read of len bytes at off into buffer buf, or a write of its first
+   len bytes to off. tag is handed back on completion. Returns 0, or -1 if
+   the submission queue is full. */
+int uring_read(uring *r, int fd, unsigned buf, size_t len, uint64_t off, uint64_t tag);
+int uring_write(uring *r, int fd, unsigned buf, size_t len, uint64_t off, uint64_t tag);
+
+/* Submit everything queued and wait until it has all completed, calling
+   done(arg, tag, res) for each; res is what the equivalent pread/pwrite
+   would return, or -errno. Returns 0, or -errno if the ring itself failed. */
+int uring_run(uring *r, void (*done)(void *arg, uint64_t tag, int res), void *arg);
+
+#endif
@@ -4,12 +4,12 @@
 Create a deterministic .pkg from a package source dir, always using local build/arch.
 
 Usage:
-  scripts/create_package.py <src_dir> [--out-root pkgs] [--keep-temp]
+  scripts/create_package.py <src_dir> [--out-root pkgs] [--keep-temp] [--compress]
 
 Behavior:
 - Expects a manifest.acl file at the top of <src_dir>.
 - Produces <out_root>/<name>/<ver>/<name>-<ver>.pkg
-- ALWAYS uses build/arch. If build/arch is missing, attempts to compile src/arch.c -> build/arch.
+- ALWAYS uses build/arch. If build/arch is missing, attempts to compile src/core/arch.c -> build/arch.
 - If compilation or arch invocation fails, the script exits with non-zero (no tar fallback).
 - Computes SHA256 and updates (or inserts) archive_sha256 in manifest.acl.
 """
@@ -23,7 +23,7 @@ import subprocess
 import sys
 import tempfile
 from pathlib import Path
-from typing import Optional
+from typing import List, Optional
 
 # -------- utility functions --------
 
@@ -73,19 +73,19 @@ def ensure_parent(path: Path) -> None:
 
 # -------- arch build / invocation (always use build/arch) --------
 
-def arch_executable() -> Path:
+def arch_executable(with_zstd: bool = False) -> Path:
     """
-    Return the Path to build/arch. If missing, attempt to compile src/arch.c into it.
-    If compilation fails, raise RuntimeError.
+    Return the Path to build/arch. If missing, attempt to compile src/core/arch.c into it
+    (linked against libzstd when with_zstd). If compilation fails, raise RuntimeError.
     """
     out_path = Path("build") / "arch"
     if out_path.is_file() and os.access(out_path, os.X_OK):
         return out_path
 
-    # attempt to build from src/arch.c
-    src_c = Path("src") / "arch.c"
+    # attempt to build from src/core/arch.c
+    src_c = Path("src") / "core" / "arch.c"
     if not src_c.is_file():
-        raise RuntimeError("build/arch not found and src/arch.c missing; cannot proceed")
+        raise RuntimeError("build/arch not found and src/core/arch.c missing; cannot proceed")
 
     out_dir = out_path.parent
     out_dir.mkdir(parents=True, exist_ok=True)
@@ -95,7 +95,12 @@ def arch_executable() -> Path:
     if not cc:
         raise RuntimeError("C compiler not found; cannot build build/arch")
 
-    cmd = [cc, "-O2", "-std=c11", "-o", str(out_path), str(src_c)]
+    cmd = [cc, "-O2", "-std=c11", "-pthread", "-Iinclude", "-DSHA256_NO_MAIN", "-o", str(out_path),
+           str(src_c), str(Path("src") / "core" / "delta.c"), str(Path("src") / "core" / "sha256.c"),
+           str(Path("src") / "util" / "dircache.c"), str(Path("src") / "util" / "uring.c")]
+    if with_zstd:
+        cmd[1:1] = ["-DWITH_ZSTD"]
+        cmd.append("-lzstd")
     print("Compiling arch:", " ".join(cmd), file=sys.stderr)
     res = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
     if res.returncode != 0:
@@ -108,8 +113,8 @@ def arch_executable() -> Path:
     out_path.chmod(0o755)
     return out_path
 
-def call_arch(arch_path: Path, src: Path, out_pkg: Path) -> int:
-    cmd = [str(arch_path), "pack", str(out_pkg), str(src)]
+def call_arch(arch_path: Path, src: Path, out_pkg: Path, pack_opts: Optional[List[str]] = None) -> int:
+    cmd = [str(arch_path), "pack"] + (pack_opts or []) + [str(out_pkg), str(src)]
     print("Running arch:", " ".join(cmd), file=sys.stderr)
     try:
         res = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
@@ -130,6 +135,8 @@ def main(argv):
     ap.add_argument("src_dir", help="source directory: pkgs/src/<name>/<ver>")
     ap.add_argument("--out-root", default="pkgs", help="output root (default: pkgs)")
     ap.add_argument("--keep-temp", action="store_true", help="keep temporary files on error")
+    ap.add_argument("--compress", action="store_true",
+                    help="write a v2 archive: per-entry zstd with a dictionary trained on the package")
     args = ap.parse_args(argv)
 
     src = Path(args.src_dir).resolve()
@@ -163,12 +170,15 @@ def main(argv):
 
     # Always use build/arch. Try to find or compile it.
     try:
-        arch_path = arch_executable()
+        arch_path = arch_executable(with_zstd=args.compress)
     except Exception as e:
         print("ERROR: could not obtain build/arch:", e, file=sys.stderr)
         return 3
 
-    rc = call_arch(arch_path, src, out_pkg)
+    pack_opts = ["-j", str(os.cpu_count() or 1)]
+    if args.compress:
+        pack_opts += ["-z", "-D"]
+    rc = call_arch(arch_path, src, out_pkg, pack_opts)
     if rc != 0 or not out_pkg.is_file():
         print(f"ERROR: build/arch failed (rc={rc}) or did not produce {out_pkg}", file=sys.stderr)
         return 4
@@ -8,12 +8,24 @@ Layout:
 
 Outputs:
   docs/index.acl
+  docs/index/root.acl
+  docs/index/shards/<prefix>.acl
   docs/pkgs/<name>/<version>/manifest.acl
 
 Behavior:
   - Creates docs/ subdirs as needed.
   - Overwrites existing manifest.acl and index.acl.
-  - SHA256 is computed as lowercase hex using the project's src/sha256.c (built and run).
+  - Also writes the same packages as a sharded index: one shard per package-name
+    prefix plus a small root listing each shard's sequence number and digest.
+    A shard's seq is bumped (to the new root generation) only when its content
+    changes, so clients re-download just the shards that changed.
+  - Each manifest carries the `dependencies` of the manifest.acl packed into its .pkg
+    (read back with build/arch cat), which is what pandora resolves.
+  - SHA256 is computed as lowercase hex using the project's src/core/sha256.c (built and run).
+  - With --deltas N (default 3), each version also gets binary deltas from the N
+    versions before it (build/arch delta), written next to its .pkg as
+    <name>-<base>-<version>.pdelta and listed as Delta "<base>" blocks in its
+    Version block. A delta that would not save at least a fifth of the .pkg is dropped.
   - Uses hardcoded release URL bases:
       Index base:  https://atlaslinux.github.io/pandora/
       Manifest pkg base: https://github.com/atlaslinux/pandora
@@ -27,16 +39,20 @@ import re
 from pathlib import Path
 from typing import Dict, List, Tuple, Optional
 
-# --- compute_sha256 replaced to compile and run ../src/sha256.c (which has main) ---
+# --- compute_sha256 replaced to compile and run ../src/core/sha256.c (which has main) ---
 SCRIPT_DIR = Path(__file__).resolve().parent
-SRC_SHA256_C = (SCRIPT_DIR / ".." / "src" / "sha256.c").resolve()
+SRC_SHA256_C = (SCRIPT_DIR / ".." / "src" / "core" / "sha256.c").resolve()
+INCLUDE_DIR = (SCRIPT_DIR / ".." / "include").resolve()
 TOOLS_DIR = SCRIPT_DIR / "tools"
 TOOL_BIN = (TOOLS_DIR / "sha256_c_bin").resolve()
 CC = os.environ.get("CC", "cc")
-CFLAGS = os.environ.get("CFLAGS", "-O2 -std=c11 -I" + str(SRC_SHA256_C.parent))
+CFLAGS = os.environ.get("CFLAGS", "-O2 -std=gnu11 -I" + str(INCLUDE_DIR))
 
 _INPUT_PKG_ROOT: Optional[Path] = None
 
+REPO_ROOT = (SCRIPT_DIR / "..").resolve()
+DELTA_MAX_RATIO = 0.8   # keep a delta only if it is smaller than this share of the .pkg
+
 def build_sha256_binary():
     TOOLS_DIR.mkdir(parents=True, exist_ok=True)
     needs_build = True
@@ -67,7 +83,7 @@ def _find_local_pkg_by_name(pkg_name: str) -> Optional[Path]:
 
 def compute_sha256(path: Path) -> str:
     """
-    Compute sha256 by compiling and running ../src/sha256.c (which contains main).
+    Compute sha256 by compiling and running ../src/core/sha256.c (which contains main).
     If 'path' doesn't exist and looks like a URL or filename, attempt to locate the
     local package file (by basename) under the input directory before failing.
     """
@@ -105,6 +121,45 @@ def compute_sha256(path: Path) -> str:
 # --- end replacement ---
 
 
+def arch_binary() -> Path:
+    """build/arch, compiled by create_pkg.py's rules if it is missing."""
+    from create_pkg import arch_executable
+    cwd = os.getcwd()
+    os.chdir(REPO_ROOT)
+    try:
+        return (REPO_ROOT / arch_executable()).resolve()
+    finally:
+        os.chdir(cwd)
+
+
+def make_deltas(pkgs: Dict[str, List[Tuple[str, Path]]], depth: int) -> Dict[Tuple[str, str], List[Tuple[str, Path]]]:
+    """
+    {(name, version): [(base_version, delta_path)]} for the depth versions
+    preceding each version, newest base first.
+    """
+    deltas: Dict[Tuple[str, str], List[Tuple[str, Path]]] = {}
+    if depth <= 0:
+        return deltas
+    arch = None
+    for name, entries in pkgs.items():
+        ordered = sorted(entries, key=lambda x: x[0])
+        for i, (ver, pkgpath) in enumerate(ordered):
+            for base, basepath in reversed(ordered[max(0, i - depth):i]):
+                if arch is None:
+                    arch = arch_binary()
+                out = pkgpath.with_name(f"{name}-{base}-{ver}.pdelta")
+                res = subprocess.run([str(arch), "delta", str(basepath), str(pkgpath), str(out)],
+                                     stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+                if res.returncode != 0:
+                    print(f"warning: no delta {name} {base} -> {ver}: {res.stderr.strip()}", file=sys.stderr)
+                    continue
+                if out.stat().st_size >= DELTA_MAX_RATIO * pkgpath.stat().st_size:
+                    out.unlink()
+                    continue
+                deltas.setdefault((name, ver), []).append((base, out))
+    return deltas
+
+
 def find_pkgs(input_dir: Path) -> Dict[str, List[Tuple[str, Path]]]:
     """
     Discover packages under input_dir.
@@ -138,7 +193,35 @@ def find_pkgs(input_dir: Path) -> Dict[str, List[Tuple[str, Path]]]:
     return pkgs
 
 
-def write_manifest(out_manifest: Path, name: str, version: str, sha256: str, pkg_url: str):
+DEPENDENCIES_RE = re.compile(r'\bdependencies\s*=\s*\{([^}]*)\}')
+
+
+def pkg_dependencies(pkgpath: Path) -> List[str]:
+    """The "name@version" entries of `dependencies` in the manifest.acl packed into pkgpath."""
+    res = subprocess.run([str(arch_binary()), "cat", str(pkgpath), "manifest.acl"],
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    m = DEPENDENCIES_RE.search(res.stdout) if res.returncode == 0 else None
+    return re.findall(r'"([^"]+)"', m.group(1)) if m else []
+
+
+DESCRIPTION_RE = re.compile(r'\bstring\s+description\s*=\s*"([^"]*)"')
+TAGS_RE = re.compile(r'\btags\s*=\s*\{([^}]*)\}')
+
+
+def pkg_search_fields(pkgpath: Path) -> Tuple[str, str]:
+    """The description and the space-separated tags of the manifest.acl packed into pkgpath."""
+    res = subprocess.run([str(arch_binary()), "cat", str(pkgpath), "manifest.acl"],
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    if res.returncode != 0:
+        return "", ""
+    m = DESCRIPTION_RE.search(res.stdout)
+    t = TAGS_RE.search(res.stdout)
+    tags = re.findall(r'"([^"\s]+)"', t.group(1)) if t else []
+    return (m.group(1) if m else ""), " ".join(tags)
+
+
+def write_manifest(out_manifest: Path, name: str, version: str, sha256: str, pkg_url: str,
+                   dependencies: Optional[List[str]] = None):
     out_manifest.parent.mkdir(parents=True, exist_ok=True)
     content = []
     content.append('Manifest {')
@@ -146,12 +229,15 @@ def write_manifest(out_manifest: Path, name: str, version: str, sha256: str, pkg
     content.append(f'    string version = "{version}";')
     content.append(f'    string sha256 = "{sha256}";')
     content.append(f'    string pkg_url = "{pkg_url}";')
+    deps = ", ".join(f'"{d}"' for d in dependencies or [])
+    content.append(f'    string[] dependencies = {{ {deps} }};' if deps else '    string[] dependencies = {};')
     content.append('    bool signed = false;')
     content.append('}')
     out_manifest.write_text("\n".join(content) + "\n", encoding="utf-8")
 
 
-def generate_index(out_dir: Path, pkgs: Dict[str, List[Tuple[str, Path]]]):
+def generate_index(out_dir: Path, pkgs: Dict[str, List[Tuple[str, Path]]],
+                   deltas: Optional[Dict[Tuple[str, str], List[Tuple[str, Path]]]] = None):
     """
     Generate index.acl where the Registry.url is fixed to:
       https://atlaslinux.github.io/pandora/index.acl
@@ -173,44 +259,148 @@ def generate_index(out_dir: Path, pkgs: Dict[str, List[Tuple[str, Path]]]):
     index_lines.append('    string cache_policy = "ttl=3600";')
     index_lines.append("")  # blank line inside Registry for readability
 
-    # For deterministic output, iterate sorted names and versions (versions sorted reverse lexicographic)
-    for name in sorted(pkgs.keys()):
-        versions = sorted([v for v, p in pkgs[name]], reverse=True)
-        index_lines.append(f'    /* {name} package */')
-        index_lines.append(f'    Package "{name}" {{')
-        versions_list = ", ".join(f'"{v}"' for v in versions)
-        index_lines.append(f'        string[] versions = {{ {versions_list} }};')
-        index_lines.append(f'        string latest = "{versions[0]}";')
-        index_lines.append('        string pkg_base_url = "";')
-        index_lines.append('')
-        # include Version sub-blocks
-        for (ver, pkgpath) in sorted(pkgs[name], key=lambda x: x[0], reverse=True):
-            sha = compute_sha256(pkgpath)
-            manifest_rel = f'pkgs/{name}/{ver}/manifest.acl'
-            manifest_url = INDEX_BASE + manifest_rel
-            pkg_url = f'{MANIFEST_PKG_BASE}/releases/download/{name}-{ver}/{pkgpath.name}'
-            index_lines.append(f'        Version "{ver}" {{')
-            index_lines.append(f'            string manifest_url = "{manifest_url}";')
-            index_lines.append(f'            string pkg_url = "{pkg_url}";')
-            index_lines.append(f'            string sha256 = "{sha}";')
-            index_lines.append('            bool deprecated = false;')
-            index_lines.append('        }')
-            index_lines.append('')
-        index_lines.append('    }')
-        index_lines.append('')  # blank after each Package
+    # For deterministic output, iterate sorted names
+    blocks = {name: render_package(name, pkgs[name], INDEX_BASE, MANIFEST_PKG_BASE, deltas or {})
+              for name in sorted(pkgs.keys())}
+    for name in sorted(blocks.keys()):
+        index_lines.extend(blocks[name])
 
     # Close Registry block
     index_lines.append("}")
 
     index_path = out_dir / "index.acl"
     index_path.write_text("\n".join(index_lines) + "\n", encoding="utf-8")
+    write_sidecar(index_path)
+    generate_shards(out_dir, blocks, INDEX_BASE)
     return index_path
 
 
+def render_package(name: str, entries: List[Tuple[str, Path]], index_base: str, manifest_pkg_base: str,
+                   deltas: Dict[Tuple[str, str], List[Tuple[str, Path]]]) -> List[str]:
+    """Lines of one Package block (versions sorted reverse lexicographic), indented for Registry."""
+    lines: List[str] = []
+    versions = sorted([v for v, p in entries], reverse=True)
+    lines.append(f'    /* {name} package */')
+    lines.append(f'    Package "{name}" {{')
+    versions_list = ", ".join(f'"{v}"' for v in versions)
+    lines.append(f'        string[] versions = {{ {versions_list} }};')
+    lines.append(f'        string latest = "{versions[0]}";')
+    # searched by `pandora search`; taken from the latest version
+    description, tags = pkg_search_fields(dict(entries)[versions[0]])
+    if description:
+        lines.append(f'        string description = "{description}";')
+    if tags:
+        lines.append(f'        string tags = "{tags}";')
+    lines.append('        string pkg_base_url = "";')
+    lines.append('')
+    # include Version sub-blocks
+    for (ver, pkgpath) in sorted(entries, key=lambda x: x[0], reverse=True):
+        sha = compute_sha256(pkgpath)
+        manifest_rel = f'pkgs/{name}/{ver}/manifest.acl'
+        manifest_url = index_base + manifest_rel
+        pkg_url = f'{manifest_pkg_base}/releases/download/{name}-{ver}/{pkgpath.name}'
+        lines.append(f'        Version "{ver}" {{')
+        lines.append(f'            string manifest_url = "{manifest_url}";')
+        lines.append(f'            string pkg_url = "{pkg_url}";')
+        lines.append(f'            string sha256 = "{sha}";')
+        lines.append('            bool deprecated = false;')
+        for base, delta in deltas.get((name, ver), []):
+            lines.append('')
+            lines.append(f'            Delta "{base}" {{')
+            lines.append(f'                string url = "{manifest_pkg_base}/releases/download/{name}-{ver}/{delta.name}";')
+            lines.append(f'                string sha256 = "{compute_sha256(delta)}";')
+            lines.append(f'                int size = {delta.stat().st_size};')
+            lines.append('            }')
+        lines.append('        }')
+        lines.append('')
+    lines.append('    }')
+    lines.append('')  # blank after each Package
+    return lines
+
+
+SHARD_PREFIX_LEN = 2
+
+def shard_prefix(name: str) -> str:
+    return name[:SHARD_PREFIX_LEN].lower()
+
+
+def read_root(root_path: Path) -> Tuple[int, Dict[str, Tuple[int, str]]]:
+    """Generation and {prefix: (seq, sha256)} of a previously written root, if any."""
+    if not root_path.exists():
+        return 0, {}
+    text = root_path.read_text(encoding="utf-8")
+    m = re.search(r'int generation = (\d+);', text)
+    generation = int(m.group(1)) if m else 0
+    shards = {}
+    for m in re.finditer(r'Shard "([^"]+)" \{\s*int seq = (\d+);\s*string sha256 = "([0-9a-f]{64})";', text):
+        shards[m.group(1)] = (int(m.group(2)), m.group(3))
+    return generation, shards
+
+
+def generate_shards(out_dir: Path, blocks: Dict[str, List[str]], index_base: str) -> Path:
+    """
+    Write docs/index/shards/<prefix>.acl (a Registry holding the packages whose
+    name starts with prefix) and docs/index/root.acl. Sequence numbers carry over
+    from the previous root so unchanged shards keep theirs.
+    """
+    index_dir = out_dir / "index"
+    shard_dir = index_dir / "shards"
+    shard_dir.mkdir(parents=True, exist_ok=True)
+    root_path = index_dir / "root.acl"
+    old_generation, old_shards = read_root(root_path)
+
+    by_prefix: Dict[str, List[str]] = {}
+    for name in sorted(blocks.keys()):
+        by_prefix.setdefault(shard_prefix(name), []).extend(blocks[name])
+
+    shas: Dict[str, str] = {}
+    for prefix, lines in sorted(by_prefix.items()):
+        shard_path = shard_dir / f"{prefix}.acl"
+        shard_path.write_text("Registry {\n" + "\n".join(lines) + "\n}\n", encoding="utf-8")
+        shas[prefix] = compute_sha256(shard_path)
+    for stale in shard_dir.glob("*.acl"):
+        if stale.stem not in by_prefix:
+            stale.unlink()
+
+    changed = set(shas) != set(old_shards) or any(old_shards[p][1] != shas[p] for p in shas)
+    generation = old_generation + 1 if changed else old_generation
+
+    root_lines: List[str] = []
+    root_lines.append("Registry {")
+    root_lines.append(f'    string url = "{index_base}index/root.acl";')
+    root_lines.append('    string cache_policy = "ttl=3600";')
+    root_lines.append(f"    int generation = {generation};")
+    root_lines.append("")
+    for prefix in sorted(shas.keys()):
+        old = old_shards.get(prefix)
+        seq = old[0] if old and old[1] == shas[prefix] else generation
+        root_lines.append(f'    Shard "{prefix}" {{')
+        root_lines.append(f"        int seq = {seq};")
+        root_lines.append(f'        string sha256 = "{shas[prefix]}";')
+        root_lines.append(f'        string url = "shards/{prefix}.acl";')
+        root_lines.append("    }")
+        root_lines.append("")
+    root_lines.append("}")
+    root_path.write_text("\n".join(root_lines) + "\n", encoding="utf-8")
+    return root_path
+
+
+def write_sidecar(path: Path) -> Path:
+    """
+    Write <path>.sha256 ("<hex>  <name>"). Static hosting can't answer conditional
+    requests, so clients fetch this sidecar to decide whether their cached copy is current.
+    """
+    sidecar = path.with_name(path.name + ".sha256")
+    sidecar.write_text(f"{compute_sha256(path)}  {path.name}\n", encoding="utf-8")
+    return sidecar
+
+
 def main(argv):
     ap = argparse.ArgumentParser(description="Generate index.acl and manifests from pkgs workspace")
     ap.add_argument("--input", "-i", required=True, help="pkgs input dir")
     ap.add_argument("--out", "-o", required=True, help="docs output dir")
+    ap.add_argument("--deltas", type=int, default=3, metavar="N",
+                    help="publish binary deltas from the N previous versions of each package (0 disables)")
     args = ap.parse_args(argv)
 
     input_dir = Path(args.input)
@@ -234,10 +424,10 @@ def main(argv):
             sha = compute_sha256(pkgpath)
             manifest_path = out_dir / "pkgs" / name / ver / "manifest.acl"
             pkg_url = f'{MANIFEST_PKG_BASE}/releases/download/{name}-{ver}/{pkgpath.name}'
-            write_manifest(manifest_path, name, ver, sha, pkg_url)
+            write_manifest(manifest_path, name, ver, sha, pkg_url, pkg_dependencies(pkgpath))
 
     # Generate index.acl with Package blocks inside Registry
-    index_path = generate_index(out_dir, pkgs)
+    index_path = generate_index(out_dir, pkgs, make_deltas(pkgs, args.deltas))
     print("Wrote index:", index_path)
     for p in sorted(out_dir.rglob("*")):
         if p.is_file():
@@ -4,11 +4,30 @@
 
 error_t cli_help(void) {
     fprintf(stderr, 
-        "usage: pandora <command>\n"
+        "usage: pandora [--quiet] [--timings] [--trace <file>] <command>\n"
+        "\n"
+        "Options:\n"
+        "\t-q, --quiet\t" "Drops per-file progress lines\n"
+        "\t--timings\t" "Prints time, bytes and files spent in each phase to stderr on exit\n"
+        "\t--trace <file>\t" "Writes each timed step to file in Chrome trace format\n"
         "\n"
         "Commands:\n"
         "\tinit\t" "Initialises pandora\n"
         "\thelp\t" "Displays this message then quits\n"
+        "\tupdate\t" "Revalidates the registry index now instead of waiting for its ttl\n"
+        "\tfetch <name> <version>\t" "Downloads and verifies a package blob\n"
+        "\tinstall <name>@<version>...\t" "Fetches, verifies and unpacks packages and their dependencies into the store in parallel\n"
+        "\trestore [profile]\t" "Installs everything pinned in manifests/<profile>.lock, completing it with dependencies first\n"
+        "\tactivate [profile]\t" "Links the profile's bin/ and lib/ into $HOME/pandora/vir in one atomic swap\n"
+        "\tinfo <name>[@<version>]\t" "Shows a package's index entry\n"
+        "\tsearch <query>\t" "Lists packages whose name, tags or description contain query\n"
+        "\tlist [--installed] [profile]\t" "Lists the packages the profile was last activated with\n"
+        "\tprune\t" "Deletes shared file objects no installed version uses any more\n"
+        "\tverify [--full] <name>@<version>\t" "Re-hashes a version's cached blob and store files\n"
+        "\tverify [--full] --all\t" "Re-hashes every object and cached blob on all cores; --full ignores the verify cache\n"
+        "\n"
+        "Parallelism is set by Pandora.Install.jobs in $HOME/conf/pandora.conf (default 4);\n"
+        "Pandora.Install.keep_blobs = false unpacks packages as they download instead of caching them.\n"
     );
     exit(0);
 }
\ No newline at end of file
@@ -6,8 +6,21 @@
 #include "util/err.h"
 #include "cli/cli.h"
 #include "net/download.h"
+#include "core/install.h"
+#include "core/activate.h"
+#include "core/store.h"
+#include "core/verify.h"
+#include "util/trace.h"
 
-int main(int argc, char** argv) {
+/* One runtime context per process, opened by the first command that needs it */
+static fetch_env g_env;
+
+static fetch_env *session(int flags) {
+    if (!g_env.conf && fetch_env_open(&g_env, flags) != ERR_OK) exit(1);
+    return &g_env;
+}
+
+static int run(int argc, char** argv) {
     if (argc < 2) {
         fprintf(stderr, "Missing arguments");
         exit(1);
@@ -21,6 +34,71 @@ int main(int argc, char** argv) {
             fprintf(stderr, "Missing arguments");
             exit(1);
         }
-        return (int)fetch_package(argv[2], argv[3]);
+        return (int)fetch_package(session(0), argv[2], argv[3]);
+    } else if (strcmp(argv[1], "update") == 0) {
+        return (int)fetch_update_index(session(FETCH_REFRESH_INDEX));
+    } else if (strcmp(argv[1], "install") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Missing arguments");
+            exit(1);
+        }
+        return (int)install_packages(session(0), (const char *const *)argv + 2, (size_t)(argc - 2));
+    } else if (strcmp(argv[1], "restore") == 0) {
+        return (int)install_restore(session(0), argc >= 3 ? argv[2] : "default");
+    } else if (strcmp(argv[1], "info") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Missing arguments");
+            exit(1);
+        }
+        return (int)cli_info(session(0), argv[2]);
+    } else if (strcmp(argv[1], "search") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Missing arguments");
+            exit(1);
+        }
+        return (int)cli_search(session(0), argv[2]);
+    } else if (strcmp(argv[1], "activate") == 0) {
+        return (int)activate_profile(session(0), argc >= 3 ? argv[2] : "default");
+    } else if (strcmp(argv[1], "list") == 0) {
+        /* --installed (the default) is the only listing so far */
+        int arg = argc >= 3 && strcmp(argv[2], "--installed") == 0 ? 3 : 2;
+        return (int)profile_list(argc > arg ? argv[arg] : "default");
+    } else if (strcmp(argv[1], "prune") == 0) {
+        return (int)store_prune();
+    } else if (strcmp(argv[1], "verify") == 0) {
+        int flags = 0, all = 0;
+        const char *spec = NULL;
+        for (int i = 2; i < argc; ++i) {
+            if (strcmp(argv[i], "--all") == 0) all = 1;
+            else if (strcmp(argv[i], "--full") == 0) flags |= VERIFY_FULL;
+            else spec = argv[i];
+        }
+        if (all == !!spec) {
+            fprintf(stderr, "usage: pandora verify [--full] (--all | <name>@<version>)\n");
+            exit(1);
+        }
+        return (int)(all ? verify_all(flags) : verify_package(spec, flags));
+    }
+    fprintf(stderr, "unknown command '%s'; see 'pandora help'\n", argv[1]);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    /* global options come before the command */
+    int flags = 0;
+    const char *trace_path = NULL;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "--timings") == 0) flags |= TRACE_TIMINGS;
+        else if (strcmp(argv[i], "--quiet") == 0 || strcmp(argv[i], "-q") == 0) flags |= TRACE_QUIET;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) trace_path = argv[++i];
+        else break;
     }
-}
\ No newline at end of file
+    argv[i - 1] = argv[0];
+    trace_open(flags, trace_path);
+    /* commands may exit() on bad arguments; the summary still gets printed */
+    atexit(trace_close);
+    int rc = run(argc - (i - 1), argv + (i - 1));
+    fetch_env_close(&g_env);
+    return rc;
+}
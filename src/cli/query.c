@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cli/cli.h"
+#include "core/arch.h"
+#include "core/cindex.h"
+#include "core/lock.h"
+#include "net/download.h"
+
+/* one search hit: name, latest version and description */
+static void print_match(void *arg, const cindex_package *pkg) {
+    (void)arg;
+    printf("%s\t%s", pkg->name, *pkg->latest ? pkg->latest : "-");
+    if (*pkg->description) printf("\t%s", pkg->description);
+    putchar('\n');
+}
+
+static void print_entry(const cindex *ci, const cindex_entry *e) {
+    printf("%s@%s%s\n", e->name, e->version, e->deprecated ? " (deprecated)" : "");
+    printf("\tmanifest_url\t%s\n", e->manifest_url);
+    if (*e->pkg_url) printf("\tpkg_url\t%s\n", e->pkg_url);
+    if (*e->sha256) printf("\tsha256\t%s\n", e->sha256);
+    for (uint32_t i = 0; i < e->ndeltas; ++i) {
+        cindex_delta d;
+        if (cindex_delta_at(ci, e, i, &d) == 0)
+            printf("\tdelta\tfrom %s (%llu bytes)\n", d.base_version, (unsigned long long)d.size);
+    }
+}
+
+/* If the blob is already cached, show what it holds. Only the entry table and
+   manifest.acl are read, however large the package is. */
+static void print_cached_package(const char *home, const char *name, const char *version) {
+    char pkg_path[512];
+    if (snprintf(pkg_path, sizeof(pkg_path), "%s/pandora/pkgs/%s-%s.pkg", home, name, version) >= (int)sizeof(pkg_path)
+     || access(pkg_path, R_OK) != 0) return;
+    arch_reader *r = arch_open(pkg_path);
+    if (!r) return;
+
+    printf("\tfiles\t%zu\n", arch_count(r));
+    arch_entry e;
+    char *manifest = arch_find(r, "manifest.acl", &e) == 0 && !e.symlink ? arch_read(r, &e, NULL) : NULL;
+    if (manifest) {
+        printf("\tmanifest.acl\n");
+        for (char *line = strtok(manifest, "\n"); line; line = strtok(NULL, "\n")) printf("\t\t%s\n", line);
+        free(manifest);
+    }
+    arch_close(r);
+}
+
+error_t cli_info(fetch_env *env, const char *spec) {
+    const cindex *index = fetch_env_index(env);
+    if (!index) return ERR_FAILED;
+
+    error_t rc = ERR_OK;
+    if (strchr(spec, '@')) {
+        char *name = NULL, *version = NULL;
+        cindex_entry e;
+        if (pkg_spec_parse(spec, &name, &version) != 0) {
+            fprintf(stderr, "invalid package spec '%s' (want name@version)\n", spec);
+            rc = ERR_FAILED;
+        } else if (cindex_find(index, name, version, &e) != 0) {
+            fprintf(stderr, "%s@%s not found in index\n", name, version);
+            rc = ERR_FAILED;
+        } else {
+            print_entry(index, &e);
+            print_cached_package(env->home, name, version);
+        }
+        free(name);
+        free(version);
+    } else {
+        cindex_package pkg;
+        if (cindex_find_package(index, spec, &pkg) != 0) {
+            fprintf(stderr, "%s not found in index\n", spec);
+            rc = ERR_FAILED;
+        } else {
+            printf("%s\n", pkg.name);
+            if (*pkg.latest) printf("\tlatest\t%s\n", pkg.latest);
+            if (*pkg.description) printf("\tdescription\t%s\n", pkg.description);
+            if (*pkg.tags) printf("\ttags\t%s\n", pkg.tags);
+            for (uint32_t i = 0; i < pkg.count; ++i) {
+                cindex_entry e;
+                if (cindex_version(index, &pkg, i, &e) == 0)
+                    printf("\tversion\t%s%s\n", e.version, e.deprecated ? " (deprecated)" : "");
+            }
+        }
+    }
+    return rc;
+}
+
+error_t cli_search(fetch_env *env, const char *query) {
+    const cindex *index = fetch_env_index(env);
+    if (!index) return ERR_FAILED;
+
+    size_t hits = cindex_search(index, query, print_match, NULL);
+    if (!hits) {
+        fprintf(stderr, "no packages match '%s'\n", query);
+        return ERR_FAILED;
+    }
+    return ERR_OK;
+}
@@ -0,0 +1,781 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "core/acl_arena.h"
+#include "core/acl.h"
+
+/* field value kinds, kept beside the fields since AclField has no slot for them */
+enum {
+    VAL_NONE,
+    VAL_STRING,
+    VAL_INT,
+    VAL_FLOAT,
+    VAL_BOOL,
+    VAL_IDENT,
+    VAL_ARRAY,
+};
+
+#define NIL UINT32_MAX
+
+/* deepest block nesting accepted; the files read here need a handful of
+   levels, and parse_items recurses once per level */
+#define ACL_MAX_DEPTH 64
+
+/* While parsing, nodes link by index and strings by offset, so the arrays can
+   grow freely; finish() lays everything out in one block and turns the
+   indices into pointers. */
+struct pblock {
+    uint32_t name, label;
+    uint32_t fields, children, next;
+    uint32_t parent;
+};
+
+struct pfield {
+    uint32_t name, value;
+    uint32_t next;
+    uint32_t count;         /* array elements */
+    uint32_t elems;         /* first of them in the element table */
+    uint8_t kind;
+};
+
+/* An array element in the string buffer. Its length is kept rather than
+   found with strlen, since a string may hold an escaped \0. */
+struct elem {
+    uint32_t off, len;
+};
+
+struct field_meta {
+    uint32_t count;
+    uint32_t elems;
+    uint8_t kind;
+};
+
+struct acl_arena {
+    AclBlock *root;
+    AclBlock *blocks;
+    AclField *fields;
+    struct field_meta *meta;
+    uint32_t *parent;       /* per block, NIL at top level */
+    uint32_t *labels;       /* child-by-label index: block + 1 per slot, 0 if free */
+    uint32_t nlabels;       /* power of two */
+    struct elem *elems;     /* array elements, offsets into strings */
+    const char *strings;
+    size_t nblocks, nfields;
+    /* blocks, fields, meta, parent, labels, elems and the strings follow in the same allocation */
+};
+
+struct parser {
+    const char *p, *end;
+    int line;
+    struct pblock *blocks;
+    size_t nblocks, cap_blocks;
+    struct pfield *fields;
+    size_t nfields, cap_fields;
+    struct elem *elems;
+    size_t nelems, cap_elems;
+    char *str;
+    size_t str_len, str_cap;
+    int err;
+};
+
+static void perr(struct parser *ps, const char *msg) {
+    if (!ps->err) fprintf(stderr, "acl: line %d: %s\n", ps->line, msg);
+    ps->err = 1;
+}
+
+static int grow(void **buf, size_t *cap, size_t need, size_t elem) {
+    if (need <= *cap) return 0;
+    size_t cap2 = *cap ? *cap : 64;
+    while (cap2 < need) cap2 *= 2;
+    void *nb = realloc(*buf, cap2 * elem);
+    if (!nb) return -1;
+    *buf = nb;
+    *cap = cap2;
+    return 0;
+}
+
+/* Append len bytes plus a NUL; returns the offset. */
+static uint32_t intern(struct parser *ps, const char *s, size_t len) {
+    if (ps->str_len + len + 1 > UINT32_MAX
+     || grow((void**)&ps->str, &ps->str_cap, ps->str_len + len + 1, 1) != 0) {
+        perr(ps, "out of memory");
+        return 0;
+    }
+    uint32_t off = (uint32_t)ps->str_len;
+    memcpy(ps->str + off, s, len);
+    ps->str[off + len] = '\0';
+    ps->str_len += len + 1;
+    return off;
+}
+
+static void skip_ws(struct parser *ps) {
+    while (ps->p < ps->end) {
+        char c = *ps->p;
+        if (c == '\n') {
+            ps->line++;
+            ps->p++;
+        } else if (isspace((unsigned char)c)) {
+            ps->p++;
+        } else if (c == '/' && ps->p + 1 < ps->end && ps->p[1] == '*') {
+            ps->p += 2;
+            while (ps->p + 1 < ps->end && !(ps->p[0] == '*' && ps->p[1] == '/')) {
+                if (*ps->p == '\n') ps->line++;
+                ps->p++;
+            }
+            ps->p = ps->p + 1 < ps->end ? ps->p + 2 : ps->end;
+        } else if (c == '/' && ps->p + 1 < ps->end && ps->p[1] == '/') {
+            while (ps->p < ps->end && *ps->p != '\n') ps->p++;
+        } else {
+            break;
+        }
+    }
+}
+
+/* identifier, allowing a trailing "[]" for array type names */
+static int read_ident(struct parser *ps, const char **s, size_t *len) {
+    const char *start = ps->p;
+    if (ps->p >= ps->end || !(isalpha((unsigned char)*ps->p) || *ps->p == '_')) return -1;
+    while (ps->p < ps->end && (isalnum((unsigned char)*ps->p) || *ps->p == '_' || *ps->p == '-')) ps->p++;
+    if (ps->p + 1 < ps->end && ps->p[0] == '[' && ps->p[1] == ']') ps->p += 2;
+    *s = start;
+    *len = (size_t)(ps->p - start);
+    return 0;
+}
+
+/* quoted string with C-style escapes, interned unescaped */
+static uint32_t read_string(struct parser *ps) {
+    ps->p++; /* opening quote */
+    if (ps->str_len >= UINT32_MAX / 2) {
+        perr(ps, "input too large");
+        return 0;
+    }
+    uint32_t off = (uint32_t)ps->str_len;
+    while (ps->p < ps->end && *ps->p != '"') {
+        char c = *ps->p++;
+        if (c == '\\' && ps->p < ps->end) {
+            c = *ps->p++;
+            if (c == 'n') c = '\n';
+            else if (c == 't') c = '\t';
+            else if (c == 'r') c = '\r';
+            else if (c == '0') c = '\0';
+        } else if (c == '\n') {
+            ps->line++;
+        }
+        if (grow((void**)&ps->str, &ps->str_cap, ps->str_len + 2, 1) != 0) {
+            perr(ps, "out of memory");
+            return 0;
+        }
+        ps->str[ps->str_len++] = c;
+    }
+    if (ps->p >= ps->end) {
+        perr(ps, "unterminated string");
+        return 0;
+    }
+    ps->p++;
+    if (grow((void**)&ps->str, &ps->str_cap, ps->str_len + 1, 1) != 0) {
+        perr(ps, "out of memory");
+        return 0;
+    }
+    ps->str[ps->str_len++] = '\0';
+    return off;
+}
+
+static uint8_t literal_kind(const char *s, size_t len) {
+    if ((len == 4 && memcmp(s, "true", 4) == 0) || (len == 5 && memcmp(s, "false", 5) == 0)) return VAL_BOOL;
+    size_t i = (len && (*s == '-' || *s == '+')) ? 1 : 0;
+    int digits = 0, dot = 0;
+    for (; i < len; ++i) {
+        if (isdigit((unsigned char)s[i])) digits = 1;
+        else if (s[i] == '.' || s[i] == 'e' || s[i] == 'E') dot = 1;
+        else return VAL_IDENT;
+    }
+    if (!digits) return VAL_IDENT;
+    return dot ? VAL_FLOAT : VAL_INT;
+}
+
+/* one scalar: a string or a bare token up to , ; or } */
+static uint32_t read_scalar(struct parser *ps, uint8_t *kind) {
+    if (ps->p < ps->end && *ps->p == '"') {
+        *kind = VAL_STRING;
+        return read_string(ps);
+    }
+    const char *s = ps->p;
+    while (ps->p < ps->end && *ps->p != ';' && *ps->p != ',' && *ps->p != '}' && *ps->p != '\n') ps->p++;
+    size_t len = (size_t)(ps->p - s);
+    while (len && isspace((unsigned char)s[len - 1])) len--;
+    if (!len) {
+        perr(ps, "missing value");
+        return 0;
+    }
+    *kind = literal_kind(s, len);
+    return intern(ps, s, len);
+}
+
+static void parse_value(struct parser *ps, struct pfield *f) {
+    if (ps->p < ps->end && *ps->p == '{') {
+        /* elements are interned back to back and listed in the element
+           table; value is the first */
+        ps->p++;
+        f->kind = VAL_ARRAY;
+        f->value = NIL;
+        f->elems = (uint32_t)ps->nelems;
+        for (;;) {
+            skip_ws(ps);
+            if (ps->p < ps->end && *ps->p == '}') { ps->p++; break; }
+            uint8_t kind;
+            uint32_t off = read_scalar(ps, &kind);
+            if (ps->err) return;
+            if (ps->nelems >= UINT32_MAX || grow((void**)&ps->elems, &ps->cap_elems, ps->nelems + 1, sizeof(*ps->elems)) != 0) {
+                perr(ps, "out of memory");
+                return;
+            }
+            /* either reader ends the element with its NUL */
+            ps->elems[ps->nelems++] = (struct elem){ off, (uint32_t)(ps->str_len - off - 1) };
+            if (f->value == NIL) f->value = off;
+            f->count++;
+            skip_ws(ps);
+            if (ps->p < ps->end && *ps->p == ',') ps->p++;
+            else if (ps->p < ps->end && *ps->p == '}') { ps->p++; break; }
+            else { perr(ps, "expected ',' or '}' in array"); return; }
+        }
+        return;
+    }
+    f->value = read_scalar(ps, &f->kind);
+}
+
+static uint32_t new_block(struct parser *ps, uint32_t parent) {
+    if (ps->nblocks >= NIL - 1 || grow((void**)&ps->blocks, &ps->cap_blocks, ps->nblocks + 1, sizeof(*ps->blocks)) != 0) {
+        perr(ps, "out of memory");
+        return NIL;
+    }
+    struct pblock *b = &ps->blocks[ps->nblocks];
+    b->name = b->label = NIL;
+    b->fields = b->children = b->next = NIL;
+    b->parent = parent;
+    return (uint32_t)ps->nblocks++;
+}
+
+static uint32_t new_field(struct parser *ps) {
+    if (ps->nfields >= NIL - 1 || grow((void**)&ps->fields, &ps->cap_fields, ps->nfields + 1, sizeof(*ps->fields)) != 0) {
+        perr(ps, "out of memory");
+        return NIL;
+    }
+    struct pfield *f = &ps->fields[ps->nfields];
+    memset(f, 0, sizeof(*f));
+    f->name = f->value = f->next = NIL;
+    return (uint32_t)ps->nfields++;
+}
+
+/* Parse block bodies and fields until '}' (nested) or end of input (top level).
+   owner is the enclosing block, NIL at top level, and depth its nesting
+   (0 at top level); returns the first block. */
+static uint32_t parse_items(struct parser *ps, uint32_t owner, int depth) {
+    int nested = depth > 0;
+    uint32_t first_block = NIL, last_block = NIL, last_field = NIL;
+    for (;;) {
+        skip_ws(ps);
+        if (ps->err) return first_block;
+        if (ps->p >= ps->end) {
+            if (nested) perr(ps, "unexpected end of input, missing '}'");
+            return first_block;
+        }
+        if (*ps->p == '}') {
+            if (!nested) perr(ps, "unexpected '}'");
+            else ps->p++;
+            return first_block;
+        }
+
+        const char *word;
+        size_t word_len;
+        if (read_ident(ps, &word, &word_len) != 0) {
+            perr(ps, "expected a block or field name");
+            return first_block;
+        }
+        skip_ws(ps);
+
+        if (ps->p < ps->end && (*ps->p == '"' || *ps->p == '{')) {
+            if (depth >= ACL_MAX_DEPTH) {
+                perr(ps, "blocks nested too deeply");
+                return first_block;
+            }
+            uint32_t bi = new_block(ps, owner);
+            if (bi == NIL) return first_block;
+            uint32_t name = intern(ps, word, word_len);
+            uint32_t label = NIL;
+            if (*ps->p == '"') {
+                label = read_string(ps);
+                skip_ws(ps);
+                if (ps->p >= ps->end || *ps->p != '{') {
+                    perr(ps, "expected '{' after block label");
+                    return first_block;
+                }
+            }
+            ps->p++;
+            ps->blocks[bi].name = name;
+            ps->blocks[bi].label = label;
+            uint32_t children = parse_items(ps, bi, depth + 1);
+            ps->blocks[bi].children = children;
+            if (last_block == NIL) first_block = bi;
+            else ps->blocks[last_block].next = bi;
+            last_block = bi;
+            skip_ws(ps);
+            if (ps->p < ps->end && *ps->p == ';') ps->p++;
+            continue;
+        }
+
+        /* field: "[type] name = value;" */
+        const char *name = word;
+        size_t name_len = word_len;
+        const char *type = NULL;
+        size_t type_len = 0;
+        if (ps->p < ps->end && *ps->p != '=') {
+            type = word;
+            type_len = word_len;
+            if (read_ident(ps, &name, &name_len) != 0) {
+                perr(ps, "expected a field name");
+                return first_block;
+            }
+            skip_ws(ps);
+        }
+        if (ps->p >= ps->end || *ps->p != '=') {
+            perr(ps, "expected '='");
+            return first_block;
+        }
+        if (owner == NIL) {
+            perr(ps, "field outside of a block");
+            return first_block;
+        }
+        ps->p++;
+        skip_ws(ps);
+
+        uint32_t fi = new_field(ps);
+        if (fi == NIL) return first_block;
+        uint32_t name_off = intern(ps, name, name_len);
+        struct pfield tmp = ps->fields[fi];
+        tmp.name = name_off;
+        parse_value(ps, &tmp);
+        if (ps->err) return first_block;
+        /* a declared scalar type wins over what the literal looks like */
+        if (type && tmp.kind != VAL_ARRAY) {
+            if (type_len == 6 && memcmp(type, "string", 6) == 0) tmp.kind = VAL_STRING;
+            else if (type_len == 3 && memcmp(type, "int", 3) == 0) tmp.kind = VAL_INT;
+            else if (type_len == 5 && memcmp(type, "float", 5) == 0) tmp.kind = VAL_FLOAT;
+            else if (type_len == 4 && memcmp(type, "bool", 4) == 0) tmp.kind = VAL_BOOL;
+        }
+        ps->fields[fi] = tmp;
+        if (last_field == NIL) ps->blocks[owner].fields = fi;
+        else ps->fields[last_field].next = fi;
+        last_field = fi;
+
+        skip_ws(ps);
+        if (ps->p >= ps->end || *ps->p != ';') {
+            perr(ps, "expected ';' after field value");
+            return first_block;
+        }
+        ps->p++;
+    }
+}
+
+/* FNV-1a over parent, name and label */
+static uint32_t label_hash(uint32_t parent, const char *name, size_t name_len, const char *label, size_t label_len) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 4; ++i) h = (h ^ ((parent >> (i * 8)) & 0xff)) * 16777619u;
+    for (size_t i = 0; i < name_len; ++i) h = (h ^ (uint8_t)name[i]) * 16777619u;
+    h = (h ^ 0) * 16777619u;
+    for (size_t i = 0; i < label_len; ++i) h = (h ^ (uint8_t)label[i]) * 16777619u;
+    return h;
+}
+
+static acl_arena *finish(struct parser *ps, uint32_t first) {
+    size_t blocks_sz = ps->nblocks * sizeof(AclBlock);
+    size_t fields_sz = ps->nfields * sizeof(AclField);
+    size_t meta_sz = ps->nfields * sizeof(struct field_meta);
+    size_t parent_sz = ps->nblocks * sizeof(uint32_t);
+    size_t nlabeled = 0;
+    for (size_t i = 0; i < ps->nblocks; ++i) nlabeled += ps->blocks[i].label != NIL;
+    uint32_t nlabels = 8;
+    while (nlabels < nlabeled * 2) nlabels <<= 1;
+    size_t labels_sz = nlabels * sizeof(uint32_t);
+    size_t elems_sz = ps->nelems * sizeof(struct elem);
+    size_t head = sizeof(acl_arena);
+    acl_arena *a = malloc(head + blocks_sz + fields_sz + meta_sz + parent_sz + labels_sz + elems_sz + ps->str_len);
+    if (!a) return NULL;
+    a->blocks = (AclBlock*)(void*)((char*)a + head);
+    a->fields = (AclField*)(void*)((char*)a->blocks + blocks_sz);
+    a->meta = (struct field_meta*)(void*)((char*)a->fields + fields_sz);
+    a->parent = (uint32_t*)(void*)((char*)a->meta + meta_sz);
+    a->labels = (uint32_t*)(void*)((char*)a->parent + parent_sz);
+    a->nlabels = nlabels;
+    a->elems = (struct elem*)(void*)((char*)a->labels + labels_sz);
+    if (elems_sz) memcpy(a->elems, ps->elems, elems_sz);
+    char *strings = (char*)a->elems + elems_sz;
+    memcpy(strings, ps->str, ps->str_len);
+    a->strings = strings;
+    memset(a->labels, 0, labels_sz);
+    a->nblocks = ps->nblocks;
+    a->nfields = ps->nfields;
+
+#define BPTR(i) ((i) == NIL ? NULL : &a->blocks[i])
+#define FPTR(i) ((i) == NIL ? NULL : &a->fields[i])
+#define SPTR(o) ((o) == NIL ? NULL : strings + (o))
+    for (size_t i = 0; i < ps->nblocks; ++i) {
+        const struct pblock *pb = &ps->blocks[i];
+        a->blocks[i].name = SPTR(pb->name);
+        a->blocks[i].label = SPTR(pb->label);
+        a->blocks[i].fields = FPTR(pb->fields);
+        a->blocks[i].children = BPTR(pb->children);
+        a->blocks[i].next = BPTR(pb->next);
+        a->parent[i] = pb->parent;
+    }
+    /* Blocks are numbered in document order, so inserting in index order
+       keeps the first of any duplicate siblings, as a linear scan would. */
+    for (size_t i = 0; i < ps->nblocks; ++i) {
+        const AclBlock *b = &a->blocks[i];
+        if (!b->label) continue;
+        uint32_t h = label_hash(a->parent[i], b->name, strlen(b->name), b->label, strlen(b->label));
+        uint32_t slot = h & (nlabels - 1);
+        int dup = 0;
+        while (a->labels[slot] && !dup) {
+            uint32_t o = a->labels[slot] - 1;
+            dup = a->parent[o] == a->parent[i] && strcmp(a->blocks[o].name, b->name) == 0
+               && strcmp(a->blocks[o].label, b->label) == 0;
+            slot = (slot + 1) & (nlabels - 1);
+        }
+        if (!dup) a->labels[slot] = (uint32_t)i + 1;
+    }
+    for (size_t i = 0; i < ps->nfields; ++i) {
+        const struct pfield *pf = &ps->fields[i];
+        a->fields[i].name = SPTR(pf->name);
+        a->fields[i].value = SPTR(pf->value);
+        a->fields[i].next = FPTR(pf->next);
+        a->meta[i].kind = pf->kind;
+        a->meta[i].count = pf->count;
+        a->meta[i].elems = pf->elems;
+    }
+#undef BPTR
+#undef FPTR
+#undef SPTR
+    a->root = &a->blocks[first];
+    return a;
+}
+
+acl_arena *acl_arena_parse_string(const char *text, size_t len) {
+    struct parser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.p = text;
+    ps.end = text + len;
+    ps.line = 1;
+
+    uint32_t first = parse_items(&ps, NIL, 0);
+    acl_arena *a = NULL;
+    if (!ps.err && first != NIL) {
+        a = finish(&ps, first);
+        if (!a) fprintf(stderr, "acl: out of memory\n");
+    } else if (!ps.err) {
+        fprintf(stderr, "acl: no blocks\n");
+    }
+    free(ps.blocks);
+    free(ps.fields);
+    free(ps.elems);
+    free(ps.str);
+    return a;
+}
+
+acl_arena *acl_arena_parse_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "acl: cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    char *buf = NULL;
+    size_t len = 0, cap = 0, r;
+    for (;;) {
+        if (grow((void**)&buf, &cap, len + 65536, 1) != 0) {
+            fclose(f);
+            free(buf);
+            return NULL;
+        }
+        r = fread(buf + len, 1, cap - len, f);
+        len += r;
+        if (r == 0) break;
+    }
+    int failed = ferror(f);
+    fclose(f);
+    acl_arena *a = failed ? NULL : acl_arena_parse_string(buf ? buf : "", len);
+    if (failed) fprintf(stderr, "acl: read error on %s\n", path);
+    else if (!a) fprintf(stderr, "acl: failed to parse %s\n", path);
+    free(buf);
+    return a;
+}
+
+void acl_arena_free(acl_arena *a) {
+    free(a);
+}
+
+AclBlock *acl_arena_root(const acl_arena *a) {
+    return a->root;
+}
+
+/* ---- path lookup ---- */
+
+enum {
+    SLOT_NONE,
+    SLOT_LABEL,     /* ["$"]: label taken from the next argument */
+    SLOT_INDEX,     /* [#]: index parsed from the next argument */
+};
+
+/* One path segment: "name", name["label"] or name[N], or a slot for either. */
+struct step {
+    const char *name;
+    size_t name_len;
+    const char *label;      /* not NUL-terminated */
+    size_t label_len;
+    long index;             /* -1 if none */
+    int slot;
+};
+
+#define ACL_MAX_STEPS 32
+
+struct acl_query {
+    size_t nsteps;
+    size_t nslots;
+    struct step steps[ACL_MAX_STEPS];
+    char path[];            /* steps point into this copy */
+};
+
+/* Split one segment off *path. Slots are only accepted when allow_slots. */
+static int next_segment(const char **path, struct step *st, int allow_slots) {
+    const char *p = *path;
+    memset(st, 0, sizeof(*st));
+    st->index = -1;
+    st->name = p;
+    while (*p && *p != '.' && *p != '[') p++;
+    st->name_len = (size_t)(p - st->name);
+    if (!st->name_len) return -1;
+    if (*p == '[') {
+        p++;
+        if (allow_slots && p[0] == '"' && p[1] == '$' && p[2] == '"') {
+            st->slot = SLOT_LABEL;
+            p += 3;
+        } else if (allow_slots && *p == '#') {
+            st->slot = SLOT_INDEX;
+            p++;
+        } else if (*p == '"') {
+            st->label = ++p;
+            while (*p && *p != '"') p++;
+            if (!*p) return -1;
+            st->label_len = (size_t)(p - st->label);
+            p++;
+        } else {
+            char *end;
+            st->index = strtol(p, &end, 10);
+            if (end == p || st->index < 0) return -1;
+            p = end;
+        }
+        if (*p != ']') return -1;
+        p++;
+    }
+    if (*p == '.') {
+        if (!p[1]) return -1;
+        p++;
+    } else if (*p) {
+        return -1;
+    }
+    *path = p;
+    return 0;
+}
+
+static int parse_steps(const char *path, struct step *steps, size_t *nsteps, size_t *nslots, int allow_slots) {
+    size_t n = 0, slots = 0;
+    while (*path) {
+        if (n == ACL_MAX_STEPS || next_segment(&path, &steps[n], allow_slots) != 0) return -1;
+        slots += steps[n].slot != SLOT_NONE;
+        n++;
+    }
+    if (!n) return -1;
+    *nsteps = n;
+    if (nslots) *nslots = slots;
+    return 0;
+}
+
+static int name_is(const char *s, const char *name, size_t len) {
+    return s && strncmp(s, name, len) == 0 && s[len] == '\0';
+}
+
+/* child of parent (NIL: top level) with the given name and label, via the label index */
+static const AclBlock *child_by_label(const acl_arena *a, uint32_t parent,
+                                      const char *name, size_t name_len, const char *label, size_t label_len) {
+    uint32_t mask = a->nlabels - 1;
+    uint32_t slot = label_hash(parent, name, name_len, label, label_len) & mask;
+    for (uint32_t probes = 0; a->labels[slot] && probes < a->nlabels; ++probes, slot = (slot + 1) & mask) {
+        uint32_t i = a->labels[slot] - 1;
+        const AclBlock *b = &a->blocks[i];
+        if (a->parent[i] == parent && name_is(b->name, name, name_len)
+         && strlen(b->label) == label_len && memcmp(b->label, label, label_len) == 0)
+            return b;
+    }
+    return NULL;
+}
+
+/* Resolve steps to a field; *elem is the array element asked for (0 otherwise). */
+static const AclField *resolve(const acl_arena *a, const struct step *steps, size_t nsteps,
+                               const char *const args[], long *elem) {
+    const AclBlock *level = a->root;
+    const AclBlock *block = NULL;
+    size_t arg = 0;
+    for (size_t s = 0; s < nsteps; ++s) {
+        struct step st = steps[s];
+        if (st.slot == SLOT_LABEL) {
+            st.label = args[arg++];
+            st.label_len = strlen(st.label);
+        } else if (st.slot == SLOT_INDEX) {
+            char *end;
+            st.index = strtol(args[arg++], &end, 10);
+            if (*end || st.index < 0) return NULL;
+        }
+
+        if (s + 1 == nsteps) {
+            /* last segment names a field of the current block */
+            if (!block || st.label) return NULL;
+            for (const AclField *f = block->fields; f; f = f->next) {
+                if (name_is(f->name, st.name, st.name_len)) {
+                    *elem = st.index < 0 ? 0 : st.index;
+                    return f;
+                }
+            }
+            return NULL;
+        }
+
+        const AclBlock *found = NULL;
+        if (st.label) {
+            found = child_by_label(a, block ? (uint32_t)(block - a->blocks) : NIL,
+                                   st.name, st.name_len, st.label, st.label_len);
+        } else {
+            long nth = 0;
+            for (const AclBlock *b = level; b; b = b->next) {
+                if (!name_is(b->name, st.name, st.name_len)) continue;
+                if (st.index >= 0 && nth++ != st.index) continue;
+                found = b;
+                break;
+            }
+        }
+        if (!found) return NULL;
+        block = found;
+        level = found->children;
+    }
+    return NULL;
+}
+
+/* value text of the resolved field (or array element) and its kind */
+static const char *field_text(const acl_arena *a, const AclField *f, long elem, uint8_t *kind) {
+    if (!f || !f->value) return NULL;
+    const struct field_meta *m = &a->meta[f - a->fields];
+    if (m->kind != VAL_ARRAY) {
+        if (elem) return NULL;
+        *kind = m->kind;
+        return f->value;
+    }
+    if ((uint32_t)elem >= m->count) return NULL;
+    const struct elem *e = &a->elems[m->elems + (uint32_t)elem];
+    *kind = literal_kind(a->strings + e->off, e->len);
+    return a->strings + e->off;
+}
+
+static int text_string(const char *v, const char **out) {
+    if (!v) return 0;
+    *out = v;
+    return 1;
+}
+
+static int text_int(const char *v, uint8_t kind, long *out) {
+    if (!v || kind != VAL_INT) return 0;
+    char *end;
+    errno = 0;
+    long n = strtol(v, &end, 0);
+    if (errno || *end) return 0;
+    *out = n;
+    return 1;
+}
+
+static int text_bool(const char *v, uint8_t kind, int *out) {
+    if (!v || kind != VAL_BOOL) return 0;
+    *out = strcmp(v, "true") == 0;
+    return 1;
+}
+
+static const char *lookup(const acl_arena *a, const char *path, uint8_t *kind) {
+    struct step steps[ACL_MAX_STEPS];
+    size_t n;
+    long elem = 0;
+    if (parse_steps(path, steps, &n, NULL, 0) != 0) return NULL;
+    /* resolve sets elem, so it must run before elem is read */
+    const AclField *f = resolve(a, steps, n, NULL, &elem);
+    return field_text(a, f, elem, kind);
+}
+
+int acl_arena_get_string(const acl_arena *a, const char *path, const char **out) {
+    uint8_t kind;
+    return text_string(lookup(a, path, &kind), out);
+}
+
+int acl_arena_get_int(const acl_arena *a, const char *path, long *out) {
+    uint8_t kind = VAL_NONE;
+    const char *v = lookup(a, path, &kind);
+    return text_int(v, kind, out);
+}
+
+int acl_arena_get_bool(const acl_arena *a, const char *path, int *out) {
+    uint8_t kind = VAL_NONE;
+    const char *v = lookup(a, path, &kind);
+    return text_bool(v, kind, out);
+}
+
+/* ---- compiled queries ---- */
+
+acl_query *acl_query_compile(const char *path) {
+    size_t len = strlen(path);
+    acl_query *q = malloc(sizeof(*q) + len + 1);
+    if (!q) return NULL;
+    memcpy(q->path, path, len + 1);
+    if (parse_steps(q->path, q->steps, &q->nsteps, &q->nslots, 1) != 0) {
+        fprintf(stderr, "acl: invalid query path '%s'\n", path);
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+void acl_query_free(acl_query *q) {
+    free(q);
+}
+
+size_t acl_query_slots(const acl_query *q) {
+    return q->nslots;
+}
+
+static const char *query_text(const acl_arena *a, const acl_query *q, const char *const args[], uint8_t *kind) {
+    long elem = 0;
+    const AclField *f = resolve(a, q->steps, q->nsteps, args, &elem);
+    return field_text(a, f, elem, kind);
+}
+
+int acl_query_string(const acl_arena *a, const acl_query *q, const char *const args[], const char **out) {
+    uint8_t kind;
+    return text_string(query_text(a, q, args, &kind), out);
+}
+
+int acl_query_int(const acl_arena *a, const acl_query *q, const char *const args[], long *out) {
+    uint8_t kind = VAL_NONE;
+    const char *v = query_text(a, q, args, &kind);
+    return text_int(v, kind, out);
+}
+
+int acl_query_bool(const acl_arena *a, const acl_query *q, const char *const args[], int *out) {
+    uint8_t kind = VAL_NONE;
+    const char *v = query_text(a, q, args, &kind);
+    return text_bool(v, kind, out);
+}
@@ -0,0 +1,412 @@
+#define _DEFAULT_SOURCE   /* syscall(), flock() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "core/activate.h"
+#include "core/lock.h"
+#include "core/resolve.h"
+#include "core/owners.h"
+#include "util/dircache.h"
+#include "util/path.h"
+#include "util/trace.h"
+
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+#define VIR_LIVE "vir"
+#define VIR_SPARE ".vir-next"
+#define VIR_OLD ".vir-old"
+#define VIR_LOCK ".vir.lock"
+#define PROFILE_MARK ".profile"   /* name of the profile a forest was built for */
+
+/* store subtrees mirrored into the forest */
+static const char *const forest_dirs[] = { "bin", "lib", NULL };
+
+struct link_want {
+    char *rel;           /* path inside the forest, e.g. "bin/foo" */
+    char *target;        /* absolute path in the store */
+    const char *owner;   /* name@version providing it */
+    size_t order;        /* lockfile position; earlier wins a conflict */
+    int present;         /* already correct in the spare tree */
+};
+
+struct forest {
+    struct link_want *v;
+    size_t n, cap;
+    size_t added, removed;
+};
+
+static int want_add(struct forest *f, const char *rel, const char *target, const char *owner, size_t order) {
+    if (f->n == f->cap) {
+        size_t cap = f->cap ? f->cap * 2 : 256;
+        struct link_want *nv = realloc(f->v, cap * sizeof(*nv));
+        if (!nv) return -1;
+        f->v = nv;
+        f->cap = cap;
+    }
+    struct link_want *w = &f->v[f->n];
+    w->rel = strdup(rel);
+    w->target = strdup(target);
+    if (!w->rel || !w->target) {
+        free(w->rel);
+        free(w->target);
+        return -1;
+    }
+    w->owner = owner;
+    w->order = order;
+    w->present = 0;
+    f->n++;
+    return 0;
+}
+
+static void forest_free(struct forest *f) {
+    for (size_t i = 0; i < f->n; ++i) {
+        free(f->v[i].rel);
+        free(f->v[i].target);
+    }
+    free(f->v);
+}
+
+/* Record every non-directory below dir_fd (forest path rel) as provided by p. Takes dir_fd. */
+static int collect_tree(int dir_fd, const char *rel, owners_pkg *p) {
+    DIR *d = fdopendir(dir_fd);
+    if (!d) {
+        close(dir_fd);
+        return -1;
+    }
+    int rc = 0;
+    struct dirent *de;
+    while (rc == 0 && (de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        char crel[PATH_MAX];
+        if (snprintf(crel, sizeof(crel), "%s/%s", rel, de->d_name) >= (int)sizeof(crel)) {
+            fprintf(stderr, "path too long under %s in %s\n", rel, p->spec);
+            rc = -1;
+            break;
+        }
+        struct stat st;
+        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            int sub = openat(dirfd(d), de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (sub >= 0) rc = collect_tree(sub, crel, p);
+        } else if (owners_add_path(p, crel) != 0) {
+            rc = -1;
+        }
+    }
+    closedir(d);
+    return rc;
+}
+
+/* Walk bin/ and lib/ of one store tree into p. */
+static int scan_package(const char *pkg_dir, owners_pkg *p) {
+    for (size_t k = 0; forest_dirs[k]; ++k) {
+        char abs[PATH_MAX];
+        if (snprintf(abs, sizeof(abs), "%s/%s", pkg_dir, forest_dirs[k]) >= (int)sizeof(abs)) continue;
+        int fd = open(abs, O_RDONLY | O_DIRECTORY);
+        if (fd < 0) continue;
+        if (collect_tree(fd, forest_dirs[k], p) != 0) {
+            fprintf(stderr, "cannot read %s\n", abs);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int want_cmp(const void *a, const void *b) {
+    const struct link_want *x = a, *y = b;
+    int c = strcmp(x->rel, y->rel);
+    if (c) return c;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static int want_key_cmp(const void *key, const void *elem) {
+    return strcmp(key, ((const struct link_want *)elem)->rel);
+}
+
+/* Sort by forest path and keep the first provider of each path. */
+static void forest_settle(struct forest *f) {
+    qsort(f->v, f->n, sizeof(*f->v), want_cmp);
+    size_t out = 0;
+    for (size_t i = 0; i < f->n; ++i) {
+        if (out && strcmp(f->v[out - 1].rel, f->v[i].rel) == 0) {
+            fprintf(stderr, "warning: %s is provided by both %s and %s; using %s\n",
+                    f->v[i].rel, f->v[out - 1].owner, f->v[i].owner, f->v[out - 1].owner);
+            free(f->v[i].rel);
+            free(f->v[i].target);
+            continue;
+        }
+        f->v[out++] = f->v[i];
+    }
+    f->n = out;
+}
+
+/* Bring an old forest in line with f: keep links that already point where
+   they should, drop everything else. rel is NULL at the forest root. Takes dir_fd. */
+static void reconcile_dir(int dir_fd, const char *rel, struct forest *f) {
+    DIR *d = fdopendir(dir_fd);
+    if (!d) {
+        close(dir_fd);
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        const char *name = de->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        char crel[PATH_MAX];
+        if (rel) {
+            if (snprintf(crel, sizeof(crel), "%s/%s", rel, name) >= (int)sizeof(crel)) continue;
+        } else {
+            if (strcmp(name, PROFILE_MARK) == 0) continue;   /* rewritten on publish */
+            int top = 0;
+            for (size_t i = 0; forest_dirs[i]; ++i) top |= strcmp(name, forest_dirs[i]) == 0;
+            if (!top) {
+                remove_tree_at(dirfd(d), name);
+                continue;
+            }
+            snprintf(crel, sizeof(crel), "%s", name);
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            int sub = openat(dirfd(d), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (sub >= 0) reconcile_dir(sub, crel, f);
+            /* drop directories left empty; they are recreated if something needs them */
+            if (rel) unlinkat(dirfd(d), name, AT_REMOVEDIR);
+            continue;
+        }
+        if (S_ISLNK(st.st_mode)) {
+            struct link_want *w = bsearch(crel, f->v, f->n, sizeof(*f->v), want_key_cmp);
+            char target[PATH_MAX];
+            ssize_t len = w ? readlinkat(dirfd(d), name, target, sizeof(target) - 1) : -1;
+            if (len >= 0) {
+                target[len] = '\0';
+                if (strcmp(target, w->target) == 0) {
+                    w->present = 1;
+                    continue;
+                }
+            }
+        }
+        if (unlinkat(dirfd(d), name, 0) == 0) f->removed++;
+    }
+    closedir(d);
+}
+
+/* Create the links the spare tree is missing. Directories already made (or
+   kept by reconcile_dir) are remembered, so each needs at most one mkdirat. */
+static int populate(int root_fd, struct forest *f) {
+    dircache *dirs = dircache_open(root_fd, ".");
+    if (!dirs) return -1;
+    int rc = 0;
+    for (size_t i = 0; i < f->n && rc == 0; ++i) {
+        struct link_want *w = &f->v[i];
+        if (w->present) continue;
+        if (dircache_mkparent(dirs, w->rel, 0755) != 0) {
+            fprintf(stderr, "cannot create parent of %s: %s\n", w->rel, strerror(errno));
+            rc = -1;
+            break;
+        }
+        if (symlinkat(w->target, root_fd, w->rel) != 0
+            && !(errno == EEXIST && unlinkat(root_fd, w->rel, 0) == 0
+                 && symlinkat(w->target, root_fd, w->rel) == 0)) {
+            fprintf(stderr, "cannot link %s: %s\n", w->rel, strerror(errno));
+            rc = -1;
+        }
+        f->added++;
+    }
+    dircache_close(dirs);
+    return rc;
+}
+
+/* Swap spare and live in one step; without RENAME_EXCHANGE (old kernels,
+   some filesystems) fall back to three renames with a short gap. */
+static int publish(int base_fd) {
+    if (syscall(SYS_renameat2, base_fd, VIR_SPARE, base_fd, VIR_LIVE, RENAME_EXCHANGE) == 0) return 0;
+    if (errno == ENOENT) return renameat(base_fd, VIR_SPARE, base_fd, VIR_LIVE);
+    if (errno != ENOSYS && errno != EINVAL) return -1;
+
+    remove_tree_at(base_fd, VIR_OLD);
+    if (renameat(base_fd, VIR_LIVE, base_fd, VIR_OLD) != 0) return -1;
+    if (renameat(base_fd, VIR_SPARE, base_fd, VIR_LIVE) != 0) {
+        renameat(base_fd, VIR_OLD, base_fd, VIR_LIVE);
+        return -1;
+    }
+    return renameat(base_fd, VIR_OLD, base_fd, VIR_SPARE);
+}
+
+error_t activate_profile(fetch_env *env, const char *profile) {
+    const char *home = env->home;
+    char base[512], lock_path[512];
+    if (snprintf(base, sizeof(base), "%s/pandora", home) >= (int)sizeof(base)
+     || snprintf(lock_path, sizeof(lock_path), "%s/manifests/%s.lock", base, profile) >= (int)sizeof(lock_path)) {
+        fprintf(stderr, "profile path too long\n");
+        return ERR_FAILED;
+    }
+
+    /* a lockfile that already pins its closure is taken as is; otherwise its
+       dependencies are resolved, and without a registry it is linked as written */
+    lock_entry *entries = NULL;
+    size_t count = 0;
+    if (resolve_profile(env, profile, &entries, &count) != ERR_OK) {
+        if (lock_read(lock_path, &entries, &count) != 0) {
+            fprintf(stderr, "Failed to read lockfile %s\n", lock_path);
+            return ERR_FAILED;
+        }
+        fprintf(stderr, "warning: dependencies of profile %s not resolved; activating its lockfile as written\n", profile);
+    }
+
+    uint64_t t0 = trace_now();
+
+    /* packages the profile had last time come from its owners file; only
+       new ones are walked in the store */
+    char owners_file[PATH_MAX], profile_dir[PATH_MAX];
+    owners old, cur = {0};
+    struct forest f = {0};
+    size_t scanned = 0;
+    error_t rc = ERR_OK;
+    if (owners_path(home, profile, owners_file, sizeof(owners_file)) != 0
+     || snprintf(profile_dir, sizeof(profile_dir), "%s/profiles/%s", base, profile) >= (int)sizeof(profile_dir)) {
+        fprintf(stderr, "profile path too long\n");
+        lock_free(entries, count);
+        return ERR_FAILED;
+    }
+    if (owners_load(owners_file, &old) != 0) {
+        fprintf(stderr, "warning: cannot read %s; rescanning every package\n", owners_file);
+        memset(&old, 0, sizeof(old));
+    }
+
+    for (size_t i = 0; i < count && rc == ERR_OK; ++i) {
+        char pkg_dir[PATH_MAX];
+        size_t slen = strlen(entries[i].name) + strlen(entries[i].version) + 2;
+        char *spec = malloc(slen);
+        owners_pkg *p = spec ? owners_add_pkg(&cur, spec) : NULL;
+        if (!p || snprintf(pkg_dir, sizeof(pkg_dir), "%s/store/%s/%s", base, entries[i].name, entries[i].version) >= (int)sizeof(pkg_dir)) {
+            if (!p) free(spec);
+            rc = ERR_FAILED;
+            break;
+        }
+        snprintf(spec, slen, "%s@%s", entries[i].name, entries[i].version);
+
+        struct stat st;
+        if (stat(pkg_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "%s is not installed; run 'pandora restore %s' first\n", spec, profile);
+            rc = ERR_FAILED;
+            break;
+        }
+        /* store versions never change, so a recorded file list stays true */
+        owners_pkg *known = owners_find(&old, spec);
+        if (known) {
+            p->paths = known->paths;
+            p->npaths = known->npaths;
+            p->cap = known->cap;
+            known->paths = NULL;
+            known->npaths = known->cap = 0;
+        } else {
+            scanned++;
+            if (scan_package(pkg_dir, p) != 0) rc = ERR_FAILED;
+        }
+        for (size_t k = 0; k < p->npaths && rc == ERR_OK; ++k) {
+            char target[PATH_MAX];
+            if (snprintf(target, sizeof(target), "%s/%s", pkg_dir, p->paths[k]) >= (int)sizeof(target)
+             || want_add(&f, p->paths[k], target, p->spec, i) != 0) rc = ERR_FAILED;
+        }
+    }
+    owners_free(&old);
+
+    int base_fd = -1, lock_fd = -1, spare_fd = -1;
+    if (rc == ERR_OK) {
+        forest_settle(&f);
+        base_fd = open(base, O_RDONLY | O_DIRECTORY);
+        lock_fd = base_fd >= 0 ? openat(base_fd, VIR_LOCK, O_RDWR | O_CREAT, 0644) : -1;
+        /* one activation at a time: the spare tree is rebuilt in place */
+        if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) {
+            fprintf(stderr, "cannot lock %s/%s: %s\n", base, VIR_LOCK, strerror(errno));
+            rc = ERR_FAILED;
+        }
+    }
+    if (rc == ERR_OK) {
+        if (mkdirat(base_fd, VIR_SPARE, 0755) != 0 && errno != EEXIST) rc = ERR_FAILED;
+        spare_fd = rc == ERR_OK ? openat(base_fd, VIR_SPARE, O_RDONLY | O_DIRECTORY | O_NOFOLLOW) : -1;
+        if (spare_fd < 0) {
+            fprintf(stderr, "cannot open %s/%s: %s\n", base, VIR_SPARE, strerror(errno));
+            rc = ERR_FAILED;
+        }
+    }
+    if (rc == ERR_OK) {
+        int walk_fd = dup(spare_fd);
+        if (walk_fd >= 0) reconcile_dir(walk_fd, NULL, &f);
+        for (size_t k = 0; forest_dirs[k]; ++k) (void)mkdirat(spare_fd, forest_dirs[k], 0755);
+        if (populate(spare_fd, &f) != 0) rc = ERR_FAILED;
+    }
+    if (rc == ERR_OK) {
+        int mark = openat(spare_fd, PROFILE_MARK, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (mark < 0 || dprintf(mark, "%s\n", profile) < 0 || close(mark) != 0) rc = ERR_FAILED;
+        if (rc == ERR_OK && publish(base_fd) != 0) {
+            fprintf(stderr, "cannot publish %s/%s: %s\n", base, VIR_LIVE, strerror(errno));
+            rc = ERR_FAILED;
+        }
+        if (rc == ERR_OK)
+            printf("activated %s: %zu links (%zu added, %zu removed; %zu of %zu packages scanned)\n",
+                   profile, f.n, f.added, f.removed, scanned, count);
+    }
+    /* the forest is live; a stale owners file would only cost a rescan */
+    if (rc == ERR_OK && (ensure_dir(profile_dir, 0755) != ERR_OK || owners_save(&cur, owners_file) != 0))
+        fprintf(stderr, "warning: cannot update %s: %s\n", owners_file, strerror(errno));
+
+    if (spare_fd >= 0) close(spare_fd);
+    if (lock_fd >= 0) close(lock_fd);   /* releases the flock */
+    if (base_fd >= 0) close(base_fd);
+    trace_span(TRACE_ACTIVATE, profile, t0, 0, rc == ERR_OK ? f.n : 0);
+    forest_free(&f);
+    owners_free(&cur);
+    lock_free(entries, count);
+    return rc;
+}
+
+error_t profile_list(const char *profile) {
+    const char *home = getenv("HOME");
+    if (!home) {
+        fprintf(stderr, "HOME not set\n");
+        return ERR_FAILED;
+    }
+    char owners_file[PATH_MAX];
+    owners o;
+    if (owners_path(home, profile, owners_file, sizeof(owners_file)) != 0 || owners_load(owners_file, &o) != 0) {
+        fprintf(stderr, "cannot read %s\n", owners_file);
+        return ERR_FAILED;
+    }
+    if (o.n == 0) fprintf(stderr, "profile %s has not been activated\n", profile);
+
+    /* a path already claimed by an earlier package is shadowed */
+    struct forest f = {0};
+    error_t rc = ERR_OK;
+    for (size_t i = 0; i < o.n && rc == ERR_OK; ++i)
+        for (size_t k = 0; k < o.pkgs[i].npaths && rc == ERR_OK; ++k)
+            if (want_add(&f, o.pkgs[i].paths[k], "", o.pkgs[i].spec, i) != 0) rc = ERR_FAILED;
+    if (rc == ERR_OK) {
+        size_t *shadowed = calloc(o.n ? o.n : 1, sizeof(*shadowed));
+        qsort(f.v, f.n, sizeof(*f.v), want_cmp);
+        for (size_t i = 1; shadowed && i < f.n; ++i)
+            if (strcmp(f.v[i - 1].rel, f.v[i].rel) == 0) shadowed[f.v[i].order]++;
+        for (size_t i = 0; i < o.n; ++i) {
+            printf("%s\t%zu files", o.pkgs[i].spec, o.pkgs[i].npaths);
+            if (shadowed && shadowed[i]) printf(" (%zu shadowed)", shadowed[i]);
+            printf("\n");
+        }
+        free(shadowed);
+    }
+    forest_free(&f);
+    owners_free(&o);
+    return rc;
+}
@@ -1,13 +1,17 @@
 /* arch - simple .pnd archive packer/unpacker
  *
  * Usage:
- *   ./arch pack archive.pnd path1 [path2 ...]
- *   ./arch unpack archive.pnd [destdir]
+ *   ./arch pack [-z[level]] [-D] [-j jobs] archive.pnd path1 [path2 ...]
+ *   ./arch unpack [-j jobs] [-O objects] archive.pnd [destdir]
+ *   ./arch list archive.pnd
+ *   ./arch cat archive.pnd path
+ *   ./arch delta base.pnd new.pnd out.pdelta
+ *   ./arch patch delta.pdelta base-dir out.pnd
  *
  * Notes:
  * - Stores regular files and symlinks.
  * - Paths inside archive are stored relative to the provided path arguments.
- * - Archive layout:
+ * - Version 1 archive layout (still read by unpack):
  *   [8 bytes magic "PNDARCH\1"]
  *   [u64 little-endian: entry_count]
  *   entries:
@@ -16,6 +20,42 @@
  *
  * Flags:
  *   0x1 = symlink (blob contains the link target bytes)
+ *
+ * Version 2 ("PNDARCH\2") adds per-entry compression and digests:
+ *   [8 bytes magic "PNDARCH\2"]
+ *   [u64 entry_count] [u32 archive_flags] [u64 dict_offset] [u64 dict_size]
+ *   entries:
+ *     [u32 path_len] [u64 file_size] [u64 stored_size] [u64 file_offset] [u32 flags]
+ *     [32 bytes sha256, if archive_flags has 0x2] [path bytes...]
+ *   followed by the dictionary (if any) and the data blobs.
+ *
+ *   archive_flags 0x1 = a zstd dictionary is stored at dict_offset
+ *                 0x2 = every entry carries the SHA-256 of its uncompressed content
+ *   entry flags   0x2 = blob is one zstd frame of stored_size bytes (with the
+ *                       dictionary when there is one); otherwise it is raw
+ * Every blob stands alone, so entries can still be extracted in parallel or
+ * one at a time. Compression (-z) needs a build with WITH_ZSTD (-lzstd).
+ *
+ * Version 3 ("PNDARCH\3", written by pack) makes the table seekable:
+ *   [8 bytes magic "PNDARCH\3"]
+ *   [u64 entry_count] [u32 archive_flags] [u64 dict_offset] [u64 dict_size] [u64 table_size]
+ *   [u64 table-relative entry offset] * entry_count, ordered by path (bytewise)
+ *   table entries exactly as in version 2, then the dictionary and blobs.
+ * A reader can map header, index and table in one go and binary-search a
+ * path without touching the blobs; see arch_open() in core/arch.h.
+ * pack writes the table in path order and the blobs in table order, so one
+ * tree always packs to the same bytes; -j only spreads the reading, hashing
+ * and compressing of the blobs over several threads.
+ *
+ * Object store (unpack -O dir): regular files are kept once per content under
+ * dir/<2 hex>/<62 hex>. An entry whose object already exists is hardlinked
+ * (or, across filesystems, cloned/copied) from it instead of being extracted;
+ * a new one is extracted, checked against its digest and linked into the
+ * store. An object whose link count has dropped to 1 is no longer used by
+ * any tree and may be deleted.
+ *
+ * Deltas (delta/patch, core/delta.h) rebuild one version's archive from the
+ * unpacked tree of another, entry by entry.
  */
 
 #define _XOPEN_SOURCE 700
@@ -35,25 +75,180 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include "core/arch.h"
+#include "core/delta.h"
+#include "core/sha256.h"
+#include "util/dircache.h"
+#include "util/uring.h"
 
 #define MAGIC "PNDARCH\1"
+#define MAGIC_V2 "PNDARCH\2"
+#define MAGIC_V3 "PNDARCH\3"
 #define MAGIC_LEN 8
 #define ENTRY_HDR_SIZE (4 + 8 + 8 + 4) /* u32 path_len, u64 size, u64 offset, u32 flags */
+#define ENTRY_HDR_SIZE_V2 (4 + 8 + 8 + 8 + 4) /* u32 path_len, u64 size, u64 stored_size, u64 offset, u32 flags */
+#define HEADER_SIZE_V2 (MAGIC_LEN + 8 + 4 + 8 + 8)
+#define HEADER_SIZE_V3 (HEADER_SIZE_V2 + 8)
+
+#define ENTRY_SYMLINK 0x1
+#define ENTRY_ZSTD 0x2
+#define ARCHIVE_DICT 0x1
+#define ARCHIVE_DIGESTS 0x2
+#define DIGEST_LEN 32
+
+#define ZSTD_DEFAULT_LEVEL 3
+#define ZSTD_MIN_ENTRY 64          /* smaller blobs are not worth a frame header */
+#define DICT_CAPACITY (112 * 1024)
+#define DICT_SAMPLE_MAX (128 * 1024)
+#define DICT_TRAIN_MAX (100 * DICT_CAPACITY)
+#define DICT_MIN_SAMPLES 8
+#define STREAM_CHUNK (128 * 1024)
 
 struct file_rec {
     char *path;        /* relative path stored in archive */
     char *src;         /* absolute source path on disk to read from */
     uint64_t size;     /* file size or symlink target len */
+    uint64_t stored;   /* bytes the blob takes in the archive (== size unless compressed) */
     uint64_t offset;   /* computed offset in archive blobs */
     uint32_t flags;    /* bit flags (0x1=symlink) */
+    uint8_t digest[DIGEST_LEN]; /* sha256 of the uncompressed content (v2 with ARCHIVE_DIGESTS) */
 };
 
+/* 1, 2 or 3 for a known archive magic, 0 otherwise */
+static int archive_version(const char magic[MAGIC_LEN]) {
+    if (memcmp(magic, MAGIC, MAGIC_LEN) == 0) return 1;
+    if (memcmp(magic, MAGIC_V2, MAGIC_LEN) == 0) return 2;
+    if (memcmp(magic, MAGIC_V3, MAGIC_LEN) == 0) return 3;
+    return 0;
+}
+
+/* offset of the first table entry: the header, plus the path index in v3 */
+static uint64_t archive_table_start(int version, uint64_t entry_count) {
+    if (version >= 3) return HEADER_SIZE_V3 + entry_count * 8;
+    return version == 2 ? HEADER_SIZE_V2 : MAGIC_LEN + 8;
+}
+
+/* Copy up to len bytes from in_fd at in_off to out_fd at out_off without
+ * bouncing them through user space when the kernel can help: copy_file_range
+ * first (it shares extents on btrfs/xfs and copies in-kernel elsewhere), then
+ * sendfile, then a buffered pread/pwrite loop. Returns the number of bytes
+ * copied, short only at EOF of the input, or -1 with errno set.
+ */
+static int64_t copy_range(int in_fd, off_t in_off, int out_fd, off_t out_off, uint64_t len) {
+    uint64_t done = 0;
+
+    while (done < len) {
+        size_t chunk = len - done > (1u << 30) ? (1u << 30) : (size_t)(len - done);
+        ssize_t n = copy_file_range(in_fd, &in_off, out_fd, &out_off, chunk, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; /* EOF, or unsupported here: fall back for the rest */
+        done += (uint64_t)n;
+    }
+    if (done == len) return (int64_t)done;
+
+    if (lseek(out_fd, out_off, SEEK_SET) == out_off) {
+        while (done < len) {
+            size_t chunk = len - done > (1u << 30) ? (1u << 30) : (size_t)(len - done);
+            ssize_t n = sendfile(out_fd, in_fd, &in_off, chunk);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += (uint64_t)n;
+            out_off += n;
+        }
+        if (done == len) return (int64_t)done;
+    }
+
+    char buf[65536];
+    while (done < len) {
+        size_t want = len - done > sizeof(buf) ? sizeof(buf) : (size_t)(len - done);
+        ssize_t r = pread(in_fd, buf, want, in_off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) break;
+        for (ssize_t w = 0; w < r; ) {
+            ssize_t n = pwrite(out_fd, buf + w, (size_t)(r - w), out_off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return -1;
+            w += n;
+            out_off += n;
+        }
+        in_off += r;
+        done += (uint64_t)r;
+    }
+    return (int64_t)done;
+}
+
+/* The whole of len bytes, or -1 with errno set (EIO for a read past EOF). */
+static int pwrite_all(int fd, const void *buf, size_t len, off_t off) {
+    const char *p = buf;
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        p += n;
+        len -= (size_t)n;
+        off += n;
+    }
+    return 0;
+}
+
+static int pread_all(int fd, void *buf, size_t len, off_t off) {
+    char *p = buf;
+    while (len) {
+        ssize_t n = pread(fd, p, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) {
+            errno = EIO;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+        off += n;
+    }
+    return 0;
+}
+
+/* sha256 of len bytes of fd starting at off; 0, or -1 like pread_all */
+static int hash_range(int fd, off_t off, uint64_t len, uint8_t digest[DIGEST_LEN]) {
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    char buf[65536];
+    while (len) {
+        size_t want = len > sizeof(buf) ? sizeof(buf) : (size_t)len;
+        ssize_t r = pread(fd, buf, want, off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) {
+            errno = EIO;
+            return -1;
+        }
+        sha256_update(&ctx, buf, (size_t)r);
+        off += r;
+        len -= (uint64_t)r;
+    }
+    sha256_final(&ctx, digest);
+    return 0;
+}
+
+#ifndef PANDORA
+/* Packing is only in the standalone arch tool; pandora itself extracts. */
 static struct file_rec *g_recs = NULL;
 static size_t g_rec_cap = 0;
 static size_t g_rec_cnt = 0;
 static size_t g_base_len = 0;
 static char *g_basepath = NULL;
 
+__attribute__((noreturn))
 static void die(const char *fmt, ...)
 {
     va_list ap;
@@ -61,6 +256,7 @@ static void die(const char *fmt, ...)
     vfprintf(stderr, fmt, ap);
     va_end(ap);
     fputc('\n', stderr);
+    exit(EXIT_FAILURE);
 }
 
 static void *xmalloc(size_t n) {
@@ -190,138 +386,372 @@ static void write_u64_le(FILE *f, uint64_t v) {
     for (int i = 0; i < 8; ++i) b[i] = (v >> (8*i)) & 0xff;
     if (fwrite(b, 1, 8, f) != 8) die("write failed");
 }
-static uint32_t read_u32_le(FILE *f) {
-    unsigned char b[4];
-    if (fread(b,1,4,f) != 4) die("unexpected EOF (u32)");
-    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+
+/* copy size bytes of the file at srcpath into the archive at offset; the
+   blob's place is fixed, so a file that changed size since it was collected
+   is an error */
+static void copy_file_to_archive(int out_fd, off_t offset, const char *srcpath, uint64_t size) {
+    int in_fd = open(srcpath, O_RDONLY);
+    if (in_fd < 0) die("open '%s': %s", srcpath, strerror(errno));
+    int64_t total = copy_range(in_fd, 0, out_fd, offset, size);
+    if (total < 0) die("copy '%s': %s", srcpath, strerror(errno));
+    struct stat st;
+    if (fstat(in_fd, &st) != 0) die("stat '%s': %s", srcpath, strerror(errno));
+    if ((uint64_t)total != size || (uint64_t)st.st_size != size)
+        die("'%s' changed size while packing", srcpath);
+    close(in_fd);
 }
-static uint64_t read_u64_le(FILE *f) {
-    unsigned char b[8];
-    if (fread(b,1,8,f) != 8) die("unexpected EOF (u64)");
-    uint64_t v = 0;
-    for (int i = 0; i < 8; ++i) v |= ((uint64_t)b[i]) << (8*i);
-    return v;
+
+#ifdef WITH_ZSTD
+/* Train a dictionary on the head of every regular file. Returns NULL (and
+   packs without one) when there is too little material to train on. */
+static void *train_dictionary(size_t *dict_len) {
+    size_t total = 0, nsamples = 0;
+    char *samples = xmalloc(DICT_TRAIN_MAX);
+    size_t *sizes = xmalloc(g_rec_cnt * sizeof(*sizes) + 1);
+    for (size_t i = 0; i < g_rec_cnt && total < DICT_TRAIN_MAX; ++i) {
+        if ((g_recs[i].flags & ENTRY_SYMLINK) || g_recs[i].size < ZSTD_MIN_ENTRY) continue;
+        int fd = open(g_recs[i].src, O_RDONLY);
+        if (fd < 0) die("open '%s': %s", g_recs[i].src, strerror(errno));
+        size_t want = g_recs[i].size < DICT_SAMPLE_MAX ? (size_t)g_recs[i].size : DICT_SAMPLE_MAX;
+        if (want > DICT_TRAIN_MAX - total) want = DICT_TRAIN_MAX - total;
+        ssize_t r = pread(fd, samples + total, want, 0);
+        close(fd);
+        if (r <= 0) continue;
+        sizes[nsamples++] = (size_t)r;
+        total += (size_t)r;
+    }
+
+    void *dict = NULL;
+    if (nsamples >= DICT_MIN_SAMPLES) {
+        dict = xmalloc(DICT_CAPACITY);
+        size_t n = ZDICT_trainFromBuffer(dict, DICT_CAPACITY, samples, sizes, (unsigned)nsamples);
+        if (ZDICT_isError(n)) {
+            fprintf(stderr, "warning: dictionary training failed (%s); packing without one\n", ZDICT_getErrorName(n));
+            free(dict);
+            dict = NULL;
+        } else {
+            *dict_len = n;
+        }
+    } else {
+        fprintf(stderr, "warning: too few files to train a dictionary; packing without one\n");
+    }
+    free(samples);
+    free(sizes);
+    return dict;
 }
 
-/* copy file contents from absolute source path to archive stream, return number of bytes copied */
-static uint64_t copy_file_to_stream(FILE *out, const char *srcpath) {
-    FILE *in = fopen(srcpath, "rb");
-    if (!in) die("fopen '%s': %s", srcpath, strerror(errno));
-    uint64_t total = 0;
+/* Compress one file into a single frame at out_off, feeding what was read
+   into hash. Returns the frame size, or 0 when the frame would not be
+   smaller than the file (store it raw). */
+static uint64_t compress_entry(ZSTD_CCtx *cctx, const struct file_rec *rec, int out_fd, off_t out_off, sha256_ctx *hash) {
+    int in_fd = open(rec->src, O_RDONLY);
+    if (in_fd < 0) die("open '%s': %s", rec->src, strerror(errno));
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+    ZSTD_CCtx_setPledgedSrcSize(cctx, rec->size);
+
+    char *ibuf = xmalloc(STREAM_CHUNK);
+    char *obuf = xmalloc(STREAM_CHUNK);
+    uint64_t consumed = 0, written = 0;
+    int finished = 0;
+    while (!finished) {
+        ssize_t r = 0;
+        if (consumed < rec->size) {
+            size_t want = rec->size - consumed > STREAM_CHUNK ? STREAM_CHUNK : (size_t)(rec->size - consumed);
+            r = pread(in_fd, ibuf, want, (off_t)consumed);
+            if (r < 0) die("read '%s': %s", rec->src, strerror(errno));
+            if (r == 0) die("'%s' changed size while packing", rec->src);
+            sha256_update(hash, ibuf, (size_t)r);
+            consumed += (uint64_t)r;
+        }
+        ZSTD_EndDirective mode = consumed == rec->size ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer in = { ibuf, (size_t)r, 0 };
+        int drained;
+        do {
+            ZSTD_outBuffer out = { obuf, STREAM_CHUNK, 0 };
+            size_t left = ZSTD_compressStream2(cctx, &out, &in, mode);
+            if (ZSTD_isError(left)) die("zstd compression of '%s' failed: %s", rec->src, ZSTD_getErrorName(left));
+            if (written + out.pos >= rec->size) {
+                written = 0;
+                goto out;
+            }
+            if (pwrite_all(out_fd, obuf, out.pos, out_off + (off_t)written) != 0)
+                die("write failed: %s", strerror(errno));
+            written += out.pos;
+            drained = mode == ZSTD_e_end ? left == 0 : in.pos == in.size;
+            finished = mode == ZSTD_e_end && left == 0;
+        } while (!drained);
+    }
+out:
+    free(ibuf);
+    free(obuf);
+    struct stat st;
+    if (fstat(in_fd, &st) != 0) die("stat '%s': %s", rec->src, strerror(errno));
+    if ((uint64_t)st.st_size != rec->size) die("'%s' changed size while packing", rec->src);
+    close(in_fd);
+    return written;
+}
+#endif
+
+/* qsort comparator: records by stored path, bytewise (then by source, so
+   two arguments that yield the same path still sort the same every run) */
+static int cmp_rec_path(const void *a, const void *b) {
+    const struct file_rec *x = a, *y = b;
+    int c = strcmp(x->path, y->path);
+    return c ? c : strcmp(x->src, y->src);
+}
+
+/* Move len bytes at src down to dst (< src) in the same file. Pieces no
+   longer than the gap never overlap and can go through copy_range; below
+   a buffer's worth each chunk is read whole before it is written, which is
+   safe moving down. */
+static void move_down(int fd, uint64_t src, uint64_t dst, uint64_t len) {
     char buf[65536];
-    size_t r;
-    while ((r = fread(buf,1,sizeof(buf), in)) > 0) {
-        if (fwrite(buf,1,r,out) != r) die("write failed");
-        total += r;
+    uint64_t gap = src - dst;
+    while (len) {
+        uint64_t n;
+        if (gap >= sizeof(buf)) {
+            n = len < gap ? len : gap;
+            if (copy_range(fd, (off_t)src, fd, (off_t)dst, n) != (int64_t)n) die("move blob failed: %s", strerror(errno));
+        } else {
+            n = len < sizeof(buf) ? len : sizeof(buf);
+            if (pread_all(fd, buf, (size_t)n, (off_t)src) != 0 || pwrite_all(fd, buf, (size_t)n, (off_t)dst) != 0)
+                die("move blob failed: %s", strerror(errno));
+        }
+        src += n;
+        dst += n;
+        len -= n;
+    }
+}
+
+/* pack -j: workers claim entries in table order and write each blob into
+   its slot, size bytes at the offset it would have uncompressed */
+struct pack_work {
+    int out_fd;
+    const uint64_t *slots;
+    size_t count;
+    size_t next;
+    int level;
+#ifdef WITH_ZSTD
+    ZSTD_CDict *cdict;
+#endif
+};
+
+static void pack_entry(struct pack_work *w, void *cctx, struct file_rec *rec, uint64_t slot) {
+    if (rec->flags & ENTRY_SYMLINK) {
+        /* symlink: read link target from absolute src and write bytes */
+        char *buf = xmalloc(rec->size + 1);
+        ssize_t r = readlink(rec->src, buf, rec->size + 1);
+        if (r < 0) die("readlink '%s': %s", rec->src, strerror(errno));
+        if ((uint64_t)r != rec->size) die("'%s' changed while packing", rec->src);
+        if (pwrite_all(w->out_fd, buf, (size_t)r, (off_t)slot) != 0) die("write failed: %s", strerror(errno));
+        sha256(buf, (size_t)r, rec->digest);
+        free(buf);
+        rec->stored = rec->size;
+        return;
+    }
+    uint64_t stored = 0;
+#ifdef WITH_ZSTD
+    if (w->level && rec->size >= ZSTD_MIN_ENTRY) {
+        sha256_ctx hash;
+        sha256_init(&hash);
+        stored = compress_entry(cctx, rec, w->out_fd, (off_t)slot, &hash);
+        if (stored) sha256_final(&hash, rec->digest);
+    }
+#else
+    (void)cctx;
+#endif
+    if (stored) {
+        rec->flags |= ENTRY_ZSTD;
+        rec->stored = stored;
+    } else {
+        /* regular file, raw: copy from absolute src, then hash what was stored */
+        copy_file_to_archive(w->out_fd, (off_t)slot, rec->src, rec->size);
+        rec->stored = rec->size;
+        if (hash_range(w->out_fd, (off_t)slot, rec->size, rec->digest) != 0)
+            die("read back '%s': %s", rec->path, strerror(errno));
     }
-    if (ferror(in)) die("read error on '%s'", srcpath);
-    fclose(in);
-    return total;
+}
+
+static void *pack_worker(void *arg) {
+    struct pack_work *w = arg;
+    void *cctx = NULL;
+#ifdef WITH_ZSTD
+    if (w->level) {
+        cctx = ZSTD_createCCtx();
+        if (!cctx) die("out of memory");
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, w->level);
+        if (w->cdict) ZSTD_CCtx_refCDict(cctx, w->cdict);
+    }
+#endif
+    size_t i;
+    while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) < w->count)
+        pack_entry(w, cctx, &g_recs[i], w->slots[i]);
+#ifdef WITH_ZSTD
+    ZSTD_freeCCtx(cctx);
+#endif
+    return NULL;
 }
 
 /* pack command implementation */
 static void do_pack(int argc, char **argv) {
-    if (argc < 3) die("pack requires: pack <archive.pnd> <file-or-dir>...");
+    int level = 0;        /* 0: every blob stored raw */
+    int jobs = 1;
+    bool want_dict = false;
+    while (argc > 1 && argv[1][0] == '-') {
+        if (strncmp(argv[1], "-z", 2) == 0) {
+            level = argv[1][2] ? atoi(argv[1] + 2) : ZSTD_DEFAULT_LEVEL;
+            if (level <= 0) die("pack: bad compression level '%s'", argv[1] + 2);
+        } else if (strcmp(argv[1], "-D") == 0) {
+            want_dict = true;
+        } else if (strcmp(argv[1], "-j") == 0 && argc > 2) {
+            jobs = atoi(argv[2]);
+            if (jobs < 1) die("pack: -j needs a positive job count");
+            argv++;
+            argc--;
+        } else {
+            die("pack: unknown option '%s'", argv[1]);
+        }
+        argv++;
+        argc--;
+    }
+    if (argc < 3) die("pack requires: pack [-z[level]] [-D] [-j jobs] <archive.pnd> <file-or-dir>...");
+    if (want_dict && !level) level = ZSTD_DEFAULT_LEVEL;
+#ifndef WITH_ZSTD
+    if (level) die("pack: compression needs arch built with WITH_ZSTD");
+#endif
     const char *arcname = argv[1];
 
-    /* collect files */
+    /* collect files; the table, and the blobs after it, go in path order,
+       whatever order the directories were read in */
     for (int i = 2; i < argc; ++i) {
         add_path_recursive(argv[i]);
     }
     if (g_rec_cnt == 0) die("no files collected");
+    qsort(g_recs, g_rec_cnt, sizeof(*g_recs), cmp_rec_path);
 
-    /* compute table size and offsets */
+    /* the table has a fixed size, so blobs are written first and the table
+       after, once offsets and stored sizes are known; with the table sorted
+       the path index is the identity */
     uint64_t entry_count = (uint64_t)g_rec_cnt;
     uint64_t table_size = 0;
+    uint64_t *entry_off = xmalloc(g_rec_cnt * sizeof(*entry_off));
     for (size_t i = 0; i < g_rec_cnt; ++i) {
         uint32_t path_len = (uint32_t)strlen(g_recs[i].path);
-        table_size += ENTRY_HDR_SIZE + path_len;
+        entry_off[i] = table_size;
+        table_size += ENTRY_HDR_SIZE_V2 + DIGEST_LEN + path_len;
     }
 
-    uint64_t header_size = MAGIC_LEN + 8; /* magic + entry_count u64 */
-    uint64_t blob_start = header_size + table_size;
+    uint64_t index_size = entry_count * 8;
+    uint64_t blob_start = HEADER_SIZE_V3 + index_size + table_size;
 
+    /* open archive file (atomic write recommended by caller); it is also read
+       back so raw blobs are hashed exactly as they were stored */
+    FILE *out = fopen(arcname, "wb+");
+    if (!out) die("fopen '%s' for write: %s", arcname, strerror(errno));
+    int out_fd = fileno(out);
+
+    uint32_t archive_flags = ARCHIVE_DIGESTS;
+    uint64_t dict_offset = 0, dict_size = 0;
     uint64_t cur_offset = blob_start;
+    struct pack_work work = { .out_fd = out_fd, .count = g_rec_cnt, .level = level };
+#ifdef WITH_ZSTD
+    if (level) {
+        size_t dlen = 0;
+        void *dict = want_dict ? train_dictionary(&dlen) : NULL;
+        if (dict) {
+            work.cdict = ZSTD_createCDict(dict, dlen, level);
+            if (!work.cdict) die("zstd: cannot load trained dictionary");
+            if (pwrite_all(out_fd, dict, dlen, (off_t)cur_offset) != 0) die("write failed: %s", strerror(errno));
+            archive_flags |= ARCHIVE_DICT;
+            dict_offset = cur_offset;
+            dict_size = dlen;
+            cur_offset += dlen;
+            free(dict);
+        }
+    }
+#endif
+
+    /* Every blob gets a slot of its uncompressed size up front, so the
+       workers can write anywhere in any order and the bytes land the same
+       for any -j. Raw blobs are then already in place; compressed ones are
+       moved down over the slack afterwards, in order. */
+    uint64_t *slots = xmalloc(g_rec_cnt * sizeof(*slots));
     for (size_t i = 0; i < g_rec_cnt; ++i) {
-        g_recs[i].offset = cur_offset;
+        slots[i] = cur_offset;
         cur_offset += g_recs[i].size;
     }
+    work.slots = slots;
+
+    size_t nthreads = (size_t)jobs < g_rec_cnt ? (size_t)jobs : g_rec_cnt;
+    pthread_t *threads = NULL;
+    size_t started = 0;
+    if (nthreads > 1) {
+        threads = calloc(nthreads - 1, sizeof(*threads));
+        while (threads && started < nthreads - 1
+               && pthread_create(&threads[started], NULL, pack_worker, &work) == 0)
+            started++;
+    }
+    pack_worker(&work);
+    for (size_t t = 0; t < started; ++t) pthread_join(threads[t], NULL);
+    free(threads);
+#ifdef WITH_ZSTD
+    ZSTD_freeCDict(work.cdict);
+#endif
+
+    cur_offset = slots[0];
+    for (size_t i = 0; i < g_rec_cnt; ++i) {
+        g_recs[i].offset = cur_offset;
+        if (cur_offset != slots[i]) move_down(out_fd, slots[i], cur_offset, g_recs[i].stored);
+        cur_offset += g_recs[i].stored;
+    }
+    free(slots);
+    if (ftruncate(out_fd, (off_t)cur_offset) != 0) die("truncate '%s': %s", arcname, strerror(errno));
 
-    /* open archive file (atomic write recommended by caller) */
-    FILE *out = fopen(arcname, "wb");
-    if (!out) die("fopen '%s' for write: %s", arcname, strerror(errno));
-
-    /* write magic */
-    if (fwrite(MAGIC, 1, MAGIC_LEN, out) != MAGIC_LEN) die("write magic failed");
-
-    /* write entry_count (u64 le) */
+    /* header, index and table go through the stream, which still sits at offset 0 */
+    if (fwrite(MAGIC_V3, 1, MAGIC_LEN, out) != MAGIC_LEN) die("write magic failed");
     write_u64_le(out, entry_count);
+    write_u32_le(out, archive_flags);
+    write_u64_le(out, dict_offset);
+    write_u64_le(out, dict_size);
+    write_u64_le(out, table_size);
+    for (size_t i = 0; i < g_rec_cnt; ++i) write_u64_le(out, entry_off[i]);
+    free(entry_off);
 
-    /* write table */
     for (size_t i = 0; i < g_rec_cnt; ++i) {
         uint32_t path_len = (uint32_t)strlen(g_recs[i].path);
         write_u32_le(out, path_len);
         write_u64_le(out, g_recs[i].size);
+        write_u64_le(out, g_recs[i].stored);
         write_u64_le(out, g_recs[i].offset);
         write_u32_le(out, g_recs[i].flags);
+        if (fwrite(g_recs[i].digest, 1, DIGEST_LEN, out) != DIGEST_LEN) die("write digest failed");
         if (fwrite(g_recs[i].path, 1, path_len, out) != path_len) die("write path failed");
     }
 
-    /* write blobs in same order */
-    for (size_t i = 0; i < g_rec_cnt; ++i) {
-        if (g_recs[i].flags & 0x1) {
-            /* symlink: read link target from absolute src and write bytes */
-            char *src = g_recs[i].src;
-            char *buf = malloc(g_recs[i].size + 1);
-            if (!buf) die("malloc");
-            ssize_t r = readlink(src, buf, g_recs[i].size + 1);
-            if (r < 0) die("readlink '%s': %s", src, strerror(errno));
-            if ((uint64_t)r != g_recs[i].size) {
-                /* size changed between collect and pack; adjust but proceed */
-            }
-            if (fwrite(buf, 1, r, out) != (size_t)r) die("write symlink blob failed");
-            free(buf);
-        } else {
-            /* regular file: copy from absolute src */
-            uint64_t wrote = copy_file_to_stream(out, g_recs[i].src);
-            if (wrote != g_recs[i].size) {
-                fprintf(stderr, "warning: size changed while packing '%s' (expected %" PRIu64 ", wrote %" PRIu64 ")\n",
-                        g_recs[i].path, g_recs[i].size, wrote);
-            }
-        }
-    }
-
     if (fclose(out) != 0) die("fclose failed");
-    printf("packed %zu entries into %s\n", g_rec_cnt, arcname);
+    if (level) {
+        uint64_t raw = 0;
+        for (size_t i = 0; i < g_rec_cnt; ++i) raw += g_recs[i].size;
+        printf("packed %zu entries into %s (%" PRIu64 " -> %" PRIu64 " bytes%s)\n", g_rec_cnt, arcname,
+               raw, cur_offset - blob_start, dict_size ? ", with dictionary" : "");
+    } else {
+        printf("packed %zu entries into %s\n", g_rec_cnt, arcname);
+    }
 }
 
-/* ensure every parent directory for the given full path exists.
- * full_path is the full destination path including filename (e.g. /tmp/out/dir/file)
- */
-static void ensure_parent_dirs(const char *full_path) {
-    char tmp[PATH_MAX];
-    if ((size_t)snprintf(tmp, sizeof(tmp), "%s", full_path) >= sizeof(tmp))
-        die("path too long in ensure_parent_dirs");
-
-    /* find parent directory */
-    char *last_slash = strrchr(tmp, '/');
-    if (!last_slash) return;            /* no parent component -> nothing to do */
-    if (last_slash == tmp) return;     /* parent is root "/" -> nothing to do */
-
-    *last_slash = '\0'; /* tmp now holds the parent directory */
+#endif /* !PANDORA */
 
-    /* create each intermediate component */
-    for (char *p = tmp + 1; *p; ++p) {
-        if (*p == '/') {
-            *p = '\0';
-            if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
-                die("mkdir '%s': %s", tmp, strerror(errno));
-            *p = '/';
-        }
-    }
-    /* final parent */
-    if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
-        die("mkdir '%s': %s", tmp, strerror(errno));
+/* Extraction is library code (arch_unpack, arch_extract, arch_stream_*):
+   an error there is printed and handed back, never exits, so a bad
+   archive fails one install rather than the process. */
+static int fail(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    return -1;
 }
 
 /* strip trailing slashes except keep single leading "/" */
@@ -331,27 +761,21 @@ static void strip_trailing_slash(char *s) {
 }
 
 /* ensure destination directory exists and is a directory */
-static void ensure_destdir(char *destbuf) {
+static int ensure_destdir(char *destbuf) {
     strip_trailing_slash(destbuf);
 
-    struct stat st;
-    if (stat(destbuf, &st) < 0) {
-        if (errno == ENOENT) {
-            if (mkdir(destbuf, 0755) < 0 && errno != EEXIST)
-                die("mkdir '%s': %s", destbuf, strerror(errno));
-            return;
-        } else {
-            die("stat '%s': %s", destbuf, strerror(errno));
-        }
+    if (mkdir_p(destbuf, 0755) < 0) {
+        if (errno == ENOTDIR) return fail("destination '%s' exists and is not a directory", destbuf);
+        return fail("mkdir '%s': %s", destbuf, strerror(errno));
     }
-    if (!S_ISDIR(st.st_mode)) die("destination '%s' exists and is not a directory", destbuf);
+    return 0;
 }
 
 /* sanitize a stored archive relative path:
  * - remove leading slashes and "./"
  * - remove "." components
  * - resolve ".." by popping previous component (reject if escapes above root)
- * Returns malloc'd string or NULL if invalid/empty.
+ * Returns malloc'd string or NULL if invalid/empty (or out of memory).
  */
 static char *sanitize_relpath(const char *p)
 {
@@ -395,13 +819,14 @@ static char *sanitize_relpath(const char *p)
         parts[nparts] = strdup(comp);
         if (!parts[nparts]) {
             for (size_t j = 0; j < nparts; ++j) free(parts[j]);
-            die("out of memory");
+            return NULL;
         }
         part_len[nparts] = i;
         nparts++;
         if (nparts >= (sizeof(parts)/sizeof(parts[0]))) {
+            /* too deep */
             for (size_t j = 0; j < nparts; ++j) free(parts[j]);
-            die("path too deep");
+            return NULL;
         }
     }
 
@@ -420,7 +845,7 @@ static char *sanitize_relpath(const char *p)
     char *out = malloc(tot + 1);
     if (!out) {
         for (size_t j = 0; j < nparts; ++j) free(parts[j]);
-        die("out of memory");
+        return NULL;
     }
     char *w = out;
     for (size_t i = 0; i < nparts; ++i) {
@@ -433,173 +858,1396 @@ static char *sanitize_relpath(const char *p)
     return out;
 }
 
-/* unpack: read table, compute blob_start, then stream blobs sequentially */
-void do_unpack(int argc, char **argv) {
-    if (argc < 2) die("unpack requires: unpack <archive.pnd> [destdir]");
-    const char *arcname = argv[1];
+#ifdef WITH_ZSTD
+static int write_all_fd(int fd, const void *buf, size_t len, const char *path) {
+    const char *p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return fail("write '%s': %s", path, strerror(errno));
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Stream one zstd frame from the archive into out_fd. */
+static int decompress_entry(ZSTD_DCtx *dctx, int in_fd, const struct file_rec *rec, int out_fd, const char *outpath) {
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    char *ibuf = malloc(STREAM_CHUNK);
+    char *obuf = malloc(STREAM_CHUNK);
+    uint64_t consumed = 0, produced = 0;
+    size_t left = 1;
+    int rc = -1;
+    if (!ibuf || !obuf) {
+        fail("out of memory");
+        goto out;
+    }
+    while (consumed < rec->stored) {
+        size_t want = rec->stored - consumed > STREAM_CHUNK ? STREAM_CHUNK : (size_t)(rec->stored - consumed);
+        ssize_t r = pread(in_fd, ibuf, want, (off_t)(rec->offset + consumed));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            fail("read blob for '%s' failed", outpath);
+            goto out;
+        }
+        consumed += (uint64_t)r;
+        ZSTD_inBuffer in = { ibuf, (size_t)r, 0 };
+        while (in.pos < in.size) {
+            ZSTD_outBuffer out = { obuf, STREAM_CHUNK, 0 };
+            left = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(left)) {
+                fail("zstd: '%s': %s", outpath, ZSTD_getErrorName(left));
+                goto out;
+            }
+            produced += out.pos;
+            if (produced > rec->size) {
+                fail("corrupt archive: '%s' inflates past its size", outpath);
+                goto out;
+            }
+            if (write_all_fd(out_fd, obuf, out.pos, outpath) != 0) goto out;
+        }
+    }
+    /* flush whatever the decoder still holds */
+    while (left != 0) {
+        ZSTD_inBuffer in = { NULL, 0, 0 };
+        ZSTD_outBuffer out = { obuf, STREAM_CHUNK, 0 };
+        left = ZSTD_decompressStream(dctx, &out, &in);
+        if (ZSTD_isError(left)) {
+            fail("zstd: '%s': %s", outpath, ZSTD_getErrorName(left));
+            goto out;
+        }
+        if (out.pos == 0) break;
+        produced += out.pos;
+        if (produced > rec->size) {
+            fail("corrupt archive: '%s' inflates past its size", outpath);
+            goto out;
+        }
+        if (write_all_fd(out_fd, obuf, out.pos, outpath) != 0) goto out;
+    }
+    if (left != 0 || produced != rec->size) {
+        fail("corrupt archive: '%s' is truncated", outpath);
+        goto out;
+    }
+    rc = 0;
+out:
+    free(ibuf);
+    free(obuf);
+    return rc;
+}
+#endif
+
+/* per-thread extraction state */
+struct extract_ctx {
+#ifdef WITH_ZSTD
+    ZSTD_DCtx *dctx;
+#endif
+    const char *objects;   /* object store directory, or NULL */
+};
+
+/* write a regular file's blob out to outpath. When verify is set the result
+   is read back and checked against the entry's digest. */
+static int extract_blob(struct extract_ctx *ctx, int in_fd, const struct file_rec *rec, const char *outpath, bool verify) {
+    int out_fd = open(outpath, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (out_fd < 0) return fail("open '%s': %s", outpath, strerror(errno));
+    int rc = 0;
+    if (rec->flags & ENTRY_ZSTD) {
+#ifdef WITH_ZSTD
+        rc = decompress_entry(ctx->dctx, in_fd, rec, out_fd, outpath);
+#else
+        (void)ctx;
+        rc = fail("'%s' is zstd-compressed; arch was built without WITH_ZSTD", outpath);
+#endif
+    } else if (copy_range(in_fd, (off_t)rec->offset, out_fd, 0, rec->size) != (int64_t)rec->size) {
+        /* regular file: copy the blob range */
+        rc = fail("read blob for '%s' failed", outpath);
+    }
+    if (rc == 0 && verify) {
+        uint8_t digest[DIGEST_LEN];
+        if (hash_range(out_fd, 0, rec->size, digest) != 0)
+            rc = fail("read back '%s': %s", outpath, strerror(errno));
+        else if (memcmp(digest, rec->digest, DIGEST_LEN) != 0)
+            rc = fail("corrupt archive: '%s' does not match its recorded sha256", outpath);
+    }
+    if (close(out_fd) != 0 && rc == 0) rc = fail("close failed for '%s': %s", outpath, strerror(errno));
+    return rc;
+}
+
+/* objects/<2 hex> and objects/<2 hex>/<62 hex> for rec's content */
+static int object_paths(const char *objects, const struct file_rec *rec,
+                        char fanout[PATH_MAX], char object[PATH_MAX]) {
+    char hex[65];
+    sha256_to_hex(rec->digest, hex);
+    if (snprintf(fanout, PATH_MAX, "%s/%.2s", objects, hex) >= PATH_MAX
+     || snprintf(object, PATH_MAX, "%s/%s", fanout, hex + 2) >= PATH_MAX)
+        return fail("object store path too long");
+    return 0;
+}
+
+/* Put an existing object at outpath. Returns 1 if it is there now, 0 if
+   there is none (or it is damaged) and the entry has to be extracted, -1
+   on error. */
+static int link_object(const struct file_rec *rec, const char *object, const char *outpath) {
+    unlink(outpath);
+    if (link(object, outpath) == 0) return 1;
+    if (errno == EXDEV || errno == EMLINK || errno == EPERM) {
+        /* store on another filesystem, or no more links allowed: clone the
+           object instead (copy_range reflinks where the filesystem can) */
+        int obj_fd = open(object, O_RDONLY);
+        if (obj_fd >= 0) {
+            int out_fd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (out_fd < 0) {
+                close(obj_fd);
+                return fail("open '%s': %s", outpath, strerror(errno));
+            }
+            int64_t n = copy_range(obj_fd, 0, out_fd, 0, rec->size);
+            close(obj_fd);
+            if (close(out_fd) != 0) return fail("close failed for '%s': %s", outpath, strerror(errno));
+            if (n == (int64_t)rec->size) return 1;
+            /* a short object is damaged: extract the entry over it */
+        }
+    }
+    return 0;
+}
+
+/* Add a freshly extracted and verified outpath to the store. Best effort:
+   losing a race to another installer or a store on another filesystem only
+   costs the sharing. */
+static void publish_object(const char *fanout, const char *object, const char *outpath) {
+    if (mkdir(fanout, 0755) < 0 && errno != EEXIST) return;
+    if (link(outpath, object) < 0 && errno != EEXIST && errno != EXDEV)
+        fprintf(stderr, "warning: cannot add '%s' to the object store: %s\n", outpath, strerror(errno));
+}
+
+/* Materialise a regular file through the object store: link the existing
+   object, or extract the entry and add it as a new object. Only content that
+   matched its digest is ever linked into the store. */
+static int extract_via_store(struct extract_ctx *ctx, int in_fd, const struct file_rec *rec, const char *outpath) {
+    char fanout[PATH_MAX], object[PATH_MAX];
+    if (object_paths(ctx->objects, rec, fanout, object) != 0) return -1;
+    int linked = link_object(rec, object, outpath);
+    if (linked) return linked < 0 ? -1 : 0;
+    if (extract_blob(ctx, in_fd, rec, outpath, true) != 0) return -1;
+    publish_object(fanout, object, outpath);
+    return 0;
+}
+
+/* write one entry's blob out to outpath; the parent directory exists */
+static int extract_entry(struct extract_ctx *ctx, int in_fd, const struct file_rec *rec, const char *outpath, bool digests) {
+    if (rec->flags & ENTRY_SYMLINK) {
+        /* symlink: read target bytes */
+        char buf[PATH_MAX];
+        if (rec->size >= sizeof(buf)) return fail("corrupt archive: '%s' has an overlong link target", outpath);
+        if (rec->size > 0 && pread_all(in_fd, buf, (size_t)rec->size, (off_t)rec->offset) != 0)
+            return fail("read symlink target for '%s' failed", outpath);
+        buf[rec->size] = '\0';
+        unlink(outpath);
+        if (symlink(buf, outpath) < 0)
+            return fail("symlink '%s' -> '%s' failed: %s", outpath, buf, strerror(errno));
+        return 0;
+    }
+
+    if (digests && ctx->objects) return extract_via_store(ctx, in_fd, rec, outpath);
+    return extract_blob(ctx, in_fd, rec, outpath, false);
+}
+
+/* Entries are handed out from a shared cursor, one at a time or a ring batch
+   at a time; every worker reads through the same descriptor with pread (or
+   its io_uring equivalent), which needs no locking. The first worker to hit
+   an error sets failed, and the others stop at their next claim. */
+struct unpack_work {
+    int in_fd;
+    const struct file_rec *recs;
+    char *const *outpaths;
+    uint64_t count;
+    uint64_t next;
+    int failed;
+    bool digests;              /* entries carry a sha256 */
+    const char *objects;       /* object store directory, or NULL */
+#ifdef WITH_ZSTD
+    const ZSTD_DDict *ddict;   /* shared, read-only */
+#endif
+};
+
+/* With io_uring, small raw blobs go a batch at a time: one submission reads
+   up to URING_BATCH of them into the ring's registered buffers, a second
+   writes them out, and store entries are checked against their digest in
+   memory rather than read back. Symlinks, compressed and larger entries,
+   and store hits, are handled one by one as without a ring. */
+#define URING_BATCH 32
+#define URING_BUF (64 * 1024)
+
+struct batch_slot {
+    uint64_t i;    /* entry */
+    int fd;        /* output file, while it is being written */
+    int res;       /* result of the last completion */
+};
+
+static void batch_done(void *arg, uint64_t tag, int res) {
+    struct batch_slot *slots = arg;
+    slots[tag].res = res;
+}
+
+/* Returns 0, or -1 (with every output it opened closed again). A ring that
+   failed midway may still hold queued operations; the caller drops it. */
+static int extract_batch(struct extract_ctx *ctx, uring *ring, const struct unpack_work *w, uint64_t lo, uint64_t hi) {
+    struct batch_slot slots[URING_BATCH];
+    unsigned n = 0;
+    bool store = w->digests && ctx->objects;
+    char fanout[PATH_MAX], object[PATH_MAX];
+    int rc = -1;
+
+    for (uint64_t i = lo; i < hi; ++i) {
+        const struct file_rec *rec = &w->recs[i];
+        const char *outpath = w->outpaths[i];
+        if (!outpath) continue;
+        if ((rec->flags & (ENTRY_SYMLINK | ENTRY_ZSTD)) || rec->size > URING_BUF) {
+            if (extract_entry(ctx, w->in_fd, rec, outpath, w->digests) != 0) return -1;
+            continue;
+        }
+        if (store) {
+            if (object_paths(ctx->objects, rec, fanout, object) != 0) return -1;
+            int linked = link_object(rec, object, outpath);
+            if (linked < 0) return -1;
+            if (linked) continue;
+        }
+        if (uring_read(ring, w->in_fd, n, (size_t)rec->size, rec->offset, n) != 0)
+            return fail("io_uring: submission queue full");
+        slots[n].i = i;
+        slots[n].fd = -1;
+        n++;
+    }
+    if (!n) return 0;
+    int err = uring_run(ring, batch_done, slots);
+    if (err < 0) return fail("io_uring: %s", strerror(-err));
+
+    for (unsigned k = 0; k < n; ++k) {
+        const struct file_rec *rec = &w->recs[slots[k].i];
+        const char *outpath = w->outpaths[slots[k].i];
+        char *buf = uring_buf(ring, k);
+        int got = slots[k].res;
+        if (got < 0) {
+            fail("read blob for '%s' failed: %s", outpath, strerror(-got));
+            goto out;
+        }
+        if ((uint64_t)got < rec->size
+            && pread_all(w->in_fd, buf + got, (size_t)rec->size - (size_t)got, (off_t)rec->offset + got) != 0) {
+            fail("read blob for '%s' failed: %s", outpath, strerror(errno));
+            goto out;
+        }
+        if (store) {
+            uint8_t digest[DIGEST_LEN];
+            sha256(buf, (size_t)rec->size, digest);
+            if (memcmp(digest, rec->digest, DIGEST_LEN) != 0) {
+                fail("corrupt archive: '%s' does not match its recorded sha256", outpath);
+                goto out;
+            }
+        }
+        slots[k].fd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (slots[k].fd < 0) {
+            fail("open '%s': %s", outpath, strerror(errno));
+            goto out;
+        }
+        if (uring_write(ring, slots[k].fd, k, (size_t)rec->size, 0, k) != 0) {
+            fail("io_uring: submission queue full");
+            goto out;
+        }
+    }
+    err = uring_run(ring, batch_done, slots);
+    if (err < 0) {
+        fail("io_uring: %s", strerror(-err));
+        goto out;
+    }
+
+    for (unsigned k = 0; k < n; ++k) {
+        const struct file_rec *rec = &w->recs[slots[k].i];
+        const char *outpath = w->outpaths[slots[k].i];
+        int put = slots[k].res;
+        if (put < 0) {
+            fail("write '%s': %s", outpath, strerror(-put));
+            goto out;
+        }
+        if ((uint64_t)put < rec->size
+            && pwrite_all(slots[k].fd, (char *)uring_buf(ring, k) + put, (size_t)rec->size - (size_t)put, put) != 0) {
+            fail("write '%s': %s", outpath, strerror(errno));
+            goto out;
+        }
+        int fd = slots[k].fd;
+        slots[k].fd = -1;
+        if (close(fd) != 0) {
+            fail("close failed for '%s': %s", outpath, strerror(errno));
+            goto out;
+        }
+        if (store && object_paths(ctx->objects, rec, fanout, object) == 0)
+            publish_object(fanout, object, outpath);
+    }
+    rc = 0;
+out:
+    for (unsigned k = 0; k < n; ++k) {
+        if (slots[k].fd >= 0) close(slots[k].fd);
+    }
+    return rc;
+}
+
+static void *unpack_worker(void *arg) {
+    struct unpack_work *w = arg;
+    struct extract_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.objects = w->objects;
+#ifdef WITH_ZSTD
+    ctx.dctx = ZSTD_createDCtx();
+    if (!ctx.dctx) {
+        fail("out of memory");
+        __atomic_store_n(&w->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    if (w->ddict) ZSTD_DCtx_refDDict(ctx.dctx, w->ddict);
+#endif
+    uint64_t i;
+    int rc = 0;
+    uring *ring = uring_open(URING_BATCH, URING_BATCH, URING_BUF);
+    if (ring) {
+        while (rc == 0 && !__atomic_load_n(&w->failed, __ATOMIC_RELAXED)
+               && (i = __atomic_fetch_add(&w->next, URING_BATCH, __ATOMIC_RELAXED)) < w->count)
+            rc = extract_batch(&ctx, ring, w, i, w->count - i > URING_BATCH ? i + URING_BATCH : w->count);
+        uring_close(ring);
+    } else {
+        while (rc == 0 && !__atomic_load_n(&w->failed, __ATOMIC_RELAXED)
+               && (i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) < w->count) {
+            if (w->outpaths[i]) rc = extract_entry(&ctx, w->in_fd, &w->recs[i], w->outpaths[i], w->digests);
+        }
+    }
+    if (rc != 0) __atomic_store_n(&w->failed, 1, __ATOMIC_RELAXED);
+#ifdef WITH_ZSTD
+    ZSTD_freeDCtx(ctx.dctx);
+#endif
+    return NULL;
+}
+
+/* below this many entries per thread, thread start-up costs more than it saves */
+#define UNPACK_MIN_ENTRIES_PER_JOB 16
+
+/* dest/.manifest: every extracted path in table order. Also prints each one
+   unless ARCH_QUIET and fills in stats. Returns 0, or -1 with no manifest
+   left behind. */
+static int write_manifest(const char *dest, const struct file_rec *recs, char *const *outpaths, uint64_t count,
+                          int flags, arch_stats *stats) {
+    char manifest_path[PATH_MAX];
+    if (snprintf(manifest_path, sizeof(manifest_path), "%s/.manifest", strcmp(dest, "/") == 0 ? "" : dest)
+        >= (int)sizeof(manifest_path))
+        return fail("manifest path too long");
+    FILE *manifest = fopen(manifest_path, "w");
+    if (!manifest) return fail("fopen manifest '%s': %s", manifest_path, strerror(errno));
+
+    arch_stats st = {0};
+    int rc = 0;
+    for (uint64_t i = 0; i < count && rc == 0; ++i) {
+        if (!outpaths[i]) continue;
+        if (fprintf(manifest, "%s\n", recs[i].path) < 0) {
+            rc = fail("write to manifest failed");
+            break;
+        }
+        if (!(flags & ARCH_QUIET)) printf("extracted: %s\n", outpaths[i]);
+        st.files++;
+        st.bytes += recs[i].size;
+    }
+    if (fclose(manifest) != 0 && rc == 0) rc = fail("fclose manifest failed");
+    if (rc != 0) {
+        unlink(manifest_path);
+        return -1;
+    }
+    if (stats) *stats = st;
+    return 0;
+}
+
+/* dest/rel with rel's parent directories created through dirs; malloc'd,
+   or NULL after printing why */
+static char *entry_outpath(dircache *dirs, const char *dest, const char *rel) {
+    char outpath[PATH_MAX];
+    int n;
+    if (strcmp(dest, "/") == 0) n = snprintf(outpath, sizeof(outpath), "/%s", rel);
+    else if (strcmp(dest, ".") == 0) n = snprintf(outpath, sizeof(outpath), "%s", rel);
+    else n = snprintf(outpath, sizeof(outpath), "%s/%s", dest, rel);
+    if (n >= (int)sizeof(outpath)) {
+        fail("path too long for extraction: '%s'", rel);
+        return NULL;
+    }
+
+    if (dircache_mkparent(dirs, rel, 0755) < 0) {
+        fail("mkdir for '%s': %s", outpath, strerror(errno));
+        return NULL;
+    }
+    char *out = strdup(outpath);
+    if (!out) fail("out of memory");
+    return out;
+}
+
+/* Undo a failed extraction: every entry's output goes, and so does each
+   directory above it that is left empty, up to (not including) dest. */
+static void remove_partial(const struct file_rec *recs, char *const *outpaths, uint64_t count) {
+    for (uint64_t i = 0; i < count; ++i) {
+        if (!outpaths[i]) continue;
+        unlink(outpaths[i]);
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s", outpaths[i]);
+        size_t keep = strlen(dir) - strlen(recs[i].path);   /* dest and its slash */
+        char *slash;
+        while ((slash = strrchr(dir, '/')) && (size_t)(slash - dir) > keep) {
+            *slash = '\0';
+            if (rmdir(dir) != 0) break;
+        }
+    }
+}
+
+/* ---- random-access reader ---- */
+
+struct arch_reader {
+    int fd;
+    int version;
+    const unsigned char *map;   /* header, index and table */
+    size_t map_len;
+    uint64_t file_size;
+    uint64_t count;
+    uint32_t archive_flags;
+    uint64_t table_start;
+    uint64_t table_size;
+    uint64_t blob_start;
+    size_t entry_hdr;           /* fixed bytes before each path */
+    uint64_t *entries;          /* table-relative offset of every entry, in table order */
+    struct extract_ctx ctx;
+#ifdef WITH_ZSTD
+    ZSTD_DDict *ddict;
+#endif
+};
+
+static uint32_t get_u32_le(const unsigned char *b) {
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+static uint64_t get_u64_le(const unsigned char *b) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= ((uint64_t)b[i]) << (8*i);
+    return v;
+}
+
+/* bytes taken by the table entry at off, or 0 if it runs past limit */
+static uint64_t entry_span(const arch_reader *r, uint64_t off, uint64_t limit) {
+    if (off > limit || limit - off < r->entry_hdr) return 0;
+    uint64_t path_len = get_u32_le(r->map + r->table_start + off);
+    if (path_len > limit - off - r->entry_hdr) return 0;
+    return r->entry_hdr + path_len;
+}
+
+/* decode and validate the table entry at off */
+static int load_entry(const arch_reader *r, uint64_t off, arch_entry *out) {
+    if (!entry_span(r, off, r->table_size)) return -1;
+    const unsigned char *p = r->map + r->table_start + off;
+    bool v2 = r->version >= 2;
+    memset(out, 0, sizeof(*out));
+    out->path_len = get_u32_le(p);
+    out->size = get_u64_le(p + 4);
+    out->stored = v2 ? get_u64_le(p + 12) : out->size;
+    out->offset = get_u64_le(p + (v2 ? 20 : 12));
+    out->flags = get_u32_le(p + (v2 ? 28 : 20));
+    if (!v2) out->flags &= ~(uint32_t)ENTRY_ZSTD;
+    if (v2 && (r->archive_flags & ARCHIVE_DIGESTS)) out->sha256 = p + ENTRY_HDR_SIZE_V2;
+    out->path = (const char *)p + r->entry_hdr;
+    out->symlink = (out->flags & ENTRY_SYMLINK) != 0;
+    out->compressed = (out->flags & ENTRY_ZSTD) != 0;
+
+    if (out->offset < r->blob_start || out->offset > r->file_size || out->stored > r->file_size - out->offset)
+        return -1;
+    if (!(out->flags & ENTRY_ZSTD) && out->stored != out->size) return -1;
+    return 0;
+}
+
+static void reader_fail(arch_reader *r, const char *path, const char *why) {
+    fprintf(stderr, "%s: %s\n", path, why);
+    arch_close(r);
+}
+
+arch_reader *arch_open(const char *path) {
+    arch_reader *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (r->fd < 0 || fstat(r->fd, &st) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (r->fd >= 0) close(r->fd);
+        free(r);
+        return NULL;
+    }
+    r->file_size = (uint64_t)st.st_size;
+
+    unsigned char hdr[HEADER_SIZE_V3];
+    size_t have = r->file_size < sizeof(hdr) ? (size_t)r->file_size : sizeof(hdr);
+    if (have < MAGIC_LEN + 8 || pread(r->fd, hdr, have, 0) != (ssize_t)have) {
+        reader_fail(r, path, "not a pnd archive");
+        return NULL;
+    }
+    r->version = archive_version((const char *)hdr);
+    uint64_t want_hdr = r->version >= 3 ? HEADER_SIZE_V3 : r->version == 2 ? HEADER_SIZE_V2 : MAGIC_LEN + 8;
+    if (!r->version || have < want_hdr) {
+        reader_fail(r, path, "not a pnd archive");
+        return NULL;
+    }
+    r->count = get_u64_le(hdr + MAGIC_LEN);
+    uint64_t dict_offset = 0, dict_size = 0;
+    if (r->version >= 2) {
+        r->archive_flags = get_u32_le(hdr + MAGIC_LEN + 8);
+        dict_offset = get_u64_le(hdr + MAGIC_LEN + 12);
+        dict_size = get_u64_le(hdr + MAGIC_LEN + 20);
+    }
+    /* every entry takes at least its fixed header, which bounds the count */
+    r->entry_hdr = r->version >= 2 ? ENTRY_HDR_SIZE_V2 : ENTRY_HDR_SIZE;
+    if (r->version >= 2 && (r->archive_flags & ARCHIVE_DIGESTS)) r->entry_hdr += DIGEST_LEN;
+    if (r->count > r->file_size / r->entry_hdr) {
+        reader_fail(r, path, "corrupt archive: bad entry count");
+        return NULL;
+    }
+    r->table_start = archive_table_start(r->version, r->count);
+
+    /* map what precedes the blobs; older versions do not record the table
+       size, so there the mapping runs to the end of the file */
+    uint64_t map_end = r->file_size;
+    if (r->version >= 3) {
+        r->table_size = get_u64_le(hdr + HEADER_SIZE_V2);
+        if (r->table_size > r->file_size - r->table_start) {
+            reader_fail(r, path, "corrupt archive: table runs past the end");
+            return NULL;
+        }
+        map_end = r->table_start + r->table_size;
+    }
+    if (map_end > SIZE_MAX || map_end < r->table_start) {
+        reader_fail(r, path, "corrupt archive");
+        return NULL;
+    }
+    r->map_len = (size_t)map_end;
+    void *m = mmap(NULL, r->map_len, PROT_READ, MAP_PRIVATE, r->fd, 0);
+    if (m == MAP_FAILED) {
+        r->map_len = 0;
+        reader_fail(r, path, strerror(errno));
+        return NULL;
+    }
+    r->map = m;
+
+    /* one pass over the table (not the blobs) to find each entry */
+    r->entries = malloc((r->count ? r->count : 1) * sizeof(*r->entries));
+    if (!r->entries) {
+        reader_fail(r, path, "out of memory");
+        return NULL;
+    }
+    uint64_t limit = r->version >= 3 ? r->table_size : map_end - r->table_start;
+    uint64_t off = 0;
+    for (uint64_t i = 0; i < r->count; ++i) {
+        uint64_t span = entry_span(r, off, limit);
+        if (!span) {
+            reader_fail(r, path, "corrupt archive: truncated entry table");
+            return NULL;
+        }
+        r->entries[i] = off;
+        off += span;
+    }
+    if (r->version >= 3 && off != r->table_size) {
+        reader_fail(r, path, "corrupt archive: table size mismatch");
+        return NULL;
+    }
+    r->table_size = off;
+    r->blob_start = r->table_start + off;
 
+    if ((r->archive_flags & ARCHIVE_DICT)
+        && (dict_offset < r->blob_start || dict_offset > r->file_size || !dict_size || dict_size > r->file_size - dict_offset)) {
+        reader_fail(r, path, "corrupt archive: dictionary lies outside the blob area");
+        return NULL;
+    }
+#ifdef WITH_ZSTD
+    r->ctx.dctx = ZSTD_createDCtx();
+    if (!r->ctx.dctx) {
+        reader_fail(r, path, "out of memory");
+        return NULL;
+    }
+    if (r->archive_flags & ARCHIVE_DICT) {
+        char *dict = malloc(dict_size);
+        if (dict && pread(r->fd, dict, dict_size, (off_t)dict_offset) == (ssize_t)dict_size)
+            r->ddict = ZSTD_createDDict(dict, dict_size);
+        free(dict);
+        if (!r->ddict) {
+            reader_fail(r, path, "zstd: cannot load archive dictionary");
+            return NULL;
+        }
+        ZSTD_DCtx_refDDict(r->ctx.dctx, r->ddict);
+    }
+#else
+    (void)dict_offset;
+#endif
+    return r;
+}
+
+void arch_close(arch_reader *r) {
+    if (!r) return;
+#ifdef WITH_ZSTD
+    ZSTD_freeDCtx(r->ctx.dctx);
+    ZSTD_freeDDict(r->ddict);
+#endif
+    if (r->map_len) munmap((void *)r->map, r->map_len);
+    free(r->entries);
+    close(r->fd);
+    free(r);
+}
+
+size_t arch_count(const arch_reader *r) {
+    return (size_t)r->count;
+}
+
+int arch_entry_at(const arch_reader *r, size_t i, arch_entry *out) {
+    if (i >= r->count) return -1;
+    return load_entry(r, r->entries[i], out);
+}
+
+static int path_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c) return c;
+    return alen < blen ? -1 : alen > blen;
+}
+
+int arch_find(const arch_reader *r, const char *path, arch_entry *out) {
+    char *want = sanitize_relpath(path);
+    if (!want) return -1;
+    size_t want_len = strlen(want);
+    int rc = -1;
+
+    if (r->version >= 3) {
+        /* binary search over the path-ordered index */
+        const unsigned char *index = r->map + HEADER_SIZE_V3;
+        uint64_t lo = 0, hi = r->count;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (load_entry(r, get_u64_le(index + mid * 8), out) != 0) break;
+            int c = path_cmp(out->path, out->path_len, want, want_len);
+            if (c == 0) {
+                rc = 0;
+                break;
+            }
+            if (c < 0) lo = mid + 1;
+            else hi = mid;
+        }
+    } else {
+        for (uint64_t i = 0; i < r->count && rc != 0; ++i) {
+            if (load_entry(r, r->entries[i], out) == 0
+                && path_cmp(out->path, out->path_len, want, want_len) == 0) rc = 0;
+        }
+    }
+    free(want);
+    return rc;
+}
+
+static struct file_rec entry_rec(const arch_entry *e) {
+    struct file_rec rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.size = e->size;
+    rec.stored = e->stored;
+    rec.offset = e->offset;
+    rec.flags = e->flags;
+    if (e->sha256) memcpy(rec.digest, e->sha256, DIGEST_LEN);
+    return rec;
+}
+
+int arch_extract(arch_reader *r, const arch_entry *e, const char *outpath) {
+    struct file_rec rec = entry_rec(e);
+    int rc = (rec.flags & ENTRY_SYMLINK) ? extract_entry(&r->ctx, r->fd, &rec, outpath, false)
+                                         : extract_blob(&r->ctx, r->fd, &rec, outpath, e->sha256 != NULL);
+    if (rc != 0) unlink(outpath);
+    return rc;
+}
+
+void *arch_read(arch_reader *r, const arch_entry *e, size_t *len) {
+    if (e->size >= SIZE_MAX || e->stored >= SIZE_MAX) return NULL;
+    char *buf = malloc((size_t)e->size + 1);
+    char *raw = (e->flags & ENTRY_ZSTD) ? malloc((size_t)e->stored + 1) : buf;
+    if (!buf || !raw) goto fail;
+    if (e->stored && pread(r->fd, raw, (size_t)e->stored, (off_t)e->offset) != (ssize_t)e->stored) {
+        fprintf(stderr, "read '%.*s': %s\n", (int)e->path_len, e->path, strerror(errno));
+        goto fail;
+    }
+    if (e->flags & ENTRY_ZSTD) {
+#ifdef WITH_ZSTD
+        size_t n = r->ddict
+            ? ZSTD_decompress_usingDDict(r->ctx.dctx, buf, (size_t)e->size, raw, (size_t)e->stored, r->ddict)
+            : ZSTD_decompressDCtx(r->ctx.dctx, buf, (size_t)e->size, raw, (size_t)e->stored);
+        if (ZSTD_isError(n) || n != e->size) {
+            fprintf(stderr, "corrupt archive: cannot inflate '%.*s'\n", (int)e->path_len, e->path);
+            goto fail;
+        }
+        free(raw);
+        raw = buf;
+#else
+        fprintf(stderr, "'%.*s' is zstd-compressed; built without WITH_ZSTD\n", (int)e->path_len, e->path);
+        goto fail;
+#endif
+    }
+    if (e->sha256) {
+        uint8_t digest[DIGEST_LEN];
+        sha256(buf, (size_t)e->size, digest);
+        if (memcmp(digest, e->sha256, DIGEST_LEN) != 0) {
+            fprintf(stderr, "corrupt archive: '%.*s' does not match its recorded sha256\n", (int)e->path_len, e->path);
+            goto fail;
+        }
+    }
+    buf[e->size] = '\0';
+    if (len) *len = (size_t)e->size;
+    return buf;
+fail:
+    if (raw != buf) free(raw);
+    free(buf);
+    return NULL;
+}
+
+/* ---- whole-archive extraction ---- */
+
+/* unpack: read the table through the reader, create directories, then
+ * extract blobs by their recorded offsets on up to `jobs` threads. The
+ * manifest lists entries in table order regardless of which thread
+ * extracted them. With an object store, regular files are linked from it
+ * where their content is already there; archives without digests are
+ * extracted as usual. If anything fails, what was extracted so far is
+ * removed again (see remove_partial) and -1 is returned.
+ */
+static int unpack_archive(const char *arcname, const char *destarg, int jobs, const char *objects,
+                          int flags, arch_stats *stats) {
     char destbuf[PATH_MAX];
-    if (argc >= 3) {
-        strncpy(destbuf, argv[2], sizeof(destbuf)-1);
+    if (destarg) {
+        strncpy(destbuf, destarg, sizeof(destbuf)-1);
         destbuf[sizeof(destbuf)-1] = '\0';
     } else {
         strcpy(destbuf, ".");
     }
-    ensure_destdir(destbuf);
+    if (ensure_destdir(destbuf) != 0) return -1;
     const char *dest = destbuf;
+    if (objects && mkdir_p(objects, 0755) < 0)
+        return fail("mkdir '%s': %s", objects, strerror(errno));
 
-    FILE *in = fopen(arcname, "rb");
-    if (!in) die("fopen '%s' for read: %s", arcname, strerror(errno));
-
-    char magic[MAGIC_LEN];
-    if (fread(magic, 1, MAGIC_LEN, in) != MAGIC_LEN) die("read magic failed");
-    if (memcmp(magic, MAGIC, MAGIC_LEN) != 0) die("bad magic - not a pnd archive");
-
-    uint64_t entry_count = read_u64_le(in);
+    arch_reader *r = arch_open(arcname);
+    if (!r) return -1;
+    uint64_t entry_count = r->count;
     if (entry_count == 0) {
         fprintf(stderr, "empty archive\n");
-        fclose(in);
-        return;
+        arch_close(r);
+        return 0;
     }
 
-    /* read table entries into recs[], but also compute table_size so we can find blob_start */
-    uint64_t table_size = 0;
+    int rc = -1;
+    bool digests = r->version >= 2 && (r->archive_flags & ARCHIVE_DIGESTS);
     struct file_rec *recs = calloc(entry_count, sizeof(*recs));
-    if (!recs) die("calloc failed");
+    char **outpaths = calloc(entry_count, sizeof(*outpaths));
+    dircache *dirs = NULL;
+    if (!recs || !outpaths) {
+        fail("out of memory");
+        goto out;
+    }
+    for (uint64_t i = 0; i < entry_count; ++i) {
+        arch_entry e;
+        if (arch_entry_at(r, (size_t)i, &e) != 0) {
+            fail("%s: corrupt archive: entry %" PRIu64 " lies outside the blob area", arcname, i);
+            goto out;
+        }
+        recs[i] = entry_rec(&e);
+        if (e.path_len && e.path_len < PATH_MAX) {
+            char raw[PATH_MAX];
+            memcpy(raw, e.path, e.path_len);
+            raw[e.path_len] = '\0';
+            recs[i].path = sanitize_relpath(raw);
+        }
+    }
 
+    /* pass 1: output paths and directories, serially so workers never race on mkdir */
+    dirs = dircache_open(AT_FDCWD, dest);
+    if (!dirs) {
+        fail("open '%s': %s", dest, strerror(errno));
+        goto out;
+    }
     for (uint64_t i = 0; i < entry_count; ++i) {
-        uint32_t path_len = read_u32_le(in);
-        uint64_t size = read_u64_le(in);
-        uint64_t offset = read_u64_le(in); /* read but ignore later */
-        uint32_t flags = read_u32_le(in);
-
-        table_size += ENTRY_HDR_SIZE + (uint64_t)path_len;
-
-        if (path_len == 0) {
-            recs[i].path = NULL;
-            recs[i].size = size;
-            recs[i].offset = offset;
-            recs[i].flags = flags;
+        if (!recs[i].path) {
+            fprintf(stderr, "warning: skipping empty or invalid archive entry at index %" PRIu64 "\n", i);
             continue;
         }
+        if (!(outpaths[i] = entry_outpath(dirs, dest, recs[i].path))) goto out;
+    }
+    dircache_close(dirs);
+    dirs = NULL;
+
+    /* pass 2: blobs */
+    struct unpack_work work = { .in_fd = r->fd, .recs = recs, .outpaths = outpaths, .count = entry_count,
+                                .digests = digests, .objects = objects };
+#ifdef WITH_ZSTD
+    work.ddict = r->ddict;
+#endif
+    uint64_t max_jobs = entry_count / UNPACK_MIN_ENTRIES_PER_JOB;
+    size_t nthreads = jobs > 1 ? (size_t)jobs : 1;
+    if (nthreads > max_jobs) nthreads = max_jobs ? (size_t)max_jobs : 1;
+
+    pthread_t *threads = NULL;
+    size_t started = 0;
+    if (nthreads > 1) {
+        threads = calloc(nthreads - 1, sizeof(*threads));
+        while (threads && started < nthreads - 1
+               && pthread_create(&threads[started], NULL, unpack_worker, &work) == 0)
+            started++;
+    }
+    unpack_worker(&work);
+    for (size_t t = 0; t < started; ++t) pthread_join(threads[t], NULL);
+    free(threads);
 
-        char *raw = malloc(path_len + 1);
-        if (!raw) die("malloc");
-        if (fread(raw, 1, path_len, in) != path_len) die("read path failed");
-        raw[path_len] = '\0';
-
-        char *san = sanitize_relpath(raw);
-        free(raw);
+    if (!work.failed && write_manifest(dest, recs, outpaths, entry_count, flags, stats) == 0) rc = 0;
 
-        if (!san) {
-            recs[i].path = NULL;
-        } else {
-            recs[i].path = san;
-        }
-        recs[i].size = size;
-        recs[i].offset = offset;
-        recs[i].flags = flags;
+out:
+    if (dirs) dircache_close(dirs);
+    if (rc != 0 && recs && outpaths) remove_partial(recs, outpaths, entry_count);
+    for (uint64_t i = 0; i < entry_count; ++i) {
+        if (recs) free(recs[i].path);
+        if (outpaths) free(outpaths[i]);
     }
+    free(outpaths);
+    free(recs);
+    arch_close(r);
+    return rc;
+}
 
-    /* compute blob_start (should match pack) */
-    uint64_t header_size = MAGIC_LEN + 8; /* magic + entry_count */
-    uint64_t blob_start = header_size + table_size;
+int arch_unpack(const char *archive, const char *destdir, int jobs, const char *objects,
+                int flags, arch_stats *stats) {
+    return unpack_archive(archive, destdir, jobs, objects, flags, stats);
+}
 
-    /* open manifest safely */
-    char manifest_path[PATH_MAX];
-    if (strcmp(dest, "/") == 0) {
-        if (snprintf(manifest_path, sizeof(manifest_path), "/.manifest") >= (int)sizeof(manifest_path))
-            die("manifest path too long");
-    } else {
-        if (snprintf(manifest_path, sizeof(manifest_path), "%s/.manifest", dest) >= (int)sizeof(manifest_path))
-            die("manifest path too long");
-    }
-    FILE *manifest = fopen(manifest_path, "w");
-    if (!manifest) die("fopen manifest '%s': %s", manifest_path, strerror(errno));
+/* ---- extraction from a stream ---- */
 
-    /* seek to blob_start and read blobs sequentially in table order */
-    if (fseeko(in, (off_t)blob_start, SEEK_SET) != 0) die("fseeko failed to blob_start: %s", strerror(errno));
+/* A blob to receive: an entry, or the dictionary (entry == NO_ENTRY). */
+#define NO_ENTRY UINT64_MAX
 
-    for (uint64_t i = 0; i < entry_count; ++i) {
-        if (!recs[i].path) {
+/* Everything held in memory is sized by the archive, that is by whoever
+   sent it, so each is capped: the header, path index and table gathered
+   before the first blob, and the dictionary. pack writes a dictionary of
+   at most DICT_CAPACITY; link targets are capped at PATH_MAX. */
+#define STREAM_HEAD_MAX (64u << 20)
+#define STREAM_DICT_MAX (8u << 20)
+
+struct stream_item {
+    uint64_t offset;
+    uint64_t stored;
+    uint64_t entry;
+};
+
+struct arch_stream {
+    FILE *input;
+    char dest[PATH_MAX];
+    char *objects;           /* object store, or NULL */
+    int flags;
+    bool failed;
+
+    /* header and table, gathered until complete */
+    unsigned char *head;
+    size_t head_len, head_cap;
+    size_t head_need;        /* bytes of header (and v3 index) before the table */
+    size_t table_pos;        /* parse cursor in head */
+    int version;
+    bool digests;
+    uint64_t entry_count, parsed;
+    uint32_t archive_flags;
+    uint64_t dict_offset, dict_size, want_table_size;
+    bool have_table;
+
+    struct file_rec *recs;
+    char **outpaths;
+    struct stream_item *items;   /* by offset */
+    size_t nitems, cur;
+    uint64_t pos;                /* archive offset of the next byte to arrive */
+
+    /* the item being received */
+    bool active;
+    uint64_t got;
+    int out_fd;
+    bool linked;                 /* taken from the object store; its bytes are skipped */
+    sha256_ctx hash;
+    char *buf;                   /* symlink target or dictionary */
+#ifdef WITH_ZSTD
+    ZSTD_DCtx *dctx;
+    ZSTD_DDict *ddict;
+    char *zbuf;
+    uint64_t produced;
+    size_t zleft;
+#endif
+};
+
+static int stream_fail(arch_stream *s, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    s->failed = true;
+    return -1;
+}
+
+static int cmp_item_offset(const void *a, const void *b) {
+    const struct stream_item *x = a, *y = b;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/* Table complete: lay out the blobs in arrival order and create the
+   directories. Blobs have to follow each other without overlapping; pack
+   writes them back to back in table order. */
+static int stream_plan(arch_stream *s) {
+    uint64_t blob_start = s->table_pos;
+    if (s->version >= 3 && blob_start - s->head_need != s->want_table_size)
+        return stream_fail(s, "corrupt archive: table size mismatch");
+
+    s->items = calloc(s->entry_count + 1, sizeof(*s->items));
+    s->outpaths = calloc(s->entry_count ? s->entry_count : 1, sizeof(*s->outpaths));
+    if (!s->items || !s->outpaths) return stream_fail(s, "out of memory");
+    for (uint64_t i = 0; i < s->entry_count; ++i) {
+        const struct file_rec *rec = &s->recs[i];
+        if (rec->offset < blob_start || rec->stored > UINT64_MAX - rec->offset)
+            return stream_fail(s, "corrupt archive: entry %" PRIu64 " lies outside the blob area", i);
+        if (!(rec->flags & ENTRY_ZSTD) && rec->stored != rec->size)
+            return stream_fail(s, "corrupt archive: entry %" PRIu64 " has a stored size for a raw blob", i);
+        /* a link target is received whole into a buffer of size + 1 */
+        if ((rec->flags & ENTRY_SYMLINK) && (rec->size >= PATH_MAX || rec->stored != rec->size))
+            return stream_fail(s, "corrupt archive: entry %" PRIu64 " has an overlong link target", i);
+    }
+    if (s->archive_flags & ARCHIVE_DICT) {
+        if (s->dict_offset < blob_start || !s->dict_size)
+            return stream_fail(s, "corrupt archive: dictionary lies outside the blob area");
+        if (s->dict_size > STREAM_DICT_MAX) return stream_fail(s, "archive dictionary is too large to stream");
+    }
+
+    dircache *dirs = dircache_open(AT_FDCWD, s->dest);
+    if (!dirs) return stream_fail(s, "open '%s': %s", s->dest, strerror(errno));
+    for (uint64_t i = 0; i < s->entry_count; ++i) {
+        const struct file_rec *rec = &s->recs[i];
+        if (!rec->path) {
             fprintf(stderr, "warning: skipping empty or invalid archive entry at index %" PRIu64 "\n", i);
-            /* still must advance file pointer by recs[i].size to keep stream aligned */
-            if (recs[i].size > 0) {
-                if (fseeko(in, (off_t)recs[i].size, SEEK_CUR) != 0)
-                    die("fseeko failed skipping blob: %s", strerror(errno));
-            }
             continue;
         }
+        if (!(s->outpaths[i] = entry_outpath(dirs, s->dest, rec->path))) {
+            dircache_close(dirs);
+            s->failed = true;
+            return -1;
+        }
+        s->items[s->nitems++] = (struct stream_item){ rec->offset, rec->stored, i };
+    }
+    dircache_close(dirs);
+    if (s->archive_flags & ARCHIVE_DICT)
+        s->items[s->nitems++] = (struct stream_item){ s->dict_offset, s->dict_size, NO_ENTRY };
+
+    qsort(s->items, s->nitems, sizeof(*s->items), cmp_item_offset);
+    for (size_t k = 1; k < s->nitems; ++k) {
+        if (s->items[k].offset < s->items[k - 1].offset + s->items[k - 1].stored)
+            return stream_fail(s, "archive blobs overlap; it cannot be extracted from a stream");
+    }
+    s->pos = blob_start;
+    s->have_table = true;
+    return 0;
+}
 
-        char outpath[PATH_MAX];
-        if (strcmp(dest, "/") == 0) {
-            if (snprintf(outpath, sizeof(outpath), "/%s", recs[i].path) >= (int)sizeof(outpath))
-                die("path too long for extraction");
-        } else if (strcmp(dest, ".") == 0) {
-            if (snprintf(outpath, sizeof(outpath), "%s", recs[i].path) >= (int)sizeof(outpath))
-                die("path too long for extraction");
-        } else {
-            if (snprintf(outpath, sizeof(outpath), "%s/%s", dest, recs[i].path) >= (int)sizeof(outpath))
-                die("path too long for extraction");
+/* Parse what has arrived of the header and table. Returns 0 (done or
+   waiting for more) or -1. */
+static int stream_parse_head(arch_stream *s) {
+    const unsigned char *h = s->head;
+    if (!s->version) {
+        if (s->head_len < MAGIC_LEN + 8) return 0;
+        s->version = archive_version((const char *)h);
+        if (!s->version) return stream_fail(s, "bad magic - not a pnd archive");
+        s->entry_count = get_u64_le(h + MAGIC_LEN);
+        /* every entry takes at least its fixed header in the table */
+        if (s->entry_count > STREAM_HEAD_MAX / ENTRY_HDR_SIZE)
+            return stream_fail(s, "corrupt archive: bad entry count");
+        s->head_need = s->version == 1 ? MAGIC_LEN + 8 : s->version == 2 ? HEADER_SIZE_V2 : HEADER_SIZE_V3;
+        if (s->version >= 3) s->head_need += (size_t)s->entry_count * 8;   /* the path index; not needed here */
+        s->recs = calloc(s->entry_count ? s->entry_count : 1, sizeof(*s->recs));
+        if (!s->recs) return stream_fail(s, "out of memory");
+    }
+    if (!s->table_pos) {
+        if (s->head_len < s->head_need) return 0;
+        if (s->version >= 2) {
+            s->archive_flags = get_u32_le(h + MAGIC_LEN + 8);
+            s->dict_offset = get_u64_le(h + MAGIC_LEN + 12);
+            s->dict_size = get_u64_le(h + MAGIC_LEN + 20);
+            s->digests = (s->archive_flags & ARCHIVE_DIGESTS) != 0;
         }
+        if (s->version >= 3) {
+            s->want_table_size = get_u64_le(h + HEADER_SIZE_V2);
+            if (s->want_table_size > STREAM_HEAD_MAX - s->head_need)
+                return stream_fail(s, "archive table is too large to stream");
+        }
+        s->table_pos = s->head_need;
+    }
 
-        ensure_parent_dirs(outpath);
+    bool v2 = s->version >= 2;
+    size_t fixed = (v2 ? ENTRY_HDR_SIZE_V2 : ENTRY_HDR_SIZE) + (s->digests ? DIGEST_LEN : 0);
+    while (s->parsed < s->entry_count) {
+        const unsigned char *e = h + s->table_pos;
+        size_t avail = s->head_len - s->table_pos;
+        if (avail < fixed) return 0;
+        uint32_t path_len = get_u32_le(e);
+        if (path_len >= PATH_MAX) return stream_fail(s, "corrupt archive: entry path too long");
+        if (avail < fixed + path_len) return 0;
+
+        struct file_rec *rec = &s->recs[s->parsed];
+        rec->size = get_u64_le(e + 4);
+        rec->stored = v2 ? get_u64_le(e + 12) : rec->size;
+        rec->offset = get_u64_le(e + (v2 ? 20 : 12));
+        rec->flags = get_u32_le(e + (v2 ? 28 : 20));
+        if (!v2) rec->flags &= ~(uint32_t)ENTRY_ZSTD;
+        if (s->digests) memcpy(rec->digest, e + fixed - DIGEST_LEN, DIGEST_LEN);
+        if (path_len) {
+            char raw[PATH_MAX];
+            memcpy(raw, e + fixed, path_len);
+            raw[path_len] = '\0';
+            rec->path = sanitize_relpath(raw);
+        }
+        s->table_pos += fixed + path_len;
+        s->parsed++;
+    }
+    return stream_plan(s);
+}
 
-        if (recs[i].flags & 0x1) {
-            /* symlink: read target bytes */
-            char *buf = malloc(recs[i].size + 1);
-            if (!buf) die("malloc");
-            if (recs[i].size > 0) {
-                if (fread(buf, 1, recs[i].size, in) != recs[i].size) die("read symlink target failed");
-            }
-            buf[recs[i].size] = '\0';
-            unlink(outpath);
-            if (symlink(buf, outpath) < 0)
-                die("symlink '%s' -> '%s' failed: %s", outpath, buf, strerror(errno));
-            free(buf);
-        } else {
-            /* regular file: stream bytes */
-            FILE *out = fopen(outpath, "wb");
-            if (!out) die("fopen '%s': %s", outpath, strerror(errno));
-            uint64_t remaining = recs[i].size;
-            char buf[65536];
-            while (remaining > 0) {
-                size_t toread = remaining > sizeof(buf) ? sizeof(buf) : (size_t)remaining;
-                if (fread(buf, 1, toread, in) != toread) die("read blob failed");
-                if (fwrite(buf, 1, toread, out) != toread) die("write out failed");
-                remaining -= toread;
-            }
-            if (fclose(out) != 0) die("fclose failed for '%s'", outpath);
+static int stream_begin(arch_stream *s, const struct stream_item *it) {
+    s->active = true;
+    s->got = 0;
+    s->linked = false;
+    /* sizes checked in stream_plan */
+    if (it->entry == NO_ENTRY) {
+        if (!(s->buf = malloc((size_t)it->stored))) return stream_fail(s, "out of memory");
+        return 0;
+    }
+    const struct file_rec *rec = &s->recs[it->entry];
+    const char *outpath = s->outpaths[it->entry];
+    if (rec->flags & ENTRY_SYMLINK) {
+        if (!(s->buf = malloc((size_t)rec->size + 1))) return stream_fail(s, "out of memory");
+        return 0;
+    }
+    if (s->digests && s->objects) {
+        char fanout[PATH_MAX], object[PATH_MAX];
+        int linked = object_paths(s->objects, rec, fanout, object) == 0 ? link_object(rec, object, outpath) : -1;
+        if (linked < 0) {
+            s->failed = true;
+            return -1;
         }
+        if ((s->linked = linked)) return 0;
+    }
+    if (rec->flags & ENTRY_ZSTD) {
+#ifdef WITH_ZSTD
+        if (!s->dctx && !(s->dctx = ZSTD_createDCtx())) return stream_fail(s, "out of memory");
+        if (!s->zbuf && !(s->zbuf = malloc(STREAM_CHUNK))) return stream_fail(s, "out of memory");
+        ZSTD_DCtx_reset(s->dctx, ZSTD_reset_session_only);
+        if (s->ddict) ZSTD_DCtx_refDDict(s->dctx, s->ddict);
+        s->produced = 0;
+        s->zleft = 1;
+#else
+        return stream_fail(s, "'%s' is zstd-compressed; arch was built without WITH_ZSTD", outpath);
+#endif
+    }
+    s->out_fd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (s->out_fd < 0) return stream_fail(s, "open '%s': %s", outpath, strerror(errno));
+    sha256_init(&s->hash);
+    return 0;
+}
 
-        if (fprintf(manifest, "%s\n", recs[i].path) < 0)
-            die("write to manifest failed");
+static int stream_data(arch_stream *s, const struct stream_item *it, const char *data, size_t len) {
+    if (it->entry == NO_ENTRY || (s->recs[it->entry].flags & ENTRY_SYMLINK)) {
+        memcpy(s->buf + s->got, data, len);
+        return 0;
+    }
+    if (s->linked) return 0;
+#ifdef WITH_ZSTD
+    const struct file_rec *rec = &s->recs[it->entry];
+    if (rec->flags & ENTRY_ZSTD) {
+        const char *outpath = s->outpaths[it->entry];
+        ZSTD_inBuffer in = { data, len, 0 };
+        while (in.pos < in.size) {
+            ZSTD_outBuffer out = { s->zbuf, STREAM_CHUNK, 0 };
+            s->zleft = ZSTD_decompressStream(s->dctx, &out, &in);
+            if (ZSTD_isError(s->zleft))
+                return stream_fail(s, "zstd: '%s': %s", outpath, ZSTD_getErrorName(s->zleft));
+            if (out.pos > rec->size - s->produced)
+                return stream_fail(s, "corrupt archive: '%s' inflates past its size", outpath);
+            if (pwrite_all(s->out_fd, s->zbuf, out.pos, (off_t)s->produced) != 0)
+                return stream_fail(s, "write '%s': %s", outpath, strerror(errno));
+            sha256_update(&s->hash, s->zbuf, out.pos);
+            s->produced += out.pos;
+        }
+        return 0;
+    }
+#endif
+    if (pwrite_all(s->out_fd, data, len, (off_t)s->got) != 0)
+        return stream_fail(s, "write '%s': %s", s->outpaths[it->entry], strerror(errno));
+    sha256_update(&s->hash, data, len);
+    return 0;
+}
 
-        printf("extracted: %s\n", outpath);
+static int stream_end(arch_stream *s, const struct stream_item *it) {
+    s->active = false;
+    if (it->entry == NO_ENTRY) {
+#ifdef WITH_ZSTD
+        s->ddict = ZSTD_createDDict(s->buf, (size_t)it->stored);
+        if (!s->ddict) return stream_fail(s, "zstd: cannot load archive dictionary");
+#endif
+        free(s->buf);
+        s->buf = NULL;
+        return 0;
+    }
+    const struct file_rec *rec = &s->recs[it->entry];
+    const char *outpath = s->outpaths[it->entry];
+    if (rec->flags & ENTRY_SYMLINK) {
+        s->buf[rec->size] = '\0';
+        unlink(outpath);
+        if (symlink(s->buf, outpath) < 0)
+            return stream_fail(s, "symlink '%s' -> '%s' failed: %s", outpath, s->buf, strerror(errno));
+        free(s->buf);
+        s->buf = NULL;
+        return 0;
     }
+    if (s->linked) return 0;
+
+    int fd = s->out_fd;
+    s->out_fd = -1;
+    if (close(fd) != 0) return stream_fail(s, "close failed for '%s': %s", outpath, strerror(errno));
+#ifdef WITH_ZSTD
+    if ((rec->flags & ENTRY_ZSTD) && (s->zleft != 0 || s->produced != rec->size))
+        return stream_fail(s, "corrupt archive: '%s' is truncated", outpath);
+#endif
+    if (s->digests) {
+        uint8_t digest[DIGEST_LEN];
+        sha256_final(&s->hash, digest);
+        if (memcmp(digest, rec->digest, DIGEST_LEN) != 0)
+            return stream_fail(s, "corrupt archive: '%s' does not match its recorded sha256", outpath);
+        if (s->objects) {
+            char fanout[PATH_MAX], object[PATH_MAX];
+            if (object_paths(s->objects, rec, fanout, object) == 0) publish_object(fanout, object, outpath);
+        }
+    }
+    return 0;
+}
 
-    if (fclose(manifest) != 0)
-        die("fclose manifest failed");
+/* Feed blob bytes, which start at archive offset s->pos. */
+static int stream_blobs(arch_stream *s, const char *data, size_t len) {
+    while (s->cur < s->nitems) {
+        const struct stream_item *it = &s->items[s->cur];
+        if (s->pos < it->offset) {
+            uint64_t gap = it->offset - s->pos;
+            size_t skip = gap < len ? (size_t)gap : len;
+            data += skip;
+            len -= skip;
+            s->pos += skip;
+            if (s->pos < it->offset) return 0;
+        }
+        if (!s->active && stream_begin(s, it) != 0) return -1;
+        uint64_t want = it->stored - s->got;
+        size_t take = want < len ? (size_t)want : len;
+        if (take && stream_data(s, it, data, take) != 0) return -1;
+        data += take;
+        len -= take;
+        s->pos += take;
+        s->got += take;
+        if (s->got < it->stored) return 0;
+        if (stream_end(s, it) != 0) return -1;
+        s->cur++;
+    }
+    return 0;   /* anything after the last blob is not ours to interpret */
+}
 
-    for (uint64_t i = 0; i < entry_count; ++i) {
-        if (recs[i].path) free(recs[i].path);
+static int stream_feed(arch_stream *s, const char *data, size_t len) {
+    if (s->have_table) return stream_blobs(s, data, len);
+
+    /* the table is parsed as it arrives, so by now it has not ended within
+       STREAM_HEAD_MAX (the last write may overshoot by its own length) */
+    if (s->head_len >= STREAM_HEAD_MAX) return stream_fail(s, "archive table is too large to stream");
+    if (len > s->head_cap - s->head_len) {
+        size_t cap = s->head_cap ? s->head_cap : 65536;
+        while (cap - s->head_len < len) cap *= 2;
+        unsigned char *head = realloc(s->head, cap);
+        if (!head) return stream_fail(s, "out of memory");
+        s->head = head;
+        s->head_cap = cap;
     }
-    free(recs);
-    fclose(in);
+    memcpy(s->head + s->head_len, data, len);
+    s->head_len += len;
+    if (stream_parse_head(s) != 0) return -1;
+    if (!s->have_table) return 0;
+
+    /* the rest of what has arrived is blob data; the table is not needed again */
+    int rc = stream_blobs(s, (const char *)s->head + s->table_pos, s->head_len - s->table_pos);
+    free(s->head);
+    s->head = NULL;
+    s->head_len = s->head_cap = 0;
+    return rc;
+}
+
+static ssize_t stream_write(void *cookie, const char *buf, size_t len) {
+    arch_stream *s = cookie;
+    if (s->failed || stream_feed(s, buf, len) != 0) return -1;
+    return (ssize_t)len;
+}
+
+arch_stream *arch_stream_open(const char *destdir, const char *objects, int flags) {
+    arch_stream *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    strncpy(s->dest, destdir, sizeof(s->dest) - 1);
+    if (ensure_destdir(s->dest) != 0) {
+        free(s);
+        return NULL;
+    }
+    if (objects && mkdir_p(objects, 0755) < 0) {
+        fail("mkdir '%s': %s", objects, strerror(errno));
+        free(s);
+        return NULL;
+    }
+    s->objects = objects ? strdup(objects) : NULL;
+    if (objects && !s->objects) {
+        free(s);
+        return NULL;
+    }
+    s->flags = flags;
+    s->out_fd = -1;
+
+    static const cookie_io_functions_t io = { .write = stream_write };
+    s->input = fopencookie(s, "wb", io);
+    if (!s->input) {
+        free(s->objects);
+        free(s);
+        return NULL;
+    }
+    /* each write goes straight to the parser instead of through a stdio copy */
+    setvbuf(s->input, NULL, _IONBF, 0);
+    return s;
+}
+
+FILE *arch_stream_input(arch_stream *s) {
+    return s->input;
+}
+
+int arch_stream_close(arch_stream *s, arch_stats *stats) {
+    if (fclose(s->input) != 0) s->failed = true;
+    if (!s->failed && (!s->have_table || s->cur < s->nitems))
+        stream_fail(s, "archive is truncated");
+    if (!s->failed && !s->entry_count) fprintf(stderr, "empty archive\n");
+    else if (!s->failed && write_manifest(s->dest, s->recs, s->outpaths, s->entry_count, s->flags, stats) != 0)
+        s->failed = true;
+
+    int rc = s->failed ? -1 : 0;
+    if (s->out_fd >= 0) close(s->out_fd);
+    for (uint64_t i = 0; s->recs && i < s->entry_count; ++i) {
+        free(s->recs[i].path);
+        if (s->outpaths) free(s->outpaths[i]);
+    }
+    free(s->recs);
+    free(s->outpaths);
+    free(s->items);
+    free(s->head);
+    free(s->buf);
+    free(s->objects);
+#ifdef WITH_ZSTD
+    ZSTD_freeDCtx(s->dctx);
+    ZSTD_freeDDict(s->ddict);
+    free(s->zbuf);
+#endif
+    free(s);
+    return rc;
 }
 
 #ifndef PANDORA
+static int do_unpack(int argc, char **argv) {
+    int jobs = 1;
+    int flags = 0;
+    const char *objects = NULL;
+    while (argc >= 3 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-q") == 0) {
+            flags |= ARCH_QUIET;
+            argv++;
+            argc--;
+            continue;
+        }
+        if (strcmp(argv[1], "-j") == 0) {
+            jobs = atoi(argv[2]);
+            if (jobs < 1) die("unpack: -j needs a positive job count");
+        } else if (strcmp(argv[1], "-O") == 0) {
+            objects = argv[2];
+        } else {
+            die("unpack: unknown option '%s'", argv[1]);
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc < 2) die("unpack requires: unpack [-q] [-j jobs] [-O objects] <archive.pnd> [destdir]");
+    return unpack_archive(argv[1], argc >= 3 ? argv[2] : NULL, jobs, objects, flags, NULL);
+}
+
+/* list: one "size path" line per entry, in table order */
+static void do_list(int argc, char **argv) {
+    if (argc < 2) die("list requires: list <archive.pnd>");
+    arch_reader *r = arch_open(argv[1]);
+    if (!r) exit(EXIT_FAILURE);
+    for (size_t i = 0; i < arch_count(r); ++i) {
+        arch_entry e;
+        if (arch_entry_at(r, i, &e) != 0) die("corrupt archive: bad entry %zu", i);
+        printf("%10" PRIu64 " %.*s%s\n", e.size, (int)e.path_len, e.path, e.symlink ? "@" : "");
+    }
+    arch_close(r);
+}
+
+/* cat: write one entry to stdout without extracting the rest */
+static void do_cat(int argc, char **argv) {
+    if (argc < 3) die("cat requires: cat <archive.pnd> <path>");
+    arch_reader *r = arch_open(argv[1]);
+    if (!r) exit(EXIT_FAILURE);
+    arch_entry e;
+    if (arch_find(r, argv[2], &e) != 0) die("'%s' is not in %s", argv[2], argv[1]);
+    size_t len = 0;
+    char *buf = arch_read(r, &e, &len);
+    if (!buf) exit(EXIT_FAILURE);
+    if (fwrite(buf, 1, len, stdout) != len) die("write failed");
+    free(buf);
+    arch_close(r);
+}
+
+/* delta: a patch rebuilding new.pkg from the tree base.pkg unpacks to */
+static void do_delta(int argc, char **argv) {
+    if (argc < 4) die("delta requires: delta <base.pnd> <new.pnd> <out.pdelta>");
+    if (delta_create(argv[1], argv[2], argv[3]) != 0) exit(EXIT_FAILURE);
+}
+
+/* patch: apply a delta to an unpacked base tree */
+static void do_patch(int argc, char **argv) {
+    if (argc < 4) die("patch requires: patch <delta.pdelta> <base-dir> <out.pnd>");
+    uint8_t digest[32];
+    if (delta_apply(argv[1], argv[2], argv[3], digest) != 0) {
+        unlink(argv[3]);
+        exit(EXIT_FAILURE);
+    }
+    char hex[65];
+    sha256_to_hex(digest, hex);
+    printf("%s  %s\n", hex, argv[3]);
+}
+
 /* main: simple CLI dispatch */
 int main(int argc, char **argv) {
     if (argc < 2) {
-        fprintf(stderr, "usage:\n  %s pack <archive.pnd> <file-or-dir>...\n  %s unpack <archive.pnd> [destdir]\n", argv[0], argv[0]);
+        fprintf(stderr, "usage:\n  %s pack [-z[level]] [-D] [-j jobs] <archive.pnd> <file-or-dir>...\n  %s unpack [-q] [-j jobs] [-O objects] <archive.pnd> [destdir]\n"
+                        "  %s list <archive.pnd>\n  %s cat <archive.pnd> <path>\n"
+                        "  %s delta <base.pnd> <new.pnd> <out.pdelta>\n  %s patch <delta.pdelta> <base-dir> <out.pnd>\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
         return EXIT_FAILURE;
     }
     if (strcmp(argv[1], "pack") == 0) {
         /* shift argv so pack sees argv[1]=archive */
         do_pack(argc - 1, argv + 1);
     } else if (strcmp(argv[1], "unpack") == 0) {
-        do_unpack(argc - 1, argv + 1);
+        if (do_unpack(argc - 1, argv + 1) != 0) return EXIT_FAILURE;
+    } else if (strcmp(argv[1], "list") == 0) {
+        do_list(argc - 1, argv + 1);
+    } else if (strcmp(argv[1], "cat") == 0) {
+        do_cat(argc - 1, argv + 1);
+    } else if (strcmp(argv[1], "delta") == 0) {
+        do_delta(argc - 1, argv + 1);
+    } else if (strcmp(argv[1], "patch") == 0) {
+        do_patch(argc - 1, argv + 1);
     } else {
         fprintf(stderr, "unknown command '%s'\n", argv[1]);
         return EXIT_FAILURE;
@@ -0,0 +1,699 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "core/cindex.h"
+#include "core/acl.h"
+
+#define CINDEX_MAGIC "PNDIDX\0\1"
+#define CINDEX_MAGIC_LEN 8
+#define CINDEX_VERSION 3
+#define CINDEX_EMPTY 0
+
+#define REC_DEPRECATED 0x1
+
+/* On-disk layout: header, then the arrays at the recorded offsets.
+   String fields are offsets into the string table (0 is the empty string). */
+struct cindex_header {
+    char magic[CINDEX_MAGIC_LEN];
+    uint32_t version;
+    uint32_t nrecs;
+    uint32_t npkgs;
+    uint32_t nslots;        /* power of two; open addressing, linear probing */
+    uint32_t ndeltas;
+    uint32_t reserved;
+    int64_t src_mtime;
+    uint64_t src_size;
+    int64_t ttl;
+    uint64_t recs_off;
+    uint64_t pkgs_off;
+    uint64_t slots_off;     /* u32 record index + 1, CINDEX_EMPTY if free */
+    uint64_t deltas_off;
+    uint64_t strings_off;
+    uint64_t strings_len;
+    uint32_t ngrams;
+    uint32_t npostings;
+    uint64_t grams_off;     /* struct cindex_gram, sorted by gram */
+    uint64_t postings_off;  /* u32 package indices, ascending within each gram */
+};
+
+struct cindex_rec {
+    uint64_t hash;
+    uint32_t pkg;           /* owning package */
+    uint32_t version;
+    uint32_t manifest_url;
+    uint32_t pkg_url;
+    uint32_t sha256;
+    uint32_t flags;
+    uint32_t first_delta;
+    uint32_t ndeltas;
+};
+
+struct cindex_delta_rec {
+    uint32_t base_version;
+    uint32_t url;
+    uint32_t sha256;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+struct cindex_pkg {
+    uint32_t name;
+    uint32_t latest;
+    uint32_t first;
+    uint32_t count;
+    uint32_t description;
+    uint32_t tags;
+};
+
+/* Search index: every lowercased 3-byte run of a package's name, tags or
+   description, with the packages it occurs in. */
+struct cindex_gram {
+    uint32_t gram;          /* bytes b0 b1 b2 as b0 << 16 | b1 << 8 | b2 */
+    uint32_t first;         /* into postings */
+    uint32_t count;
+};
+
+struct cindex {
+    void *map;
+    size_t map_len;
+    const struct cindex_header *hdr;
+    const struct cindex_rec *recs;
+    const struct cindex_pkg *pkgs;
+    const uint32_t *slots;
+    const struct cindex_delta_rec *deltas;
+    const char *strings;
+    const struct cindex_gram *grams;
+    const uint32_t *postings;
+    cindex_source src;
+};
+
+/* FNV-1a over "name\0version" */
+static uint64_t entry_hash(const char *name, const char *version) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char *p = name; *p; ++p) h = (h ^ (uint8_t)*p) * 1099511628211ULL;
+    h = (h ^ 0) * 1099511628211ULL;
+    for (const char *p = version; *p; ++p) h = (h ^ (uint8_t)*p) * 1099511628211ULL;
+    return h;
+}
+
+/* ---- building ---- */
+
+struct strtab {
+    char *buf;
+    size_t len, cap;
+};
+
+static uint32_t strtab_add(struct strtab *t, const char *s) {
+    if (!s || !*s) return 0;
+    size_t n = strlen(s) + 1;
+    if (t->len + n > t->cap) {
+        size_t cap = t->cap ? t->cap : 4096;
+        while (t->len + n > cap) cap *= 2;
+        char *nb = realloc(t->buf, cap);
+        if (!nb) return UINT32_MAX;
+        t->buf = nb;
+        t->cap = cap;
+    }
+    memcpy(t->buf + t->len, s, n);
+    uint32_t off = (uint32_t)t->len;
+    t->len += n;
+    return off;
+}
+
+static const char *field_value(const AclBlock *b, const char *name) {
+    for (const AclField *f = b->fields; f; f = f->next) {
+        if (f->name && strcmp(f->name, name) == 0) return f->value;
+    }
+    return NULL;
+}
+
+struct build_pkg {
+    const char *name;
+    const AclBlock *block;
+};
+
+static int cmp_build_pkg(const void *a, const void *b) {
+    return strcmp(((const struct build_pkg*)a)->name, ((const struct build_pkg*)b)->name);
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/* ASCII case folding: names, tags and queries are matched case-insensitively */
+static unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+static uint32_t gram_at(const char *s) {
+    return (uint32_t)fold((unsigned char)s[0]) << 16 | (uint32_t)fold((unsigned char)s[1]) << 8
+         | fold((unsigned char)s[2]);
+}
+
+#define GRAM_FREE UINT32_MAX   /* grams only use 24 bits */
+
+/* distinct grams while building, open addressing */
+struct gram_slot {
+    uint32_t gram;
+    uint32_t count;     /* packages counted so far */
+    uint32_t first;     /* into postings, once counting is done */
+    uint32_t seen;      /* package index + 1 last counted, so each counts once */
+};
+
+struct gram_table {
+    struct gram_slot *slots;
+    uint32_t cap;       /* power of two */
+    uint32_t used;
+};
+
+static struct gram_slot *gram_slot(const struct gram_table *t, uint32_t gram) {
+    uint32_t mask = t->cap - 1;
+    for (uint32_t i = (gram * 2654435761u) & mask;; i = (i + 1) & mask) {
+        if (t->slots[i].gram == gram || t->slots[i].gram == GRAM_FREE) return &t->slots[i];
+    }
+}
+
+static int gram_grow(struct gram_table *t) {
+    uint32_t cap = t->cap ? t->cap * 2 : 4096;
+    struct gram_slot *slots = malloc((size_t)cap * sizeof(*slots));
+    if (!slots) return -1;
+    for (uint32_t i = 0; i < cap; ++i) slots[i].gram = GRAM_FREE;
+    struct gram_table grown = { slots, cap, t->used };
+    for (uint32_t i = 0; i < t->cap; ++i) {
+        if (t->slots[i].gram != GRAM_FREE) *gram_slot(&grown, t->slots[i].gram) = t->slots[i];
+    }
+    free(t->slots);
+    *t = grown;
+    return 0;
+}
+
+/* Count pkg once under every gram of text, or, once postings is allocated
+   and the counts turned into offsets, file it there. Packages come in
+   index order, so every posting list ends up ascending. */
+static int add_grams(struct gram_table *t, const char *text, uint32_t pkg, uint32_t *postings) {
+    size_t n = text ? strlen(text) : 0;
+    for (size_t i = 0; i + 3 <= n; ++i) {
+        if (!postings && (t->used + 1) * 2 > t->cap && gram_grow(t) != 0) return -1;
+        struct gram_slot *g = gram_slot(t, gram_at(text + i));
+        if (g->gram == GRAM_FREE) {
+            *g = (struct gram_slot){ gram_at(text + i), 0, 0, 0 };
+            t->used++;
+        }
+        if (g->seen == pkg + 1) continue;
+        g->seen = pkg + 1;
+        if (postings) postings[g->first + g->count] = pkg;
+        if (g->count == UINT32_MAX) return -1;
+        g->count++;
+    }
+    return 0;
+}
+
+static int cmp_gram_slot(const void *a, const void *b) {
+    uint32_t x = (*(const struct gram_slot *const *)a)->gram, y = (*(const struct gram_slot *const *)b)->gram;
+    return x < y ? -1 : x > y;
+}
+
+/* The search section for pkgs (already sorted by name): *grams sorted by
+   gram, each pointing at its run of *postings. Returns 0 or -1. */
+static int build_grams(const struct build_pkg *bp, size_t npkgs, struct cindex_gram **grams, uint32_t *ngrams,
+                       uint32_t **postings, uint32_t *npostings) {
+    static const char *const fields[] = { "tags", "description" };
+    struct gram_table t = {0};
+    struct gram_slot **order = NULL;
+    int rc = -1;
+    *grams = NULL;
+    *postings = NULL;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < npkgs; ++i) {
+            if (add_grams(&t, bp[i].name, (uint32_t)i, *postings) != 0) goto out;
+            for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); ++f) {
+                if (add_grams(&t, field_value(bp[i].block, fields[f]), (uint32_t)i, *postings) != 0) goto out;
+            }
+        }
+        if (pass == 1) break;
+
+        /* counts to offsets, in gram order */
+        order = malloc((t.used ? t.used : 1) * sizeof(*order));
+        *grams = malloc((t.used ? t.used : 1) * sizeof(**grams));
+        if (!order || !*grams) goto out;
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < t.cap; ++i) {
+            if (t.slots[i].gram != GRAM_FREE) order[n++] = &t.slots[i];
+        }
+        qsort(order, n, sizeof(*order), cmp_gram_slot);
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            order[i]->first = (uint32_t)total;
+            total += order[i]->count;
+            if (total > UINT32_MAX) goto out;
+            order[i]->count = 0;
+            order[i]->seen = 0;
+        }
+        *postings = malloc((total ? total : 1) * sizeof(**postings));
+        if (!*postings) goto out;
+        *npostings = (uint32_t)total;
+    }
+    for (uint32_t i = 0; i < t.used; ++i)
+        (*grams)[i] = (struct cindex_gram){ order[i]->gram, order[i]->first, order[i]->count };
+    *ngrams = t.used;
+    rc = 0;
+
+out:
+    if (rc != 0) {
+        free(*grams);
+        free(*postings);
+        *grams = NULL;
+        *postings = NULL;
+    }
+    free(order);
+    free(t.slots);
+    return rc;
+}
+
+static const AclBlock *find_registry(const AclBlock *tree) {
+    for (const AclBlock *b = tree; b; b = b->next) {
+        if (b->name && strcmp(b->name, "Registry") == 0) return b;
+    }
+    return NULL;
+}
+
+static int is_package(const AclBlock *b) {
+    return b->name && strcmp(b->name, "Package") == 0 && b->label;
+}
+
+static int is_delta(const AclBlock *b) {
+    return b->name && strcmp(b->name, "Delta") == 0 && b->label;
+}
+
+int cindex_build(AclBlock *const trees[], size_t ntrees, const cindex_source *src, const char *out_path) {
+    /* count packages across every tree, then sort them by name so listing and search walk them in order */
+    size_t npkgs = 0, nrecs = 0, ndeltas = 0;
+    for (size_t t = 0; t < ntrees; ++t) {
+        const AclBlock *registry = find_registry(trees[t]);
+        if (!registry) {
+            fprintf(stderr, "index has no Registry block\n");
+            return -1;
+        }
+        for (const AclBlock *p = registry->children; p; p = p->next) {
+            if (!is_package(p)) continue;
+            npkgs++;
+            for (const AclBlock *v = p->children; v; v = v->next) {
+                if (!v->name || strcmp(v->name, "Version") != 0 || !v->label) continue;
+                nrecs++;
+                for (const AclBlock *d = v->children; d; d = d->next) ndeltas += is_delta(d);
+            }
+        }
+    }
+    if (npkgs > UINT32_MAX / 2 || nrecs > UINT32_MAX / 4 || ndeltas > UINT32_MAX / 4) return -1;
+
+    struct build_pkg *bp = calloc(npkgs ? npkgs : 1, sizeof(*bp));
+    struct cindex_pkg *pkgs = calloc(npkgs ? npkgs : 1, sizeof(*pkgs));
+    struct cindex_rec *recs = calloc(nrecs ? nrecs : 1, sizeof(*recs));
+    struct cindex_delta_rec *deltas = calloc(ndeltas ? ndeltas : 1, sizeof(*deltas));
+    uint32_t nslots = 16;
+    while (nslots < nrecs * 2) nslots <<= 1;
+    uint32_t *slots = calloc(nslots, sizeof(*slots));
+    struct strtab st = {0};
+    struct cindex_gram *grams = NULL;
+    uint32_t *postings = NULL;
+    uint32_t ngrams = 0, npostings = 0;
+    int rc = -1;
+    if (!bp || !pkgs || !recs || !deltas || !slots) goto out;
+
+    size_t i = 0;
+    for (size_t t = 0; t < ntrees; ++t) {
+        for (const AclBlock *p = find_registry(trees[t])->children; p; p = p->next) {
+            if (!is_package(p)) continue;
+            bp[i].name = p->label;
+            bp[i].block = p;
+            i++;
+        }
+    }
+    qsort(bp, npkgs, sizeof(*bp), cmp_build_pkg);
+
+    /* offset 0 is the empty string */
+    st.cap = 4096;
+    if (!(st.buf = malloc(st.cap))) goto out;
+    st.buf[0] = '\0';
+    st.len = 1;
+
+    size_t r = 0, nd = 0;
+    for (i = 0; i < npkgs; ++i) {
+        pkgs[i].name = strtab_add(&st, bp[i].name);
+        pkgs[i].latest = strtab_add(&st, field_value(bp[i].block, "latest"));
+        pkgs[i].description = strtab_add(&st, field_value(bp[i].block, "description"));
+        pkgs[i].tags = strtab_add(&st, field_value(bp[i].block, "tags"));
+        pkgs[i].first = (uint32_t)r;
+        if (pkgs[i].name == UINT32_MAX || pkgs[i].latest == UINT32_MAX
+         || pkgs[i].description == UINT32_MAX || pkgs[i].tags == UINT32_MAX) goto out;
+
+        for (const AclBlock *v = bp[i].block->children; v; v = v->next) {
+            if (!v->name || strcmp(v->name, "Version") != 0 || !v->label) continue;
+            struct cindex_rec *rec = &recs[r];
+            const char *dep = field_value(v, "deprecated");
+            rec->hash = entry_hash(bp[i].name, v->label);
+            rec->pkg = (uint32_t)i;
+            rec->version = strtab_add(&st, v->label);
+            rec->manifest_url = strtab_add(&st, field_value(v, "manifest_url"));
+            rec->pkg_url = strtab_add(&st, field_value(v, "pkg_url"));
+            rec->sha256 = strtab_add(&st, field_value(v, "sha256"));
+            rec->flags = (dep && strcmp(dep, "true") == 0) ? REC_DEPRECATED : 0;
+            if (rec->version == UINT32_MAX || rec->manifest_url == UINT32_MAX
+             || rec->pkg_url == UINT32_MAX || rec->sha256 == UINT32_MAX) goto out;
+
+            /* Delta "base" { url; sha256; size; } children, in index order */
+            rec->first_delta = (uint32_t)nd;
+            for (const AclBlock *d = v->children; d; d = d->next) {
+                if (!is_delta(d)) continue;
+                struct cindex_delta_rec *dr = &deltas[nd++];
+                const char *size = field_value(d, "size");
+                dr->base_version = strtab_add(&st, d->label);
+                dr->url = strtab_add(&st, field_value(d, "url"));
+                dr->sha256 = strtab_add(&st, field_value(d, "sha256"));
+                dr->size = size ? strtoull(size, NULL, 10) : 0;
+                if (dr->base_version == UINT32_MAX || dr->url == UINT32_MAX || dr->sha256 == UINT32_MAX) goto out;
+            }
+            rec->ndeltas = (uint32_t)nd - rec->first_delta;
+
+            uint32_t s = (uint32_t)rec->hash & (nslots - 1);
+            while (slots[s] != CINDEX_EMPTY) s = (s + 1) & (nslots - 1);
+            slots[s] = (uint32_t)r + 1;
+            r++;
+        }
+        pkgs[i].count = (uint32_t)r - pkgs[i].first;
+    }
+
+    if (build_grams(bp, npkgs, &grams, &ngrams, &postings, &npostings) != 0) goto out;
+
+    struct cindex_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CINDEX_MAGIC, CINDEX_MAGIC_LEN);
+    hdr.version = CINDEX_VERSION;
+    hdr.nrecs = (uint32_t)nrecs;
+    hdr.npkgs = (uint32_t)npkgs;
+    hdr.nslots = nslots;
+    hdr.ndeltas = (uint32_t)ndeltas;
+    hdr.src_mtime = src->mtime;
+    hdr.src_size = src->size;
+    hdr.ttl = src->ttl;
+    hdr.recs_off = sizeof(hdr);
+    hdr.pkgs_off = hdr.recs_off + nrecs * sizeof(*recs);
+    hdr.slots_off = hdr.pkgs_off + npkgs * sizeof(*pkgs);
+    hdr.deltas_off = hdr.slots_off + (uint64_t)nslots * sizeof(*slots);
+    hdr.strings_off = hdr.deltas_off + ndeltas * sizeof(*deltas);
+    hdr.strings_len = st.len;
+    hdr.ngrams = ngrams;
+    hdr.npostings = npostings;
+    hdr.grams_off = hdr.strings_off + st.len;
+    hdr.grams_off = (hdr.grams_off + 7) & ~(uint64_t)7;   /* keep the arrays aligned */
+    hdr.postings_off = hdr.grams_off + (uint64_t)ngrams * sizeof(*grams);
+    static const char pad[8];
+
+    char tmp_path[1024];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path) >= (int)sizeof(tmp_path)) goto out;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "open %s: %s\n", tmp_path, strerror(errno));
+        goto out;
+    }
+    if (write_all(fd, &hdr, sizeof(hdr)) != 0
+     || write_all(fd, recs, nrecs * sizeof(*recs)) != 0
+     || write_all(fd, pkgs, npkgs * sizeof(*pkgs)) != 0
+     || write_all(fd, slots, (size_t)nslots * sizeof(*slots)) != 0
+     || write_all(fd, deltas, ndeltas * sizeof(*deltas)) != 0
+     || write_all(fd, st.buf, st.len) != 0
+     || write_all(fd, pad, (size_t)(hdr.grams_off - hdr.strings_off - st.len)) != 0
+     || write_all(fd, grams, (size_t)ngrams * sizeof(*grams)) != 0
+     || write_all(fd, postings, (size_t)npostings * sizeof(*postings)) != 0) {
+        fprintf(stderr, "write %s: %s\n", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        goto out;
+    }
+    if (close(fd) != 0 || rename(tmp_path, out_path) != 0) {
+        fprintf(stderr, "publish %s: %s\n", out_path, strerror(errno));
+        unlink(tmp_path);
+        goto out;
+    }
+    rc = 0;
+
+out:
+    free(bp);
+    free(pkgs);
+    free(recs);
+    free(deltas);
+    free(slots);
+    free(st.buf);
+    free(grams);
+    free(postings);
+    return rc;
+}
+
+/* ---- reading ---- */
+
+cindex *cindex_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(struct cindex_header)) {
+        close(fd);
+        return NULL;
+    }
+    size_t len = (size_t)sb.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const struct cindex_header *h = map;
+    /* every array must lie inside the file and the string table must end in NUL */
+    int ok = memcmp(h->magic, CINDEX_MAGIC, CINDEX_MAGIC_LEN) == 0
+          && h->version == CINDEX_VERSION
+          && h->nslots && (h->nslots & (h->nslots - 1)) == 0
+          && h->recs_off + (uint64_t)h->nrecs * sizeof(struct cindex_rec) <= len
+          && h->pkgs_off + (uint64_t)h->npkgs * sizeof(struct cindex_pkg) <= len
+          && h->slots_off + (uint64_t)h->nslots * sizeof(uint32_t) <= len
+          && h->deltas_off + (uint64_t)h->ndeltas * sizeof(struct cindex_delta_rec) <= len
+          && h->strings_len > 0
+          && h->strings_off + h->strings_len <= len
+          && ((const char*)map)[h->strings_off + h->strings_len - 1] == '\0'
+          && h->grams_off + (uint64_t)h->ngrams * sizeof(struct cindex_gram) <= len
+          && h->postings_off + (uint64_t)h->npostings * sizeof(uint32_t) <= len;
+    cindex *ci = ok ? calloc(1, sizeof(*ci)) : NULL;
+    if (!ci) {
+        munmap(map, len);
+        return NULL;
+    }
+    ci->map = map;
+    ci->map_len = len;
+    ci->hdr = h;
+    ci->recs = (const struct cindex_rec*)((const char*)map + h->recs_off);
+    ci->pkgs = (const struct cindex_pkg*)((const char*)map + h->pkgs_off);
+    ci->slots = (const uint32_t*)((const char*)map + h->slots_off);
+    ci->deltas = (const struct cindex_delta_rec*)((const char*)map + h->deltas_off);
+    ci->strings = (const char*)map + h->strings_off;
+    ci->grams = (const struct cindex_gram*)((const char*)map + h->grams_off);
+    ci->postings = (const uint32_t*)((const char*)map + h->postings_off);
+    ci->src.mtime = h->src_mtime;
+    ci->src.size = h->src_size;
+    ci->src.ttl = h->ttl;
+    return ci;
+}
+
+void cindex_close(cindex *ci) {
+    if (!ci) return;
+    munmap(ci->map, ci->map_len);
+    free(ci);
+}
+
+const cindex_source *cindex_source_of(const cindex *ci) {
+    return &ci->src;
+}
+
+int cindex_touch(const char *path, const cindex_source *src) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) return -1;
+    struct cindex_header h;
+    int rc = 0;
+    if (pwrite(fd, &src->mtime, sizeof(h.src_mtime), offsetof(struct cindex_header, src_mtime)) != sizeof(h.src_mtime)
+     || pwrite(fd, &src->ttl, sizeof(h.ttl), offsetof(struct cindex_header, ttl)) != sizeof(h.ttl))
+        rc = -1;
+    if (close(fd) != 0) rc = -1;
+    return rc;
+}
+
+static const char *str_at(const cindex *ci, uint32_t off) {
+    return off < ci->hdr->strings_len ? ci->strings + off : "";
+}
+
+static void fill_entry(const cindex *ci, const struct cindex_rec *rec, cindex_entry *out) {
+    out->name = rec->pkg < ci->hdr->npkgs ? str_at(ci, ci->pkgs[rec->pkg].name) : "";
+    out->version = str_at(ci, rec->version);
+    out->manifest_url = str_at(ci, rec->manifest_url);
+    out->pkg_url = str_at(ci, rec->pkg_url);
+    out->sha256 = str_at(ci, rec->sha256);
+    out->deprecated = (rec->flags & REC_DEPRECATED) != 0;
+    out->first_delta = rec->first_delta;
+    out->ndeltas = rec->ndeltas;
+}
+
+int cindex_find(const cindex *ci, const char *name, const char *version, cindex_entry *out) {
+    uint64_t h = entry_hash(name, version);
+    uint32_t mask = ci->hdr->nslots - 1;
+    for (uint32_t s = (uint32_t)h & mask, n = 0; n < ci->hdr->nslots; s = (s + 1) & mask, ++n) {
+        uint32_t v = ci->slots[s];
+        if (v == CINDEX_EMPTY) return -1;
+        if (v - 1 >= ci->hdr->nrecs) return -1;
+        const struct cindex_rec *rec = &ci->recs[v - 1];
+        if (rec->hash != h) continue;
+        fill_entry(ci, rec, out);
+        if (strcmp(out->name, name) == 0 && strcmp(out->version, version) == 0) return 0;
+    }
+    return -1;
+}
+
+size_t cindex_package_count(const cindex *ci) {
+    return ci->hdr->npkgs;
+}
+
+int cindex_package_at(const cindex *ci, size_t i, cindex_package *out) {
+    if (i >= ci->hdr->npkgs) return -1;
+    const struct cindex_pkg *p = &ci->pkgs[i];
+    out->name = str_at(ci, p->name);
+    out->latest = str_at(ci, p->latest);
+    out->description = str_at(ci, p->description);
+    out->tags = str_at(ci, p->tags);
+    out->first = p->first;
+    out->count = p->count;
+    return 0;
+}
+
+int cindex_find_package(const cindex *ci, const char *name, cindex_package *out) {
+    size_t lo = 0, hi = ci->hdr->npkgs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(str_at(ci, ci->pkgs[mid].name), name);
+        if (c == 0) return cindex_package_at(ci, mid, out);
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+int cindex_version(const cindex *ci, const cindex_package *pkg, uint32_t i, cindex_entry *out) {
+    if (i >= pkg->count || (uint64_t)pkg->first + i >= ci->hdr->nrecs) return -1;
+    fill_entry(ci, &ci->recs[pkg->first + i], out);
+    return 0;
+}
+
+int cindex_delta_at(const cindex *ci, const cindex_entry *e, uint32_t i, cindex_delta *out) {
+    if (i >= e->ndeltas || (uint64_t)e->first_delta + i >= ci->hdr->ndeltas) return -1;
+    const struct cindex_delta_rec *d = &ci->deltas[e->first_delta + i];
+    out->base_version = str_at(ci, d->base_version);
+    out->url = str_at(ci, d->url);
+    out->sha256 = str_at(ci, d->sha256);
+    out->size = d->size;
+    return 0;
+}
+
+/* folded (lowercase) needle of length n in hay, ignoring case */
+static int contains_folded(const char *hay, const char *needle, size_t n) {
+    if (n == 0) return 1;
+    unsigned char c0 = (unsigned char)needle[0];
+    for (const unsigned char *p = (const unsigned char *)hay; *p; ++p) {
+        if (fold(*p) != c0) continue;
+        size_t i = 1;
+        while (i < n && p[i] && fold(p[i]) == (unsigned char)needle[i]) i++;
+        if (i == n) return 1;
+    }
+    return 0;
+}
+
+static int search_hit(const cindex *ci, size_t i, const char *q, size_t qn,
+                      void (*fn)(void *arg, const cindex_package *pkg), void *arg) {
+    cindex_package pkg;
+    if (cindex_package_at(ci, i, &pkg) != 0) return 0;
+    if (!contains_folded(pkg.name, q, qn) && !contains_folded(pkg.tags, q, qn)
+     && !contains_folded(pkg.description, q, qn)) return 0;
+    fn(arg, &pkg);
+    return 1;
+}
+
+static const struct cindex_gram *find_gram(const cindex *ci, uint32_t gram) {
+    size_t lo = 0, hi = ci->hdr->ngrams;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ci->grams[mid].gram == gram) {
+            const struct cindex_gram *g = &ci->grams[mid];
+            return (uint64_t)g->first + g->count <= ci->hdr->npostings ? g : NULL;
+        }
+        if (ci->grams[mid].gram < gram) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+static int cmp_gram_count(const void *a, const void *b) {
+    uint32_t x = (*(const struct cindex_gram *const *)a)->count, y = (*(const struct cindex_gram *const *)b)->count;
+    return x < y ? -1 : x > y;
+}
+
+size_t cindex_search(const cindex *ci, const char *query, void (*fn)(void *arg, const cindex_package *pkg), void *arg) {
+    size_t qn = strlen(query), hits = 0;
+    char *q = malloc(qn + 1);
+    const struct cindex_gram **lists = qn >= 3 ? malloc((qn - 2) * sizeof(*lists)) : NULL;
+    uint32_t *cursor = qn >= 3 ? calloc(qn - 2, sizeof(*cursor)) : NULL;
+    if (!q || (qn >= 3 && (!lists || !cursor))) goto out;
+    for (size_t i = 0; i <= qn; ++i) q[i] = (char)fold((unsigned char)query[i]);
+
+    if (qn < 3) {
+        /* too short for a gram: look at every package */
+        for (size_t i = 0; i < ci->hdr->npkgs; ++i) hits += search_hit(ci, i, q, qn, fn, arg);
+        goto out;
+    }
+
+    /* candidates hold every gram of the query; walk the rarest gram's list and
+       check the others with a cursor each, since all lists ascend */
+    size_t ng = qn - 2;
+    for (size_t i = 0; i < ng; ++i) {
+        if (!(lists[i] = find_gram(ci, gram_at(q + i)))) goto out;
+    }
+    qsort(lists, ng, sizeof(*lists), cmp_gram_count);
+    const uint32_t *rare = ci->postings + lists[0]->first;
+    for (uint32_t k = 0; k < lists[0]->count; ++k) {
+        uint32_t pkg = rare[k];
+        size_t j = 1;
+        for (; j < ng; ++j) {
+            const uint32_t *list = ci->postings + lists[j]->first;
+            while (cursor[j] < lists[j]->count && list[cursor[j]] < pkg) cursor[j]++;
+            if (cursor[j] == lists[j]->count) goto out;
+            if (list[cursor[j]] != pkg) break;
+        }
+        /* the grams can all be there without being adjacent: confirm */
+        if (j == ng) hits += search_hit(ci, pkg, q, qn, fn, arg);
+    }
+
+out:
+    free(q);
+    free(lists);
+    free(cursor);
+    return hits;
+}
@@ -0,0 +1,609 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "core/delta.h"
+#include "core/arch.h"
+#include "core/sha256.h"
+
+#define DELTA_MAGIC "PNDDLT\0\1"
+#define DELTA_MAGIC_LEN 8
+
+#define OP_END 0
+#define OP_LITERAL 1
+#define OP_FILE 2
+#define OP_PATCH 3
+#define CMD_COPY 1
+#define CMD_INSERT 2
+
+#define DELTA_BLOCK 32         /* match granularity of the patcher */
+#define DELTA_MAX_CHAIN 16     /* candidates tried per hash bucket */
+#define DELTA_MIN_ENTRY 256    /* smaller blobs are cheaper as literals */
+#define DELTA_IO_CHUNK (64 * 1024)
+
+/* ---- shared helpers ---- */
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+static void set_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+/* a path as unpack writes it: relative, no empty, "." or ".." components */
+static int clean_relpath(const char *p, size_t len) {
+    if (len == 0 || len >= PATH_MAX || p[0] == '/') return 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= len; ++i) {
+        if (i < len && p[i] == '\0') return 0;
+        if (i < len && p[i] != '/') continue;
+        size_t n = i - start;
+        if (n == 0 || (n == 1 && p[start] == '.') || (n == 2 && p[start] == '.' && p[start + 1] == '.')) return 0;
+        start = i + 1;
+    }
+    return 1;
+}
+
+/* ---- building ---- */
+
+struct dbuf {
+    uint8_t *p;
+    size_t n, cap;
+};
+
+static int dbuf_put(struct dbuf *b, const void *data, size_t len) {
+    if (b->n + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (b->n + len > cap) cap *= 2;
+        uint8_t *np = realloc(b->p, cap);
+        if (!np) return -1;
+        b->p = np;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->n, data, len);
+    b->n += len;
+    return 0;
+}
+
+static int dbuf_u8(struct dbuf *b, uint8_t v) {
+    return dbuf_put(b, &v, 1);
+}
+
+static int dbuf_u32(struct dbuf *b, uint32_t v) {
+    uint8_t p[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+    return dbuf_put(b, p, 4);
+}
+
+static int dbuf_u64(struct dbuf *b, uint64_t v) {
+    uint8_t p[8];
+    set_u64(p, v);
+    return dbuf_put(b, p, 8);
+}
+
+/* rolling checksum of one block, rsync style */
+struct roll {
+    uint32_t a, b;
+};
+
+static void roll_init(struct roll *r, const uint8_t *p) {
+    r->a = r->b = 0;
+    for (size_t i = 0; i < DELTA_BLOCK; ++i) {
+        r->a += p[i];
+        r->b += (uint32_t)(DELTA_BLOCK - i) * p[i];
+    }
+}
+
+static void roll_step(struct roll *r, uint8_t out, uint8_t in) {
+    r->a += (uint32_t)in - out;
+    r->b += r->a - (uint32_t)DELTA_BLOCK * out;
+}
+
+static uint32_t roll_key(const struct roll *r) {
+    uint32_t k = (r->a & 0xffff) | (r->b << 16);
+    return k ^ (k >> 15);
+}
+
+static int emit_insert(struct dbuf *out, size_t *ncmds, const uint8_t *p, size_t len) {
+    if (!len) return 0;
+    (*ncmds)++;
+    return dbuf_u8(out, CMD_INSERT) || dbuf_u64(out, len) || dbuf_put(out, p, len) ? -1 : 0;
+}
+
+/* Copy/insert commands turning base into target. Every DELTA_BLOCK-aligned
+   block of base is hashed; target is scanned with a rolling hash at every
+   offset, and each verified hit is extended both ways. */
+static int make_patch(const uint8_t *base, size_t bn, const uint8_t *t, size_t tn, struct dbuf *out, size_t *ncmds) {
+    *ncmds = 0;
+    size_t nblocks = bn / DELTA_BLOCK;
+    size_t nslots = 1;
+    while (nslots < nblocks * 2) nslots <<= 1;
+    size_t *head = malloc(nslots * sizeof(*head));
+    size_t *next = malloc((nblocks ? nblocks : 1) * sizeof(*next));
+    if (!head || !next) {
+        free(head);
+        free(next);
+        return -1;
+    }
+    for (size_t i = 0; i < nslots; ++i) head[i] = SIZE_MAX;
+    /* insert back to front so chains list earlier blocks first */
+    for (size_t j = nblocks; j-- > 0;) {
+        struct roll r;
+        roll_init(&r, base + j * DELTA_BLOCK);
+        size_t s = roll_key(&r) & (nslots - 1);
+        next[j] = head[s];
+        head[s] = j;
+    }
+
+    int rc = 0;
+    size_t i = 0, lit = 0;
+    struct roll r;
+    if (nblocks && tn >= DELTA_BLOCK) roll_init(&r, t);
+    while (rc == 0 && nblocks && i + DELTA_BLOCK <= tn) {
+        size_t best_len = 0, best_off = 0, tries = 0;
+        for (size_t j = head[roll_key(&r) & (nslots - 1)]; j != SIZE_MAX && tries < DELTA_MAX_CHAIN; j = next[j], ++tries) {
+            size_t off = j * DELTA_BLOCK;
+            if (memcmp(base + off, t + i, DELTA_BLOCK) != 0) continue;
+            size_t len = DELTA_BLOCK;
+            while (off + len < bn && i + len < tn && base[off + len] == t[i + len]) len++;
+            if (len > best_len) {
+                best_len = len;
+                best_off = off;
+            }
+        }
+        if (!best_len) {
+            if (i + DELTA_BLOCK < tn) roll_step(&r, t[i], t[i + DELTA_BLOCK]);
+            i++;
+            continue;
+        }
+        /* grow the match back over the pending literal */
+        while (i > lit && best_off > 0 && base[best_off - 1] == t[i - 1]) {
+            i--;
+            best_off--;
+            best_len++;
+        }
+        if (emit_insert(out, ncmds, t + lit, i - lit) != 0
+         || dbuf_u8(out, CMD_COPY) || dbuf_u64(out, best_off) || dbuf_u64(out, best_len)) {
+            rc = -1;
+            break;
+        }
+        (*ncmds)++;
+        i += best_len;
+        lit = i;
+        if (i + DELTA_BLOCK <= tn) roll_init(&r, t + i);
+    }
+    if (rc == 0) rc = emit_insert(out, ncmds, t + lit, tn - lit);
+    free(head);
+    free(next);
+    return rc;
+}
+
+struct base_ref {
+    const uint8_t *sha256;
+    const char *path;
+    size_t path_len;
+};
+
+static int cmp_base_ref(const void *a, const void *b) {
+    return memcmp(((const struct base_ref *)a)->sha256, ((const struct base_ref *)b)->sha256, 32);
+}
+
+static int cmp_entry_offset(const void *a, const void *b) {
+    uint64_t x = ((const arch_entry *)a)->offset, y = ((const arch_entry *)b)->offset;
+    return (x > y) - (x < y);
+}
+
+struct delta_out {
+    FILE *f;
+    int nfd;                 /* the new archive, for literals */
+    uint64_t pending_from;   /* start of the literal run not yet written */
+    uint64_t literal;        /* bytes sent as literals */
+    size_t files, patches;
+};
+
+static int read_range(int fd, uint64_t off, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len) {
+        ssize_t r = pread(fd, p, len, (off_t)off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p += r;
+        off += (uint64_t)r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+static int write_bytes(FILE *f, const void *p, size_t len) {
+    return fwrite(p, 1, len, f) == len ? 0 : -1;
+}
+
+/* write the new archive's bytes [pending_from, upto) as one LITERAL */
+static int flush_literal(struct delta_out *o, uint64_t upto) {
+    if (upto <= o->pending_from) return 0;
+    uint64_t len = upto - o->pending_from;
+    uint8_t hdr[9];
+    hdr[0] = OP_LITERAL;
+    set_u64(hdr + 1, len);
+    if (write_bytes(o->f, hdr, sizeof(hdr)) != 0) return -1;
+    uint8_t buf[DELTA_IO_CHUNK];
+    for (uint64_t done = 0; done < len;) {
+        size_t n = len - done < sizeof(buf) ? (size_t)(len - done) : sizeof(buf);
+        if (read_range(o->nfd, o->pending_from + done, buf, n) != 0 || write_bytes(o->f, buf, n) != 0) return -1;
+        done += n;
+    }
+    o->literal += len;
+    o->pending_from = upto;
+    return 0;
+}
+
+static int write_op_path(struct delta_out *o, uint8_t op, const char *path, size_t path_len, uint64_t len) {
+    struct dbuf b = {0};
+    int rc = dbuf_u8(&b, op) || dbuf_u32(&b, (uint32_t)path_len) || dbuf_put(&b, path, path_len) || dbuf_u64(&b, len)
+          || write_bytes(o->f, b.p, b.n) ? -1 : 0;
+    free(b.p);
+    return rc;
+}
+
+/* Try to express new entry e through the base; returns 1 if an op was
+   written, 0 to leave it to the surrounding literal, -1 on error. */
+static int encode_entry(struct delta_out *o, arch_reader *br, const struct base_ref *refs, size_t nrefs,
+                        const arch_entry *e) {
+    if (e->symlink || e->compressed || e->stored < DELTA_MIN_ENTRY) return 0;
+
+    if (e->sha256) {
+        struct base_ref key = { .sha256 = e->sha256 };
+        const struct base_ref *hit = nrefs ? bsearch(&key, refs, nrefs, sizeof(*refs), cmp_base_ref) : NULL;
+        if (hit) {
+            if (flush_literal(o, e->offset) != 0 || write_op_path(o, OP_FILE, hit->path, hit->path_len, e->size) != 0)
+                return -1;
+            o->files++;
+            return 1;
+        }
+    }
+
+    /* changed content: patch against the base file at the same path */
+    char *path = malloc(e->path_len + 1);
+    if (!path) return -1;
+    memcpy(path, e->path, e->path_len);
+    path[e->path_len] = '\0';
+    arch_entry be;
+    int found = arch_find(br, path, &be) == 0 && !be.symlink && clean_relpath(be.path, be.path_len);
+    free(path);
+    if (!found) return 0;
+
+    size_t blen = 0;
+    uint8_t *base = arch_read(br, &be, &blen);
+    uint8_t *target = base ? malloc(e->stored ? e->stored : 1) : NULL;
+    if (!target || read_range(o->nfd, e->offset, target, e->stored) != 0) {
+        free(base);
+        free(target);
+        return base ? -1 : 0;   /* an unreadable base (e.g. zstd without WITH_ZSTD) just means literal */
+    }
+
+    int rc = 0;
+    struct dbuf patch = {0};
+    size_t ncmds = 0;
+    if (blen == e->stored && memcmp(base, target, blen) == 0) {
+        rc = flush_literal(o, e->offset) != 0 || write_op_path(o, OP_FILE, be.path, be.path_len, e->size) != 0 ? -1 : 1;
+        if (rc > 0) o->files++;
+    } else if (make_patch(base, blen, target, e->stored, &patch, &ncmds) != 0) {
+        rc = -1;
+    } else if (patch.n + 64 + be.path_len < e->stored - e->stored / 4) {
+        /* worth it only if it saves a quarter of the blob */
+        uint8_t n[8];
+        set_u64(n, ncmds);
+        rc = flush_literal(o, e->offset) != 0 || write_op_path(o, OP_PATCH, be.path, be.path_len, e->size) != 0
+          || write_bytes(o->f, n, sizeof(n)) != 0 || write_bytes(o->f, patch.p, patch.n) != 0 ? -1 : 1;
+        if (rc > 0) o->patches++;
+    }
+    free(patch.p);
+    free(base);
+    free(target);
+    return rc;
+}
+
+int delta_create(const char *base_pkg, const char *new_pkg, const char *out_path) {
+    arch_reader *br = arch_open(base_pkg);
+    arch_reader *nr = br ? arch_open(new_pkg) : NULL;
+    if (!nr) {
+        arch_close(br);
+        return -1;
+    }
+
+    int rc = -1;
+    size_t nbase = arch_count(br), nnew = arch_count(nr), nrefs = 0;
+    struct base_ref *refs = calloc(nbase ? nbase : 1, sizeof(*refs));
+    arch_entry *entries = calloc(nnew ? nnew : 1, sizeof(*entries));
+    struct delta_out o = { .nfd = open(new_pkg, O_RDONLY | O_CLOEXEC) };
+    char tmp[PATH_MAX];
+    tmp[0] = '\0';
+    struct stat st;
+    if (!refs || !entries || o.nfd < 0 || fstat(o.nfd, &st) != 0) {
+        fprintf(stderr, "delta: cannot read %s: %s\n", new_pkg, strerror(errno));
+        goto out;
+    }
+
+    /* unchanged content is found by digest wherever it moved to */
+    for (size_t i = 0; i < nbase; ++i) {
+        arch_entry e;
+        if (arch_entry_at(br, i, &e) != 0) {
+            fprintf(stderr, "delta: %s: corrupt entry %zu\n", base_pkg, i);
+            goto out;
+        }
+        if (e.symlink || !e.sha256 || !clean_relpath(e.path, e.path_len)) continue;
+        refs[nrefs++] = (struct base_ref){ .sha256 = e.sha256, .path = e.path, .path_len = e.path_len };
+    }
+    qsort(refs, nrefs, sizeof(*refs), cmp_base_ref);
+
+    for (size_t i = 0; i < nnew; ++i) {
+        if (arch_entry_at(nr, i, &entries[i]) != 0) {
+            fprintf(stderr, "delta: %s: corrupt entry %zu\n", new_pkg, i);
+            goto out;
+        }
+    }
+    qsort(entries, nnew, sizeof(*entries), cmp_entry_offset);
+
+    /* the header carries the digest of the output, so hash it first */
+    uint8_t digest[32];
+    {
+        sha256_ctx ctx;
+        sha256_init(&ctx);
+        uint8_t buf[DELTA_IO_CHUNK];
+        for (uint64_t off = 0; off < (uint64_t)st.st_size;) {
+            size_t n = (uint64_t)st.st_size - off < sizeof(buf) ? (size_t)((uint64_t)st.st_size - off) : sizeof(buf);
+            if (read_range(o.nfd, off, buf, n) != 0) {
+                fprintf(stderr, "delta: read %s failed\n", new_pkg);
+                goto out;
+            }
+            sha256_update(&ctx, buf, n);
+            off += n;
+        }
+        sha256_final(&ctx, digest);
+    }
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", out_path) >= (int)sizeof(tmp) || !(o.f = fopen(tmp, "wb"))) {
+        fprintf(stderr, "delta: cannot create %s.tmp: %s\n", out_path, strerror(errno));
+        tmp[0] = '\0';
+        goto out;
+    }
+    uint8_t hdr[DELTA_MAGIC_LEN + 8 + 32];
+    memcpy(hdr, DELTA_MAGIC, DELTA_MAGIC_LEN);
+    set_u64(hdr + DELTA_MAGIC_LEN, (uint64_t)st.st_size);
+    memcpy(hdr + DELTA_MAGIC_LEN + 8, digest, 32);
+    if (write_bytes(o.f, hdr, sizeof(hdr)) != 0) goto write_fail;
+
+    uint64_t cursor = 0;
+    for (size_t i = 0; i < nnew; ++i) {
+        if (entries[i].offset < cursor) continue;   /* shared blob, already covered */
+        int done = encode_entry(&o, br, refs, nrefs, &entries[i]);
+        if (done < 0) goto write_fail;
+        cursor = entries[i].offset + entries[i].stored;
+        if (done) o.pending_from = cursor;
+    }
+    uint8_t end = OP_END;
+    if (flush_literal(&o, (uint64_t)st.st_size) != 0 || write_bytes(o.f, &end, 1) != 0) goto write_fail;
+
+    FILE *f = o.f;
+    o.f = NULL;
+    if (fclose(f) != 0 || rename(tmp, out_path) != 0) goto write_fail;
+    tmp[0] = '\0';
+    printf("delta %s: %zu files reused, %zu patched, %llu bytes literal of %llu\n", out_path, o.files, o.patches,
+           (unsigned long long)o.literal, (unsigned long long)st.st_size);
+    rc = 0;
+    goto out;
+
+write_fail:
+    fprintf(stderr, "delta: write %s failed: %s\n", out_path, strerror(errno));
+out:
+    if (o.f) fclose(o.f);
+    if (*tmp) unlink(tmp);
+    if (o.nfd >= 0) close(o.nfd);
+    free(refs);
+    free(entries);
+    arch_close(nr);
+    arch_close(br);
+    return rc;
+}
+
+/* ---- applying ---- */
+
+struct delta_in {
+    FILE *f;
+    const char *path;
+};
+
+static int read_exact(struct delta_in *in, void *buf, size_t len) {
+    if (fread(buf, 1, len, in->f) == len) return 0;
+    fprintf(stderr, "%s: truncated delta\n", in->path);
+    return -1;
+}
+
+static int read_u64(struct delta_in *in, uint64_t *v) {
+    uint8_t p[8];
+    if (read_exact(in, p, sizeof(p)) != 0) return -1;
+    *v = get_u64(p);
+    return 0;
+}
+
+static int read_path(struct delta_in *in, char *path) {
+    uint8_t p[4];
+    if (read_exact(in, p, sizeof(p)) != 0) return -1;
+    uint32_t len = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    if (len >= PATH_MAX) {
+        fprintf(stderr, "%s: bad path in delta\n", in->path);
+        return -1;
+    }
+    if (read_exact(in, path, len) != 0) return -1;
+    path[len] = '\0';
+    if (!clean_relpath(path, len)) {
+        fprintf(stderr, "%s: bad path in delta\n", in->path);
+        return -1;
+    }
+    return 0;
+}
+
+struct delta_sink {
+    FILE *f;
+    sha256_ctx ctx;
+    uint64_t written;
+};
+
+static int sink_put(struct delta_sink *s, const void *p, size_t len) {
+    if (fwrite(p, 1, len, s->f) != len) return -1;
+    sha256_update(&s->ctx, p, len);
+    s->written += len;
+    return 0;
+}
+
+/* len bytes of the delta stream, straight to the output */
+static int copy_literal(struct delta_in *in, struct delta_sink *s, uint64_t len) {
+    uint8_t buf[DELTA_IO_CHUNK];
+    while (len) {
+        size_t n = len < sizeof(buf) ? (size_t)len : sizeof(buf);
+        if (read_exact(in, buf, n) != 0 || sink_put(s, buf, n) != 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/* map a base file read-only; *len must come out as expected when non-zero */
+static int open_base_file(int base_fd, const char *path, const char *base_dir, uint8_t **map, size_t *len) {
+    int fd = openat(base_fd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "%s/%s: %s\n", base_dir, path, fd < 0 ? strerror(errno) : "not a regular file");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    *len = (size_t)st.st_size;
+    *map = NULL;
+    if (*len) {
+        void *m = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            fprintf(stderr, "mmap %s/%s: %s\n", base_dir, path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        *map = m;
+    }
+    close(fd);
+    return 0;
+}
+
+static int apply_patch(struct delta_in *in, struct delta_sink *s, const uint8_t *base, size_t blen, uint64_t len) {
+    uint64_t ncmds, produced = 0;
+    if (read_u64(in, &ncmds) != 0) return -1;
+    for (uint64_t c = 0; c < ncmds; ++c) {
+        uint8_t cmd;
+        uint64_t a, b;
+        if (read_exact(in, &cmd, 1) != 0) return -1;
+        if (cmd == CMD_COPY) {
+            if (read_u64(in, &a) != 0 || read_u64(in, &b) != 0) return -1;
+            if (a > blen || b > blen - a || sink_put(s, base + a, (size_t)b) != 0) {
+                fprintf(stderr, "%s: patch copies outside its base file\n", in->path);
+                return -1;
+            }
+        } else if (cmd == CMD_INSERT) {
+            if (read_u64(in, &b) != 0 || copy_literal(in, s, b) != 0) return -1;
+        } else {
+            fprintf(stderr, "%s: unknown patch command %u\n", in->path, cmd);
+            return -1;
+        }
+        produced += b;
+    }
+    if (produced != len) {
+        fprintf(stderr, "%s: patch produced %llu bytes, expected %llu\n", in->path,
+                (unsigned long long)produced, (unsigned long long)len);
+        return -1;
+    }
+    return 0;
+}
+
+int delta_apply(const char *delta_path, const char *base_dir, const char *out_path, uint8_t digest[32]) {
+    struct delta_in in = { .f = fopen(delta_path, "rb"), .path = delta_path };
+    struct delta_sink s = { .f = NULL };
+    int base_fd = -1, rc = -1;
+    if (!in.f) {
+        fprintf(stderr, "%s: %s\n", delta_path, strerror(errno));
+        return -1;
+    }
+    uint8_t hdr[DELTA_MAGIC_LEN + 8 + 32];
+    if (read_exact(&in, hdr, sizeof(hdr)) != 0) goto out;
+    if (memcmp(hdr, DELTA_MAGIC, DELTA_MAGIC_LEN) != 0) {
+        fprintf(stderr, "%s: not a pandora delta\n", delta_path);
+        goto out;
+    }
+    uint64_t want_size = get_u64(hdr + DELTA_MAGIC_LEN);
+    if ((base_fd = open(base_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "%s: %s\n", base_dir, strerror(errno));
+        goto out;
+    }
+    if (!(s.f = fopen(out_path, "wb"))) {
+        fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+        goto out;
+    }
+    sha256_init(&s.ctx);
+
+    char path[PATH_MAX];
+    for (;;) {
+        uint8_t op;
+        uint64_t len;
+        if (read_exact(&in, &op, 1) != 0) goto out;
+        if (op == OP_END) break;
+        if (op == OP_LITERAL) {
+            if (read_u64(&in, &len) != 0 || copy_literal(&in, &s, len) != 0) goto out;
+        } else if (op == OP_FILE || op == OP_PATCH) {
+            uint8_t *map;
+            size_t blen;
+            if (read_path(&in, path) != 0 || read_u64(&in, &len) != 0
+             || open_base_file(base_fd, path, base_dir, &map, &blen) != 0) goto out;
+            int failed;
+            if (op == OP_FILE) {
+                failed = blen != len || sink_put(&s, map, blen) != 0;
+                if (blen != len) fprintf(stderr, "%s/%s: size differs from the base version\n", base_dir, path);
+            } else {
+                failed = apply_patch(&in, &s, map, blen, len) != 0;
+            }
+            if (map) munmap(map, blen);
+            if (failed) goto out;
+        } else {
+            fprintf(stderr, "%s: unknown delta op %u\n", delta_path, op);
+            goto out;
+        }
+        if (s.written > want_size) break;
+    }
+    if (s.written != want_size) {
+        fprintf(stderr, "%s: rebuilt %llu bytes, expected %llu\n", delta_path,
+                (unsigned long long)s.written, (unsigned long long)want_size);
+        goto out;
+    }
+    sha256_final(&s.ctx, digest);
+    if (memcmp(digest, hdr + DELTA_MAGIC_LEN + 8, 32) != 0) {
+        fprintf(stderr, "%s: rebuilt archive does not match the delta's digest (base tree changed?)\n", delta_path);
+        goto out;
+    }
+    rc = 0;
+
+out:
+    if (s.f && fclose(s.f) != 0 && rc == 0) {
+        fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+        rc = -1;
+    }
+    if (base_fd >= 0) close(base_fd);
+    fclose(in.f);
+    return rc;
+}
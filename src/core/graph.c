@@ -0,0 +1,358 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "core/graph.h"
+
+#define GRAPH_MAGIC "PNDGRF\0\1"
+#define GRAPH_MAGIC_LEN 8
+#define GRAPH_VERSION 1
+
+/* On-disk layout: header, nodes sorted by digest, their edges, strings.
+   String fields are offsets into the string table (0 is the empty string). */
+struct graph_header {
+    char magic[GRAPH_MAGIC_LEN];
+    uint32_t version;
+    uint32_t nnodes;
+    uint32_t ndeps;
+    uint32_t reserved;
+    uint64_t nodes_off;
+    uint64_t deps_off;
+    uint64_t strings_off;
+    uint64_t strings_len;
+};
+
+struct graph_node_rec {
+    uint8_t sha256[32];
+    uint32_t first_dep;
+    uint32_t ndeps;
+};
+
+struct graph_dep_rec {
+    uint32_t name;
+    uint32_t version;
+};
+
+struct added_node {
+    uint8_t sha256[32];
+    graph_dep *deps;      /* strings owned here */
+    size_t n;
+};
+
+struct graph {
+    void *map;
+    size_t map_len;
+    uint32_t nnodes, ndeps;
+    uint64_t strings_len;
+    const struct graph_node_rec *nodes;
+    const struct graph_dep_rec *deps;
+    const char *strings;
+    struct added_node *added;
+    size_t nadded, cap;
+};
+
+int graph_path(const char *home, char *out, size_t len) {
+    return snprintf(out, len, "%s/pandora/cache/graph.bin", home) >= (int)len ? -1 : 0;
+}
+
+graph *graph_open(const char *path) {
+    graph *g = calloc(1, sizeof(*g));
+    if (!g) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return g;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(struct graph_header)) {
+        close(fd);
+        return g;
+    }
+    size_t len = (size_t)sb.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return g;
+
+    /* every array must lie inside the file and the string table must end in NUL */
+    const struct graph_header *h = map;
+    int ok = memcmp(h->magic, GRAPH_MAGIC, GRAPH_MAGIC_LEN) == 0
+          && h->version == GRAPH_VERSION
+          && h->nodes_off + (uint64_t)h->nnodes * sizeof(struct graph_node_rec) <= len
+          && h->deps_off + (uint64_t)h->ndeps * sizeof(struct graph_dep_rec) <= len
+          && h->strings_len > 0
+          && h->strings_off + h->strings_len <= len
+          && ((const char*)map)[h->strings_off + h->strings_len - 1] == '\0';
+    if (!ok) {
+        munmap(map, len);
+        return g;
+    }
+    g->map = map;
+    g->map_len = len;
+    g->nnodes = h->nnodes;
+    g->ndeps = h->ndeps;
+    g->strings_len = h->strings_len;
+    g->nodes = (const struct graph_node_rec*)((const char*)map + h->nodes_off);
+    g->deps = (const struct graph_dep_rec*)((const char*)map + h->deps_off);
+    g->strings = (const char*)map + h->strings_off;
+    return g;
+}
+
+static void free_deps(graph_dep *deps, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        free((char*)deps[i].name);
+        free((char*)deps[i].version);
+    }
+    free(deps);
+}
+
+void graph_close(graph *g) {
+    if (!g) return;
+    if (g->map) munmap(g->map, g->map_len);
+    for (size_t i = 0; i < g->nadded; ++i) free_deps(g->added[i].deps, g->added[i].n);
+    free(g->added);
+    free(g);
+}
+
+int graph_find(const graph *g, const uint8_t sha256[32], graph_node *out) {
+    size_t lo = 0, hi = g->nnodes;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = memcmp(g->nodes[mid].sha256, sha256, 32);
+        if (c == 0) {
+            const struct graph_node_rec *r = &g->nodes[mid];
+            if ((uint64_t)r->first_dep + r->ndeps > g->ndeps) return -1;
+            out->first = r->first_dep;
+            out->ndeps = r->ndeps;
+            out->added = 0;
+            return 0;
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    for (size_t i = 0; i < g->nadded; ++i) {
+        if (memcmp(g->added[i].sha256, sha256, 32) != 0) continue;
+        out->first = (uint32_t)i;
+        out->ndeps = (uint32_t)g->added[i].n;
+        out->added = 1;
+        return 0;
+    }
+    return -1;
+}
+
+int graph_dep_at(const graph *g, const graph_node *node, uint32_t i, graph_dep *out) {
+    if (i >= node->ndeps) return -1;
+    if (node->added) {
+        *out = g->added[node->first].deps[i];
+        return 0;
+    }
+    const struct graph_dep_rec *d = &g->deps[node->first + i];
+    if (d->name >= g->strings_len || d->version >= g->strings_len) return -1;
+    out->name = g->strings + d->name;
+    out->version = g->strings + d->version;
+    return 0;
+}
+
+int graph_add(graph *g, const uint8_t sha256[32], const graph_dep *deps, size_t n) {
+    if (g->nadded == g->cap) {
+        size_t cap = g->cap ? g->cap * 2 : 16;
+        struct added_node *v = realloc(g->added, cap * sizeof(*v));
+        if (!v) return -1;
+        g->added = v;
+        g->cap = cap;
+    }
+    graph_dep *copy = calloc(n ? n : 1, sizeof(*copy));
+    if (!copy) return -1;
+    for (size_t i = 0; i < n; ++i) {
+        copy[i].name = strdup(deps[i].name);
+        copy[i].version = strdup(deps[i].version);
+        if (!copy[i].name || !copy[i].version) {
+            free_deps(copy, i + 1);
+            return -1;
+        }
+    }
+    struct added_node *a = &g->added[g->nadded++];
+    memcpy(a->sha256, sha256, 32);
+    a->deps = copy;
+    a->n = n;
+    return 0;
+}
+
+/* String table being written: names and versions repeat across nodes, so
+   each distinct string is stored once. */
+struct strtab {
+    char *buf;
+    size_t len, cap;
+    uint32_t *slots;      /* offset + 1, 0 if free */
+    size_t nslots, used;
+};
+
+static uint32_t str_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; ++s) h = (h ^ (uint8_t)*s) * 16777619u;
+    return h;
+}
+
+static int strtab_grow(struct strtab *t) {
+    size_t n = t->nslots ? t->nslots * 2 : 1024;
+    uint32_t *slots = calloc(n, sizeof(*slots));
+    if (!slots) return -1;
+    for (size_t i = 0; i < t->nslots; ++i) {
+        if (!t->slots[i]) continue;
+        size_t s = str_hash(t->buf + t->slots[i] - 1) & (n - 1);
+        while (slots[s]) s = (s + 1) & (n - 1);
+        slots[s] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->nslots = n;
+    return 0;
+}
+
+static int strtab_add(struct strtab *t, const char *s, uint32_t *off) {
+    if (!*s) {
+        *off = 0;
+        return 0;
+    }
+    if ((t->used + 1) * 2 > t->nslots && strtab_grow(t) != 0) return -1;
+    size_t slot = str_hash(s) & (t->nslots - 1);
+    for (; t->slots[slot]; slot = (slot + 1) & (t->nslots - 1)) {
+        if (strcmp(t->buf + t->slots[slot] - 1, s) == 0) {
+            *off = t->slots[slot] - 1;
+            return 0;
+        }
+    }
+    size_t n = strlen(s) + 1;
+    if (t->len + n > UINT32_MAX - 1) return -1;
+    if (t->len + n > t->cap) {
+        size_t cap = t->cap ? t->cap : 4096;
+        while (cap < t->len + n) cap *= 2;
+        char *buf = realloc(t->buf, cap);
+        if (!buf) return -1;
+        t->buf = buf;
+        t->cap = cap;
+    }
+    memcpy(t->buf + t->len, s, n);
+    *off = (uint32_t)t->len;
+    t->slots[slot] = (uint32_t)t->len + 1;
+    t->len += n;
+    t->used++;
+    return 0;
+}
+
+/* a node of the merged graph: index into the mapped nodes or into added */
+struct save_ref {
+    const uint8_t *sha256;
+    size_t at;
+    int added;
+};
+
+static int ref_cmp(const void *a, const void *b) {
+    const struct save_ref *x = a, *y = b;
+    int c = memcmp(x->sha256, y->sha256, 32);
+    if (c) return c;
+    return x->added - y->added;   /* the mapped copy first; duplicates are dropped */
+}
+
+int graph_save(graph *g, const char *path) {
+    if (!g->nadded) return 0;
+
+    size_t total = g->nnodes + g->nadded;
+    struct save_ref *refs = malloc(total * sizeof(*refs));
+    if (!refs) return -1;
+    for (size_t i = 0; i < g->nnodes; ++i) refs[i] = (struct save_ref){ g->nodes[i].sha256, i, 0 };
+    for (size_t i = 0; i < g->nadded; ++i) refs[g->nnodes + i] = (struct save_ref){ g->added[i].sha256, i, 1 };
+    qsort(refs, total, sizeof(*refs), ref_cmp);
+
+    struct graph_node_rec *nodes = malloc(total * sizeof(*nodes));
+    struct graph_dep_rec *deps = NULL;
+    size_t nnodes = 0, ndeps = 0, deps_cap = 0;
+    struct strtab st = {0};
+    int rc = -1;
+    if (!nodes || !(st.buf = malloc(1))) goto out;
+    st.buf[0] = '\0';
+    st.len = st.cap = 1;
+
+    for (size_t i = 0; i < total; ++i) {
+        if (nnodes && memcmp(nodes[nnodes - 1].sha256, refs[i].sha256, 32) == 0) continue;
+        graph_node node;
+        if (refs[i].added) node = (graph_node){ (uint32_t)refs[i].at, (uint32_t)g->added[refs[i].at].n, 1 };
+        else if (graph_find(g, refs[i].sha256, &node) != 0) continue;   /* damaged record */
+
+        struct graph_node_rec *r = &nodes[nnodes];
+        memcpy(r->sha256, refs[i].sha256, 32);
+        r->first_dep = (uint32_t)ndeps;
+        r->ndeps = 0;
+        int bad = 0;
+        for (uint32_t k = 0; k < node.ndeps; ++k) {
+            graph_dep d;
+            if (graph_dep_at(g, &node, k, &d) != 0) {
+                bad = 1;
+                break;
+            }
+            if (ndeps == deps_cap) {
+                size_t cap = deps_cap ? deps_cap * 2 : 256;
+                struct graph_dep_rec *v = realloc(deps, cap * sizeof(*v));
+                if (!v) goto out;
+                deps = v;
+                deps_cap = cap;
+            }
+            if (strtab_add(&st, d.name, &deps[ndeps].name) != 0
+             || strtab_add(&st, d.version, &deps[ndeps].version) != 0) goto out;
+            ndeps++;
+            r->ndeps++;
+        }
+        if (bad) {
+            ndeps = r->first_dep;
+            continue;
+        }
+        nnodes++;
+    }
+
+    struct graph_header h = {0};
+    memcpy(h.magic, GRAPH_MAGIC, GRAPH_MAGIC_LEN);
+    h.version = GRAPH_VERSION;
+    h.nnodes = (uint32_t)nnodes;
+    h.ndeps = (uint32_t)ndeps;
+    h.nodes_off = sizeof(h);
+    h.deps_off = h.nodes_off + nnodes * sizeof(*nodes);
+    h.strings_off = h.deps_off + ndeps * sizeof(*deps);
+    h.strings_len = st.len;
+
+    /* a unique temp name: two runs may save at once, and either result is whole */
+    char tmp[1024];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) goto out;
+    int fd = mkstemp(tmp);
+    if (fd < 0) goto out;
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+    int failed = fwrite(&h, sizeof(h), 1, f) != 1
+              || (nnodes && fwrite(nodes, sizeof(*nodes), nnodes, f) != nnodes)
+              || (ndeps && fwrite(deps, sizeof(*deps), ndeps, f) != ndeps)
+              || fwrite(st.buf, 1, st.len, f) != st.len;
+    if (fchmod(fd, 0644) != 0) failed = 1;
+    if (fclose(f) != 0 || failed || rename(tmp, path) != 0) {
+        unlink(tmp);
+        goto out;
+    }
+    rc = 0;
+
+out:
+    free(refs);
+    free(nodes);
+    free(deps);
+    free(st.buf);
+    free(st.slots);
+    return rc;
+}
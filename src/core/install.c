@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "core/install.h"
+#include "core/arch.h"
+#include "core/lock.h"
+#include "core/resolve.h"
+#include "core/store.h"
+#include "net/download.h"
+#include "util/dircache.h"
+#include "util/err.h"
+#include "util/path.h"
+#include "util/pool.h"
+#include "util/trace.h"
+
+#define SMALL_PATH_LEN 512
+
+struct install_run;
+
+struct install_item {
+    struct install_run *run;
+    char *name;
+    char *version;
+    const char *lock_sha256;  /* checksum pinned by a lockfile, or NULL */
+    char *pkg_url;
+    char *sha256;
+    char pkg_path[SMALL_PATH_LEN];
+    int skipped;              /* already present in the store */
+    error_t status;
+};
+
+struct install_run {
+    fetch_env *env;
+    pool_t *manifests;   /* stage 1: index lookup + manifest fetch */
+    pool_t *blobs;       /* stage 2: blob download, hashed on the fly */
+    pool_t *unpack;      /* stage 3: extract into the store */
+    int extract_jobs;    /* threads per archive inside stage 3 */
+    int keep_blobs;      /* 0: extract while downloading, keep nothing in pkgs/ */
+    char objects[SMALL_PATH_LEN]; /* shared object store; empty when unusable */
+};
+
+static int store_path(const char *home, const char *name, const char *version, char *out, size_t len) {
+    return snprintf(out, len, "%s/pandora/store/%s/%s", home, name, version) >= (int)len ? -1 : 0;
+}
+
+/* Make the private staging dir a version is extracted into; it is published
+   with one rename, so a half-written version never appears in the store. */
+static int open_staging(struct install_item *it, char final_dir[SMALL_PATH_LEN], char staging[SMALL_PATH_LEN]) {
+    const char *home = it->run->env->home;
+    char pkg_dir[SMALL_PATH_LEN];
+    if (snprintf(pkg_dir, sizeof(pkg_dir), "%s/pandora/store/%s", home, it->name) >= (int)sizeof(pkg_dir)
+     || store_path(home, it->name, it->version, final_dir, SMALL_PATH_LEN) != 0
+     || snprintf(staging, SMALL_PATH_LEN, "%s/.%s.XXXXXX", pkg_dir, it->version) >= SMALL_PATH_LEN) {
+        fprintf(stderr, "store path too long for %s@%s\n", it->name, it->version);
+        return -1;
+    }
+    if (ensure_dir(pkg_dir, 0755) != ERR_OK || !mkdtemp(staging)) {
+        fprintf(stderr, "cannot create staging dir for %s@%s: %s\n", it->name, it->version, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void publish_staging(struct install_item *it, const char *staging, const char *final_dir) {
+    if (rename(staging, final_dir) != 0) {
+        fprintf(stderr, "publish %s@%s failed: %s (left in %s)\n", it->name, it->version, strerror(errno), staging);
+        it->status = ERR_FAILED;
+        return;
+    }
+    it->status = ERR_OK;
+}
+
+static void stage_unpack(void *arg) {
+    struct install_item *it = arg;
+    char final_dir[SMALL_PATH_LEN];
+    char staging[SMALL_PATH_LEN];
+    if (open_staging(it, final_dir, staging) != 0) {
+        it->status = ERR_FAILED;
+        return;
+    }
+    const char *objects = *it->run->objects ? it->run->objects : NULL;
+    uint64_t t0 = trace_now();
+    arch_stats stats = {0};
+    if (arch_unpack(it->pkg_path, staging, it->run->extract_jobs, objects,
+                    trace_quiet() ? ARCH_QUIET : 0, &stats) != 0) {
+        fprintf(stderr, "unpack %s@%s failed\n", it->name, it->version);
+        remove_tree_at(AT_FDCWD, staging);
+        it->status = ERR_FAILED;
+        return;
+    }
+    trace_span(TRACE_UNPACK, it->name, t0, stats.bytes, stats.files);
+    publish_staging(it, staging, final_dir);
+    if (it->status == ERR_OK && !it->run->keep_blobs) unlink(it->pkg_path);
+}
+
+/* With keep_blobs off, extract the blob into staging while it downloads and
+   publish the tree once the whole download matched the manifest's sha256;
+   nothing is written to pkgs/. Returns 0 once it->status is final, or -1 to
+   take the blob path instead: when the blob is cached already, or the
+   stream failed and the whole package is to be downloaded (with retries and
+   deltas) after all. The download and extraction overlap, so they are
+   traced together as one unpack span. */
+static int stage_stream(struct install_item *it) {
+    char cached[SMALL_PATH_LEN];
+    struct stat st;
+    if (snprintf(cached, sizeof(cached), "%s/pandora/pkgs/%s-%s.pkg", it->run->env->home, it->name, it->version)
+        >= (int)sizeof(cached) || stat(cached, &st) == 0) return -1;
+
+    char final_dir[SMALL_PATH_LEN];
+    char staging[SMALL_PATH_LEN];
+    if (open_staging(it, final_dir, staging) != 0) {
+        it->status = ERR_FAILED;
+        return 0;
+    }
+    const char *objects = *it->run->objects ? it->run->objects : NULL;
+    uint64_t t0 = trace_now();
+    arch_stats stats = {0};
+    arch_stream *s = arch_stream_open(staging, objects, trace_quiet() ? ARCH_QUIET : 0);
+    error_t rc = s ? fetch_blob_stream(it->run->env, it->name, it->version, it->pkg_url, it->sha256,
+                                       arch_stream_input(s))
+                   : ERR_FAILED;
+    if (s && arch_stream_close(s, &stats) != 0) rc = ERR_FAILED;
+    if (rc != ERR_OK) {
+        remove_tree_at(AT_FDCWD, staging);
+        fprintf(stderr, "streaming %s@%s failed; downloading the whole package\n", it->name, it->version);
+        return -1;
+    }
+    trace_span(TRACE_UNPACK, it->name, t0, stats.bytes, stats.files);
+    publish_staging(it, staging, final_dir);
+    return 0;
+}
+
+static void stage_blob(void *arg) {
+    struct install_item *it = arg;
+    if (!it->run->keep_blobs && stage_stream(it) == 0) return;
+    if (fetch_blob(it->run->env, it->name, it->version, it->pkg_url, it->sha256,
+                   it->pkg_path, sizeof(it->pkg_path)) != ERR_OK) {
+        it->status = ERR_FAILED;
+        return;
+    }
+    if (pool_submit(it->run->unpack, stage_unpack, it) != 0) it->status = ERR_FAILED;
+}
+
+static void stage_manifest(void *arg) {
+    struct install_item *it = arg;
+
+    char final_dir[SMALL_PATH_LEN];
+    struct stat st;
+    if (store_path(it->run->env->home, it->name, it->version, final_dir, sizeof(final_dir)) == 0
+     && stat(final_dir, &st) == 0 && S_ISDIR(st.st_mode)) {
+        it->skipped = 1;
+        it->status = ERR_OK;
+        return;
+    }
+
+    if (fetch_manifest(it->run->env, it->name, it->version, &it->pkg_url, &it->sha256) != ERR_OK) {
+        it->status = ERR_FAILED;
+        return;
+    }
+    if (it->lock_sha256 && strcasecmp(it->lock_sha256, it->sha256) != 0) {
+        fprintf(stderr, "%s@%s: manifest sha256 %s does not match lockfile %s\n",
+                it->name, it->version, it->sha256, it->lock_sha256);
+        it->status = ERR_FAILED;
+        return;
+    }
+    if (pool_submit(it->run->blobs, stage_blob, it) != 0) it->status = ERR_FAILED;
+}
+
+/* Run the pipeline over items in the session env. */
+static error_t install_items(struct install_item *items, size_t n, fetch_env *env) {
+    struct install_run run;
+    run.env = env;
+    run.keep_blobs = fetch_env_keep_blobs(env);
+
+    size_t jobs = fetch_env_jobs(env);
+    size_t ncpu = pool_cpu_count();
+    size_t unpack_jobs = ncpu < jobs ? ncpu : jobs;
+    /* split the cores between the archives that can be extracting at once */
+    size_t concurrent = n < unpack_jobs ? n : unpack_jobs;
+    run.extract_jobs = concurrent && ncpu / concurrent > 1 ? (int)(ncpu / concurrent) : 1;
+
+    /* without the object store every file is simply written out in full */
+    if (store_objects_path(env->home, run.objects, sizeof(run.objects)) != 0
+     || ensure_dir(run.objects, 0755) != ERR_OK) {
+        fprintf(stderr, "warning: object store unavailable; installing without file sharing\n");
+        run.objects[0] = '\0';
+    }
+
+    run.manifests = pool_create(jobs);
+    run.blobs = pool_create(jobs);
+    run.unpack = pool_create(unpack_jobs);
+    if (!run.manifests || !run.blobs || !run.unpack) {
+        fprintf(stderr, "failed to start worker pools\n");
+        pool_destroy(run.manifests);
+        pool_destroy(run.blobs);
+        pool_destroy(run.unpack);
+        return ERR_FAILED;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        items[i].run = &run;
+        items[i].status = ERR_FAILED;
+        if (pool_submit(run.manifests, stage_manifest, &items[i]) != 0) {
+            fprintf(stderr, "failed to queue %s@%s\n", items[i].name, items[i].version);
+        }
+    }
+
+    /* work only flows forward, so draining the stages in order drains the pipeline */
+    pool_wait(run.manifests);
+    pool_wait(run.blobs);
+    pool_wait(run.unpack);
+    pool_destroy(run.manifests);
+    pool_destroy(run.blobs);
+    pool_destroy(run.unpack);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (items[i].status != ERR_OK) {
+            failed++;
+            fprintf(stderr, "failed: %s@%s\n", items[i].name, items[i].version);
+        } else if (items[i].skipped) {
+            printf("already installed: %s@%s\n", items[i].name, items[i].version);
+        } else {
+            printf("installed: %s@%s\n", items[i].name, items[i].version);
+        }
+        free(items[i].pkg_url);
+        free(items[i].sha256);
+    }
+    if (failed) fprintf(stderr, "%zu of %zu packages failed\n", failed, n);
+    return failed ? ERR_FAILED : ERR_OK;
+}
+
+/* Install a resolved closure; every entry carries the sha256 it resolved to. */
+static error_t install_closure(lock_entry *entries, size_t count, fetch_env *env) {
+    struct install_item *items = calloc(count ? count : 1, sizeof(*items));
+    if (!items) {
+        perror("calloc");
+        return ERR_FAILED;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        items[i].name = entries[i].name;
+        items[i].version = entries[i].version;
+        items[i].lock_sha256 = entries[i].sha256;
+    }
+    error_t rc = install_items(items, count, env);
+    free(items);
+    return rc;
+}
+
+error_t install_packages(fetch_env *env, const char *const specs[], size_t n) {
+    if (n == 0) return ERR_OK;
+    lock_entry *roots = calloc(n, sizeof(*roots));
+    if (!roots) {
+        perror("calloc");
+        return ERR_FAILED;
+    }
+
+    error_t rc = ERR_OK;
+    size_t parsed = 0;
+    for (; parsed < n; ++parsed) {
+        if (pkg_spec_parse(specs[parsed], &roots[parsed].name, &roots[parsed].version) != 0) {
+            fprintf(stderr, "invalid package spec '%s' (expected name@version)\n", specs[parsed]);
+            rc = ERR_FAILED;
+            break;
+        }
+    }
+
+    lock_entry *closure = NULL;
+    size_t count = 0;
+    if (rc == ERR_OK) rc = resolve_closure(env, roots, n, &closure, &count);
+    if (rc == ERR_OK) {
+        if (count > n) printf("resolved %zu packages (%zu dependencies)\n", count, count - n);
+        rc = install_closure(closure, count, env);
+    }
+    lock_free(closure, count);
+    lock_free(roots, parsed);
+    return rc;
+}
+
+error_t install_restore(fetch_env *env, const char *profile) {
+    lock_entry *entries = NULL;
+    size_t count = 0;
+    if (resolve_profile(env, profile, &entries, &count) != ERR_OK) return ERR_FAILED;
+    error_t rc = ERR_OK;
+    if (count) rc = install_closure(entries, count, env);
+    lock_free(entries, count);
+    return rc;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "core/lock.h"
+
+static int valid_component(const char *s, size_t len) {
+    if (len == 0 || s[0] == '.') return 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (s[i] == '/' || isspace((unsigned char)s[i])) return 0;
+    }
+    return 1;
+}
+
+int pkg_version_valid(const char *version) {
+    return !strchr(version, '@') && valid_component(version, strlen(version));
+}
+
+int pkg_spec_parse(const char *spec, char **name, char **version) {
+    const char *at = strrchr(spec, '@');
+    if (!at) return -1;
+    size_t nlen = (size_t)(at - spec);
+    size_t vlen = strlen(at + 1);
+    if (!valid_component(spec, nlen) || !valid_component(at + 1, vlen)) return -1;
+
+    *name = strndup(spec, nlen);
+    *version = strdup(at + 1);
+    if (!*name || !*version) {
+        free(*name);
+        free(*version);
+        return -1;
+    }
+    return 0;
+}
+
+int lock_read(const char *path, lock_entry **entries, size_t *count) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    lock_entry *v = NULL;
+    size_t n = 0, cap = 0;
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char *spec = strtok(line, " \t\r\n");
+        if (!spec) continue;
+        char *sum = strtok(NULL, " \t\r\n");
+
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            lock_entry *nv = realloc(v, cap * sizeof(*v));
+            if (!nv) goto fail;
+            v = nv;
+        }
+        lock_entry *e = &v[n];
+        if (pkg_spec_parse(spec, &e->name, &e->version) != 0) {
+            fprintf(stderr, "%s:%d: invalid entry '%s'\n", path, lineno, spec);
+            goto fail;
+        }
+        e->sha256 = sum ? strdup(sum) : NULL;
+        n++;
+    }
+    fclose(f);
+    *entries = v;
+    *count = n;
+    return 0;
+
+fail:
+    fclose(f);
+    lock_free(v, n);
+    return -1;
+}
+
+int lock_write(const char *path, const lock_entry *entries, size_t count) {
+    char tmp[1024];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    for (size_t i = 0; i < count; ++i) {
+        if (entries[i].sha256) fprintf(f, "%s@%s %s\n", entries[i].name, entries[i].version, entries[i].sha256);
+        else fprintf(f, "%s@%s\n", entries[i].name, entries[i].version);
+    }
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void lock_free(lock_entry *entries, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        free(entries[i].name);
+        free(entries[i].version);
+        free(entries[i].sha256);
+    }
+    free(entries);
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "core/owners.h"
+
+int owners_path(const char *home, const char *profile, char *out, size_t len) {
+    return snprintf(out, len, "%s/pandora/profiles/%s/owners", home, profile) >= (int)len ? -1 : 0;
+}
+
+owners_pkg *owners_add_pkg(owners *o, char *spec) {
+    if (o->n == o->cap) {
+        size_t cap = o->cap ? o->cap * 2 : 16;
+        owners_pkg *nv = realloc(o->pkgs, cap * sizeof(*nv));
+        if (!nv) return NULL;
+        o->pkgs = nv;
+        o->cap = cap;
+    }
+    owners_pkg *p = &o->pkgs[o->n++];
+    memset(p, 0, sizeof(*p));
+    p->spec = spec;
+    return p;
+}
+
+int owners_add_path(owners_pkg *p, const char *path) {
+    if (p->npaths == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 32;
+        char **nv = realloc(p->paths, cap * sizeof(*nv));
+        if (!nv) return -1;
+        p->paths = nv;
+        p->cap = cap;
+    }
+    if (!(p->paths[p->npaths] = strdup(path))) return -1;
+    p->npaths++;
+    return 0;
+}
+
+owners_pkg *owners_find(owners *o, const char *spec) {
+    for (size_t i = 0; i < o->n; ++i) {
+        if (o->pkgs[i].spec && strcmp(o->pkgs[i].spec, spec) == 0) return &o->pkgs[i];
+    }
+    return NULL;
+}
+
+int owners_load(const char *path, owners *out) {
+    memset(out, 0, sizeof(*out));
+    FILE *f = fopen(path, "r");
+    if (!f) return errno == ENOENT ? 0 : -1;
+
+    char line[4096];
+    owners_pkg *cur = NULL;
+    int rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (!*line) continue;
+        if (line[0] == '=' && line[1] == ' ') {
+            char *spec = strdup(line + 2);
+            cur = spec ? owners_add_pkg(out, spec) : NULL;
+            if (!cur) {
+                free(spec);
+                rc = -1;
+            }
+        } else if (!cur || owners_add_path(cur, line) != 0) {
+            rc = -1;   /* a path before any package, or out of memory */
+        }
+    }
+    fclose(f);
+    if (rc != 0) owners_free(out);
+    return rc;
+}
+
+int owners_save(const owners *o, const char *path) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    int ok = 1;
+    for (size_t i = 0; i < o->n && ok; ++i) {
+        if (!o->pkgs[i].spec) continue;
+        ok = fprintf(f, "= %s\n", o->pkgs[i].spec) >= 0;
+        for (size_t k = 0; k < o->pkgs[i].npaths && ok; ++k)
+            ok = fprintf(f, "%s\n", o->pkgs[i].paths[k]) >= 0;
+    }
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void owners_free(owners *o) {
+    for (size_t i = 0; i < o->n; ++i) {
+        free(o->pkgs[i].spec);
+        for (size_t k = 0; k < o->pkgs[i].npaths; ++k) free(o->pkgs[i].paths[k]);
+        free(o->pkgs[i].paths);
+    }
+    free(o->pkgs);
+    memset(o, 0, sizeof(*o));
+}
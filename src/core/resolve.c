@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "core/resolve.h"
+#include "core/graph.h"
+#include "core/cindex.h"
+#include "core/sha256.h"
+#include "util/err.h"
+#include "util/path.h"
+#include "util/pool.h"
+#include "util/trace.h"
+
+#define SMALL_PATH_LEN 512
+#define NO_PARENT SIZE_MAX
+
+/* name -> position, open addressing; keys are borrowed */
+struct name_map {
+    struct name_slot {
+        const char *name;
+        size_t at;
+    } *slots;
+    size_t cap, n;
+};
+
+static uint32_t name_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; ++s) h = (h ^ (uint8_t)*s) * 16777619u;
+    return h;
+}
+
+static int name_map_get(const struct name_map *m, const char *name, size_t *at) {
+    if (!m->cap) return -1;
+    for (size_t s = name_hash(name) & (m->cap - 1); m->slots[s].name; s = (s + 1) & (m->cap - 1)) {
+        if (strcmp(m->slots[s].name, name) == 0) {
+            *at = m->slots[s].at;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Returns 0 once added, 1 (with *at set) if name was already there, -1 when out of memory. */
+static int name_map_put(struct name_map *m, const char *name, size_t *at) {
+    size_t existing;
+    if (name_map_get(m, name, &existing) == 0) {
+        *at = existing;
+        return 1;
+    }
+    if ((m->n + 1) * 2 > m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 64;
+        struct name_slot *slots = calloc(cap, sizeof(*slots));
+        if (!slots) return -1;
+        for (size_t i = 0; i < m->cap; ++i) {
+            if (!m->slots[i].name) continue;
+            size_t s = name_hash(m->slots[i].name) & (cap - 1);
+            while (slots[s].name) s = (s + 1) & (cap - 1);
+            slots[s] = m->slots[i];
+        }
+        free(m->slots);
+        m->slots = slots;
+        m->cap = cap;
+    }
+    size_t s = name_hash(name) & (m->cap - 1);
+    while (m->slots[s].name) s = (s + 1) & (m->cap - 1);
+    m->slots[s].name = name;
+    m->slots[s].at = *at;
+    m->n++;
+    return 0;
+}
+
+struct rnode {
+    char *name;
+    char *version;
+    char *sha256;          /* hex, from the index or the manifest */
+    const char *pinned;    /* checksum the root was given, or NULL */
+    size_t parent;         /* first node that required it, NO_PARENT for a root */
+    int cached;            /* edges come from the graph cache */
+    graph_node edges;
+    /* a cache miss: the manifest's own answer, filled by fetch_edges */
+    fetch_env *env;
+    char *manifest_sha256;
+    char **deps;
+    size_t ndeps;
+    error_t status;
+};
+
+struct closure {
+    struct rnode *v;
+    size_t n, cap;
+    struct name_map names;
+    int failed;
+};
+
+static void node_free(struct rnode *r) {
+    free(r->name);
+    free(r->version);
+    free(r->sha256);
+    free(r->manifest_sha256);
+    for (size_t i = 0; i < r->ndeps; ++i) free(r->deps[i]);
+    free(r->deps);
+}
+
+static void print_required_by(const struct closure *c, size_t parent) {
+    if (parent == NO_PARENT) fprintf(stderr, " (requested)");
+    else fprintf(stderr, " (required by %s@%s)", c->v[parent].name, c->v[parent].version);
+}
+
+/* Add name@version to the closure unless it is there already. A different
+   version of the same name is a conflict. Returns -1 only when out of memory. */
+static int closure_add(struct closure *c, const char *name, const char *version,
+                       const char *pinned, size_t parent) {
+    size_t at;
+    if (name_map_get(&c->names, name, &at) == 0) {
+        const struct rnode *old = &c->v[at];
+        if (strcmp(old->version, version) != 0) {
+            fprintf(stderr, "conflict: %s@%s", name, version);
+            print_required_by(c, parent);
+            fprintf(stderr, " and %s@%s", name, old->version);
+            print_required_by(c, old->parent);
+            fprintf(stderr, "\n");
+            c->failed = 1;
+        }
+        return 0;
+    }
+    if (c->n == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 64;
+        struct rnode *v = realloc(c->v, cap * sizeof(*v));
+        if (!v) return -1;
+        c->v = v;
+        c->cap = cap;
+    }
+    struct rnode *node = &c->v[c->n];
+    memset(node, 0, sizeof(*node));
+    node->name = strdup(name);
+    node->version = strdup(version);
+    node->pinned = pinned;
+    node->parent = parent;
+    at = c->n;
+    if (!node->name || !node->version || name_map_put(&c->names, node->name, &at) < 0) {
+        node_free(node);
+        return -1;
+    }
+    c->n++;
+    return 0;
+}
+
+static void fetch_edges(void *arg) {
+    struct rnode *r = arg;
+    r->status = fetch_dependencies(r->env, r->name, r->version, &r->manifest_sha256, &r->deps, &r->ndeps);
+}
+
+/* Check a fetched manifest against the index and add its edges to the
+   graph. Returns 0, 1 if the manifest is unusable, -1 when out of memory. */
+static int record_edges(const cindex *index, graph *g, struct rnode *r) {
+    cindex_entry entry;
+    uint8_t sha[32];
+    if (hex_to_bin(r->manifest_sha256, sha, sizeof(sha)) != (int)sizeof(sha)) {
+        fprintf(stderr, "%s@%s: invalid sha256 in manifest\n", r->name, r->version);
+        return 1;
+    }
+    if (cindex_find(index, r->name, r->version, &entry) == 0 && *entry.sha256
+     && strcasecmp(entry.sha256, r->manifest_sha256) != 0) {
+        fprintf(stderr, "%s@%s: manifest sha256 %s does not match the index (%s)\n",
+                r->name, r->version, r->manifest_sha256, entry.sha256);
+        return 1;
+    }
+
+    graph_dep *deps = calloc(r->ndeps ? r->ndeps : 1, sizeof(*deps));
+    if (!deps) return -1;
+    int rc = 0;
+    for (size_t k = 0; k < r->ndeps; ++k) {
+        char *dn, *dv;
+        if (pkg_spec_parse(r->deps[k], &dn, &dv) != 0) {
+            fprintf(stderr, "%s@%s: invalid dependency '%s'\n", r->name, r->version, r->deps[k]);
+            rc = 1;
+            break;
+        }
+        /* the name replaces the raw spec; the version lives until the edges are copied */
+        free(r->deps[k]);
+        r->deps[k] = dn;
+        deps[k].name = dn;
+        deps[k].version = dv;
+    }
+    if (rc == 0) {
+        rc = graph_add(g, sha, deps, r->ndeps) == 0 && graph_find(g, sha, &r->edges) == 0 ? 0 : -1;
+        if (rc == 0) {
+            r->sha256 = r->manifest_sha256;
+            r->manifest_sha256 = NULL;
+        }
+    }
+    for (size_t k = 0; k < r->ndeps; ++k) free((char*)deps[k].version);
+    free(deps);
+    return rc;
+}
+
+/* Look up, or fetch, the edges of every node in [lo, hi) and queue their
+   dependencies as the next level. */
+static int resolve_level(struct closure *c, fetch_env *env, graph *g, pool_t **pool, size_t lo, size_t hi) {
+    cindex *index = fetch_env_index(env);
+    if (!index) {
+        c->failed = 1;
+        return 0;
+    }
+    size_t misses = 0;
+    for (size_t i = lo; i < hi; ++i) {
+        struct rnode *r = &c->v[i];
+        cindex_entry entry;
+        uint8_t sha[32];
+        if (cindex_find(index, r->name, r->version, &entry) != 0) {
+            fprintf(stderr, "%s@%s is not in the index", r->name, r->version);
+            print_required_by(c, r->parent);
+            fprintf(stderr, "\n");
+            r->status = ERR_FAILED;
+            c->failed = 1;
+            continue;
+        }
+        if (*entry.sha256 && hex_to_bin(entry.sha256, sha, sizeof(sha)) == (int)sizeof(sha)
+         && graph_find(g, sha, &r->edges) == 0) {
+            r->cached = 1;
+            r->status = ERR_OK;
+            if (!(r->sha256 = strdup(entry.sha256))) return -1;
+            continue;
+        }
+        if (!*pool && !(*pool = pool_create(fetch_env_jobs(env)))) return -1;
+        r->env = env;
+        r->status = ERR_FAILED;
+        if (pool_submit(*pool, fetch_edges, r) != 0) return -1;
+        misses++;
+    }
+    if (misses) pool_wait(*pool);
+
+    for (size_t i = lo; i < hi; ++i) {
+        if (c->v[i].status != ERR_OK) {
+            c->failed = 1;
+            continue;
+        }
+        if (!c->v[i].cached) {
+            int r = record_edges(index, g, &c->v[i]);
+            if (r < 0) return -1;
+            if (r > 0) {
+                c->failed = 1;
+                continue;
+            }
+        }
+        struct rnode *r = &c->v[i];
+        if (r->pinned && strcasecmp(r->pinned, r->sha256) != 0) {
+            fprintf(stderr, "%s@%s: pinned to %s but the registry has %s\n", r->name, r->version, r->pinned, r->sha256);
+            c->failed = 1;
+        }
+        graph_node edges = r->edges;
+        for (uint32_t k = 0; k < edges.ndeps; ++k) {
+            graph_dep d;
+            if (graph_dep_at(g, &edges, k, &d) != 0) continue;
+            if (closure_add(c, d.name, d.version, NULL, i) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+error_t resolve_closure(fetch_env *env, const lock_entry *roots, size_t nroots,
+                        lock_entry **out, size_t *count) {
+    *out = NULL;
+    *count = 0;
+
+    uint64_t t0 = trace_now();
+    char path[SMALL_PATH_LEN];
+    graph *g = NULL;
+    if (graph_path(env->home, path, sizeof(path)) != 0 || !(g = graph_open(path))) {
+        fprintf(stderr, "cannot open the dependency graph cache\n");
+        return ERR_FAILED;
+    }
+
+    struct closure c = {0};
+    pool_t *pool = NULL;
+    int oom = 0;
+    for (size_t i = 0; i < nroots && !oom; ++i)
+        oom = closure_add(&c, roots[i].name, roots[i].version, roots[i].sha256, NO_PARENT) != 0;
+    for (size_t lo = 0; lo < c.n && !oom && !c.failed; ) {
+        size_t hi = c.n;
+        oom = resolve_level(&c, env, g, &pool, lo, hi) != 0;
+        lo = hi;
+    }
+    pool_destroy(pool);
+    if (oom) fprintf(stderr, "out of memory resolving dependencies\n");
+
+    /* edges learned on the way are worth keeping even if resolution failed */
+    char dir[SMALL_PATH_LEN];
+    if (snprintf(dir, sizeof(dir), "%s/pandora/cache", env->home) < (int)sizeof(dir)) (void)ensure_dir(dir, 0755);
+    if (graph_save(g, path) != 0) fprintf(stderr, "warning: cannot write %s\n", path);
+    graph_close(g);
+    trace_span(TRACE_RESOLVE, "closure", t0, 0, c.n);
+
+    error_t rc = oom || c.failed ? ERR_FAILED : ERR_OK;
+    lock_entry *res = rc == ERR_OK ? calloc(c.n ? c.n : 1, sizeof(*res)) : NULL;
+    if (rc == ERR_OK && !res) {
+        perror("calloc");
+        rc = ERR_FAILED;
+    }
+    for (size_t i = 0; i < c.n; ++i) {
+        if (res) {
+            res[i].name = c.v[i].name;
+            res[i].version = c.v[i].version;
+            res[i].sha256 = c.v[i].sha256;
+            c.v[i].name = c.v[i].version = c.v[i].sha256 = NULL;
+        }
+        node_free(&c.v[i]);
+    }
+    if (res) {
+        *out = res;
+        *count = c.n;
+    }
+    free(c.v);
+    free(c.names.slots);
+    return rc;
+}
+
+/* Whether a lockfile is its own closure by the graph cache: every entry has
+   a checksum the cache knows, and every edge of it lands on an entry. */
+static int lock_is_closed(const char *home, const lock_entry *e, size_t n) {
+    char path[SMALL_PATH_LEN];
+    graph *g = NULL;
+    if (graph_path(home, path, sizeof(path)) != 0 || !(g = graph_open(path))) return 0;
+
+    struct name_map names = {0};
+    int closed = 1;
+    for (size_t i = 0; i < n && closed; ++i) {
+        size_t at = i;
+        int r = name_map_put(&names, e[i].name, &at);
+        closed = r == 0 && e[i].sha256;
+    }
+    for (size_t i = 0; i < n && closed; ++i) {
+        uint8_t sha[32];
+        graph_node node = {0};
+        closed = hex_to_bin(e[i].sha256, sha, sizeof(sha)) == (int)sizeof(sha) && graph_find(g, sha, &node) == 0;
+        for (uint32_t k = 0; closed && k < node.ndeps; ++k) {
+            graph_dep d;
+            size_t at;
+            closed = graph_dep_at(g, &node, k, &d) == 0 && name_map_get(&names, d.name, &at) == 0
+                  && strcmp(e[at].version, d.version) == 0;
+        }
+    }
+    free(names.slots);
+    graph_close(g);
+    return closed;
+}
+
+static int same_lock(const lock_entry *a, size_t na, const lock_entry *b, size_t nb) {
+    if (na != nb) return 0;
+    for (size_t i = 0; i < na; ++i) {
+        if (strcmp(a[i].name, b[i].name) != 0 || strcmp(a[i].version, b[i].version) != 0
+         || !a[i].sha256 || !b[i].sha256 || strcasecmp(a[i].sha256, b[i].sha256) != 0) return 0;
+    }
+    return 1;
+}
+
+error_t resolve_profile(fetch_env *env, const char *profile, lock_entry **out, size_t *count) {
+    *out = NULL;
+    *count = 0;
+    const char *home = env->home;
+    char lock_path[SMALL_PATH_LEN];
+    if (snprintf(lock_path, sizeof(lock_path), "%s/pandora/manifests/%s.lock", home, profile) >= (int)sizeof(lock_path)) {
+        fprintf(stderr, "lockfile path too long\n");
+        return ERR_FAILED;
+    }
+
+    lock_entry *entries = NULL;
+    size_t n = 0;
+    if (lock_read(lock_path, &entries, &n) != 0) {
+        fprintf(stderr, "Failed to read lockfile %s\n", lock_path);
+        return ERR_FAILED;
+    }
+    uint64_t t0 = trace_now();
+    int closed = n == 0 || lock_is_closed(home, entries, n);
+    trace_span(TRACE_RESOLVE, "lockfile", t0, 0, closed ? n : 0);
+    if (closed) {
+        *out = entries;
+        *count = n;
+        return ERR_OK;
+    }
+
+    lock_entry *res = NULL;
+    size_t nres = 0;
+    error_t rc = resolve_closure(env, entries, n, &res, &nres);
+
+    if (rc == ERR_OK && !same_lock(entries, n, res, nres)) {
+        if (lock_write(lock_path, res, nres) != 0) fprintf(stderr, "warning: cannot rewrite %s\n", lock_path);
+        else printf("%s: %zu packages pinned (%zu added)\n", lock_path, nres, nres > n ? nres - n : 0);
+    }
+    lock_free(entries, n);
+    if (rc != ERR_OK) return rc;
+    *out = res;
+    *count = nres;
+    return ERR_OK;
+}
@@ -1,5 +1,5 @@
 /* sha256.c - small SHA-256 implementation (public-domain-style) */
-#include "sha256.h"
+#include "core/sha256.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -17,7 +17,7 @@ static const uint32_t K[64] = {
   0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
 };
 
-static void sha256_compress(uint32_t state[8], const uint8_t block[64]) {
+static void sha256_compress_block(uint32_t state[8], const uint8_t block[64]) {
     uint32_t W[64];
     for (int t = 0; t < 16; ++t) {
         W[t] = (uint32_t)block[t*4]<<24 | (uint32_t)block[t*4+1]<<16 | (uint32_t)block[t*4+2]<<8 | (uint32_t)block[t*4+3];
@@ -43,31 +43,297 @@ static void sha256_compress(uint32_t state[8], const uint8_t block[64]) {
     state[4] += e; state[5] += f; state[6] += g; state[7] += h;
 }
 
-void sha256(const void *data, size_t len, uint8_t digest[32]) {
-    uint32_t state[8] = {
-        0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,
-        0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19
-    };
-    uint8_t block[64];
-    size_t rem = len;
+static void sha256_compress_scalar(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+    for (; nblocks; --nblocks, data += 64) sha256_compress_block(state, data);
+}
+
+/* ---- x86_64: Intel SHA extensions, AVX2 8-lane multi-buffer ---- */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define SHA256_HAVE_X86 1
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_compress_shani(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    /* state words are kept as ABEF / CDGH, the layout sha256rnds2 expects */
+    __m128i TMP = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i STATE1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);
+    __m128i STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+    for (; nblocks; --nblocks, data += 64) {
+        __m128i ABEF_SAVE = STATE0, CDGH_SAVE = STATE1;
+        __m128i M[4];
+
+        /* 16 groups of 4 rounds; M[] is a rolling window over the message schedule */
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; ++g) {
+            if (g < 4) M[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * g)), MASK);
+            __m128i cur = M[g & 3];
+            __m128i MSG = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i*)&K[4 * g]));
+            STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+            if (g >= 3 && g <= 14) {
+                __m128i next = _mm_add_epi32(M[(g + 1) & 3], _mm_alignr_epi8(cur, M[(g + 3) & 3], 4));
+                M[(g + 1) & 3] = _mm_sha256msg2_epu32(next, cur);
+            }
+            MSG = _mm_shuffle_epi32(MSG, 0x0E);
+            STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+            if (g >= 1 && g <= 12) M[(g + 3) & 3] = _mm_sha256msg1_epu32(M[(g + 3) & 3], cur);
+        }
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);
+    _mm_storeu_si128((__m128i*)&state[0], STATE0);
+    _mm_storeu_si128((__m128i*)&state[4], STATE1);
+}
+
+#define AVX_ROTR(x, r) _mm256_or_si256(_mm256_srli_epi32((x), (r)), _mm256_slli_epi32((x), 32 - (r)))
+
+/* load 32 bytes from each of 8 lanes and transpose, so out[w] holds word w of every lane */
+__attribute__((target("avx2")))
+static void sha256_x8_load(__m256i out[8], const uint8_t *const data[8], size_t off) {
+    const __m256i BSWAP = _mm256_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3,
+                                          12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+    __m256i r[8], t[8], u[8];
+    for (int i = 0; i < 8; ++i)
+        r[i] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(data[i] + off)), BSWAP);
+    for (int i = 0; i < 8; i += 4) {
+        t[i+0] = _mm256_unpacklo_epi32(r[i+0], r[i+1]);
+        t[i+1] = _mm256_unpackhi_epi32(r[i+0], r[i+1]);
+        t[i+2] = _mm256_unpacklo_epi32(r[i+2], r[i+3]);
+        t[i+3] = _mm256_unpackhi_epi32(r[i+2], r[i+3]);
+        u[i+0] = _mm256_unpacklo_epi64(t[i+0], t[i+2]);
+        u[i+1] = _mm256_unpackhi_epi64(t[i+0], t[i+2]);
+        u[i+2] = _mm256_unpacklo_epi64(t[i+1], t[i+3]);
+        u[i+3] = _mm256_unpackhi_epi64(t[i+1], t[i+3]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        out[i]     = _mm256_permute2x128_si256(u[i], u[i+4], 0x20);
+        out[i + 4] = _mm256_permute2x128_si256(u[i], u[i+4], 0x31);
+    }
+}
+
+/* hash nblocks from each of 8 independent streams in lockstep; st[j] holds state word j of every lane */
+__attribute__((target("avx2")))
+static void sha256_compress_x8_avx2(__m256i st[8], const uint8_t *const data[8], size_t nblocks) {
+    for (size_t blk = 0; blk < nblocks; ++blk) {
+        __m256i W[16];
+        sha256_x8_load(W, data, blk * 64);
+        sha256_x8_load(W + 8, data, blk * 64 + 32);
+
+        __m256i a = st[0], b = st[1], c = st[2], d = st[3];
+        __m256i e = st[4], f = st[5], g = st[6], h = st[7];
+        for (int t = 0; t < 64; ++t) {
+            __m256i w;
+            if (t < 16) {
+                w = W[t];
+            } else {
+                __m256i w15 = W[(t - 15) & 15], w2 = W[(t - 2) & 15];
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(AVX_ROTR(w15, 7), AVX_ROTR(w15, 18)), _mm256_srli_epi32(w15, 3));
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(AVX_ROTR(w2, 17), AVX_ROTR(w2, 19)), _mm256_srli_epi32(w2, 10));
+                w = _mm256_add_epi32(_mm256_add_epi32(W[t & 15], s0), _mm256_add_epi32(W[(t - 7) & 15], s1));
+                W[t & 15] = w;
+            }
+            __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(AVX_ROTR(e, 6), AVX_ROTR(e, 11)), AVX_ROTR(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(h, S1),
+                                             _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32((int)K[t]), w)));
+            __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(AVX_ROTR(a, 2), AVX_ROTR(a, 13)), AVX_ROTR(a, 22));
+            __m256i maj = _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+            __m256i temp2 = _mm256_add_epi32(S0, maj);
+            h = g; g = f; f = e; e = _mm256_add_epi32(d, temp1);
+            d = c; c = b; b = a; a = _mm256_add_epi32(temp1, temp2);
+        }
+        st[0] = _mm256_add_epi32(st[0], a); st[1] = _mm256_add_epi32(st[1], b);
+        st[2] = _mm256_add_epi32(st[2], c); st[3] = _mm256_add_epi32(st[3], d);
+        st[4] = _mm256_add_epi32(st[4], e); st[5] = _mm256_add_epi32(st[5], f);
+        st[6] = _mm256_add_epi32(st[6], g); st[7] = _mm256_add_epi32(st[7], h);
+    }
+}
+
+__attribute__((target("avx2")))
+static void sha256_lanes_avx2(uint32_t *const states[8], const uint8_t *const data[8], size_t nblocks) {
+    __m256i st[8];
+    for (int j = 0; j < 8; ++j)
+        st[j] = _mm256_setr_epi32((int)states[0][j], (int)states[1][j], (int)states[2][j], (int)states[3][j],
+                                  (int)states[4][j], (int)states[5][j], (int)states[6][j], (int)states[7][j]);
+    sha256_compress_x8_avx2(st, data, nblocks);
+    for (int j = 0; j < 8; ++j) {
+        uint32_t lane[8];
+        _mm256_storeu_si256((__m256i*)lane, st[j]);
+        for (int i = 0; i < 8; ++i) states[i][j] = lane[i];
+    }
+}
+
+#undef AVX_ROTR
+#endif
+
+/* ---- aarch64: ARMv8 crypto extensions ---- */
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define SHA256_HAVE_ARM 1
+
+__attribute__((target("arch=armv8-a+crypto")))
+static void sha256_compress_armce(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+    uint32x4_t STATE0 = vld1q_u32(&state[0]);
+    uint32x4_t STATE1 = vld1q_u32(&state[4]);
+
+    for (; nblocks; --nblocks, data += 64) {
+        uint32x4_t ABCD_SAVE = STATE0, EFGH_SAVE = STATE1;
+        uint32x4_t M[4];
+        for (int i = 0; i < 4; ++i)
+            M[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+
+        /* 16 groups of 4 rounds; M[g & 3] is advanced to group g + 4 as it is consumed */
+        for (int g = 0; g < 16; ++g) {
+            uint32x4_t TMP = vaddq_u32(M[g & 3], vld1q_u32(&K[4 * g]));
+            if (g < 12) M[g & 3] = vsha256su0q_u32(M[g & 3], M[(g + 1) & 3]);
+            uint32x4_t ABCD = STATE0;
+            STATE0 = vsha256hq_u32(STATE0, STATE1, TMP);
+            STATE1 = vsha256h2q_u32(STATE1, ABCD, TMP);
+            if (g < 12) M[g & 3] = vsha256su1q_u32(M[g & 3], M[(g + 2) & 3], M[(g + 3) & 3]);
+        }
+
+        STATE0 = vaddq_u32(STATE0, ABCD_SAVE);
+        STATE1 = vaddq_u32(STATE1, EFGH_SAVE);
+    }
+
+    vst1q_u32(&state[0], STATE0);
+    vst1q_u32(&state[4], STATE1);
+}
+#endif
+
+/* ---- runtime dispatch ---- */
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *data, size_t nblocks);
+
+static sha256_blocks_fn sha256_blocks = sha256_compress_scalar;
+static const char *sha256_impl = "scalar";
+static int sha256_have_x8 = 0;
+
+/* CPU capabilities, probed once at startup */
+static int cpu_shani = 0, cpu_avx2 = 0, cpu_armce = 0;
+
+int sha256_select_impl(const char *name) {
+    if (strcmp(name, "scalar") == 0) {
+        sha256_blocks = sha256_compress_scalar;
+        sha256_have_x8 = 0;
+#if defined(SHA256_HAVE_X86)
+    } else if (strcmp(name, "sha-ni") == 0 && cpu_shani) {
+        sha256_blocks = sha256_compress_shani;
+        sha256_have_x8 = 0;
+    } else if (strcmp(name, "avx2-x8") == 0 && cpu_avx2) {
+        sha256_blocks = sha256_compress_scalar;
+        sha256_have_x8 = 1;
+#elif defined(SHA256_HAVE_ARM)
+    } else if (strcmp(name, "armv8-ce") == 0 && cpu_armce) {
+        sha256_blocks = sha256_compress_armce;
+        sha256_have_x8 = 0;
+#endif
+    } else {
+        return -1;
+    }
+    sha256_impl = name;
+    return 0;
+}
+
+__attribute__((constructor))
+static void sha256_probe_cpu(void) {
+#if defined(SHA256_HAVE_X86)
+    unsigned eax, ebx, ecx, edx;
+    int sse41 = 0, ssse3 = 0, osxsave = 0;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        ssse3 = (ecx >> 9) & 1;
+        sse41 = (ecx >> 19) & 1;
+        osxsave = (ecx >> 27) & 1;
+    }
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        cpu_avx2 = (ebx >> 5) & 1;
+        cpu_shani = ((ebx >> 29) & 1) && sse41 && ssse3;
+    }
+    /* AVX state must also be enabled by the OS */
+    if (cpu_avx2 && osxsave) {
+        unsigned xcr0_lo, xcr0_hi;
+        __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        if ((xcr0_lo & 0x6) != 0x6) cpu_avx2 = 0;
+    } else {
+        cpu_avx2 = 0;
+    }
+#elif defined(SHA256_HAVE_ARM)
+    cpu_armce = (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#endif
+    (void)cpu_shani; (void)cpu_avx2; (void)cpu_armce;
+
+    /* best first; SHA-NI on one stream beats eight AVX2 lanes, so x8 is only the
+       default when the SHA extensions are missing */
+    if (sha256_select_impl("sha-ni") != 0
+     && sha256_select_impl("armv8-ce") != 0
+     && sha256_select_impl("avx2-x8") != 0)
+        sha256_select_impl("scalar");
+}
+
+const char *sha256_impl_name(void) {
+    return sha256_impl;
+}
+
+static const uint32_t H0[8] = {
+    0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,
+    0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19
+};
+
+void sha256_init(sha256_ctx *ctx) {
+    memcpy(ctx->state, H0, sizeof(H0));
+    ctx->total = 0;
+    ctx->buf_len = 0;
+}
+
+void sha256_update(sha256_ctx *ctx, const void *data, size_t len) {
     const uint8_t *p = (const uint8_t*)data;
-    /* process full blocks */
-    while (rem >= 64) {
-        memcpy(block, p, 64);
-        sha256_compress(state, block);
-        p += 64; rem -= 64;
+    ctx->total += len;
+    /* top up a partially filled block first */
+    if (ctx->buf_len) {
+        size_t take = 64 - ctx->buf_len;
+        if (take > len) take = len;
+        memcpy(ctx->buf + ctx->buf_len, p, take);
+        ctx->buf_len += take;
+        p += take; len -= take;
+        if (ctx->buf_len < 64) return;
+        sha256_blocks(ctx->state, ctx->buf, 1);
+        ctx->buf_len = 0;
+    }
+    /* full blocks straight from the caller's buffer */
+    if (len >= 64) {
+        size_t nblocks = len / 64;
+        sha256_blocks(ctx->state, p, nblocks);
+        p += nblocks * 64; len -= nblocks * 64;
     }
+    if (len) {
+        memcpy(ctx->buf, p, len);
+        ctx->buf_len = len;
+    }
+}
+
+void sha256_final(sha256_ctx *ctx, uint8_t digest[32]) {
+    size_t rem = ctx->buf_len;
     /* final padding */
-    size_t total_bits_hi = (len >> 61);
-    size_t total_bits_lo = (len << 3);
-    /* copy remainder */
     uint8_t tail[128];
     memset(tail, 0, sizeof(tail));
-    if (rem) memcpy(tail, p, rem);
+    if (rem) memcpy(tail, ctx->buf, rem);
     tail[rem] = 0x80;
     size_t pad_len = (rem + 1 + 8 <= 64) ? (64) : (128);
     /* append 64-bit big-endian length (we'll support up to 2^64-1 bits) */
-    uint64_t bits = (uint64_t)len * 8;
+    uint64_t bits = ctx->total * 8;
     tail[pad_len - 8] = (bits >> 56) & 0xFF;
     tail[pad_len - 7] = (bits >> 48) & 0xFF;
     tail[pad_len - 6] = (bits >> 40) & 0xFF;
@@ -77,15 +343,53 @@ void sha256(const void *data, size_t len, uint8_t digest[32]) {
     tail[pad_len - 2] = (bits >> 8) & 0xFF;
     tail[pad_len - 1] = (bits >> 0) & 0xFF;
     /* compress final blocks */
-    sha256_compress(state, tail);
-    if (pad_len == 128) sha256_compress(state, tail + 64);
+    sha256_blocks(ctx->state, tail, pad_len / 64);
     /* produce digest big-endian */
     for (int i = 0; i < 8; ++i) {
-        digest[i*4+0] = (state[i] >> 24) & 0xFF;
-        digest[i*4+1] = (state[i] >> 16) & 0xFF;
-        digest[i*4+2] = (state[i] >> 8) & 0xFF;
-        digest[i*4+3] = (state[i] >> 0) & 0xFF;
+        digest[i*4+0] = (ctx->state[i] >> 24) & 0xFF;
+        digest[i*4+1] = (ctx->state[i] >> 16) & 0xFF;
+        digest[i*4+2] = (ctx->state[i] >> 8) & 0xFF;
+        digest[i*4+3] = (ctx->state[i] >> 0) & 0xFF;
+    }
+}
+
+void sha256(const void *data, size_t len, uint8_t digest[32]) {
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, digest);
+}
+
+void sha256_update_lanes(sha256_ctx *const ctx[], const void *const data[], size_t n, size_t len) {
+    size_t nblocks = len / 64;
+    int aligned = n > 1 && nblocks > 0;
+    for (size_t i = 0; i < n && aligned; ++i) aligned = ctx[i]->buf_len == 0;
+#if defined(SHA256_HAVE_X86)
+    if (sha256_have_x8 && aligned) {
+        /* pad short batches by repeating lane 0 into scratch states */
+        uint32_t scratch[SHA256_MAX_LANES][8];
+        uint32_t *states[SHA256_MAX_LANES];
+        const uint8_t *ptrs[SHA256_MAX_LANES];
+        for (size_t i = 0; i < SHA256_MAX_LANES; ++i) {
+            if (i < n) {
+                states[i] = ctx[i]->state;
+                ptrs[i] = data[i];
+            } else {
+                memcpy(scratch[i], ctx[0]->state, sizeof(scratch[i]));
+                states[i] = scratch[i];
+                ptrs[i] = data[0];
+            }
+        }
+        sha256_lanes_avx2(states, ptrs, nblocks);
+        for (size_t i = 0; i < n; ++i) {
+            ctx[i]->total += nblocks * 64;
+            if (len > nblocks * 64) sha256_update(ctx[i], (const uint8_t*)data[i] + nblocks * 64, len - nblocks * 64);
+        }
+        return;
     }
+#endif
+    (void)aligned;
+    for (size_t i = 0; i < n; ++i) sha256_update(ctx[i], data[i], len);
 }
 
 void sha256_to_hex(const uint8_t digest[32], char out_hex[65]) {
@@ -119,7 +423,7 @@ int ct_memcmp(const void *a, const void *b, size_t len) {
     return diff == 0;
 }
 
-#ifndef PANDORA
+#if !defined(PANDORA) && !defined(SHA256_NO_MAIN)
 #include <sys/stat.h>
 #include <errno.h>
 
@@ -139,48 +443,28 @@ int main(int argc, char **argv) {
         return 3;
     }
 
-    size_t filesize = (size_t)st.st_size;
-    uint8_t *data = NULL;
-
-    if (filesize > 0) {
-        FILE *f = fopen(path, "rb");
-        if (!f) {
-            fprintf(stderr, "fopen(%s): %s\n", path, strerror(errno));
-            return 4;
-        }
-
-        data = malloc(filesize);
-        if (!data) {
-            fclose(f);
-            fprintf(stderr, "out of memory\n");
-            return 5;
-        }
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "fopen(%s): %s\n", path, strerror(errno));
+        return 4;
+    }
 
-        size_t read_total = 0;
-        while (read_total < filesize) {
-            size_t n = fread(data + read_total, 1, filesize - read_total, f);
-            if (n == 0) {
-                if (ferror(f)) {
-                    fprintf(stderr, "read error: %s\n", strerror(errno));
-                    fclose(f);
-                    free(data);
-                    return 6;
-                }
-                break;
-            }
-            read_total += n;
-        }
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        sha256_update(&ctx, buf, n);
+    }
+    if (ferror(f)) {
+        fprintf(stderr, "read error: %s\n", strerror(errno));
         fclose(f);
-        if (read_total != filesize) {
-            free(data);
-            fprintf(stderr, "short read\n");
-            return 7;
-        }
+        return 6;
     }
+    fclose(f);
 
     uint8_t digest[32];
-    sha256(data, filesize, digest);
-    if (data) free(data);
+    sha256_final(&ctx, digest);
 
     char hex[65];
     sha256_to_hex(digest, hex);
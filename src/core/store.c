@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "core/store.h"
+
+int store_objects_path(const char *home, char *out, size_t len) {
+    return snprintf(out, len, "%s/pandora/objects", home) >= (int)len ? -1 : 0;
+}
+
+/* Unlink the unreferenced objects in one fan-out directory. Fan-out
+   directories themselves are kept so a concurrent install never finds its
+   parent gone between mkdir and link. */
+static void prune_fanout(int dir_fd, const char *path, size_t *objects, unsigned long long *bytes) {
+    DIR *d = fdopendir(dir_fd);
+    if (!d) {
+        fprintf(stderr, "cannot read %s: %s\n", path, strerror(errno));
+        close(dir_fd);
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        struct stat st;
+        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        if (!S_ISREG(st.st_mode) || st.st_nlink != 1) continue;
+        if (unlinkat(dirfd(d), de->d_name, 0) != 0) {
+            fprintf(stderr, "cannot remove %s/%s: %s\n", path, de->d_name, strerror(errno));
+            continue;
+        }
+        (*objects)++;
+        *bytes += (unsigned long long)st.st_size;
+    }
+    closedir(d);
+}
+
+error_t store_prune(void) {
+    const char *home = getenv("HOME");
+    if (!home) {
+        fprintf(stderr, "HOME not set\n");
+        return ERR_FAILED;
+    }
+    char root[512];
+    if (store_objects_path(home, root, sizeof(root)) != 0) {
+        fprintf(stderr, "object store path too long\n");
+        return ERR_FAILED;
+    }
+
+    DIR *d = opendir(root);
+    if (!d) {
+        if (errno == ENOENT) {
+            printf("pruned 0 objects (0 bytes)\n");
+            return ERR_OK;
+        }
+        fprintf(stderr, "cannot read %s: %s\n", root, strerror(errno));
+        return ERR_FAILED;
+    }
+
+    size_t objects = 0;
+    unsigned long long bytes = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        int fd = openat(dirfd(d), de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (fd < 0) continue;
+        char path[768];
+        snprintf(path, sizeof(path), "%s/%s", root, de->d_name);
+        prune_fanout(fd, path, &objects, &bytes);
+    }
+    closedir(d);
+
+    printf("pruned %zu objects (%llu bytes)\n", objects, bytes);
+    return ERR_OK;
+}
@@ -0,0 +1,786 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "core/verify.h"
+#include "core/acl_arena.h"
+#include "core/lock.h"
+#include "core/sha256.h"
+#include "util/path.h"
+#include "util/pool.h"
+
+/* read size per syscall; a multiple of the page size on an aligned buffer, so
+   the loop stays O_DIRECT-friendly */
+#define VERIFY_CHUNK (1024 * 1024)
+#define VERIFY_ALIGN 4096
+/* per file when SHA256_MAX_LANES are hashed together (see hash_batch) */
+#define VERIFY_LANE_CHUNK (256 * 1024)
+/* a cache hit older than this is rehashed anyway, so bit rot that leaves
+   mtime alone is still caught within a month */
+#define VERIFY_RECHECK_SECS (30LL * 24 * 3600)
+#define VERIFY_CACHE "cache/verify.cache"
+
+enum item_kind {
+    ITEM_OBJECT,   /* objects/<2>/<62>: the name is the digest */
+    ITEM_BLOB,     /* pkgs/<name>-<version>.pkg: digest from its cached manifest */
+    ITEM_STORE,    /* store tree file: must hash to the object it is linked to */
+};
+
+enum item_state {
+    ITEM_PENDING,
+    ITEM_OK,
+    ITEM_CACHED,     /* unchanged since a recent sweep; not reread */
+    ITEM_CORRUPT,
+    ITEM_UNREADABLE,
+    ITEM_UNCHECKED,  /* nothing to compare against */
+};
+
+struct vitem {
+    char *rel;               /* relative to $HOME/pandora */
+    int kind;
+    int state;
+    struct stat st;
+    uint8_t want[32];        /* ITEM_OBJECT and ITEM_BLOB */
+    uint8_t got[32];
+    int64_t verified_at;
+};
+
+struct vitems {
+    struct vitem *v;
+    size_t n, cap;
+    size_t unchecked_blobs;  /* cached blobs without a usable manifest */
+};
+
+/* one entry of the verify cache: "<sha256> <size> <mtime s> <mtime ns> <inode> <verified at> <path>" */
+struct vcache_entry {
+    char *rel;
+    uint8_t digest[32];
+    uint64_t size;
+    int64_t mtime_sec;
+    long mtime_nsec;
+    uint64_t ino;
+    int64_t verified_at;
+};
+
+struct vcache {
+    struct vcache_entry *v;
+    size_t n, cap;
+};
+
+static int add_item(struct vitems *items, int root_fd, const char *rel, int kind) {
+    struct stat st;
+    if (fstatat(root_fd, rel, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) return 1;
+    if (items->n == items->cap) {
+        size_t ncap = items->cap ? items->cap * 2 : 256;
+        struct vitem *nv = realloc(items->v, ncap * sizeof(*nv));
+        if (!nv) return -1;
+        items->v = nv;
+        items->cap = ncap;
+    }
+    struct vitem *it = &items->v[items->n];
+    memset(it, 0, sizeof(*it));
+    if (!(it->rel = strdup(rel))) return -1;
+    it->kind = kind;
+    it->st = st;
+    items->n++;
+    return 0;
+}
+
+static void free_items(struct vitems *items) {
+    for (size_t i = 0; i < items->n; ++i) free(items->v[i].rel);
+    free(items->v);
+}
+
+static int cmp_item_rel(const void *a, const void *b) {
+    return strcmp(((const struct vitem *)a)->rel, ((const struct vitem *)b)->rel);
+}
+
+static int is_hex(const char *s, size_t len) {
+    size_t i = 0;
+    for (; i < len && s[i]; ++i)
+        if (!((s[i] >= '0' && s[i] <= '9') || (s[i] >= 'a' && s[i] <= 'f'))) return 0;
+    return i == len && s[i] == '\0';
+}
+
+/* every objects/<2>/<62> file, wanting the digest spelled by its name */
+static int collect_objects(int root_fd, struct vitems *items) {
+    int fd = openat(root_fd, "objects", O_RDONLY | O_DIRECTORY);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!d) {
+        if (fd >= 0) close(fd);
+        return errno == ENOENT ? 0 : -1;
+    }
+    int rc = 0;
+    struct dirent *de;
+    while (rc == 0 && (de = readdir(d)) != NULL) {
+        if (!is_hex(de->d_name, 2)) continue;
+        int sub_fd = openat(dirfd(d), de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        DIR *sub = sub_fd >= 0 ? fdopendir(sub_fd) : NULL;
+        if (!sub) {
+            if (sub_fd >= 0) close(sub_fd);
+            continue;
+        }
+        struct dirent *oe;
+        while (rc == 0 && (oe = readdir(sub)) != NULL) {
+            if (!is_hex(oe->d_name, 62)) continue;
+            char rel[PATH_MAX], hex[65];
+            snprintf(rel, sizeof(rel), "objects/%s/%s", de->d_name, oe->d_name);
+            snprintf(hex, sizeof(hex), "%.2s%.62s", de->d_name, oe->d_name);
+            size_t at = items->n;
+            int added = add_item(items, root_fd, rel, ITEM_OBJECT);
+            if (added < 0) rc = -1;
+            else if (added == 0) hex_to_bin(hex, items->v[at].want, 32);
+        }
+        closedir(sub);
+    }
+    closedir(d);
+    return rc;
+}
+
+/* the sha256 pinned by manifests/<stem>-manifest.acl, as fetch_manifest reads it */
+static int manifest_digest(const char *base, const char *stem, uint8_t digest[32]) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/manifests/%s-manifest.acl", base, stem) >= (int)sizeof(path)) return -1;
+    acl_arena *manifest = acl_arena_parse_file(path);
+    if (!manifest) return -1;
+    const char *sum = NULL;
+    int ok = acl_arena_get_string(manifest, "Manifest.sha256", &sum) && hex_to_bin(sum, digest, 32) == 32;
+    acl_arena_free(manifest);
+    return ok ? 0 : -1;
+}
+
+static int add_blob(struct vitems *items, int root_fd, const char *base, const char *stem) {
+    char rel[PATH_MAX];
+    if (snprintf(rel, sizeof(rel), "pkgs/%s.pkg", stem) >= (int)sizeof(rel)) return 0;
+    uint8_t want[32];
+    struct stat st;
+    if (fstatat(root_fd, rel, &st, AT_SYMLINK_NOFOLLOW) != 0) return 0;
+    if (manifest_digest(base, stem, want) != 0) {
+        items->unchecked_blobs++;
+        return 0;
+    }
+    size_t at = items->n;
+    int added = add_item(items, root_fd, rel, ITEM_BLOB);
+    if (added == 0) memcpy(items->v[at].want, want, 32);
+    return added < 0 ? -1 : 0;
+}
+
+/* every finished download in pkgs/ */
+static int collect_blobs(int root_fd, const char *base, struct vitems *items) {
+    int fd = openat(root_fd, "pkgs", O_RDONLY | O_DIRECTORY);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!d) {
+        if (fd >= 0) close(fd);
+        return errno == ENOENT ? 0 : -1;
+    }
+    int rc = 0;
+    struct dirent *de;
+    while (rc == 0 && (de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (de->d_name[0] == '.' || len <= 4 || strcmp(de->d_name + len - 4, ".pkg") != 0) continue;
+        char stem[NAME_MAX + 1];
+        memcpy(stem, de->d_name, len - 4);
+        stem[len - 4] = '\0';
+        rc = add_blob(items, root_fd, base, stem);
+    }
+    closedir(d);
+    return rc;
+}
+
+/* every regular file below rel */
+static int collect_tree(int root_fd, const char *rel, struct vitems *items) {
+    int fd = openat(root_fd, rel, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!d) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    int rc = 0;
+    struct dirent *de;
+    while (rc == 0 && (de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        char crel[PATH_MAX];
+        if (snprintf(crel, sizeof(crel), "%s/%s", rel, de->d_name) >= (int)sizeof(crel)) continue;
+        struct stat st;
+        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        if (S_ISDIR(st.st_mode)) rc = collect_tree(root_fd, crel, items);
+        else if (S_ISREG(st.st_mode) && add_item(items, root_fd, crel, ITEM_STORE) < 0) rc = -1;
+    }
+    closedir(d);
+    return rc;
+}
+
+static void cache_free(struct vcache *c) {
+    for (size_t i = 0; i < c->n; ++i) free(c->v[i].rel);
+    free(c->v);
+    c->v = NULL;
+    c->n = c->cap = 0;
+}
+
+static int cmp_cache_rel(const void *a, const void *b) {
+    return strcmp(((const struct vcache_entry *)a)->rel, ((const struct vcache_entry *)b)->rel);
+}
+
+/* A missing or damaged cache just means everything is hashed again. */
+static void cache_load(const char *path, struct vcache *c) {
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    char line[PATH_MAX + 192];
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') continue;
+        line[len - 1] = '\0';
+        struct vcache_entry e;
+        char hex[65];
+        unsigned long long size, ino;
+        long long mtime_sec, verified_at;
+        int off = 0;
+        if (sscanf(line, "%64s %llu %lld %ld %llu %lld %n", hex, &size, &mtime_sec, &e.mtime_nsec,
+                   &ino, &verified_at, &off) != 6 || off == 0 || !line[off]
+         || hex_to_bin(hex, e.digest, 32) != 32) continue;
+        if (c->n == c->cap) {
+            size_t ncap = c->cap ? c->cap * 2 : 256;
+            struct vcache_entry *nv = realloc(c->v, ncap * sizeof(*nv));
+            if (!nv) break;
+            c->v = nv;
+            c->cap = ncap;
+        }
+        if (!(e.rel = strdup(line + off))) break;
+        e.size = size;
+        e.mtime_sec = mtime_sec;
+        e.ino = ino;
+        e.verified_at = verified_at;
+        c->v[c->n++] = e;
+    }
+    fclose(f);
+    qsort(c->v, c->n, sizeof(*c->v), cmp_cache_rel);
+}
+
+static const struct vcache_entry *cache_find(const struct vcache *c, const char *rel) {
+    struct vcache_entry key = { .rel = (char *)rel };
+    return c->n ? bsearch(&key, c->v, c->n, sizeof(*c->v), cmp_cache_rel) : NULL;
+}
+
+/* The entry for it if the file is the one hashed last time, hashed recently,
+   to the digest it should have; NULL otherwise. */
+static const struct vcache_entry *cache_hit(const struct vcache *c, const struct vitem *it, int64_t now) {
+    const struct vcache_entry *e = cache_find(c, it->rel);
+    return e && e->size == (uint64_t)it->st.st_size && e->ino == (uint64_t)it->st.st_ino
+        && e->mtime_sec == (int64_t)it->st.st_mtim.tv_sec && e->mtime_nsec == it->st.st_mtim.tv_nsec
+        && now - e->verified_at < VERIFY_RECHECK_SECS
+        && (it->kind == ITEM_STORE || memcmp(e->digest, it->want, 32) == 0) ? e : NULL;
+}
+
+static void cache_write_entry(FILE *f, const struct vcache_entry *e) {
+    char hex[65];
+    sha256_to_hex(e->digest, hex);
+    fprintf(f, "%s %llu %lld %ld %llu %lld %s\n", hex, (unsigned long long)e->size, (long long)e->mtime_sec,
+            e->mtime_nsec, (unsigned long long)e->ino, (long long)e->verified_at, e->rel);
+}
+
+/* Rewrite the cache with every file that passed. With keep_others, entries
+   for files this run did not look at are carried over. Both lists are
+   sorted by path, so this is a merge. */
+static int cache_save(const char *path, const struct vcache *old, const struct vitems *items, int keep_others) {
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    size_t o = 0;
+    for (size_t i = 0; i <= items->n; ++i) {
+        const struct vitem *it = i < items->n ? &items->v[i] : NULL;
+        for (; o < old->n && (!it || strcmp(old->v[o].rel, it->rel) < 0); ++o)
+            if (keep_others) cache_write_entry(f, &old->v[o]);
+        if (!it) break;
+        if (o < old->n && strcmp(old->v[o].rel, it->rel) == 0) o++;
+        if (it->state != ITEM_OK && it->state != ITEM_CACHED) continue;
+        struct vcache_entry e = {
+            .rel = it->rel, .size = (uint64_t)it->st.st_size, .mtime_sec = (int64_t)it->st.st_mtim.tv_sec,
+            .mtime_nsec = it->st.st_mtim.tv_nsec, .ino = (uint64_t)it->st.st_ino, .verified_at = it->verified_at,
+        };
+        memcpy(e.digest, it->got, 32);
+        cache_write_entry(f, &e);
+    }
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Work-stealing sweep. The items are dealt round-robin, largest first, into
+   one contiguous range of order[] per worker; a worker takes from the front
+   of its own range and, once that is empty, steals the back half of the
+   fullest other range. Ranges only shrink, so an empty sweep is final. */
+struct deque {
+    pthread_mutex_t mu;
+    size_t lo, hi;
+};
+
+struct sweep {
+    struct vitem *items;
+    const size_t *order;
+    struct deque *dq;
+    size_t nworkers;
+    int root_fd;
+    int lanes;               /* hash SHA256_MAX_LANES files at a time */
+    pthread_mutex_t stats_mu;
+    unsigned long long hashed_bytes;
+};
+
+struct worker {
+    struct sweep *sw;
+    size_t id;
+};
+
+static int next_item(struct sweep *sw, size_t self, size_t *out) {
+    struct deque *mine = &sw->dq[self];
+    for (;;) {
+        pthread_mutex_lock(&mine->mu);
+        if (mine->lo < mine->hi) {
+            *out = sw->order[mine->lo++];
+            pthread_mutex_unlock(&mine->mu);
+            return 1;
+        }
+        pthread_mutex_unlock(&mine->mu);
+
+        /* pick the fullest victim without locks, then recheck under its lock */
+        size_t victim = sw->nworkers, most = 0;
+        for (size_t w = 0; w < sw->nworkers; ++w) {
+            if (w == self) continue;
+            pthread_mutex_lock(&sw->dq[w].mu);
+            size_t left = sw->dq[w].hi - sw->dq[w].lo;
+            pthread_mutex_unlock(&sw->dq[w].mu);
+            if (left > most) {
+                most = left;
+                victim = w;
+            }
+        }
+        if (victim == sw->nworkers) return 0;
+
+        struct deque *v = &sw->dq[victim];
+        pthread_mutex_lock(&v->mu);
+        size_t left = v->hi - v->lo;
+        size_t take = (left + 1) / 2;
+        size_t lo = v->hi - take, hi = v->hi;
+        v->hi = lo;
+        pthread_mutex_unlock(&v->mu);
+        if (!take) continue;
+
+        pthread_mutex_lock(&mine->mu);
+        mine->lo = lo;
+        mine->hi = hi;
+        pthread_mutex_unlock(&mine->mu);
+    }
+}
+
+/* Open an item for hashing, telling the kernel to read ahead. */
+static int open_item(int root_fd, struct vitem *it) {
+    int fd = openat(root_fd, it->rel, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    it->st = st;   /* what the cache records must be what was hashed */
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+/* Stream one file through SHA-256 in large sequential reads, dropping each
+   chunk from the page cache once hashed so a sweep over the whole store
+   does not push everything else out. */
+static int hash_file(int root_fd, struct vitem *it, uint8_t *buf, unsigned long long *bytes) {
+    int fd = open_item(root_fd, it);
+    if (fd < 0) return -1;
+
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    off_t done = 0;
+    for (;;) {
+        ssize_t r = read(fd, buf, VERIFY_CHUNK);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) {
+            close(fd);
+            return -1;
+        }
+        if (r == 0) break;
+        sha256_update(&ctx, buf, (size_t)r);
+        (void)posix_fadvise(fd, done, r, POSIX_FADV_DONTNEED);
+        done += r;
+    }
+    close(fd);
+    sha256_final(&ctx, it->got);
+    *bytes += (unsigned long long)done;
+    return 0;
+}
+
+/* a store file is intact if its content hashes to the object it is a link of */
+static int linked_object_matches(int root_fd, const struct vitem *it) {
+    char hex[65], rel[80];
+    sha256_to_hex(it->got, hex);
+    snprintf(rel, sizeof(rel), "objects/%.2s/%s", hex, hex + 2);
+    struct stat st;
+    return fstatat(root_fd, rel, &st, AT_SYMLINK_NOFOLLOW) == 0
+        && st.st_dev == it->st.st_dev && st.st_ino == it->st.st_ino;
+}
+
+/* judge a hashed item against what it should be */
+static void settle_item(int root_fd, struct vitem *it) {
+    if (it->kind == ITEM_STORE) it->state = linked_object_matches(root_fd, it) ? ITEM_OK : ITEM_CORRUPT;
+    else it->state = ct_memcmp(it->got, it->want, 32) ? ITEM_OK : ITEM_CORRUPT;
+}
+
+/* One file of a batch: bytes buf[pos, len) are read but not yet hashed. */
+struct lane {
+    struct vitem *it;
+    int fd;                  /* -1 once finished */
+    sha256_ctx ctx;
+    uint8_t *buf;
+    size_t pos, len;
+    off_t done;
+};
+
+/* Hash up to SHA256_MAX_LANES items in lockstep through the multi-buffer
+   kernel. Each round feeds every lane the bytes all of them have (whole
+   blocks) in one sha256_update_lanes call; a lane's short tail goes in on
+   its own. The sweep hands out items largest first, so a batch is of
+   similar sizes and the lanes stay busy together. */
+static void hash_batch(struct sweep *sw, struct vitem *const items[], size_t n, uint8_t *bufs,
+                       unsigned long long *bytes) {
+    struct lane lanes[SHA256_MAX_LANES];
+    size_t active = 0;
+    for (size_t i = 0; i < n; ++i) {
+        struct lane *l = &lanes[i];
+        *l = (struct lane){ .it = items[i], .buf = bufs + i * VERIFY_LANE_CHUNK };
+        l->fd = open_item(sw->root_fd, l->it);
+        if (l->fd < 0) {
+            l->it->state = ITEM_UNREADABLE;
+            continue;
+        }
+        sha256_init(&l->ctx);
+        active++;
+    }
+
+    while (active) {
+        sha256_ctx *ctx[SHA256_MAX_LANES];
+        const void *data[SHA256_MAX_LANES];
+        size_t k = 0, common = SIZE_MAX;
+        for (size_t i = 0; i < n; ++i) {
+            struct lane *l = &lanes[i];
+            if (l->fd < 0) continue;
+            if (l->pos == l->len) {
+                ssize_t r;
+                do r = read(l->fd, l->buf, VERIFY_LANE_CHUNK); while (r < 0 && errno == EINTR);
+                if (r <= 0) {
+                    close(l->fd);
+                    l->fd = -1;
+                    active--;
+                    if (r < 0) {
+                        l->it->state = ITEM_UNREADABLE;
+                        continue;
+                    }
+                    sha256_final(&l->ctx, l->it->got);
+                    *bytes += (unsigned long long)l->done;
+                    settle_item(sw->root_fd, l->it);
+                    continue;
+                }
+                (void)posix_fadvise(l->fd, l->done, r, POSIX_FADV_DONTNEED);
+                l->done += r;
+                l->pos = 0;
+                l->len = (size_t)r;
+            }
+            size_t have = l->len - l->pos;
+            if (have < 64) {
+                sha256_update(&l->ctx, l->buf + l->pos, have);
+                l->pos = l->len;
+                continue;
+            }
+            if (have < common) common = have;
+            ctx[k] = &l->ctx;
+            data[k++] = l->buf + l->pos;
+        }
+        if (!k) continue;
+        common -= common % 64;
+        sha256_update_lanes(ctx, data, k, common);
+        for (size_t i = 0; i < n; ++i) {
+            struct lane *l = &lanes[i];
+            if (l->fd >= 0 && l->len - l->pos >= 64) l->pos += common;
+        }
+    }
+}
+
+static void *sweep_worker(void *arg) {
+    struct worker *wk = arg;
+    struct sweep *sw = wk->sw;
+    void *buf = NULL;
+    size_t size = sw->lanes ? (size_t)SHA256_MAX_LANES * VERIFY_LANE_CHUNK : VERIFY_CHUNK;
+    if (posix_memalign(&buf, VERIFY_ALIGN, size) != 0) buf = NULL;
+
+    unsigned long long bytes = 0;
+    size_t idx;
+    if (buf && sw->lanes) {
+        struct vitem *batch[SHA256_MAX_LANES];
+        size_t n;
+        do {
+            for (n = 0; n < SHA256_MAX_LANES && next_item(sw, wk->id, &idx); ++n) batch[n] = &sw->items[idx];
+            if (n) hash_batch(sw, batch, n, buf, &bytes);
+        } while (n == SHA256_MAX_LANES);
+    }
+    while (next_item(sw, wk->id, &idx)) {
+        struct vitem *it = &sw->items[idx];
+        if (!buf || hash_file(sw->root_fd, it, buf, &bytes) != 0) {
+            it->state = ITEM_UNREADABLE;
+            continue;
+        }
+        settle_item(sw->root_fd, it);
+    }
+    free(buf);
+
+    pthread_mutex_lock(&sw->stats_mu);
+    sw->hashed_bytes += bytes;
+    pthread_mutex_unlock(&sw->stats_mu);
+    return NULL;
+}
+
+static struct vitem *g_sort_items;
+
+static int cmp_order_size_desc(const void *a, const void *b) {
+    off_t sa = g_sort_items[*(const size_t *)a].st.st_size;
+    off_t sb = g_sort_items[*(const size_t *)b].st.st_size;
+    return (sa < sb) - (sa > sb);
+}
+
+/* Hash every pending item on nworkers threads. Returns 0, or -1 if the sweep could not start. */
+static int run_sweep(struct vitems *items, int root_fd, size_t nworkers, unsigned long long *hashed) {
+    size_t pending = 0;
+    for (size_t i = 0; i < items->n; ++i) pending += items->v[i].state == ITEM_PENDING;
+    *hashed = 0;
+    if (!pending) return 0;
+    if (nworkers > pending) nworkers = pending;
+
+    size_t *sorted = malloc(pending * sizeof(*sorted));
+    size_t *order = malloc(pending * sizeof(*order));
+    struct deque *dq = calloc(nworkers, sizeof(*dq));
+    struct worker *wk = calloc(nworkers, sizeof(*wk));
+    pthread_t *threads = calloc(nworkers, sizeof(*threads));
+    if (!sorted || !order || !dq || !wk || !threads) {
+        free(sorted);
+        free(order);
+        free(dq);
+        free(wk);
+        free(threads);
+        return -1;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < items->n; ++i)
+        if (items->v[i].state == ITEM_PENDING) sorted[k++] = i;
+    g_sort_items = items->v;
+    qsort(sorted, pending, sizeof(*sorted), cmp_order_size_desc);
+
+    /* worker w gets sorted[w], sorted[w + n], ... as one contiguous range */
+    size_t at = 0;
+    for (size_t w = 0; w < nworkers; ++w) {
+        pthread_mutex_init(&dq[w].mu, NULL);
+        dq[w].lo = at;
+        for (size_t i = w; i < pending; i += nworkers) order[at++] = sorted[i];
+        dq[w].hi = at;
+    }
+    free(sorted);
+
+    /* the eight-lane kernel only runs when the SHA extensions are missing;
+       with them, one file per call is faster and lanes would only serialize */
+    struct sweep sw = { .items = items->v, .order = order, .dq = dq, .nworkers = nworkers, .root_fd = root_fd,
+                        .lanes = strcmp(sha256_impl_name(), "avx2-x8") == 0 };
+    pthread_mutex_init(&sw.stats_mu, NULL);
+    size_t started = 0;
+    for (; started < nworkers; ++started) {
+        wk[started].sw = &sw;
+        wk[started].id = started;
+        if (pthread_create(&threads[started], NULL, sweep_worker, &wk[started]) != 0) break;
+    }
+    /* with fewer threads than ranges, the ones running steal the rest */
+    if (started == 0) sweep_worker(&(struct worker){ .sw = &sw, .id = 0 });
+    for (size_t w = 0; w < started; ++w) pthread_join(threads[w], NULL);
+
+    *hashed = sw.hashed_bytes;
+    pthread_mutex_destroy(&sw.stats_mu);
+    for (size_t w = 0; w < nworkers; ++w) pthread_mutex_destroy(&dq[w].mu);
+    free(order);
+    free(dq);
+    free(wk);
+    free(threads);
+    return 0;
+}
+
+static const char *kind_name(int kind) {
+    switch (kind) {
+    case ITEM_OBJECT: return "object";
+    case ITEM_BLOB: return "blob";
+    default: return "file";
+    }
+}
+
+/* Hash items (skipping cache hits), report, and update the cache. */
+static error_t verify_items(const char *base, int root_fd, struct vitems *items, int flags, int partial) {
+    qsort(items->v, items->n, sizeof(*items->v), cmp_item_rel);
+
+    char cache_path[PATH_MAX];
+    struct vcache cache = {0};
+    int have_cache_path = snprintf(cache_path, sizeof(cache_path), "%s/" VERIFY_CACHE, base) < (int)sizeof(cache_path);
+    if (have_cache_path) cache_load(cache_path, &cache);
+
+    int64_t now = (int64_t)time(NULL);
+    size_t cached = 0, unshared = 0;
+    for (size_t i = 0; i < items->n; ++i) {
+        struct vitem *it = &items->v[i];
+        it->verified_at = now;
+        if (it->kind == ITEM_STORE && it->st.st_nlink < 2) {
+            it->state = ITEM_UNCHECKED;   /* a private copy: nothing recorded to check it against */
+            unshared++;
+            continue;
+        }
+        const struct vcache_entry *e = flags & VERIFY_FULL ? NULL : cache_hit(&cache, it, now);
+        if (e) {
+            it->state = ITEM_CACHED;
+            memcpy(it->got, e->digest, 32);
+            it->verified_at = e->verified_at;
+            cached++;
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    size_t nworkers = pool_cpu_count();
+    unsigned long long hashed = 0;
+    if (run_sweep(items, root_fd, nworkers, &hashed) != 0) {
+        fprintf(stderr, "failed to start verify workers\n");
+        cache_free(&cache);
+        return ERR_FAILED;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    size_t corrupt = 0, unreadable = 0;
+    for (size_t i = 0; i < items->n; ++i) {
+        const struct vitem *it = &items->v[i];
+        if (it->state == ITEM_CORRUPT) {
+            char want[65], got[65];
+            sha256_to_hex(it->got, got);
+            if (it->kind == ITEM_STORE) {
+                fprintf(stderr, "corrupt %s: %s (content %s matches none of its objects)\n",
+                        kind_name(it->kind), it->rel, got);
+            } else {
+                sha256_to_hex(it->want, want);
+                fprintf(stderr, "corrupt %s: %s (expected %s, got %s)\n", kind_name(it->kind), it->rel, want, got);
+            }
+            corrupt++;
+        } else if (it->state == ITEM_UNREADABLE) {
+            fprintf(stderr, "unreadable %s: %s\n", kind_name(it->kind), it->rel);
+            unreadable++;
+        }
+    }
+
+    char cache_dir[PATH_MAX];
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", base);
+    if (have_cache_path && (ensure_dir(cache_dir, 0755) != ERR_OK || cache_save(cache_path, &cache, items, partial) != 0))
+        fprintf(stderr, "warning: could not write %s\n", cache_path);
+    cache_free(&cache);
+
+    printf("verified %zu files: %zu hashed (%.1f MiB in %.1fs on %zu threads), %zu unchanged since the last sweep\n",
+           items->n - unshared, items->n - unshared - cached, (double)hashed / (1024.0 * 1024.0), secs,
+           nworkers, cached);
+    if (unshared || items->unchecked_blobs)
+        printf("not checked: %zu unshared store files, %zu blobs without a cached manifest\n",
+               unshared, items->unchecked_blobs);
+    if (corrupt || unreadable) {
+        fprintf(stderr, "%zu corrupt, %zu unreadable\n", corrupt, unreadable);
+        return ERR_FAILED;
+    }
+    printf("no corruption found\n");
+    return ERR_OK;
+}
+
+static int open_base(char *base, size_t len) {
+    const char *home = getenv("HOME");
+    if (!home) {
+        fprintf(stderr, "HOME not set\n");
+        return -1;
+    }
+    if (snprintf(base, len, "%s/pandora", home) >= (int)len) {
+        fprintf(stderr, "store path too long\n");
+        return -1;
+    }
+    int fd = open(base, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) fprintf(stderr, "cannot open %s: %s\n", base, strerror(errno));
+    return fd;
+}
+
+error_t verify_all(int flags) {
+    char base[PATH_MAX];
+    int root_fd = open_base(base, sizeof(base));
+    if (root_fd < 0) return ERR_FAILED;
+
+    struct vitems items = {0};
+    error_t rc = ERR_OK;
+    if (collect_objects(root_fd, &items) != 0 || collect_blobs(root_fd, base, &items) != 0) {
+        fprintf(stderr, "cannot list %s: %s\n", base, strerror(errno));
+        rc = ERR_FAILED;
+    }
+    if (rc == ERR_OK) rc = verify_items(base, root_fd, &items, flags, 0);
+    free_items(&items);
+    close(root_fd);
+    return rc;
+}
+
+error_t verify_package(const char *spec, int flags) {
+    char *name = NULL, *version = NULL;
+    if (pkg_spec_parse(spec, &name, &version) != 0) {
+        fprintf(stderr, "invalid package spec '%s' (expected name@version)\n", spec);
+        return ERR_FAILED;
+    }
+    char base[PATH_MAX];
+    int root_fd = open_base(base, sizeof(base));
+    if (root_fd < 0) {
+        free(name);
+        free(version);
+        return ERR_FAILED;
+    }
+
+    struct vitems items = {0};
+    error_t rc = ERR_OK;
+    char stem[PATH_MAX], tree[PATH_MAX];
+    if (snprintf(stem, sizeof(stem), "%s-%s", name, version) >= (int)sizeof(stem)
+     || snprintf(tree, sizeof(tree), "store/%s/%s", name, version) >= (int)sizeof(tree)) {
+        fprintf(stderr, "store path too long\n");
+        rc = ERR_FAILED;
+    } else if (add_blob(&items, root_fd, base, stem) != 0) {
+        rc = ERR_FAILED;
+    } else {
+        if (collect_tree(root_fd, tree, &items) != 0 && errno != ENOENT) {
+            fprintf(stderr, "cannot read %s/%s: %s\n", base, tree, strerror(errno));
+            rc = ERR_FAILED;
+        } else if (items.n + items.unchecked_blobs == 0) {
+            fprintf(stderr, "%s@%s is neither installed nor cached\n", name, version);
+            rc = ERR_FAILED;
+        }
+    }
+    if (rc == ERR_OK) rc = verify_items(base, root_fd, &items, flags, 1);
+    free_items(&items);
+    close(root_fd);
+    free(name);
+    free(version);
+    return rc;
+}
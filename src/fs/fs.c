@@ -19,6 +19,7 @@ error_t fs_init(void) {
 
     const char *target_dirs[] = {
         "/pandora/store",
+        "/pandora/objects",
         "/pandora/vir/bin",
         "/pandora/vir/lib",
         "/pandora/profiles/default",
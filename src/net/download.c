@@ -5,82 +5,79 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "net/download.h"
 #include "util/err.h"
 #include "core/sha256.h"
 #include "core/acl.h"
-#include "core/curl.h"
+#include "core/acl_arena.h"
+#include "core/delta.h"
+#include "core/lock.h"
+#include "net/http.h"
+#include "net/index.h"
+#include "net/mirror.h"
 #include "util/sha256.h"
 #include "util/path.h"
+#include "util/trace.h"
 
 #define PATH_MAX_LEN 1024
 #define SMALL_PATH_LEN 512
 #define SHA256_HEX_LEN 65
 #define SHA256_BIN_LEN 32
-
-/* Download url -> out_path. Returns 0 on success, ERR_FAILED on curl failure, -1 on other */
-static int download_to_file(const char *url, const char *out_path) {
-    FILE *out = fopen(out_path, "wb");
-    if (!out) return -1;
-
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        fclose(out);
-        return -1;
-    }
-
-    int rc = 0;
-    if (curl_easy_setopt(curl, CURLOPT_URL, (void*)url) != CURLE_OK
-     || curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)out) != CURLE_OK
-     || curl_easy_setopt(curl, CURLOPT_VERBOSE, (void*)(intptr_t)0) != CURLE_OK) {
-        rc = -1;
-        goto done;
-    }
-
-    int res = curl_easy_perform(curl);
-    if (res != CURLE_OK) rc = ERR_FAILED;
-
-done:
-    curl_easy_cleanup(curl);
-    fclose(out);
-    return rc;
-}
-
-/* Retrieve a string value from ACL; returns 0 on success and sets *out to a newly allocated copy.
-   Caller must free *out. Returns -1 on missing/other error. */
-static int acl_get_string_dup(AclBlock *root, const char *key, char **out) {
-    char *tmp = NULL;
-    if (acl_get_string(root, key, &tmp) && !tmp) return -1;
-    if (!tmp) return -1;
-    *out = strdup(tmp);
-    return *out ? 0 : -1;
-}
-
-error_t fetch_package(const char* name, const char* version) {
-    const char *home_env = getenv("HOME");
-    if (!home_env) {
+#define FETCH_DEFAULT_JOBS 4
+
+/* a parsed manifest kept for the session, keyed "name@version" */
+struct manifest_slot {
+    char *key;
+    acl_arena *manifest;
+};
+
+/* The parts of a session loaded on first use; one lock covers them */
+struct fetch_state {
+    pthread_mutex_t lock;
+    int index_tried;           /* index_sync ran, whether or not it worked */
+    int http_up;
+    mirror_set *mirrors;
+    cindex *index;
+    struct manifest_slot *manifests;   /* open addressing, power-of-two size */
+    size_t nmanifests, manifest_cap;
+};
+
+error_t fetch_env_open(fetch_env *env, int flags) {
+    memset(env, 0, sizeof(*env));
+    mirror_set *mirrors = NULL;
+    env->home = getenv("HOME");
+    if (!env->home) {
         fprintf(stderr, "HOME not set\n");
-        return -1;
+        return ERR_FAILED;
     }
 
     char conf_path[SMALL_PATH_LEN];
-    if (snprintf(conf_path, sizeof(conf_path), "%s/conf/pandora.conf", home_env) >= (int)sizeof(conf_path)) {
+    if (snprintf(conf_path, sizeof(conf_path), "%s/conf/pandora.conf", env->home) >= (int)sizeof(conf_path)) {
         fprintf(stderr, "conf path too long\n");
-        return -1;
+        return ERR_FAILED;
     }
 
-    AclBlock *root = acl_parse_file(conf_path);
-    if (!root) {
+    uint64_t t0 = trace_now();
+    env->conf = acl_parse_file(conf_path);
+    trace_span(TRACE_CONFIG, "pandora.conf", t0, 0, 1);
+    if (!env->conf) {
         fprintf(stderr, "Failed to parse config %s\n", conf_path);
-        return -1;
+        return ERR_FAILED;
     }
 
-    char *mirror_index = NULL;
-    if (acl_get_string_dup(root, "Pandora.Mirrors.mirror.index", &mirror_index) != 0) {
+    /* a mirror serving the sharded index names its root; the whole index.acl is the fallback */
+    mirrors = mirror_set_open(env->conf, env->home);
+    if (!mirrors) {
         fprintf(stderr, "Missing required mirror index in config %s\n", conf_path);
-        acl_free(root);
-        return -1;
+        goto fail;
+    }
+    if ((mirror_index_url(mirrors) && !(env->mirror_index = strdup(mirror_index_url(mirrors))))
+     || (mirror_root_url(mirrors) && !(env->mirror_root = strdup(mirror_root_url(mirrors))))) {
+        perror("fetch session");
+        goto fail;
     }
 
     /* Ensure directories exist (best-effort) */
@@ -89,13 +86,11 @@ error_t fetch_package(const char* name, const char* version) {
         char manifests_dir[SMALL_PATH_LEN];
         char pkgs_dir[SMALL_PATH_LEN];
 
-        if (snprintf(tmp_dir, sizeof(tmp_dir), "%s/pandora/tmp", home_env) >= (int)sizeof(tmp_dir)
-         || snprintf(manifests_dir, sizeof(manifests_dir), "%s/pandora/manifests", home_env) >= (int)sizeof(manifests_dir)
-         || snprintf(pkgs_dir, sizeof(pkgs_dir), "%s/pandora/pkgs", home_env) >= (int)sizeof(pkgs_dir)) {
+        if (snprintf(tmp_dir, sizeof(tmp_dir), "%s/pandora/tmp", env->home) >= (int)sizeof(tmp_dir)
+         || snprintf(manifests_dir, sizeof(manifests_dir), "%s/pandora/manifests", env->home) >= (int)sizeof(manifests_dir)
+         || snprintf(pkgs_dir, sizeof(pkgs_dir), "%s/pandora/pkgs", env->home) >= (int)sizeof(pkgs_dir)) {
             fprintf(stderr, "path too long\n");
-            free(mirror_index);
-            acl_free(root);
-            return -1;
+            goto fail;
         }
 
         (void)ensure_dir(tmp_dir, 0755);
@@ -103,211 +98,428 @@ error_t fetch_package(const char* name, const char* version) {
         (void)ensure_dir(pkgs_dir, 0755);
     }
 
-    char index_path[SMALL_PATH_LEN];
-    if (snprintf(index_path, sizeof(index_path), "%s/pandora/tmp/index.acl", home_env) >= (int)sizeof(index_path)) {
-        fprintf(stderr, "index path too long\n");
-        free(mirror_index);
-        acl_free(root);
-        return -1;
+    env->flags = flags;
+    env->state = calloc(1, sizeof(*env->state));
+    if (!env->state || pthread_mutex_init(&env->state->lock, NULL) != 0) {
+        perror("fetch session");
+        free(env->state);
+        goto fail;
     }
+    env->state->mirrors = mirrors;
+    return ERR_OK;
+
+fail:
+    mirror_set_close(mirrors);
+    free(env->mirror_index);
+    free(env->mirror_root);
+    acl_free(env->conf);
+    memset(env, 0, sizeof(*env));
+    return ERR_FAILED;
+}
 
-    struct stat st;
-
-    /* Initialize curl once for this operation */
-    if (curl_global_init(0) != 0) {
-        fprintf(stderr, "curl_global_init failed\n");
-        free(mirror_index);
-        acl_free(root);
-        return -1;
+cindex *fetch_env_index(fetch_env *env) {
+    struct fetch_state *s = env->state;
+    pthread_mutex_lock(&s->lock);
+    if (!s->index_tried) {
+        s->index_tried = 1;
+        /* Transport (and its per-mirror connection cache) lives as long as the session */
+        if (http_init() != 0) {
+            fprintf(stderr, "curl_global_init failed\n");
+        } else {
+            s->http_up = 1;
+            s->index = index_sync(env->home, s->mirrors, env->mirror_index, env->mirror_root,
+                                  (env->flags & FETCH_REFRESH_INDEX) != 0);
+        }
     }
+    cindex *index = s->index;
+    pthread_mutex_unlock(&s->lock);
+    return index;
+}
 
-    /* Download index if missing */
-    if (stat(index_path, &st) != 0) {
-        int dres = download_to_file(mirror_index, index_path);
-        if (dres != 0) {
-            if (dres == ERR_FAILED) fprintf(stderr, "curl_easy_perform failed when downloading index\n");
-            else perror("fopen/download");
-            curl_global_cleanup();
-            free(mirror_index);
-            acl_free(root);
-            return ERR_FAILED;
-        }
+void fetch_env_close(fetch_env *env) {
+    if (!env->conf) return;
+    struct fetch_state *s = env->state;
+    mirror_set_close(s->mirrors);
+    if (s->http_up) http_cleanup();
+    cindex_close(s->index);
+    for (size_t i = 0; i < s->manifest_cap; ++i) {
+        free(s->manifests[i].key);
+        acl_arena_free(s->manifests[i].manifest);
     }
+    free(s->manifests);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    free(env->mirror_index);
+    free(env->mirror_root);
+    acl_free(env->conf);
+    memset(env, 0, sizeof(*env));
+}
+
+size_t fetch_env_jobs(const fetch_env *env) {
+    long jobs = 0;
+    if (!acl_get_int(env->conf, "Pandora.Install.jobs", &jobs) || jobs <= 0) jobs = FETCH_DEFAULT_JOBS;
+    return (size_t)jobs;
+}
+
+int fetch_env_keep_blobs(const fetch_env *env) {
+    int keep = 1;
+    if (!acl_get_bool(env->conf, "Pandora.Install.keep_blobs", &keep)) keep = 1;
+    return keep;
+}
 
-    AclBlock *index_root = acl_parse_file(index_path);
-    if (!index_root) {
-        fprintf(stderr, "Failed to parse index %s\n", index_path);
-        curl_global_cleanup();
-        free(mirror_index);
-        acl_free(root);
+/* Download url into path's ".part" sibling (written to part). Nothing appears
+   at path itself until the caller renames the finished file into place, so an
+   interrupted run never leaves a truncated file that a later stat() would
+   take for a cached copy. */
+static int download_part(fetch_env *env, const char *url, const char *path, char *part, size_t part_len,
+                         uint8_t digest[32], int flags, const char *what) {
+    if (snprintf(part, part_len, "%s.part", path) >= (int)part_len) {
+        fprintf(stderr, "%s path too long\n", what);
         return -1;
     }
+    int dres = mirror_fetch_file(env->state->mirrors, url, part, digest, flags);
+    if (dres != 0) {
+        if (dres == -1) fprintf(stderr, "curl_easy_perform failed when downloading %s\n", what);
+        else perror("fopen/download");
+        unlink(part);
+        return -1;
+    }
+    return 0;
+}
 
-    char manifest_key[SMALL_PATH_LEN];
-    if (snprintf(manifest_key, sizeof(manifest_key),
-                 "Registry.Package[\"%s\"].Version[\"%s\"].manifest_url", name, version) >= (int)sizeof(manifest_key)) {
-        fprintf(stderr, "manifest key too long\n");
-        acl_free(index_root);
-        curl_global_cleanup();
-        free(mirror_index);
-        acl_free(root);
+static int publish_part(const char *part, const char *path) {
+    if (rename(part, path) != 0) {
+        fprintf(stderr, "rename %s: %s\n", part, strerror(errno));
+        unlink(part);
         return -1;
     }
+    return 0;
+}
+
+static size_t key_hash(const char *key) {
+    size_t h = 2166136261u;
+    for (; *key; ++key) h = (h ^ (unsigned char)*key) * 16777619u;
+    return h;
+}
+
+/* Slot of key, or the empty slot where it would go; caller holds the lock */
+static struct manifest_slot *manifest_slot(struct fetch_state *s, const char *key) {
+    size_t mask = s->manifest_cap - 1;
+    for (size_t i = key_hash(key) & mask;; i = (i + 1) & mask)
+        if (!s->manifests[i].key || strcmp(s->manifests[i].key, key) == 0) return &s->manifests[i];
+}
+
+static acl_arena *manifest_cached(struct fetch_state *s, const char *key) {
+    pthread_mutex_lock(&s->lock);
+    acl_arena *m = s->manifest_cap ? manifest_slot(s, key)->manifest : NULL;
+    pthread_mutex_unlock(&s->lock);
+    return m;
+}
+
+static int manifest_grow(struct fetch_state *s) {
+    size_t cap = s->manifest_cap ? s->manifest_cap * 2 : 64;
+    struct manifest_slot *old = s->manifests, *v = calloc(cap, sizeof(*v));
+    if (!v) return -1;
+    size_t old_cap = s->manifest_cap;
+    s->manifests = v;
+    s->manifest_cap = cap;
+    for (size_t i = 0; i < old_cap; ++i)
+        if (old[i].key) *manifest_slot(s, old[i].key) = old[i];
+    free(old);
+    return 0;
+}
+
+/* Keep manifest for the session. If another worker parsed the same one in
+   the meantime, that copy wins and manifest is freed. Returns the kept one,
+   or NULL when out of memory. */
+static acl_arena *manifest_keep(struct fetch_state *s, const char *key, acl_arena *manifest) {
+    pthread_mutex_lock(&s->lock);
+    struct manifest_slot *slot = NULL;
+    if ((s->nmanifests + 1) * 2 <= s->manifest_cap || manifest_grow(s) == 0) slot = manifest_slot(s, key);
+    if (slot && !slot->key) {
+        if ((slot->key = strdup(key))) {
+            slot->manifest = manifest;
+            s->nmanifests++;
+        } else {
+            slot = NULL;
+        }
+    }
+    acl_arena *kept = slot ? slot->manifest : NULL;
+    pthread_mutex_unlock(&s->lock);
+    if (kept != manifest) acl_arena_free(manifest);
+    if (!kept) fprintf(stderr, "out of memory caching manifest %s\n", key);
+    return kept;
+}
+
+/* name@version's parsed manifest: from this session's cache, else
+   downloaded into manifests/ unless it is already there and parsed.
+   The session owns the result. Returns NULL after printing why. */
+static acl_arena *load_manifest(fetch_env *env, const char *name, const char *version) {
+    char key[SMALL_PATH_LEN];
+    if (snprintf(key, sizeof(key), "%s@%s", name, version) >= (int)sizeof(key)) {
+        fprintf(stderr, "package name too long\n");
+        return NULL;
+    }
+    acl_arena *cached = manifest_cached(env->state, key);
+    if (cached) return cached;
 
-    char *manifest_url = NULL;
-    if (acl_get_string_dup(index_root, manifest_key, &manifest_url) != 0) {
+    cindex *index = fetch_env_index(env);
+    if (!index) return NULL;
+    cindex_entry entry;
+    if (cindex_find(index, name, version, &entry) != 0 || !*entry.manifest_url) {
         fprintf(stderr, "manifest_url not found for %s-%s in index\n", name, version);
-        acl_free(index_root);
-        curl_global_cleanup();
-        free(mirror_index);
-        acl_free(root);
-        return -1;
+        return NULL;
     }
 
     char manifest_path[SMALL_PATH_LEN];
     if (snprintf(manifest_path, sizeof(manifest_path), "%s/pandora/manifests/%s-%s-manifest.acl",
-                 home_env, name, version) >= (int)sizeof(manifest_path)) {
+                 env->home, name, version) >= (int)sizeof(manifest_path)) {
         fprintf(stderr, "manifest path too long\n");
-        free(manifest_url);
-        acl_free(index_root);
-        curl_global_cleanup();
-        free(mirror_index);
-        acl_free(root);
-        return -1;
+        return NULL;
     }
 
+    uint64_t t0 = trace_now();
+    struct stat st;
     if (stat(manifest_path, &st) != 0) {
-        int dres = download_to_file(manifest_url, manifest_path);
-        if (dres != 0) {
-            if (dres == ERR_FAILED) fprintf(stderr, "curl_easy_perform failed when downloading manifest\n");
-            else perror("fopen/download");
-            free(manifest_url);
-            acl_free(index_root);
-            curl_global_cleanup();
-            free(mirror_index);
-            acl_free(root);
-            return ERR_FAILED;
-        }
+        char part_path[SMALL_PATH_LEN];
+        if (download_part(env, entry.manifest_url, manifest_path, part_path, sizeof(part_path), NULL,
+                          MIRROR_SMALL, "manifest") != 0
+         || publish_part(part_path, manifest_path) != 0) return NULL;
+        if (!t0 || stat(manifest_path, &st) != 0) st.st_size = 0;
     }
 
-    AclBlock *manifest_root = acl_parse_file(manifest_path);
-    if (!manifest_root) {
+    /* manifests go through the arena parser: reentrant, so fetch workers need no lock */
+    acl_arena *manifest = acl_arena_parse_file(manifest_path);
+    trace_span(TRACE_MANIFEST, key, t0, (uint64_t)st.st_size, 1);
+    if (!manifest) {
         fprintf(stderr, "Failed to parse manifest %s\n", manifest_path);
-        free(manifest_url);
-        acl_free(index_root);
-        curl_global_cleanup();
-        free(mirror_index);
-        acl_free(root);
-        return -1;
+        return NULL;
+    }
+    return manifest_keep(env->state, key, manifest);
+}
+
+error_t fetch_manifest(fetch_env *env, const char *name, const char *version,
+                       char **pkg_url, char **sha256) {
+    *pkg_url = NULL;
+    *sha256 = NULL;
+
+    acl_arena *manifest = load_manifest(env, name, version);
+    const char *url = NULL, *sum = NULL;
+    int parsed = manifest != NULL;
+    int missing = !parsed
+               || !acl_arena_get_string(manifest, "Manifest.pkg_url", &url)
+               || !acl_arena_get_string(manifest, "Manifest.sha256", &sum)
+               || !(*pkg_url = strdup(url))
+               || !(*sha256 = strdup(sum));
+
+    if (missing) {
+        if (parsed) fprintf(stderr, "Missing pkg_url or sha256 in manifest\n");
+        free(*pkg_url);
+        free(*sha256);
+        *pkg_url = NULL;
+        *sha256 = NULL;
+        return ERR_FAILED;
     }
+    return ERR_OK;
+}
 
-    char *pkg_url = NULL;
-    char *expected_sha256 = NULL;
-    if (acl_get_string_dup(manifest_root, "Manifest.pkg_url", &pkg_url) != 0
-     || acl_get_string_dup(manifest_root, "Manifest.sha256", &expected_sha256) != 0) {
-        fprintf(stderr, "Missing pkg_url or sha256 in manifest\n");
-        if (pkg_url) free(pkg_url);
-        if (expected_sha256) free(expected_sha256);
-        acl_free(manifest_root);
-        acl_free(index_root);
-        curl_global_cleanup();
-        free(manifest_url);
-        free(mirror_index);
-        acl_free(root);
+error_t fetch_dependencies(fetch_env *env, const char *name, const char *version,
+                           char **sha256, char ***deps, size_t *ndeps) {
+    *sha256 = NULL;
+    *deps = NULL;
+    *ndeps = 0;
+
+    acl_arena *manifest = load_manifest(env, name, version);
+    if (!manifest) return ERR_FAILED;
+    const char *sum = NULL;
+    if (!acl_arena_get_string(manifest, "Manifest.sha256", &sum) || !(*sha256 = strdup(sum))) {
+        fprintf(stderr, "Missing sha256 in manifest of %s@%s\n", name, version);
+        return ERR_FAILED;
+    }
+
+    acl_query *dep_query = acl_query_compile("Manifest.dependencies[#]");
+    if (!dep_query) {
+        free(*sha256);
+        *sha256 = NULL;
+        return ERR_FAILED;
+    }
+    size_t n = 0;
+    char idx[24];
+    const char *dep;
+    for (;;) {
+        snprintf(idx, sizeof(idx), "%zu", n);
+        if (!acl_query_string(manifest, dep_query, (const char *[]){ idx }, &dep)) break;
+        char **v = realloc(*deps, (n + 1) * sizeof(*v));
+        if (!v || !(v[n] = strdup(dep))) {
+            if (v) *deps = v;
+            for (size_t i = 0; i < n; ++i) free((*deps)[i]);
+            free(*deps);
+            free(*sha256);
+            *deps = NULL;
+            *sha256 = NULL;
+            acl_query_free(dep_query);
+            return ERR_FAILED;
+        }
+        *deps = v;
+        n++;
+    }
+    acl_query_free(dep_query);
+    *ndeps = n;
+    return ERR_OK;
+}
+
+/* Rebuild the blob into part from an older version already in the store,
+   using the smallest delta the index offers from one. Returns 0 if part was
+   written and hashes to expected, -1 to fall back to downloading the whole
+   package. */
+static int fetch_via_delta(fetch_env *env, const char *name, const char *version, const char *pkg_path,
+                           const uint8_t expected[32], char *part, size_t part_len, uint8_t digest[32]) {
+    cindex *index = fetch_env_index(env);
+    cindex_entry entry;
+    if (!index || cindex_find(index, name, version, &entry) != 0 || !entry.ndeltas) return -1;
+
+    cindex_delta best = {0}, d;
+    char base_dir[SMALL_PATH_LEN], dir[SMALL_PATH_LEN];
+    for (uint32_t i = 0; i < entry.ndeltas; ++i) {
+        struct stat st;
+        /* base_version comes from the index and names paths below */
+        if (cindex_delta_at(index, &entry, i, &d) != 0 || !*d.url || (best.url && d.size >= best.size)
+         || !pkg_version_valid(d.base_version)
+         || snprintf(dir, sizeof(dir), "%s/pandora/store/%s/%s", env->home, name, d.base_version) >= (int)sizeof(dir)
+         || stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+        best = d;
+        memcpy(base_dir, dir, sizeof(dir));
+    }
+    if (!best.url) return -1;
+
+    char delta_path[SMALL_PATH_LEN], delta_part[SMALL_PATH_LEN];
+    uint8_t delta_bin[SHA256_BIN_LEN], want_bin[SHA256_BIN_LEN];
+    if (snprintf(delta_path, sizeof(delta_path), "%s/pandora/pkgs/%s-%s-%s.pdelta", env->home, name,
+                 best.base_version, version) >= (int)sizeof(delta_path)
+     || snprintf(part, part_len, "%s.part", pkg_path) >= (int)part_len
+     || download_part(env, best.url, delta_path, delta_part, sizeof(delta_part), delta_bin, MIRROR_BULK, "delta") != 0) return -1;
+
+    int rc = -1;
+    if (*best.sha256 && (hex_to_bin(best.sha256, want_bin, sizeof(want_bin)) != (int)sizeof(want_bin)
+                         || !ct_memcmp(want_bin, delta_bin, sizeof(want_bin))))
+        fprintf(stderr, "SHA-256 mismatch for delta %s -> %s of %s\n", best.base_version, version, name);
+    else if (delta_apply(delta_part, base_dir, part, digest) == 0 && ct_memcmp(digest, expected, SHA256_BIN_LEN))
+        rc = 0;
+    unlink(delta_part);
+    if (rc != 0) {
+        unlink(part);
+        fprintf(stderr, "delta from %s@%s failed; downloading the whole package\n", name, best.base_version);
         return -1;
     }
+    printf("rebuilt %s@%s from %s with a %llu-byte delta\n", name, version, best.base_version,
+           (unsigned long long)best.size);
+    return 0;
+}
 
-    char pkg_path[SMALL_PATH_LEN];
-    if (snprintf(pkg_path, sizeof(pkg_path), "%s/pandora/pkgs/%s-%s.pkg", home_env, name, version) >= (int)sizeof(pkg_path)) {
+error_t fetch_blob(fetch_env *env, const char *name, const char *version,
+                   const char *pkg_url, const char *expected_sha256,
+                   char *pkg_path, size_t pkg_path_len) {
+    if (snprintf(pkg_path, pkg_path_len, "%s/pandora/pkgs/%s-%s.pkg", env->home, name, version) >= (int)pkg_path_len) {
         fprintf(stderr, "package path too long\n");
-        free(pkg_url);
-        free(expected_sha256);
-        acl_free(manifest_root);
-        acl_free(index_root);
-        curl_global_cleanup();
-        free(manifest_url);
-        free(mirror_index);
-        acl_free(root);
-        return -1;
+        return ERR_FAILED;
     }
 
+    /* A fresh download (or delta rebuild) is hashed as it is written and only
+       renamed into the cache once it verifies; only a blob that was already
+       cached has to be read back */
+    uint8_t expected_bin[SHA256_BIN_LEN];
+    uint8_t actual_bin[SHA256_BIN_LEN];
+    char actual_sha256[SHA256_HEX_LEN] = {0};
+    char part_path[SMALL_PATH_LEN];
+    int downloaded = 0;
+    if (hex_to_bin(expected_sha256, expected_bin, sizeof(expected_bin)) != (int)sizeof(expected_bin)) {
+        fprintf(stderr, "invalid expected sha256 hex\n");
+        return ERR_FAILED;
+    }
+    uint64_t t0 = trace_now();
+    struct stat st;
     if (stat(pkg_path, &st) != 0) {
-        int dres = download_to_file(pkg_url, pkg_path);
-        if (dres != 0) {
-            if (dres == ERR_FAILED) fprintf(stderr, "curl_easy_perform failed when downloading package\n");
-            else perror("fopen/download");
-            free(pkg_url);
-            free(expected_sha256);
-            acl_free(manifest_root);
-            acl_free(index_root);
-            curl_global_cleanup();
-            free(manifest_url);
-            free(mirror_index);
-            acl_free(root);
+        if (fetch_via_delta(env, name, version, pkg_path, expected_bin, part_path, sizeof(part_path), actual_bin) != 0
+         && download_part(env, pkg_url, pkg_path, part_path, sizeof(part_path), actual_bin, MIRROR_BULK,
+                          "package") != 0)
+            return ERR_FAILED;
+        downloaded = 1;
+        sha256_to_hex(actual_bin, actual_sha256);
+        if (!t0 || stat(part_path, &st) != 0) st.st_size = 0;
+        trace_span(TRACE_BLOB, name, t0, (uint64_t)st.st_size, 1);
+    } else {
+        int rc = sha256_file_hex(pkg_path, actual_sha256);
+        trace_span(TRACE_HASH, name, t0, (uint64_t)st.st_size, 1);
+        if (rc != 0) {
+            fprintf(stderr, "sha256_file failed\n");
+            return ERR_FAILED;
+        }
+        if (hex_to_bin(actual_sha256, actual_bin, sizeof(actual_bin)) != (int)sizeof(actual_bin)) {
+            fprintf(stderr, "invalid computed sha256 hex\n");
             return ERR_FAILED;
         }
     }
 
-    /* Done with network operations */
-    curl_global_cleanup();
-
-    /* Verify SHA-256 */
-    char actual_sha256[SHA256_HEX_LEN] = {0};
-    if (sha256_file_hex(pkg_path, actual_sha256) != 0) {
-        fprintf(stderr, "sha256_file failed\n");
-        free(pkg_url);
-        free(expected_sha256);
-        acl_free(manifest_root);
-        acl_free(index_root);
-        free(manifest_url);
-        free(mirror_index);
-        acl_free(root);
+    if (!ct_memcmp(expected_bin, actual_bin, sizeof(expected_bin))) {
+        fprintf(stderr, "SHA-256 mismatch for %s-%s:\nExpected: %s\nActual:   %s\n",
+                name, version, expected_sha256, actual_sha256);
+        /* don't leave a bad blob behind to be mistaken for a cached one next run */
+        if (downloaded) unlink(part_path);
         return ERR_FAILED;
     }
+    if (downloaded && publish_part(part_path, pkg_path) != 0) return ERR_FAILED;
+    return ERR_OK;
+}
 
+error_t fetch_blob_stream(fetch_env *env, const char *name, const char *version,
+                          const char *pkg_url, const char *expected_sha256, FILE *out) {
     uint8_t expected_bin[SHA256_BIN_LEN];
     uint8_t actual_bin[SHA256_BIN_LEN];
     if (hex_to_bin(expected_sha256, expected_bin, sizeof(expected_bin)) != (int)sizeof(expected_bin)) {
         fprintf(stderr, "invalid expected sha256 hex\n");
-        free(pkg_url);
-        free(expected_sha256);
-        acl_free(manifest_root);
-        acl_free(index_root);
-        free(manifest_url);
-        free(mirror_index);
-        acl_free(root);
         return ERR_FAILED;
     }
-    if (hex_to_bin(actual_sha256, actual_bin, sizeof(actual_bin)) != (int)sizeof(actual_bin)) {
-        fprintf(stderr, "invalid computed sha256 hex\n");
-        free(pkg_url);
-        free(expected_sha256);
-        acl_free(manifest_root);
-        acl_free(index_root);
-        free(manifest_url);
-        free(mirror_index);
-        acl_free(root);
+    if (!fetch_env_index(env)) return ERR_FAILED;   /* brings up the transport */
+
+    sha256_ctx hash;
+    sha256_init(&hash);
+    FILE *tee = sha256_tee_open(out, &hash);
+    if (!tee) {
+        perror("sha256_tee_open");
         return ERR_FAILED;
     }
-
+    int rc = mirror_fetch(env->state->mirrors, pkg_url, tee, MIRROR_BULK);
+    /* closing the tee pushes its buffered tail through out and the hash */
+    if (fclose(tee) != 0 && rc == 0) rc = -2;
+    if (rc != 0) {
+        if (rc == -1) fprintf(stderr, "curl_easy_perform failed when downloading package\n");
+        return ERR_FAILED;
+    }
+    sha256_final(&hash, actual_bin);
     if (!ct_memcmp(expected_bin, actual_bin, sizeof(expected_bin))) {
-        fprintf(stderr, "SHA-256 mismatch:\nExpected: %s\nActual:   %s\n", expected_sha256, actual_sha256);
-        free(pkg_url);
-        free(expected_sha256);
-        acl_free(manifest_root);
-        acl_free(index_root);
-        free(manifest_url);
-        free(mirror_index);
-        acl_free(root);
+        char actual_sha256[SHA256_HEX_LEN];
+        sha256_to_hex(actual_bin, actual_sha256);
+        fprintf(stderr, "SHA-256 mismatch for %s-%s:\nExpected: %s\nActual:   %s\n",
+                name, version, expected_sha256, actual_sha256);
         return ERR_FAILED;
     }
+    return ERR_OK;
+}
+
+error_t fetch_package(fetch_env *env, const char* name, const char* version) {
+    char *pkg_url = NULL;
+    char *expected_sha256 = NULL;
+    error_t rc = fetch_manifest(env, name, version, &pkg_url, &expected_sha256);
+    if (rc == ERR_OK) {
+        char pkg_path[SMALL_PATH_LEN];
+        rc = fetch_blob(env, name, version, pkg_url, expected_sha256, pkg_path, sizeof(pkg_path));
+    }
 
     free(pkg_url);
     free(expected_sha256);
-    acl_free(manifest_root);
-    acl_free(index_root);
-    free(manifest_url);
-    free(mirror_index);
-    acl_free(root);
-    return 0;
+    return rc;
+}
+
+error_t fetch_update_index(fetch_env *env) {
+    return fetch_env_index(env) ? ERR_OK : ERR_FAILED;
 }
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "net/http.h"
+#include "core/curl.h"
+
+/* idle handles kept per origin; roughly the number of parallel fetch workers */
+#define HTTP_MAX_IDLE_PER_ORIGIN 16
+#define HTTP_ORIGIN_LEN 256
+
+struct http_origin {
+    char origin[HTTP_ORIGIN_LEN];
+    CURL *idle[HTTP_MAX_IDLE_PER_ORIGIN];
+    size_t nidle;
+    struct http_origin *next;
+};
+
+static pthread_mutex_t g_http_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct http_origin *g_origins = NULL;
+static int g_http_refs = 0;
+
+/* "https://host:port/path" -> "https://host:port" */
+static void url_origin(const char *url, char out[HTTP_ORIGIN_LEN]) {
+    const char *p = strstr(url, "://");
+    p = p ? p + 3 : url;
+    size_t n = strcspn(p, "/?#");
+    size_t len = (size_t)(p - url) + n;
+    if (len >= HTTP_ORIGIN_LEN) len = HTTP_ORIGIN_LEN - 1;
+    memcpy(out, url, len);
+    out[len] = '\0';
+}
+
+int http_init(void) {
+    pthread_mutex_lock(&g_http_lock);
+    int rc = 0;
+    if (g_http_refs == 0 && curl_global_init(0) != 0) rc = -1;
+    if (rc == 0) g_http_refs++;
+    pthread_mutex_unlock(&g_http_lock);
+    return rc;
+}
+
+void http_cleanup(void) {
+    pthread_mutex_lock(&g_http_lock);
+    if (g_http_refs > 0 && --g_http_refs == 0) {
+        while (g_origins) {
+            struct http_origin *o = g_origins;
+            g_origins = o->next;
+            for (size_t i = 0; i < o->nidle; ++i) curl_easy_cleanup(o->idle[i]);
+            free(o);
+        }
+        curl_global_cleanup();
+    }
+    pthread_mutex_unlock(&g_http_lock);
+}
+
+/* take a warm handle for url's origin, or make a new one */
+static CURL *http_acquire(const char *url) {
+    char origin[HTTP_ORIGIN_LEN];
+    url_origin(url, origin);
+
+    CURL *h = NULL;
+    pthread_mutex_lock(&g_http_lock);
+    for (struct http_origin *o = g_origins; o; o = o->next) {
+        if (strcmp(o->origin, origin) == 0) {
+            if (o->nidle) h = o->idle[--o->nidle];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_http_lock);
+    return h ? h : curl_easy_init();
+}
+
+/* hand a handle back for reuse; a handle whose transfer failed is dropped,
+   since its connection may be in an unknown state */
+static void http_release(const char *url, CURL *h, int ok) {
+    if (!h) return;
+    if (!ok) {
+        curl_easy_cleanup(h);
+        return;
+    }
+    char origin[HTTP_ORIGIN_LEN];
+    url_origin(url, origin);
+
+    pthread_mutex_lock(&g_http_lock);
+    struct http_origin *o = g_origins;
+    while (o && strcmp(o->origin, origin) != 0) o = o->next;
+    if (!o && g_http_refs > 0) {
+        o = calloc(1, sizeof(*o));
+        if (o) {
+            memcpy(o->origin, origin, sizeof(o->origin));
+            o->next = g_origins;
+            g_origins = o;
+        }
+    }
+    if (o && o->nidle < HTTP_MAX_IDLE_PER_ORIGIN) {
+        o->idle[o->nidle++] = h;
+        h = NULL;
+    }
+    pthread_mutex_unlock(&g_http_lock);
+    if (h) curl_easy_cleanup(h);
+}
+
+int http_get_stream(const char *url, FILE *out) {
+    CURL *curl = http_acquire(url);
+    if (!curl) return -2;
+
+    int rc = 0;
+    if (curl_easy_setopt(curl, CURLOPT_URL, (void*)url) != CURLE_OK
+     || curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)out) != CURLE_OK
+     || curl_easy_setopt(curl, CURLOPT_VERBOSE, (void*)(intptr_t)0) != CURLE_OK) {
+        rc = -2;
+    } else if (curl_easy_perform(curl) != CURLE_OK) {
+        rc = -1;
+    }
+    http_release(url, curl, rc == 0);
+    return rc;
+}
@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+
+#include "net/index.h"
+#include "net/mirror.h"
+#include "core/acl.h"
+#include "core/sha256.h"
+#include "util/sha256.h"
+#include "util/err.h"
+#include "util/path.h"
+#include "core/cindex.h"
+#include "core/acl_arena.h"
+#include "util/trace.h"
+
+#define SMALL_PATH_LEN 512
+#define URL_LEN 1024
+
+long index_policy_ttl(const char *policy) {
+    if (!policy) return -1;
+    const char *p = policy;
+    while ((p = strstr(p, "ttl=")) != NULL) {
+        /* only accept "ttl=" at the start of a comma/space separated token */
+        if (p == policy || p[-1] == ',' || isspace((unsigned char)p[-1])) {
+            char *end = NULL;
+            long v = strtol(p + 4, &end, 10);
+            if (end != p + 4 && v >= 0) return v;
+        }
+        p += 4;
+    }
+    return -1;
+}
+
+static long index_ttl(const acl_arena *index) {
+    const char *policy = NULL;
+    if (!acl_arena_get_string(index, "Registry.cache_policy", &policy)) return INDEX_DEFAULT_TTL;
+    long ttl = index_policy_ttl(policy);
+    return ttl >= 0 ? ttl : INDEX_DEFAULT_TTL;
+}
+
+/* Fetch the registry's "<index_url>.sha256" sidecar (64 hex chars, optionally
+   followed by a file name). Returns 0 and fills hex on success. */
+static int fetch_sidecar(mirror_set *mirrors, const char *index_url, char hex[65]) {
+    char url[URL_LEN];
+    if (snprintf(url, sizeof(url), "%s.sha256", index_url) >= (int)sizeof(url)) return -1;
+
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&buf, &len);
+    if (!mem) return -1;
+    uint64_t t0 = trace_now();
+    int rc = mirror_fetch(mirrors, url, mem, MIRROR_SMALL);
+    if (fclose(mem) != 0) rc = -1;
+    trace_span(TRACE_INDEX_DOWNLOAD, "index.acl.sha256", t0, len, 1);
+
+    if (rc == 0) {
+        size_t n = 0;
+        while (n < len && n < 64 && isxdigit((unsigned char)buf[n])) n++;
+        if (n == 64 && (len == 64 || isspace((unsigned char)buf[64]))) {
+            for (size_t i = 0; i < 64; ++i) hex[i] = (char)tolower((unsigned char)buf[i]);
+            hex[64] = '\0';
+        } else {
+            rc = -1;
+        }
+    }
+    free(buf);
+    return rc;
+}
+
+/* Download a fresh copy next to the cached one and publish it atomically.
+   If want_hex is given the transfer must hash to it. */
+static int index_download(mirror_set *mirrors, const char *index_url, const char *index_path, const char *want_hex) {
+    char part_path[SMALL_PATH_LEN];
+    if (snprintf(part_path, sizeof(part_path), "%s.part", index_path) >= (int)sizeof(part_path)) return -1;
+
+    uint8_t digest[32];
+    uint64_t t0 = trace_now();
+    int dres = mirror_fetch_file(mirrors, index_url, part_path, digest, MIRROR_BULK);
+    struct stat st = {0};
+    if (t0 && dres == 0) (void)stat(part_path, &st);
+    trace_span(TRACE_INDEX_DOWNLOAD, "index.acl", t0, (uint64_t)st.st_size, 1);
+    if (dres != 0) {
+        if (dres == -1) fprintf(stderr, "curl_easy_perform failed when downloading index\n");
+        else perror("fopen/download");
+        unlink(part_path);
+        return -1;
+    }
+    if (want_hex) {
+        char got_hex[65];
+        sha256_to_hex(digest, got_hex);
+        if (strcmp(got_hex, want_hex) != 0) {
+            fprintf(stderr, "index digest %s does not match registry sidecar %s\n", got_hex, want_hex);
+            unlink(part_path);
+            return -1;
+        }
+    }
+    if (rename(part_path, index_path) != 0) {
+        fprintf(stderr, "rename %s: %s\n", part_path, strerror(errno));
+        unlink(part_path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Parse index.acl and compile it into the binary cache. */
+static cindex *index_compile(const char *index_path, const char *cache_path) {
+    struct stat st;
+    if (stat(index_path, &st) != 0) return NULL;
+    uint64_t t0 = trace_now();
+    acl_arena *index = acl_arena_parse_file(index_path);
+    if (!index) {
+        fprintf(stderr, "Failed to parse index %s\n", index_path);
+        return NULL;
+    }
+    AclBlock *tree = acl_arena_root(index);
+    cindex_source src = { .mtime = st.st_mtime, .size = (uint64_t)st.st_size, .ttl = index_ttl(index) };
+    int rc = cindex_build(&tree, 1, &src, cache_path);
+    acl_arena_free(index);
+    if (rc != 0) return NULL;
+    cindex *ci = cindex_open(cache_path);
+    if (!ci) fprintf(stderr, "Failed to map compiled index %s\n", cache_path);
+    trace_span(TRACE_INDEX_PARSE, "index.acl", t0, (uint64_t)st.st_size, 1);
+    return ci;
+}
+
+/* Map the compiled cache if it was built from index.acl as it is now. */
+static cindex *index_load(const char *cache_path, const struct stat *st) {
+    uint64_t t0 = trace_now();
+    cindex *ci = cindex_open(cache_path);
+    if (!ci) return NULL;
+    const cindex_source *src = cindex_source_of(ci);
+    if (src->mtime != st->st_mtime || src->size != (uint64_t)st->st_size) {
+        cindex_close(ci);
+        return NULL;
+    }
+    trace_span(TRACE_INDEX_PARSE, "index.bin", t0, 0, 1);
+    return ci;
+}
+
+static cindex *index_sync_whole(const char *home, mirror_set *mirrors, const char *index_url, int force) {
+    char index_path[SMALL_PATH_LEN];
+    char cache_dir[SMALL_PATH_LEN];
+    char cache_path[SMALL_PATH_LEN];
+    if (snprintf(index_path, sizeof(index_path), "%s/pandora/tmp/index.acl", home) >= (int)sizeof(index_path)
+     || snprintf(cache_dir, sizeof(cache_dir), "%s/pandora/cache", home) >= (int)sizeof(cache_dir)
+     || snprintf(cache_path, sizeof(cache_path), "%s/index.bin", cache_dir) >= (int)sizeof(cache_path)) {
+        fprintf(stderr, "index path too long\n");
+        return NULL;
+    }
+    (void)ensure_dir(cache_dir, 0755);
+
+    struct stat st;
+    int have_local = stat(index_path, &st) == 0;
+    cindex *ci = NULL;
+    if (have_local) {
+        ci = index_load(cache_path, &st);
+        if (!ci) ci = index_compile(index_path, cache_path);
+        if (ci && !force && time(NULL) - st.st_mtime < cindex_source_of(ci)->ttl) return ci;
+    }
+
+    /* Stale or missing. The static registry hosts can't answer conditional
+       requests, so the tiny sidecar digest plays the role of an ETag. */
+    char remote_hex[65];
+    int have_remote = fetch_sidecar(mirrors, index_url, remote_hex) == 0;
+    if (ci && have_remote) {
+        char local_hex[65];
+        if (sha256_file_hex(index_path, local_hex) == 0 && strcmp(local_hex, remote_hex) == 0) {
+            /* unchanged: restart the ttl clock without transferring the index,
+               and carry the new mtime into the cache so it stays valid */
+            if (utimensat(AT_FDCWD, index_path, NULL, 0) != 0 || stat(index_path, &st) != 0) {
+                fprintf(stderr, "warning: cannot touch %s: %s\n", index_path, strerror(errno));
+            } else {
+                cindex_source src = *cindex_source_of(ci);
+                src.mtime = st.st_mtime;
+                if (cindex_touch(cache_path, &src) != 0) unlink(cache_path);
+            }
+            return ci;
+        }
+    }
+
+    if (index_download(mirrors, index_url, index_path, have_remote ? remote_hex : NULL) != 0) {
+        if (ci) {
+            fprintf(stderr, "warning: using stale index %s\n", index_path);
+            return ci;
+        }
+        return NULL;
+    }
+
+    cindex_close(ci);
+    return index_compile(index_path, cache_path);
+}
+
+/* ---- sharded index ---- */
+
+struct shard_ref {
+    const char *prefix;
+    const char *sha256;
+    const char *url;
+    long seq;
+};
+
+static const char *block_field(const AclBlock *b, const char *name) {
+    for (const AclField *f = b->fields; f; f = f->next) {
+        if (f->name && strcmp(f->name, name) == 0) return f->value;
+    }
+    return NULL;
+}
+
+static int is_sha256_hex(const char *s) {
+    size_t n = 0;
+    while (n < 64 && isxdigit((unsigned char)s[n])) n++;
+    return n == 64 && s[n] == '\0';
+}
+
+/* List the Shard blocks of a parsed root. Strings point into root.
+   Returns the count, or -1 if the root is malformed. */
+static long root_shards(const acl_arena *root, struct shard_ref **out) {
+    *out = NULL;
+    const AclBlock *registry = NULL;
+    for (const AclBlock *b = acl_arena_root(root); b; b = b->next) {
+        if (b->name && strcmp(b->name, "Registry") == 0) { registry = b; break; }
+    }
+    if (!registry) return -1;
+
+    long n = 0;
+    for (const AclBlock *b = registry->children; b; b = b->next) {
+        if (b->name && strcmp(b->name, "Shard") == 0) n++;
+    }
+    struct shard_ref *refs = calloc(n ? (size_t)n : 1, sizeof(*refs));
+    if (!refs) return -1;
+
+    acl_query *seq_query = acl_query_compile("Registry.Shard[\"$\"].seq");
+    if (!seq_query) {
+        free(refs);
+        return -1;
+    }
+    long i = 0;
+    for (const AclBlock *b = registry->children; b; b = b->next) {
+        if (!b->name || strcmp(b->name, "Shard") != 0) continue;
+        struct shard_ref *r = &refs[i];
+        r->prefix = b->label;
+        r->sha256 = block_field(b, "sha256");
+        r->url = block_field(b, "url");
+        /* prefix and digest name a local file, so keep it to one plain path component */
+        if (!r->prefix || !*r->prefix || r->prefix[0] == '.' || strchr(r->prefix, '/')
+         || !r->sha256 || !is_sha256_hex(r->sha256) || !r->url
+         || !acl_query_int(root, seq_query, &r->prefix, &r->seq)) {
+            fprintf(stderr, "malformed Shard block in index root\n");
+            acl_query_free(seq_query);
+            free(refs);
+            return -1;
+        }
+        i++;
+    }
+    acl_query_free(seq_query);
+    *out = refs;
+    return n;
+}
+
+/* A shard is kept as <prefix>.<sha256>.acl, so a new version never lands
+   on the file the current root still names; it only becomes live when the
+   new root is renamed into place, and the old one is pruned after that. */
+static int shard_name(const struct shard_ref *ref, char *out, size_t len) {
+    return snprintf(out, len, "%s.%s.acl", ref->prefix, ref->sha256) < (int)len ? 0 : -1;
+}
+
+static int shard_path(const char *shard_dir, const struct shard_ref *ref, char *out, size_t len) {
+    char name[SMALL_PATH_LEN];
+    if (shard_name(ref, name, sizeof(name)) != 0) return -1;
+    return snprintf(out, len, "%s/%s", shard_dir, name) < (int)len ? 0 : -1;
+}
+
+/* Shard urls are relative to the root unless absolute. */
+static int shard_url(const char *root_url, const char *url, char *out, size_t len) {
+    if (strstr(url, "://")) return snprintf(out, len, "%s", url) < (int)len ? 0 : -1;
+    const char *slash = strrchr(root_url, '/');
+    int base = slash ? (int)(slash - root_url + 1) : 0;
+    return snprintf(out, len, "%.*s%s", base, root_url, url) < (int)len ? 0 : -1;
+}
+
+/* Parse the root and all of its shards and compile them together. */
+static cindex *index_compile_sharded(const char *root_path, const char *shard_dir, const char *cache_path) {
+    struct stat st;
+    if (stat(root_path, &st) != 0) return NULL;
+    uint64_t t0 = trace_now();
+    uint64_t bytes = (uint64_t)st.st_size;
+    acl_arena *root = acl_arena_parse_file(root_path);
+    if (!root) {
+        fprintf(stderr, "Failed to parse index root %s\n", root_path);
+        return NULL;
+    }
+
+    cindex *ci = NULL;
+    struct shard_ref *refs = NULL;
+    long n = root_shards(root, &refs);
+    acl_arena **shards = n >= 0 ? calloc(n ? (size_t)n : 1, sizeof(*shards)) : NULL;
+    AclBlock **trees = n >= 0 ? calloc(n ? (size_t)n : 1, sizeof(*trees)) : NULL;
+    long parsed = 0;
+    if (!shards || !trees) goto out;
+
+    for (; parsed < n; ++parsed) {
+        char path[SMALL_PATH_LEN];
+        if (shard_path(shard_dir, &refs[parsed], path, sizeof(path)) != 0
+         || !(shards[parsed] = acl_arena_parse_file(path))) {
+            fprintf(stderr, "Failed to parse index shard %s\n", path);
+            goto out;
+        }
+        trees[parsed] = acl_arena_root(shards[parsed]);
+        struct stat sst;
+        if (t0 && stat(path, &sst) == 0) bytes += (uint64_t)sst.st_size;
+    }
+
+    cindex_source src = { .mtime = st.st_mtime, .size = (uint64_t)st.st_size, .ttl = index_ttl(root) };
+    if (cindex_build(trees, (size_t)n, &src, cache_path) == 0) {
+        ci = cindex_open(cache_path);
+        if (!ci) fprintf(stderr, "Failed to map compiled index %s\n", cache_path);
+        trace_span(TRACE_INDEX_PARSE, "index shards", t0, bytes, (uint64_t)n + 1);
+    }
+
+out:
+    for (long i = 0; i < parsed; ++i) acl_arena_free(shards[i]);
+    free(shards);
+    free(trees);
+    free(refs);
+    acl_arena_free(root);
+    return ci;
+}
+
+/* Fetch one shard and verify it against the root's digest. It goes under
+   its own digest's name, so nothing the current root names is touched. */
+static int shard_download(mirror_set *mirrors, const char *root_url, const struct shard_ref *ref, const char *shard_dir) {
+    char url[URL_LEN];
+    char path[SMALL_PATH_LEN];
+    char part_path[SMALL_PATH_LEN];
+    if (shard_url(root_url, ref->url, url, sizeof(url)) != 0
+     || shard_path(shard_dir, ref, path, sizeof(path)) != 0
+     || snprintf(part_path, sizeof(part_path), "%s.part", path) >= (int)sizeof(part_path)) {
+        fprintf(stderr, "shard url or path too long\n");
+        return -1;
+    }
+
+    uint8_t digest[32];
+    char got_hex[65];
+    uint64_t t0 = trace_now();
+    int dres = mirror_fetch_file(mirrors, url, part_path, digest, MIRROR_BULK);
+    struct stat st = {0};
+    if (t0 && dres == 0) (void)stat(part_path, &st);
+    trace_span(TRACE_INDEX_DOWNLOAD, ref->prefix, t0, (uint64_t)st.st_size, 1);
+    if (dres != 0) {
+        if (dres == -1) fprintf(stderr, "curl_easy_perform failed when downloading index shard %s\n", ref->prefix);
+        else perror("fopen/download");
+        unlink(part_path);
+        return -1;
+    }
+    sha256_to_hex(digest, got_hex);
+    if (strcasecmp(got_hex, ref->sha256) != 0) {
+        fprintf(stderr, "index shard %s digest %s does not match root %s\n", ref->prefix, got_hex, ref->sha256);
+        unlink(part_path);
+        return -1;
+    }
+    if (rename(part_path, path) != 0) {
+        fprintf(stderr, "rename %s: %s\n", part_path, strerror(errno));
+        unlink(part_path);
+        return -1;
+    }
+    return 0;
+}
+
+static int shard_listed(const struct shard_ref *refs, long n, const char *file) {
+    for (long i = 0; i < n; ++i) {
+        char name[SMALL_PATH_LEN];
+        if (shard_name(&refs[i], name, sizeof(name)) == 0 && strcmp(name, file) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Drop local shards (and leftover downloads) the committed root does not
+   name. Only called once that root is in place. */
+static void shard_prune(const char *shard_dir, const struct shard_ref *refs, long n) {
+    DIR *d = opendir(shard_dir);
+    if (!d) return;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.' || shard_listed(refs, n, de->d_name)) continue;
+        char path[SMALL_PATH_LEN];
+        if (snprintf(path, sizeof(path), "%s/%s", shard_dir, de->d_name) < (int)sizeof(path)) unlink(path);
+    }
+    closedir(d);
+}
+
+static int file_equals(const char *path, const char *buf, size_t len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    char chunk[4096];
+    size_t off = 0, r;
+    int same = 1;
+    while (same && (r = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        same = off + r <= len && memcmp(chunk, buf + off, r) == 0;
+        off += r;
+    }
+    fclose(f);
+    return same && off == len;
+}
+
+static int write_file(const char *path, const char *buf, size_t len) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    int rc = fwrite(buf, 1, len, f) == len ? 0 : -1;
+    if (fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+static cindex *index_sync_sharded(const char *home, mirror_set *mirrors, const char *root_url, int force) {
+    char dir[SMALL_PATH_LEN];
+    char shard_dir[SMALL_PATH_LEN];
+    char root_path[SMALL_PATH_LEN];
+    char part_path[SMALL_PATH_LEN];
+    char cache_dir[SMALL_PATH_LEN];
+    char cache_path[SMALL_PATH_LEN];
+    if (snprintf(dir, sizeof(dir), "%s/pandora/tmp/index", home) >= (int)sizeof(dir)
+     || snprintf(shard_dir, sizeof(shard_dir), "%s/shards", dir) >= (int)sizeof(shard_dir)
+     || snprintf(root_path, sizeof(root_path), "%s/root.acl", dir) >= (int)sizeof(root_path)
+     || snprintf(part_path, sizeof(part_path), "%s.part", root_path) >= (int)sizeof(part_path)
+     || snprintf(cache_dir, sizeof(cache_dir), "%s/pandora/cache", home) >= (int)sizeof(cache_dir)
+     || snprintf(cache_path, sizeof(cache_path), "%s/index.bin", cache_dir) >= (int)sizeof(cache_path)) {
+        fprintf(stderr, "index path too long\n");
+        return NULL;
+    }
+    (void)ensure_dir(dir, 0755);
+    (void)ensure_dir(shard_dir, 0755);
+    (void)ensure_dir(cache_dir, 0755);
+
+    struct stat st;
+    int have_local = stat(root_path, &st) == 0;
+    cindex *ci = NULL;
+    if (have_local) {
+        ci = index_load(cache_path, &st);
+        if (!ci) ci = index_compile_sharded(root_path, shard_dir, cache_path);
+        if (ci && !force && time(NULL) - st.st_mtime < cindex_source_of(ci)->ttl) return ci;
+    }
+
+    /* the root is a few bytes per shard, so it is simply fetched again */
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&buf, &len);
+    uint64_t t0 = trace_now();
+    int rc = mem ? mirror_fetch(mirrors, root_url, mem, MIRROR_SMALL) : -1;
+    if (mem && fclose(mem) != 0) rc = -1;
+    trace_span(TRACE_INDEX_DOWNLOAD, "index root", t0, rc == 0 ? len : 0, 1);
+    if (rc != 0) {
+        free(buf);
+        if (ci) fprintf(stderr, "warning: using stale index %s\n", root_path);
+        else fprintf(stderr, "failed to download index root %s\n", root_url);
+        return ci;
+    }
+
+    if (ci && file_equals(root_path, buf, len)) {
+        free(buf);
+        if (utimensat(AT_FDCWD, root_path, NULL, 0) != 0 || stat(root_path, &st) != 0) {
+            fprintf(stderr, "warning: cannot touch %s: %s\n", root_path, strerror(errno));
+        } else {
+            cindex_source src = *cindex_source_of(ci);
+            src.mtime = st.st_mtime;
+            if (cindex_touch(cache_path, &src) != 0) unlink(cache_path);
+        }
+        return ci;
+    }
+
+    acl_arena *new_root = NULL;
+    struct shard_ref *new_refs = NULL;
+    long new_n = -1;
+
+    if (!(new_root = acl_arena_parse_string(buf, len)) || write_file(part_path, buf, len) != 0
+     || (new_n = root_shards(new_root, &new_refs)) < 0) {
+        fprintf(stderr, "invalid index root from %s\n", root_url);
+        goto fail;
+    }
+
+    /* a shard already here under its digest is current; only changed ones
+       (a new seq comes with a new digest) are fetched */
+    for (long i = 0; i < new_n; ++i) {
+        char path[SMALL_PATH_LEN];
+        if (shard_path(shard_dir, &new_refs[i], path, sizeof(path)) == 0 && access(path, R_OK) == 0) continue;
+        if (shard_download(mirrors, root_url, &new_refs[i], shard_dir) != 0) goto fail;
+    }
+
+    /* publish the root only once every shard it names is in place; until
+       the rename the old root and its shards stay whole */
+    if (rename(part_path, root_path) != 0) {
+        fprintf(stderr, "rename %s: %s\n", part_path, strerror(errno));
+        goto fail;
+    }
+    shard_prune(shard_dir, new_refs, new_n);
+
+    free(buf);
+    free(new_refs);
+    acl_arena_free(new_root);
+    cindex_close(ci);
+    return index_compile_sharded(root_path, shard_dir, cache_path);
+
+fail:
+    unlink(part_path);
+    free(buf);
+    free(new_refs);
+    acl_arena_free(new_root);
+    if (ci) fprintf(stderr, "warning: using stale index %s\n", root_path);
+    return ci;
+}
+
+cindex *index_sync(const char *home, mirror_set *mirrors, const char *index_url, const char *root_url, int force) {
+    if (root_url) return index_sync_sharded(home, mirrors, root_url, force);
+    return index_sync_whole(home, mirrors, index_url, force);
+}
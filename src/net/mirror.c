@@ -0,0 +1,677 @@
+#define _GNU_SOURCE   /* fopencookie */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "net/mirror.h"
+#include "net/http.h"
+#include "core/sha256.h"
+#include "util/sha256.h"
+
+#define MIRROR_MAGIC "PNDMIR\0\1"
+#define MIRROR_MAGIC_LEN 8
+#define MIRROR_VERSION 1
+#define MIRROR_MAX 32
+#define MIRROR_URL_LEN 1024
+#define MIRROR_PATH_LEN 512
+#define MIRROR_CONF_PATH_LEN 256
+#define MIRROR_DEFAULT_RACE 3
+#define MIRROR_DEFAULT_PRIORITY 100
+/* a failure benches a mirror this long, doubled per failure in a row */
+#define MIRROR_BACKOFF_S 30
+#define MIRROR_BACKOFF_MAX_S 3600
+/* a transfer smaller than this says little about throughput, only latency */
+#define MIRROR_MIN_RATE_BYTES (64 * 1024)
+/* tries per bulk fetch when fewer mirrors than this serve it; past the
+   first round only mirrors that got further on their last try */
+#define MIRROR_BULK_ATTEMPTS 3
+
+/* mirrors.bin: header, then one record per mirror */
+struct mirror_header {
+    char magic[MIRROR_MAGIC_LEN];
+    uint32_t version;
+    uint32_t count;
+};
+
+struct mirror_rec {
+    uint8_t key[32];          /* SHA-256 of the mirror's base url */
+    uint64_t latency_us;      /* small requests, moving average; 0 if never measured */
+    uint64_t bytes_per_s;     /* bulk transfers, likewise */
+    int64_t last_failure;     /* wall clock seconds */
+    uint32_t failures;        /* in a row */
+    uint32_t reserved;
+};
+
+struct mirror {
+    char *index;              /* as configured; either may be NULL */
+    char *root;
+    char *base;               /* index (or root) url up to and including the last '/' */
+    long priority;
+    struct mirror_rec stats;
+};
+
+struct mirror_set {
+    pthread_mutex_t lock;
+    char path[MIRROR_PATH_LEN];
+    struct mirror m[MIRROR_MAX];
+    size_t n;
+    long race;
+    int raced;                /* the session's first small fetch went out */
+    int leader;               /* the mirror that won it, or -1 */
+    int dirty;
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/* ---- config and stats ---- */
+
+static const AclBlock *child_block(const AclBlock *b, const char *name) {
+    for (; b; b = b->next) {
+        if (b->name && strcmp(b->name, name) == 0) return b;
+    }
+    return NULL;
+}
+
+static int conf_string(AclBlock *conf, const char *prefix, const char *key, char **out) {
+    char path[MIRROR_CONF_PATH_LEN];
+    char *s = NULL;
+    *out = NULL;
+    if (snprintf(path, sizeof(path), "%s%s", prefix, key) >= (int)sizeof(path)
+     || !acl_get_string(conf, path, &s) || !s) return 0;
+    return (*out = strdup(s)) ? 0 : -1;
+}
+
+static void free_mirror(struct mirror *m) {
+    free(m->index);
+    free(m->root);
+    free(m->base);
+}
+
+static int add_mirror(mirror_set *ms, AclBlock *conf, const char *prefix) {
+    char path[MIRROR_CONF_PATH_LEN];
+    struct mirror *m = &ms->m[ms->n];
+    memset(m, 0, sizeof(*m));
+    if (conf_string(conf, prefix, "index", &m->index) != 0 || conf_string(conf, prefix, "root", &m->root) != 0) {
+        free_mirror(m);
+        return -1;
+    }
+    const char *url = m->index ? m->index : m->root;
+    const char *slash = url ? strrchr(url, '/') : NULL;
+    if (!slash || !(m->base = strndup(url, (size_t)(slash - url + 1)))) {
+        free_mirror(m);
+        return -1;
+    }
+    if (snprintf(path, sizeof(path), "%spriority", prefix) >= (int)sizeof(path)
+     || !acl_get_int(conf, path, &m->priority))
+        m->priority = MIRROR_DEFAULT_PRIORITY;
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, m->base, strlen(m->base));
+    sha256_final(&ctx, m->stats.key);
+    ms->n++;
+    return 0;
+}
+
+static void load_stats(mirror_set *ms) {
+    FILE *f = fopen(ms->path, "rb");
+    if (!f) return;
+    struct mirror_header h;
+    struct mirror_rec rec;
+    if (fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, MIRROR_MAGIC, MIRROR_MAGIC_LEN) == 0
+     && h.version == MIRROR_VERSION) {
+        for (uint32_t i = 0; i < h.count && fread(&rec, sizeof(rec), 1, f) == 1; ++i) {
+            for (size_t j = 0; j < ms->n; ++j) {
+                if (memcmp(ms->m[j].stats.key, rec.key, sizeof(rec.key)) == 0) ms->m[j].stats = rec;
+            }
+        }
+    }
+    fclose(f);
+}
+
+/* Write the stats of the configured mirrors (others are dropped) and
+   rename them into place. Best effort: they are only a hint. */
+static void save_stats(const mirror_set *ms) {
+    char part[MIRROR_PATH_LEN + 8];
+    char dir[MIRROR_PATH_LEN];
+    const char *slash = strrchr(ms->path, '/');
+    if (!slash || snprintf(part, sizeof(part), "%s.part", ms->path) >= (int)sizeof(part)) return;
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - ms->path), ms->path);
+    (void)mkdir(dir, 0755);
+
+    struct mirror_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MIRROR_MAGIC, MIRROR_MAGIC_LEN);
+    h.version = MIRROR_VERSION;
+    h.count = (uint32_t)ms->n;
+    FILE *f = fopen(part, "wb");
+    if (!f) return;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (size_t i = 0; ok && i < ms->n; ++i) ok = fwrite(&ms->m[i].stats, sizeof(ms->m[i].stats), 1, f) == 1;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(part, ms->path) != 0) {
+        fprintf(stderr, "warning: cannot save mirror stats %s: %s\n", ms->path, strerror(errno));
+        unlink(part);
+    }
+}
+
+mirror_set *mirror_set_open(AclBlock *conf, const char *home) {
+    const AclBlock *pandora = child_block(conf, "Pandora");
+    const AclBlock *mirrors = pandora ? child_block(pandora->children, "Mirrors") : NULL;
+    if (!mirrors) return NULL;
+
+    mirror_set *ms = calloc(1, sizeof(*ms));
+    if (!ms || pthread_mutex_init(&ms->lock, NULL) != 0) {
+        perror("mirror set");
+        free(ms);
+        return NULL;
+    }
+    if (snprintf(ms->path, sizeof(ms->path), "%s/pandora/cache/mirrors.bin", home) >= (int)sizeof(ms->path)) {
+        fprintf(stderr, "mirror stats path too long\n");
+        mirror_set_close(ms);
+        return NULL;
+    }
+    if (!acl_get_int(conf, "Pandora.Mirrors.race", &ms->race) || ms->race < 1) ms->race = MIRROR_DEFAULT_RACE;
+    ms->leader = -1;
+
+    int first = 1;
+    for (const AclBlock *b = mirrors->children; b; b = b->next) {
+        if (!b->name || strcmp(b->name, "mirror") != 0) continue;
+        char prefix[MIRROR_CONF_PATH_LEN];
+        if (ms->n == MIRROR_MAX) {
+            fprintf(stderr, "warning: more than %d mirrors configured; using the first %d\n", MIRROR_MAX, MIRROR_MAX);
+            break;
+        }
+        if (b->label && !strchr(b->label, '"')) {
+            if (snprintf(prefix, sizeof(prefix), "Pandora.Mirrors.mirror[\"%s\"].", b->label) >= (int)sizeof(prefix))
+                continue;
+        } else if (first && !b->label) {
+            snprintf(prefix, sizeof(prefix), "Pandora.Mirrors.mirror.");
+        } else {
+            fprintf(stderr, "warning: ignoring a mirror block without a usable label\n");
+            continue;
+        }
+        first = 0;
+        if (add_mirror(ms, conf, prefix) != 0)
+            fprintf(stderr, "warning: ignoring mirror %s without an index url\n", b->label ? b->label : "");
+    }
+    if (!ms->n) {
+        mirror_set_close(ms);
+        return NULL;
+    }
+    load_stats(ms);
+    return ms;
+}
+
+void mirror_set_close(mirror_set *ms) {
+    if (!ms) return;
+    if (ms->dirty) save_stats(ms);
+    for (size_t i = 0; i < ms->n; ++i) free_mirror(&ms->m[i]);
+    pthread_mutex_destroy(&ms->lock);
+    free(ms);
+}
+
+const char *mirror_index_url(const mirror_set *ms) {
+    return ms->m[0].index;
+}
+
+const char *mirror_root_url(const mirror_set *ms) {
+    return ms->m[0].root;
+}
+
+static void note_success(mirror_set *ms, int i, uint64_t us, uint64_t bytes, int bulk) {
+    if (!ms || i < 0) return;
+    if (!us) us = 1;
+    pthread_mutex_lock(&ms->lock);
+    struct mirror_rec *s = &ms->m[i].stats;
+    s->failures = 0;
+    if (!bulk || bytes < MIRROR_MIN_RATE_BYTES) {
+        /* small transfers are all latency */
+        s->latency_us = s->latency_us ? (s->latency_us * 3 + us) / 4 : us;
+    } else {
+        uint64_t rate = bytes * 1000000u / us;
+        s->bytes_per_s = s->bytes_per_s ? (s->bytes_per_s * 3 + rate) / 4 : rate;
+    }
+    ms->dirty = 1;
+    pthread_mutex_unlock(&ms->lock);
+}
+
+/* a race lane still running when the race was decided: it took at least us */
+static void note_slow(mirror_set *ms, int i, uint64_t us) {
+    if (!ms || i < 0) return;
+    if (!us) us = 1;
+    pthread_mutex_lock(&ms->lock);
+    struct mirror_rec *s = &ms->m[i].stats;
+    if (us > s->latency_us) s->latency_us = s->latency_us ? (s->latency_us * 3 + us) / 4 : us;
+    ms->dirty = 1;
+    pthread_mutex_unlock(&ms->lock);
+}
+
+/* Mirrors that failed a fetch. They are only held against them once
+   another mirror served it: when every mirror fails, the url or the
+   network is more likely at fault. */
+struct strikes {
+    size_t n;
+    int mirror[MIRROR_MAX];
+};
+
+static void strike(struct strikes *st, int i) {
+    if (i < 0) return;
+    for (size_t k = 0; k < st->n; ++k) {
+        if (st->mirror[k] == i) return;
+    }
+    if (st->n < MIRROR_MAX) st->mirror[st->n++] = i;
+}
+
+static void note_failures(mirror_set *ms, const struct strikes *st) {
+    if (!ms || !st->n) return;
+    int64_t now = (int64_t)time(NULL);
+    pthread_mutex_lock(&ms->lock);
+    for (size_t k = 0; k < st->n; ++k) {
+        struct mirror_rec *s = &ms->m[st->mirror[k]].stats;
+        s->failures++;
+        s->last_failure = now;
+    }
+    ms->dirty = 1;
+    pthread_mutex_unlock(&ms->lock);
+}
+
+/* ---- choosing mirrors ---- */
+
+struct candidates {
+    size_t n;
+    int owned;                     /* the url is under a mirror's base */
+    int mirror[MIRROR_MAX];        /* into the set; -1 for a url fetched as is */
+    char url[MIRROR_MAX][MIRROR_URL_LEN];
+};
+
+struct rank {
+    int i;
+    int healthy;
+    int leader;
+    uint64_t latency, rate;
+    long priority;
+};
+
+static int healthy(const struct mirror_rec *s, int64_t now) {
+    if (!s->failures) return 1;
+    int64_t wait = MIRROR_BACKOFF_S;
+    for (uint32_t k = 1; k < s->failures && wait < MIRROR_BACKOFF_MAX_S; ++k) wait *= 2;
+    if (wait > MIRROR_BACKOFF_MAX_S) wait = MIRROR_BACKOFF_MAX_S;
+    return now - s->last_failure >= wait;
+}
+
+/* Healthy mirrors first. Bulk fetches then go by throughput, small ones to
+   the session's race winner, then by latency; explore puts the never
+   measured ahead so a race gets to time them. */
+static int rank_before(const struct rank *a, const struct rank *b, int bulk, int explore) {
+    if (a->healthy != b->healthy) return a->healthy;
+    if (!bulk && a->leader != b->leader) return a->leader;
+    if (bulk) {
+        if (!a->rate != !b->rate) return a->rate != 0;
+        if (a->rate != b->rate) return a->rate > b->rate;
+    }
+    if (!a->latency != !b->latency) return explore ? a->latency == 0 : a->latency != 0;
+    if (a->latency != b->latency) return a->latency < b->latency;
+    if (a->priority != b->priority) return a->priority < b->priority;
+    return a->i < b->i;
+}
+
+/* url as served by every mirror, best first. NULL when out of memory. */
+static struct candidates *candidates(mirror_set *ms, const char *url, int bulk, int *first_small) {
+    struct candidates *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    *first_small = 0;
+
+    size_t owner = 0, best = 0;
+    for (size_t i = 0; ms && i < ms->n; ++i) {
+        size_t len = strlen(ms->m[i].base);
+        if (len > best && strncmp(url, ms->m[i].base, len) == 0) {
+            owner = i;
+            best = len;
+        }
+    }
+    if (!best) {
+        c->n = 1;
+        c->mirror[0] = -1;
+        snprintf(c->url[0], sizeof(c->url[0]), "%s", url);
+        return c;
+    }
+
+    struct rank r[MIRROR_MAX];
+    int64_t now = (int64_t)time(NULL);
+    pthread_mutex_lock(&ms->lock);
+    if (!bulk && !ms->raced) {
+        ms->raced = 1;
+        *first_small = 1;
+    }
+    for (size_t i = 0; i < ms->n; ++i) {
+        const struct mirror_rec *s = &ms->m[i].stats;
+        r[i] = (struct rank){ (int)i, healthy(s, now), (int)i == ms->leader, s->latency_us, s->bytes_per_s,
+                              ms->m[i].priority };
+    }
+    size_t n = ms->n;
+    pthread_mutex_unlock(&ms->lock);
+
+    for (size_t i = 1; i < n; ++i) {
+        struct rank key = r[i];
+        size_t j = i;
+        for (; j > 0 && rank_before(&key, &r[j - 1], bulk, *first_small); --j) r[j] = r[j - 1];
+        r[j] = key;
+    }
+    const char *suffix = url + strlen(ms->m[owner].base);
+    c->owned = 1;
+    for (size_t i = 0; i < n; ++i) {
+        if (snprintf(c->url[c->n], sizeof(c->url[c->n]), "%s%s", ms->m[r[i].i].base, suffix)
+            >= (int)sizeof(c->url[c->n])) continue;
+        c->mirror[c->n++] = r[i].i;
+    }
+    return c;
+}
+
+/* ---- transfers ---- */
+
+/* Write-only stream passing a response on to out, after dropping its first
+   skip bytes (what a previous mirror already delivered). Once *cancel is
+   set it refuses more, which makes the transport give up. */
+struct relay {
+    FILE *out;
+    uint64_t skip;
+    uint64_t seen;            /* response bytes so far */
+    uint64_t written;         /* passed on to out */
+    int out_failed;
+    const int *cancel;
+    int cancelled;            /* refused bytes because *cancel was set */
+};
+
+static ssize_t relay_write(void *cookie, const char *buf, size_t len) {
+    struct relay *r = cookie;
+    if (r->cancel && __atomic_load_n(r->cancel, __ATOMIC_ACQUIRE)) {
+        r->cancelled = 1;
+        return -1;
+    }
+    size_t drop = 0;
+    if (r->seen < r->skip) drop = r->skip - r->seen < len ? (size_t)(r->skip - r->seen) : len;
+    r->seen += len;
+    if (drop < len) {
+        if (fwrite(buf + drop, 1, len - drop, r->out) != len - drop) {
+            r->out_failed = 1;
+            return -1;
+        }
+        r->written += len - drop;
+    }
+    return (ssize_t)len;
+}
+
+static FILE *relay_open(struct relay *r) {
+    static const cookie_io_functions_t io = { .write = relay_write };
+    return fopencookie(r, "wb", io);
+}
+
+/* Stream from each mirror in turn, picking up where the previous one
+   stopped. This runs on the fetch pool's workers, so it never sleeps
+   between tries: once every mirror has had one, a mirror is tried again
+   straight away only if its last try delivered new bytes before breaking
+   off. One that delivered nothing waits out its bench (note_failures)
+   instead of a retry. */
+static int fetch_bulk(mirror_set *ms, const struct candidates *c, FILE *out, struct strikes *st) {
+    uint64_t done = 0;
+    int moved[MIRROR_MAX];
+    for (size_t k = 0; k < c->n; ++k) moved[k] = 1;
+    size_t attempts = c->n > MIRROR_BULK_ATTEMPTS ? c->n : MIRROR_BULK_ATTEMPTS;
+    for (size_t a = 0; a < attempts; ++a) {
+        size_t k = a % c->n;
+        if (!moved[k]) continue;
+        if (a) fprintf(stderr, "retrying %s from byte %llu\n", c->url[k], (unsigned long long)done);
+
+        struct relay r = { out, done, 0, 0, 0, NULL, 0 };
+        FILE *f = relay_open(&r);
+        if (!f) return -2;
+        uint64_t t0 = now_us();
+        int rc = http_get_stream(c->url[k], f);
+        /* closing flushes the relay, so written counts everything out took */
+        if (fclose(f) != 0 && rc == 0) rc = -1;
+        if (r.out_failed) return -2;
+        done += r.written;
+        moved[k] = r.written > 0;
+        if (rc == -2) return -2;
+        if (rc == 0 && r.seen >= r.skip) {
+            note_success(ms, c->mirror[k], now_us() - t0, r.seen, 1);
+            return 0;
+        }
+        /* a response shorter than what we already have is as good as a failure */
+        strike(st, c->mirror[k]);
+    }
+    return -1;
+}
+
+/* Ask the mirrors from the from-th on one at a time, keeping the first whole answer. */
+static int fetch_small(mirror_set *ms, const struct candidates *c, size_t from, FILE *out, struct strikes *st) {
+    for (size_t k = from; k < c->n; ++k) {
+        char *buf = NULL;
+        size_t len = 0;
+        FILE *mem = open_memstream(&buf, &len);
+        if (!mem) return -2;
+        uint64_t t0 = now_us();
+        int rc = http_get_stream(c->url[k], mem);
+        if (fclose(mem) != 0) rc = -2;
+        if (rc == 0) {
+            note_success(ms, c->mirror[k], now_us() - t0, len, 0);
+            rc = fwrite(buf, 1, len, out) == len ? 0 : -2;
+            free(buf);
+            return rc;
+        }
+        free(buf);
+        if (rc == -2) return -2;
+        strike(st, c->mirror[k]);
+    }
+    return -1;
+}
+
+/* A race between mirrors. Once a lane wins, the race is decided and the
+   other lanes are told to stop: a lane not yet started never sends, and a
+   running one has its next bytes refused, so the transport aborts. Lanes
+   run detached, since one still connecting cannot be interrupted and
+   nobody waits for it. The lanes and the caller share the race, and the
+   last of them to let go frees it. */
+struct race;
+
+struct race_lane {
+    struct race *race;
+    int mirror;
+    uint64_t t0, elapsed;
+    int rc;
+    int done;                 /* ended on its own, not running or stopped for the winner */
+    char url[MIRROR_URL_LEN];
+};
+
+struct race {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int decided;              /* set under the lock, read by the lanes' relays without it */
+    int winner;               /* lane, or -1 */
+    size_t pending;           /* lanes still running */
+    size_t refs;              /* the caller and every running lane */
+    char *buf;                /* the winning response */
+    size_t len;
+    size_t n;
+    struct race_lane lanes[];
+};
+
+static void race_unref(struct race *r) {
+    /* caller holds r->lock */
+    int last = --r->refs == 0;
+    pthread_mutex_unlock(&r->lock);
+    if (!last) return;
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r->buf);
+    free(r);
+}
+
+static void *race_run(void *arg) {
+    struct race_lane *l = arg;
+    struct race *r = l->race;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&buf, &len);
+    struct relay rel = { mem, 0, 0, 0, 0, &r->decided, 0 };
+    FILE *f = mem ? relay_open(&rel) : NULL;
+    /* unbuffered, so every write from the transport sees a decided race */
+    if (f) setvbuf(f, NULL, _IONBF, 0);
+    int rc = -2;
+    if (f && __atomic_load_n(&r->decided, __ATOMIC_ACQUIRE)) rel.cancelled = 1;
+    else if (f) rc = http_get_stream(l->url, f);
+    if (f && fclose(f) != 0 && rc == 0) rc = -1;
+    if (mem && fclose(mem) != 0 && rc == 0) rc = -2;
+
+    pthread_mutex_lock(&r->lock);
+    l->elapsed = now_us() - l->t0;
+    l->rc = rc;
+    /* a lane stopped for the winner lost, and did not fail */
+    l->done = !rel.cancelled;
+    if (rc == 0 && r->winner < 0 && !r->decided) {
+        r->winner = (int)(l - r->lanes);
+        r->buf = buf;
+        r->len = len;
+        buf = NULL;
+        __atomic_store_n(&r->decided, 1, __ATOMIC_RELEASE);   /* stop the other lanes */
+    }
+    r->pending--;
+    pthread_cond_broadcast(&r->cond);
+    race_unref(r);
+    free(buf);
+    http_cleanup();   /* each lane holds the transport up for itself */
+    return NULL;
+}
+
+static int fetch_race(mirror_set *ms, const struct candidates *c, size_t k, FILE *out, struct strikes *st) {
+    struct race *r = calloc(1, sizeof(*r) + k * sizeof(r->lanes[0]));
+    if (!r) return -2;
+    if (pthread_mutex_init(&r->lock, NULL) != 0) {
+        free(r);
+        return -2;
+    }
+    if (pthread_cond_init(&r->cond, NULL) != 0) {
+        pthread_mutex_destroy(&r->lock);
+        free(r);
+        return -2;
+    }
+    r->winner = -1;
+    r->refs = 1;
+    r->n = k;
+
+    for (size_t i = 0; i < k; ++i) {
+        struct race_lane *l = &r->lanes[i];
+        *l = (struct race_lane){ r, c->mirror[i], now_us(), 0, -2, 0, "" };
+        memcpy(l->url, c->url[i], sizeof(l->url));
+        if (http_init() != 0) {
+            l->done = 1;
+            continue;
+        }
+        pthread_mutex_lock(&r->lock);
+        r->pending++;
+        r->refs++;
+        pthread_mutex_unlock(&r->lock);
+        pthread_t t;
+        if (pthread_create(&t, NULL, race_run, l) == 0) {
+            pthread_detach(t);
+            continue;
+        }
+        pthread_mutex_lock(&r->lock);
+        r->pending--;
+        r->refs--;
+        l->done = 1;
+        pthread_mutex_unlock(&r->lock);
+        http_cleanup();
+    }
+
+    pthread_mutex_lock(&r->lock);
+    while (r->winner < 0 && r->pending) pthread_cond_wait(&r->cond, &r->lock);
+    __atomic_store_n(&r->decided, 1, __ATOMIC_RELEASE);
+
+    /* note the outcome of every lane while the race is ours to read */
+    uint64_t now = now_us();
+    struct { int mirror, done, rc; uint64_t us; } seen[MIRROR_MAX];
+    for (size_t i = 0; i < k; ++i) {
+        const struct race_lane *l = &r->lanes[i];
+        seen[i].mirror = l->mirror;
+        seen[i].done = l->done;
+        seen[i].rc = l->rc;
+        seen[i].us = l->done ? l->elapsed : now - l->t0;
+    }
+    int winner = r->winner >= 0 ? r->lanes[r->winner].mirror : -1;
+    uint64_t best = r->winner >= 0 ? r->lanes[r->winner].elapsed : 0;
+    /* no winner, however the lanes ended, leaves the rest to fail over to */
+    int rc = -1;
+    if (r->winner >= 0) rc = fwrite(r->buf, 1, r->len, out) == r->len ? 0 : -2;
+    race_unref(r);
+
+    for (size_t i = 0; i < k; ++i) {
+        if (seen[i].done && seen[i].rc == 0) note_success(ms, seen[i].mirror, seen[i].us, 0, 0);
+        else if (seen[i].done && seen[i].rc == -1) strike(st, seen[i].mirror);
+        /* a lane cut short lost: charge it more than the winner took */
+        else if (!seen[i].done) note_slow(ms, seen[i].mirror, seen[i].us > best ? seen[i].us : best + 1);
+    }
+    if (winner >= 0) {
+        pthread_mutex_lock(&ms->lock);
+        ms->leader = winner;
+        pthread_mutex_unlock(&ms->lock);
+    }
+    return rc;
+}
+
+int mirror_fetch(mirror_set *ms, const char *url, FILE *out, int flags) {
+    int bulk = (flags & MIRROR_BULK) != 0, first_small = 0;
+    struct candidates *c = candidates(ms, url, bulk, &first_small);
+    if (!c) return -2;
+    struct strikes st = {0};
+    int rc;
+    if (bulk) {
+        rc = fetch_bulk(ms, c, out, &st);
+    } else if (first_small && c->n > 1 && ms->race > 1) {
+        size_t k = (size_t)ms->race < c->n ? (size_t)ms->race : c->n;
+        rc = fetch_race(ms, c, k, out, &st);
+        if (rc == -1) rc = fetch_small(ms, c, k, out, &st);
+    } else {
+        rc = fetch_small(ms, c, 0, out, &st);
+    }
+    if (rc == 0) note_failures(ms, &st);
+    free(c);
+    return rc;
+}
+
+int mirror_fetch_file(mirror_set *ms, const char *url, const char *out_path, uint8_t digest[32], int flags) {
+    FILE *file = fopen(out_path, "wb");
+    if (!file) return -2;
+
+    sha256_ctx hash;
+    FILE *out = file;
+    if (digest) {
+        sha256_init(&hash);
+        out = sha256_tee_open(file, &hash);
+        if (!out) {
+            fclose(file);
+            return -2;
+        }
+    }
+
+    int rc = mirror_fetch(ms, url, out, flags);
+
+    /* close the tee first so its buffered tail reaches both the file and the hash */
+    if (out != file && fclose(out) != 0 && rc == 0) rc = -2;
+    if (fclose(file) != 0 && rc == 0) rc = -2;
+    if (rc == 0 && digest) sha256_final(&hash, digest);
+    return rc;
+}
@@ -0,0 +1,213 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "util/dircache.h"
+
+static int is_dir(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int mkdir_p(const char *path, mode_t mode) {
+    if (mkdir(path, mode) == 0) return 0;
+    if (errno == EEXIST) {
+        if (is_dir(path)) return 0;
+        errno = ENOTDIR;
+        return -1;
+    }
+    if (errno != ENOENT) return -1;
+
+    char *buf = strdup(path);
+    if (!buf) return -1;
+    size_t n = strlen(buf);
+    while (n > 1 && buf[n - 1] == '/') buf[--n] = '\0';
+
+    /* climb: cut at each '/' from the right until a prefix exists or can be made */
+    int found = 0;
+    for (;;) {
+        char *s = strrchr(buf, '/');
+        while (s && s > buf && s[-1] == '/') s--;   /* treat "a//b" like "a/b" */
+        if (!s || s == buf) break;
+        *s = '\0';
+        if (mkdir(buf, 0755) == 0 || errno == EEXIST) {
+            found = 1;
+            break;
+        }
+        if (errno != ENOENT) goto fail;
+    }
+    if (!found && mkdir(buf, 0755) != 0 && errno != EEXIST) goto fail;
+
+    /* descend: every cut left behind is a directory still to make */
+    for (size_t i = 0; i < n; ++i) {
+        if (buf[i] != '\0') continue;
+        if (i > 0 && buf[i - 1] != '\0' && mkdir(buf, 0755) != 0 && errno != EEXIST) goto fail;
+        buf[i] = '/';
+    }
+    int rc = mkdir(buf, mode) == 0 || (errno == EEXIST && is_dir(buf)) ? 0 : -1;
+    free(buf);
+    return rc;
+
+fail:
+    {
+        int saved = errno;
+        free(buf);
+        errno = saved;
+    }
+    return -1;
+}
+
+void remove_tree_at(int dir_fd, const char *name) {
+    if (unlinkat(dir_fd, name, 0) == 0 || (errno != EISDIR && errno != EPERM)) return;
+    int sub = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (sub < 0) return;
+    DIR *d = fdopendir(sub);
+    if (!d) {
+        close(sub);
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        remove_tree_at(dirfd(d), de->d_name);
+    }
+    closedir(d);
+    unlinkat(dir_fd, name, AT_REMOVEDIR);
+}
+
+/* open-addressed set of relative directory paths known to exist */
+struct dircache {
+    int fd;
+    char **slots;
+    size_t cap;      /* power of two */
+    size_t used;
+};
+
+static uint64_t hash_path(const char *s, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* slot holding s[0..len), or the empty slot where it would go */
+static char **lookup(const dircache *dc, const char *s, size_t len) {
+    size_t mask = dc->cap - 1;
+    for (size_t i = (size_t)hash_path(s, len) & mask;; i = (i + 1) & mask) {
+        char *e = dc->slots[i];
+        if (!e || (strncmp(e, s, len) == 0 && e[len] == '\0')) return &dc->slots[i];
+    }
+}
+
+static int remember(dircache *dc, const char *s, size_t len) {
+    if ((dc->used + 1) * 10 > dc->cap * 7) {
+        size_t ncap = dc->cap * 2;
+        char **nslots = calloc(ncap, sizeof(*nslots));
+        if (!nslots) return -1;
+        char **old = dc->slots;
+        size_t ocap = dc->cap;
+        dc->slots = nslots;
+        dc->cap = ncap;
+        for (size_t i = 0; i < ocap; ++i)
+            if (old[i]) *lookup(dc, old[i], strlen(old[i])) = old[i];
+        free(old);
+    }
+    char **slot = lookup(dc, s, len);
+    if (*slot) return 0;
+    char *copy = malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    *slot = copy;
+    dc->used++;
+    return 0;
+}
+
+dircache *dircache_open(int dir_fd, const char *path) {
+    dircache *dc = calloc(1, sizeof(*dc));
+    if (!dc) return NULL;
+    dc->cap = 64;
+    dc->slots = calloc(dc->cap, sizeof(*dc->slots));
+    dc->fd = dc->slots ? openat(dir_fd, path, O_RDONLY | O_DIRECTORY) : -1;
+    if (dc->fd < 0) {
+        int saved = errno;
+        free(dc->slots);
+        free(dc);
+        errno = saved;
+        return NULL;
+    }
+    return dc;
+}
+
+void dircache_close(dircache *dc) {
+    if (!dc) return;
+    for (size_t i = 0; i < dc->cap; ++i) free(dc->slots[i]);
+    free(dc->slots);
+    close(dc->fd);
+    free(dc);
+}
+
+int dircache_fd(const dircache *dc) {
+    return dc->fd;
+}
+
+/* an existing entry only counts if it is a real directory, not a symlink to one */
+static int is_dir_at(int fd, const char *rel) {
+    struct stat st;
+    if (fstatat(fd, rel, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode)) return 1;
+    errno = ENOTDIR;
+    return 0;
+}
+
+/* make rel[0..len) and its parents, starting below the deepest known prefix */
+static int mkdirs_len(dircache *dc, const char *rel, size_t len, mode_t mode) {
+    while (len && rel[len - 1] == '/') len--;
+    if (!len || *lookup(dc, rel, len)) return 0;
+
+    size_t start = len;
+    while (start > 0) {
+        size_t cut = start;
+        while (cut > 0 && rel[cut - 1] != '/') cut--;
+        if (cut == 0) {
+            start = 0;
+            break;
+        }
+        start = cut - 1;
+        if (*lookup(dc, rel, start)) break;
+    }
+
+    char *buf = malloc(len + 1);
+    if (!buf) return -1;
+    memcpy(buf, rel, len);
+    buf[len] = '\0';
+    int rc = 0;
+    for (size_t i = start ? start + 1 : 0; i <= len && rc == 0; ++i) {
+        if (i < len && buf[i] != '/') continue;
+        if (i == 0 || buf[i - 1] == '/') continue;  /* empty component */
+        buf[i] = '\0';
+        if (mkdirat(dc->fd, buf, i == len ? mode : 0755) != 0 && (errno != EEXIST || !is_dir_at(dc->fd, buf))) rc = -1;
+        else rc = remember(dc, buf, i);
+        if (i < len) buf[i] = '/';
+    }
+    free(buf);
+    return rc;
+}
+
+int dircache_mkdirs(dircache *dc, const char *rel, mode_t mode) {
+    return mkdirs_len(dc, rel, strlen(rel), mode);
+}
+
+int dircache_mkparent(dircache *dc, const char *rel, mode_t mode) {
+    const char *slash = strrchr(rel, '/');
+    return slash ? mkdirs_len(dc, rel, (size_t)(slash - rel), mode) : 0;
+}
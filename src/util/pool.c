@@ -0,0 +1,113 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "util/pool.h"
+
+struct pool_job {
+    pool_fn fn;
+    void *arg;
+    struct pool_job *next;
+};
+
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;       /* signalled when a job is queued or on shutdown */
+    pthread_cond_t idle;       /* signalled when the pool drains */
+    struct pool_job *head, *tail;
+    size_t busy;               /* jobs currently running */
+    int stop;
+    size_t nthreads;
+    pthread_t *threads;
+};
+
+static void *pool_worker(void *arg) {
+    pool_t *p = arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->head && !p->stop) pthread_cond_wait(&p->work, &p->lock);
+        if (!p->head && p->stop) break;
+
+        struct pool_job *job = p->head;
+        p->head = job->next;
+        if (!p->head) p->tail = NULL;
+        p->busy++;
+        pthread_mutex_unlock(&p->lock);
+
+        job->fn(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&p->lock);
+        p->busy--;
+        if (!p->head && p->busy == 0) pthread_cond_broadcast(&p->idle);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+pool_t *pool_create(size_t nthreads) {
+    if (nthreads == 0) nthreads = 1;
+    pool_t *p = calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    p->threads = calloc(nthreads, sizeof(*p->threads));
+    if (!p->threads) {
+        free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->idle, NULL);
+
+    for (size_t i = 0; i < nthreads; ++i) {
+        if (pthread_create(&p->threads[i], NULL, pool_worker, p) != 0) break;
+        p->nthreads++;
+    }
+    if (p->nthreads == 0) {
+        pool_destroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+int pool_submit(pool_t *p, pool_fn fn, void *arg) {
+    struct pool_job *job = malloc(sizeof(*job));
+    if (!job) return -1;
+    job->fn = fn;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->tail) p->tail->next = job;
+    else p->head = job;
+    p->tail = job;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+void pool_wait(pool_t *p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->head || p->busy) pthread_cond_wait(&p->idle, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void pool_destroy(pool_t *p) {
+    if (!p) return;
+    pool_wait(p);
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    for (size_t i = 0; i < p->nthreads; ++i) pthread_join(p->threads[i], NULL);
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->idle);
+    free(p->threads);
+    free(p);
+}
+
+size_t pool_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+}
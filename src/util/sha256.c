@@ -1,6 +1,12 @@
+#define _GNU_SOURCE
 #include "core/sha256.h"
+#include "util/sha256.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/types.h>
+
+/* read size for streaming; peak memory stays at this regardless of file size */
+#define SHA256_FILE_CHUNK (128 * 1024)
 
 int sha256_file_hex(const char *path, char out_hex[65]) {
     if (!path || !out_hex) return -1;
@@ -8,32 +14,58 @@ int sha256_file_hex(const char *path, char out_hex[65]) {
     FILE *f = fopen(path, "rb");
     if (!f) return -1;
 
-    /* Read file into a growing buffer */
-    uint8_t *buf = NULL;
-    size_t cap = 0, len = 0;
-    const size_t CHUNK = 65536;
-    for (;;) {
-        if (cap - len < CHUNK) {
-            size_t newcap = cap ? cap * 2 : CHUNK;
-            if (newcap - len < CHUNK) newcap = len + CHUNK;
-            uint8_t *nb = (uint8_t*)realloc(buf, newcap);
-            if (!nb) { free(buf); fclose(f); return -1; }
-            buf = nb;
-            cap = newcap;
-        }
-        size_t r = fread(buf + len, 1, CHUNK, f);
-        len += r;
-        if (r < CHUNK) {
-            if (feof(f)) break;
-            if (ferror(f)) { free(buf); fclose(f); return -1; }
-        }
+    uint8_t *buf = malloc(SHA256_FILE_CHUNK);
+    if (!buf) { fclose(f); return -1; }
+
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    size_t r;
+    while ((r = fread(buf, 1, SHA256_FILE_CHUNK, f)) > 0) {
+        sha256_update(&ctx, buf, r);
     }
+    int failed = ferror(f);
+    free(buf);
     fclose(f);
+    if (failed) return -1;
 
     uint8_t digest[32];
-    sha256(buf, len, digest);
-    free(buf);
-
+    sha256_final(&ctx, digest);
     sha256_to_hex(digest, out_hex);
     return 0;
 }
+
+/* cookie stream: every chunk written goes to the wrapped file and into the hash */
+struct sha256_tee {
+    FILE *out;
+    sha256_ctx *ctx;
+};
+
+static ssize_t sha256_tee_write(void *cookie, const char *buf, size_t len) {
+    struct sha256_tee *tee = cookie;
+    size_t wrote = fwrite(buf, 1, len, tee->out);
+    sha256_update(tee->ctx, buf, wrote);
+    if (wrote == 0 && len != 0) return -1;
+    return (ssize_t)wrote;
+}
+
+static int sha256_tee_close(void *cookie) {
+    /* the wrapped file stays open; it belongs to the caller */
+    free(cookie);
+    return 0;
+}
+
+FILE *sha256_tee_open(FILE *out, sha256_ctx *ctx) {
+    if (!out || !ctx) return NULL;
+    struct sha256_tee *tee = malloc(sizeof(*tee));
+    if (!tee) return NULL;
+    tee->out = out;
+    tee->ctx = ctx;
+
+    static const cookie_io_functions_t io = {
+        .write = sha256_tee_write,
+        .close = sha256_tee_close,
+    };
+    FILE *f = fopencookie(tee, "wb", io);
+    if (!f) free(tee);
+    return f;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "util/trace.h"
+
+struct phase_stats {
+    uint64_t spans;
+    uint64_t busy_ns;      /* summed over spans, so parallel work counts once per thread */
+    uint64_t first_ns;     /* start of the earliest span */
+    uint64_t last_ns;      /* end of the latest one */
+    uint64_t bytes;
+    uint64_t files;
+};
+
+static const char *const phase_names[TRACE_NPHASES] = {
+    [TRACE_CONFIG] = "config",
+    [TRACE_INDEX_DOWNLOAD] = "index download",
+    [TRACE_INDEX_PARSE] = "index parse",
+    [TRACE_RESOLVE] = "resolve",
+    [TRACE_MANIFEST] = "manifest fetch",
+    [TRACE_BLOB] = "blob download",
+    [TRACE_HASH] = "hash",
+    [TRACE_UNPACK] = "unpack",
+    [TRACE_ACTIVATE] = "activate",
+};
+
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_flags;
+static int g_recording;
+static uint64_t g_t0;
+static FILE *g_trace_file;
+static int g_trace_events;
+static unsigned g_next_tid;
+static struct phase_stats g_stats[TRACE_NPHASES];
+static _Thread_local unsigned t_tid;
+
+static uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int trace_open(int flags, const char *trace_path) {
+    g_flags = flags;
+    g_recording = (flags & TRACE_TIMINGS) || trace_path;
+    g_t0 = clock_ns();
+    if (!trace_path) return 0;
+    g_trace_file = fopen(trace_path, "w");
+    if (!g_trace_file) {
+        perror(trace_path);
+        g_recording = (flags & TRACE_TIMINGS) != 0;
+        return -1;
+    }
+    fputs("{\"traceEvents\":[\n", g_trace_file);
+    return 0;
+}
+
+int trace_quiet(void) {
+    return (g_flags & TRACE_QUIET) != 0;
+}
+
+uint64_t trace_now(void) {
+    return g_recording ? clock_ns() : 0;
+}
+
+static void write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+void trace_span(trace_phase phase, const char *name, uint64_t start, uint64_t bytes, uint64_t files) {
+    if (!g_recording || !start || phase >= TRACE_NPHASES) return;
+    uint64_t end = clock_ns();
+
+    pthread_mutex_lock(&g_trace_lock);
+    struct phase_stats *s = &g_stats[phase];
+    if (!s->spans || start < s->first_ns) s->first_ns = start;
+    if (end > s->last_ns) s->last_ns = end;
+    s->spans++;
+    s->busy_ns += end - start;
+    s->bytes += bytes;
+    s->files += files;
+    if (g_trace_file) {
+        if (!t_tid) t_tid = ++g_next_tid;
+        fprintf(g_trace_file, "%s{\"name\":", g_trace_events++ ? ",\n" : "");
+        write_json_string(g_trace_file, name ? name : phase_names[phase]);
+        fprintf(g_trace_file, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%u,"
+                "\"args\":{\"bytes\":%llu,\"files\":%llu}}",
+                phase_names[phase], (double)(start - g_t0) / 1e3, (double)(end - start) / 1e3,
+                (long)getpid(), t_tid, (unsigned long long)bytes, (unsigned long long)files);
+    }
+    pthread_mutex_unlock(&g_trace_lock);
+}
+
+void trace_close(void) {
+    pthread_mutex_lock(&g_trace_lock);
+    if (g_flags & TRACE_TIMINGS) {
+        fflush(stdout);   /* keep the table after the command's own output */
+        uint64_t total = clock_ns() - g_t0;
+        fprintf(stderr, "%-16s %7s %10s %10s %14s %8s\n", "phase", "spans", "wall ms", "busy ms", "bytes", "files");
+        for (int p = 0; p < TRACE_NPHASES; ++p) {
+            const struct phase_stats *s = &g_stats[p];
+            if (!s->spans) continue;
+            fprintf(stderr, "%-16s %7llu %10.2f %10.2f %14llu %8llu\n", phase_names[p],
+                    (unsigned long long)s->spans, (double)(s->last_ns - s->first_ns) / 1e6,
+                    (double)s->busy_ns / 1e6, (unsigned long long)s->bytes, (unsigned long long)s->files);
+        }
+        fprintf(stderr, "%-16s %7s %10.2f\n", "total", "", (double)total / 1e6);
+    }
+    if (g_trace_file) {
+        fputs("\n]}\n", g_trace_file);
+        if (fclose(g_trace_file) != 0) perror("trace file");
+        g_trace_file = NULL;
+    }
+    /* closed: a second call prints nothing */
+    g_recording = 0;
+    g_flags &= ~TRACE_TIMINGS;
+    pthread_mutex_unlock(&g_trace_lock);
+}
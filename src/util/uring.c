@@ -0,0 +1,235 @@
+#define _DEFAULT_SOURCE   /* syscall() */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "util/uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+struct uring {
+    int fd;
+    unsigned entries;
+    unsigned queued;       /* written to the SQ, not yet submitted */
+    unsigned inflight;     /* submitted, not yet completed */
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map, *cq_map;
+    size_t sq_len, cq_len, sqes_len;
+
+    char *bufs;
+    unsigned nbufs;
+    size_t buf_size;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned op, const void *arg, unsigned n) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+void uring_close(uring *r) {
+    if (!r) return;
+    if (r->sqes) munmap(r->sqes, r->sqes_len);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_len);
+    if (r->sq_map) munmap(r->sq_map, r->sq_len);
+    if (r->fd >= 0) close(r->fd);   /* also drops the buffer registration */
+    free(r->bufs);
+    free(r);
+}
+
+uring *uring_open(unsigned entries, unsigned nbufs, size_t buf_size) {
+    const char *off = getenv("PANDORA_NO_URING");
+    if (off && *off) return NULL;
+
+    uring *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_setup(entries, &p);
+    if (r->fd < 0) {
+        free(r);
+        return NULL;
+    }
+    r->entries = p.sq_entries;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+    r->sq_map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = NULL;
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            r->cq_map = NULL;
+            goto fail;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* one page-aligned block, registered as nbufs fixed buffers */
+    r->nbufs = nbufs;
+    r->buf_size = buf_size;
+    void *mem = NULL;
+    if (!nbufs || posix_memalign(&mem, 4096, (size_t)nbufs * buf_size) != 0) goto fail;
+    r->bufs = mem;
+    struct iovec *iov = calloc(nbufs, sizeof(*iov));
+    if (!iov) goto fail;
+    for (unsigned i = 0; i < nbufs; ++i) {
+        iov[i].iov_base = r->bufs + (size_t)i * buf_size;
+        iov[i].iov_len = buf_size;
+    }
+    int rc = sys_register(r->fd, IORING_REGISTER_BUFFERS, iov, nbufs);
+    free(iov);
+    if (rc < 0) goto fail;
+    return r;
+
+fail:
+    uring_close(r);
+    return NULL;
+}
+
+void *uring_buf(uring *r, unsigned i) {
+    return i < r->nbufs ? r->bufs + (size_t)i * r->buf_size : NULL;
+}
+
+size_t uring_buf_size(const uring *r) {
+    return r->buf_size;
+}
+
+static int queue(uring *r, unsigned char op, int fd, unsigned buf, size_t len, uint64_t off, uint64_t tag) {
+    if (buf >= r->nbufs || len > r->buf_size) return -1;
+    unsigned tail = *r->sq_tail;   /* only we move the tail */
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries) return -1;
+
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->off = off;
+    sqe->addr = (uint64_t)(uintptr_t)uring_buf(r, buf);
+    sqe->len = (uint32_t)len;
+    sqe->buf_index = (uint16_t)buf;
+    sqe->user_data = tag;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+    return 0;
+}
+
+int uring_read(uring *r, int fd, unsigned buf, size_t len, uint64_t off, uint64_t tag) {
+    return queue(r, IORING_OP_READ_FIXED, fd, buf, len, off, tag);
+}
+
+int uring_write(uring *r, int fd, unsigned buf, size_t len, uint64_t off, uint64_t tag) {
+    return queue(r, IORING_OP_WRITE_FIXED, fd, buf, len, off, tag);
+}
+
+int uring_run(uring *r, void (*done)(void *arg, uint64_t tag, int res), void *arg) {
+    while (r->queued || r->inflight) {
+        int n = sys_enter(r->fd, r->queued, 1, IORING_ENTER_GETEVENTS);
+        if (n < 0) {
+            /* EINTR: nothing lost; EAGAIN/EBUSY: reap what is done and retry */
+            if (errno != EINTR && ((errno != EAGAIN && errno != EBUSY) || !r->inflight)) return -errno;
+            n = 0;
+        }
+        r->queued -= (unsigned)n;
+        r->inflight += (unsigned)n;
+
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            done(arg, cqe->user_data, cqe->res);
+            r->inflight--;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+#else /* no io_uring: callers take their blocking path */
+
+uring *uring_open(unsigned entries, unsigned nbufs, size_t buf_size) {
+    (void)entries;
+    (void)nbufs;
+    (void)buf_size;
+    return NULL;
+}
+
+void uring_close(uring *r) {
+    (void)r;
+}
+
+void *uring_buf(uring *r, unsigned i) {
+    (void)r;
+    (void)i;
+    return NULL;
+}
+
+size_t uring_buf_size(const uring *r) {
+    (void)r;
+    return 0;
+}
+
+int uring_read(uring *r, int fd, unsigned buf, size_t len, uint64_t off, uint64_t tag) {
+    (void)r; (void)fd; (void)buf; (void)len; (void)off; (void)tag;
+    return -1;
+}
+
+int uring_write(uring *r, int fd, unsigned buf, size_t len, uint64_t off, uint64_t tag) {
+    (void)r; (void)fd; (void)buf; (void)len; (void)off; (void)tag;
+    return -1;
+}
+
+int uring_run(uring *r, void (*done)(void *arg, uint64_t tag, int res), void *arg) {
+    (void)r;
+    (void)done;
+    (void)arg;
+    return -ENOSYS;
+}
+
+#endif